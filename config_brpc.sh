@@ -38,10 +38,12 @@ else
     LDD=ldd
 fi
 
-TEMP=`getopt -o v: --long headers:,libs:,cc:,cxx:,with-glog,with-thrift,with-mesalink,nodebugsymbols -n 'config_brpc' -- "$@"`
+TEMP=`getopt -o v: --long headers:,libs:,cc:,cxx:,with-glog,with-thrift,with-mesalink,with-lz4,with-zstd,nodebugsymbols -n 'config_brpc' -- "$@"`
 WITH_GLOG=0
 WITH_THRIFT=0
 WITH_MESALINK=0
+WITH_LZ4=0
+WITH_ZSTD=0
 DEBUGSYMBOLS=-g
 
 if [ $? != 0 ] ; then >&2 $ECHO "Terminating..."; exit 1 ; fi
@@ -65,6 +67,8 @@ while true; do
         --with-glog ) WITH_GLOG=1; shift 1 ;;
         --with-thrift) WITH_THRIFT=1; shift 1 ;;
         --with-mesalink) WITH_MESALINK=1; shift 1 ;;
+        --with-lz4) WITH_LZ4=1; shift 1 ;;
+        --with-zstd) WITH_ZSTD=1; shift 1 ;;
         --nodebugsymbols ) DEBUGSYMBOLS=; shift 1 ;;
         -- ) shift; break ;;
         * ) break ;;
@@ -345,6 +349,22 @@ if [ $WITH_MESALINK != 0 ]; then
     CPPFLAGS="${CPPFLAGS} -DUSE_MESALINK"
 fi
 
+if [ $WITH_LZ4 != 0 ]; then
+    LZ4_LIB=$(find_dir_of_lib_or_die lz4)
+    LZ4_HDR=$(find_dir_of_header_or_die lz4frame.h)
+    append_to_output_headers "$LZ4_HDR"
+    append_to_output_linkings $LZ4_LIB lz4
+    CPPFLAGS="${CPPFLAGS} -DBRPC_WITH_LZ4"
+fi
+
+if [ $WITH_ZSTD != 0 ]; then
+    ZSTD_LIB=$(find_dir_of_lib_or_die zstd)
+    ZSTD_HDR=$(find_dir_of_header_or_die zstd.h)
+    append_to_output_headers "$ZSTD_HDR"
+    append_to_output_linkings $ZSTD_LIB zstd
+    CPPFLAGS="${CPPFLAGS} -DBRPC_WITH_ZSTD"
+fi
+
 append_to_output "CPPFLAGS=${CPPFLAGS}"
 
 append_to_output "ifeq (\$(NEED_LIBPROTOC), 1)"
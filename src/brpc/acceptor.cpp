@@ -17,16 +17,21 @@
 
 
 #include <inttypes.h>
+#include <algorithm>                        // std::find
 #include <gflags/gflags.h>
 #include "butil/fd_guard.h"                 // fd_guard 
 #include "butil/fd_utility.h"               // make_close_on_exec
 #include "butil/time.h"                     // gettimeofday_us
+#include "brpc/shared_memory_transport.h"     // SharedMemoryConnection
+#include "brpc/udp_transport.h"             // UdpConnection
 #include "brpc/acceptor.h"
 
 
 namespace brpc {
 
 static const int INITIAL_CONNECTION_CAP = 65536;
+// Max number of connections accepted before registering them.
+static const size_t ACCEPT_BATCH_SIZE = 32;
 
 Acceptor::Acceptor(bthread_keytable_pool_t* pool)
     : InputMessenger()
@@ -35,9 +40,11 @@ Acceptor::Acceptor(bthread_keytable_pool_t* pool)
     , _idle_timeout_sec(-1)
     , _close_idle_tid(INVALID_BTHREAD)
     , _listened_fd(-1)
-    , _acception_id(0)
+    , _datagram_id(INVALID_SOCKET_ID)
+    , _nacception(0)
     , _empty_cond(&_map_mutex)
-    , _ssl_ctx(NULL) {
+    , _ssl_ctx(NULL)
+    , _use_shared_memory(false) {
 }
 
 Acceptor::~Acceptor() {
@@ -51,44 +58,132 @@ int Acceptor::StartAccept(int listened_fd, int idle_timeout_sec,
         LOG(FATAL) << "Invalid listened_fd=" << listened_fd;
         return -1;
     }
-    
-    BAIDU_SCOPED_LOCK(_map_mutex);
+    return StartAccept(&listened_fd, 1, false, idle_timeout_sec, ssl_ctx);
+}
+
+int Acceptor::StartAccept(const std::vector<int>& listened_fds,
+                          int idle_timeout_sec,
+                          const std::shared_ptr<SocketSSLContext>& ssl_ctx) {
+    bool valid = !listened_fds.empty();
+    for (size_t i = 0; i < listened_fds.size(); ++i) {
+        if (listened_fds[i] < 0) {
+            LOG(FATAL) << "Invalid listened_fd=" << listened_fds[i];
+            valid = false;
+        }
+    }
+    if (!valid) {
+        for (size_t i = 0; i < listened_fds.size(); ++i) {
+            if (listened_fds[i] >= 0) {
+                close(listened_fds[i]);
+            }
+        }
+        return -1;
+    }
+    return StartAccept(&listened_fds[0], listened_fds.size(), true,
+                       idle_timeout_sec, ssl_ctx);
+}
+
+// Close fds[begin, n) which are not handed to any Socket.
+static void CloseUnusedFds(const int* fds, size_t begin, size_t n) {
+    for (size_t i = begin; i < n; ++i) {
+        close(fds[i]);
+    }
+}
+
+int Acceptor::StartAccept(const int* fds, size_t n, bool bind_dispatcher,
+                          int idle_timeout_sec,
+                          const std::shared_ptr<SocketSSLContext>& ssl_ctx) {
+    // Unused fds are closed iff bind_dispatcher is true, see comments of
+    // the public StartAccept.
+    const size_t nowned = (bind_dispatcher ? 0 : n);
+    std::unique_lock<butil::Mutex> mu(_map_mutex);
     if (_status == UNINITIALIZED) {
         if (Initialize() != 0) {
             LOG(FATAL) << "Fail to initialize Acceptor";
+            CloseUnusedFds(fds, nowned, n);
             return -1;
         }
         _status = READY;
     }
     if (_status != READY) {
         LOG(FATAL) << "Acceptor hasn't stopped yet: status=" << status();
+        CloseUnusedFds(fds, nowned, n);
         return -1;
     }
     if (idle_timeout_sec > 0) {
         if (bthread_start_background(&_close_idle_tid, NULL,
                                      CloseIdleConnections, this) != 0) {
             LOG(FATAL) << "Fail to start bthread";
+            CloseUnusedFds(fds, nowned, n);
             return -1;
         }
     }
     _idle_timeout_sec = idle_timeout_sec;
     _ssl_ctx = ssl_ctx;
     
-    // Creation of _acception_id is inside lock so that OnNewConnections
+    // Creation of _acception_ids is inside lock so that OnNewConnections
     // (which may run immediately) should see sane fields set below.
+    _acception_ids.clear();
+    for (size_t i = 0; i < n; ++i) {
+        SocketOptions options;
+        options.fd = fds[i];
+        options.user = this;
+        // Processing functions used after new connections arrive
+        options.on_edge_triggered_events = OnNewConnections;
+        if (bind_dispatcher) {
+            options.event_dispatcher_index = (int)i;
+        }
+        SocketId id;
+        if (Socket::Create(options, &id) != 0) {
+            // Close-idle-socket thread will be stopped inside destructor
+            LOG(FATAL) << "Fail to create acception socket of fd=" << fds[i];
+            // fds[i] may be owned by the failed Socket.
+            CloseUnusedFds(fds, std::max(i + 1, nowned), n);
+            break;
+        }
+        _acception_ids.push_back(id);
+    }
+    if (_acception_ids.empty()) {
+        return -1;
+    }
+    _listened_fd = fds[0];
+    _nacception = _acception_ids.size();
+    _status = RUNNING;
+    if (_acception_ids.size() == n) {
+        return 0;
+    }
+    // Stop the ones being accepted.
+    mu.unlock();
+    StopAccept(0);
+    return -1;
+}
+
+int Acceptor::AcceptDatagrams(int udp_fd) {
+    butil::fd_guard fd_guard(udp_fd);
+    BAIDU_SCOPED_LOCK(_map_mutex);
+    if (_status != RUNNING) {
+        LOG(ERROR) << "Acceptor is not accepting: status=" << status();
+        return -1;
+    }
+    if (_datagram_id != INVALID_SOCKET_ID) {
+        LOG(ERROR) << "Acceptor is already receiving datagrams";
+        return -1;
+    }
     SocketOptions options;
-    options.fd = listened_fd;
+    options.fd = udp_fd;
+    options.keytable_pool = _keytable_pool;
     options.user = this;
-    // Processing functions used after new connections arrive
-    options.on_edge_triggered_events = OnNewConnections;
-    if (Socket::Create(options, &_acception_id) != 0) {
-        // Close-idle-socket thread will be stopped inside destructor
-        LOG(FATAL) << "Fail to create _acception_id";
+    options.on_edge_triggered_events = InputMessenger::OnNewMessages;
+    // Deleted in Socket::OnRecycle.
+    options.conn = new UdpConnection(true);
+    SocketId id;
+    if (Socket::Create(options, &id) != 0) {
+        LOG(ERROR) << "Fail to create datagram socket of fd=" << udp_fd;
         return -1;
     }
-    
-    _listened_fd = listened_fd;
-    _status = RUNNING;
+    fd_guard.release();
+    _datagram_id = id;
+    ++_nacception;
     return 0;
 }
 
@@ -122,8 +217,13 @@ void Acceptor::StopAccept(int /*closewait_ms*/) {
         _status = STOPPING;
     }
 
-    // Don't set _acception_id to 0 because BeforeRecycle needs it.
-    Socket::SetFailed(_acception_id);
+    // Don't clear _acception_ids because BeforeRecycle needs them.
+    for (size_t i = 0; i < _acception_ids.size(); ++i) {
+        Socket::SetFailed(_acception_ids[i]);
+    }
+    if (_datagram_id != INVALID_SOCKET_ID) {
+        Socket::SetFailed(_datagram_id);
+    }
 
     // SetFailed all existing connections. Connections added after this piece
     // of code will be SetFailed directly in OnNewConnectionsUntilEAGAIN
@@ -239,82 +339,117 @@ void Acceptor::ListConnections(std::vector<SocketId>* conn_list) {
     return ListConnections(conn_list, std::numeric_limits<size_t>::max());
 }
 
+// Accept a connection from `listened_fd' and set the new fd to be
+// non-blocking and close-on-exec atomically when possible.
+static int AcceptNonBlocking(int listened_fd, struct sockaddr* addr,
+                             socklen_t* addrlen) {
+#if defined(OS_LINUX)
+    return accept4(listened_fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    return accept(listened_fd, addr, addrlen);
+#endif
+}
+
 void Acceptor::OnNewConnectionsUntilEAGAIN(Socket* acception) {
-    while (1) {
-        struct sockaddr in_addr;
-        socklen_t in_len = sizeof(in_addr);
-        // Use Listenfd to accept the client fd 
-        butil::fd_guard in_fd(accept(acception->fd(), &in_addr, &in_len));
-        if (in_fd < 0) {
-            // no EINTR because listened fd is non-blocking.
-            if (errno == EAGAIN) {
-                return;
+    Acceptor* am = dynamic_cast<Acceptor*>(acception->user());
+    if (NULL == am) {
+        LOG(FATAL) << "Impossible! acception->user() MUST be Acceptor";
+        acception->SetFailed(EINVAL, "Impossible! acception->user() MUST be Acceptor");
+        return;
+    }
+    SocketOptions options;
+    options.keytable_pool = am->_keytable_pool;
+    options.user = acception->user();
+    options.on_edge_triggered_events = InputMessenger::OnNewMessages;
+    options.initial_ssl_ctx = am->_ssl_ctx;
+    // Connections are served by the dispatcher of the listened fd, which
+    // is chosen by the new fd if the listened fd is not bound.
+    options.event_dispatcher_index = acception->_event_dispatcher_index;
+
+    bool eagain = false;
+    while (!eagain) {
+        // Accept connections in batches to register them into _socket_map
+        // with one locking.
+        SocketUniquePtr socks[ACCEPT_BATCH_SIZE];
+        size_t nsock = 0;
+        while (nsock < ARRAY_SIZE(socks)) {
+            struct sockaddr_storage in_addr;
+            socklen_t in_len = sizeof(in_addr);
+            // Use Listenfd to accept the client fd 
+            butil::fd_guard in_fd(AcceptNonBlocking(
+                acception->fd(), (struct sockaddr*)&in_addr, &in_len));
+            if (in_fd < 0) {
+                // no EINTR because listened fd is non-blocking.
+                if (errno == EAGAIN) {
+                    eagain = true;
+                    break;
+                }
+                // Do NOT return -1 when `accept' failed, otherwise `_listened_fd'
+                // will be closed. Continue to consume all the events until EAGAIN
+                // instead.
+                // If the accept was failed, the error may repeat constantly, 
+                // limit frequency of logging.
+                PLOG_EVERY_SECOND(ERROR)
+                    << "Fail to accept from listened_fd=" << acception->fd();
+                continue;
             }
-            // Do NOT return -1 when `accept' failed, otherwise `_listened_fd'
-            // will be closed. Continue to consume all the events until EAGAIN
-            // instead.
-            // If the accept was failed, the error may repeat constantly, 
-            // limit frequency of logging.
-            PLOG_EVERY_SECOND(ERROR)
-                << "Fail to accept from listened_fd=" << acception->fd();
-            continue;
-        }
 
-        Acceptor* am = dynamic_cast<Acceptor*>(acception->user());
-        if (NULL == am) {
-            LOG(FATAL) << "Impossible! acception->user() MUST be Acceptor";
-            acception->SetFailed(EINVAL, "Impossible! acception->user() MUST be Acceptor");
-            return;
+            SocketId socket_id;
+            options.fd = in_fd;
+            if (butil::sockaddr2endpoint(&in_addr, in_len,
+                                         &options.remote_side) != 0) {
+                options.remote_side = butil::EndPoint();
+            }
+            // Deleted in Socket::OnRecycle.
+            options.conn = (am->_use_shared_memory ?
+                            new SharedMemoryConnection(true) : NULL);
+            // Create a new socket to process the subsequent messages of this new connection, 
+            // and add a new epoll in it_ In event, the registered processing function is 
+            // InputMessenger::OnNewMessages: Read the message and submit it to the processing function of the 
+            // corresponding protocol to call the actual business function in the user service
+            if (Socket::Create(options, &socket_id) != 0) {
+                LOG(ERROR) << "Fail to create Socket";
+                continue;
+            }
+            in_fd.release(); // transfer ownership to socket_id
+
+            // There's a funny race condition here. After Socket::Create, messages
+            // from the socket are already handled and a RPC is possibly done
+            // before the socket is added into _socket_map below. This is found in
+            // ChannelTest.skip_parallel in test/brpc_channel_unittest.cpp (running
+            // on machines with few cores) where the _messenger.ConnectionCount()
+            // may surprisingly be 0 even if the RPC is already done.
+            if (Socket::AddressFailedAsWell(socket_id, &socks[nsock]) >= 0) {
+                ++nsock;
+            } // else: The socket has already been destroyed, Don't add its id
+              // into _socket_map
         }
-        
-        SocketId socket_id;
-        SocketOptions options;
-        options.keytable_pool = am->_keytable_pool;
-        options.fd = in_fd;
-        options.remote_side = butil::EndPoint(*(sockaddr_in*)&in_addr);
-        options.user = acception->user();
-        options.on_edge_triggered_events = InputMessenger::OnNewMessages;
-        options.initial_ssl_ctx = am->_ssl_ctx;
-        // Create a new socket to process the subsequent messages of this new connection, 
-        // and add a new epoll in it_ In event, the registered processing function is 
-        // InputMessenger::OnNewMessages: Read the message and submit it to the processing function of the 
-        // corresponding protocol to call the actual business function in the user service
-        if (Socket::Create(options, &socket_id) != 0) {
-            LOG(ERROR) << "Fail to create Socket";
+        if (nsock == 0) {
             continue;
         }
-        in_fd.release(); // transfer ownership to socket_id
-
-        // There's a funny race condition here. After Socket::Create, messages
-        // from the socket are already handled and a RPC is possibly done
-        // before the socket is added into _socket_map below. This is found in
-        // ChannelTest.skip_parallel in test/brpc_channel_unittest.cpp (running
-        // on machines with few cores) where the _messenger.ConnectionCount()
-        // may surprisingly be 0 even if the RPC is already done.
-
-        SocketUniquePtr sock;
-        if (Socket::AddressFailedAsWell(socket_id, &sock) >= 0) {
-            bool is_running = true;
-            {
-                BAIDU_SCOPED_LOCK(am->_map_mutex);
-                is_running = (am->status() == RUNNING);
-                // Always add this socket into `_socket_map' whether it
-                // has been `SetFailed' or not, whether `Acceptor' is
-                // running or not. Otherwise, `Acceptor::BeforeRecycle'
-                // may be called (inside Socket::OnRecycle) after `Acceptor'
-                // has been destroyed
-                am->_socket_map.insert(socket_id, ConnectStatistics());
+        bool is_running = true;
+        {
+            BAIDU_SCOPED_LOCK(am->_map_mutex);
+            is_running = (am->status() == RUNNING);
+            // Always add the sockets into `_socket_map' whether they
+            // have been `SetFailed' or not, whether `Acceptor' is
+            // running or not. Otherwise, `Acceptor::BeforeRecycle'
+            // may be called (inside Socket::OnRecycle) after `Acceptor'
+            // has been destroyed
+            for (size_t i = 0; i < nsock; ++i) {
+                am->_socket_map.insert(socks[i]->id(), ConnectStatistics());
             }
-            if (!is_running) {
+        }
+        if (!is_running) {
+            for (size_t i = 0; i < nsock; ++i) {
                 LOG(WARNING) << "Acceptor on fd=" << acception->fd()
-                    << " has been stopped, discard newly created " << *sock;
-                sock->SetFailed(ELOGOFF, "Acceptor on fd=%d has been stopped, "
+                    << " has been stopped, discard newly created " << *socks[i];
+                socks[i]->SetFailed(ELOGOFF, "Acceptor on fd=%d has been stopped, "
                         "discard newly created %s", acception->fd(),
-                        sock->description().c_str());
-                return;
+                        socks[i]->description().c_str());
             }
-        } // else: The socket has already been destroyed, Don't add its id
-          // into _socket_map
+            return;
+        }
     }
 }
 
@@ -330,12 +465,19 @@ void Acceptor::OnNewConnections(Socket* acception) {
 
 void Acceptor::BeforeRecycle(Socket* sock) {
     BAIDU_SCOPED_LOCK(_map_mutex);
-    if (sock->id() == _acception_id) {
-        // Set _listened_fd to -1 when acception socket has been recycled
-        // so that we are ensured no more events will arrive (and `Join'
-        // will return to its caller)
-        _listened_fd = -1;
-        _empty_cond.Broadcast();
+    if (sock->id() == _datagram_id ||
+        std::find(_acception_ids.begin(), _acception_ids.end(), sock->id())
+        != _acception_ids.end()) {
+        if (sock->id() == _datagram_id) {
+            _datagram_id = INVALID_SOCKET_ID;
+        }
+        // Set _listened_fd to -1 when all acception sockets have been
+        // recycled so that we are ensured no more events will arrive (and
+        // `Join' will return to its caller)
+        if (--_nacception == 0) {
+            _listened_fd = -1;
+            _empty_cond.Broadcast();
+        }
         return;
     }
     // If a Socket could not be addressed shortly after its creation, it
@@ -56,6 +56,23 @@ public:
     int StartAccept(int listened_fd, int idle_timeout_sec,
                     const std::shared_ptr<SocketSSLContext>& ssl_ctx);
 
+    // [thread-safe] Same as above but accept connections from all
+    // `listened_fds' which are SO_REUSEPORT sockets of the same port. The
+    // i-th fd is watched by the i-th(modulo -event_dispatcher_num)
+    // EventDispatcher which also serves connections accepted from the fd,
+    // so that connections are accepted and served by dispatchers in parallel.
+    // Ownership of `listened_fds' is transferred to `Acceptor' whether this
+    // function succeeds or not.
+    // Return 0 on success, -1 otherwise.
+    int StartAccept(const std::vector<int>& listened_fds, int idle_timeout_sec,
+                    const std::shared_ptr<SocketSSLContext>& ssl_ctx);
+
+    // [thread-safe] Receive one-way baidu_std messages from the UDP socket
+    // `udp_fd'(udp_transport.h) as well until StopAccept. Ownership of
+    // `udp_fd' is transferred to `Acceptor'. Call after StartAccept.
+    // Return 0 on success, -1 otherwise.
+    int AcceptDatagrams(int udp_fd);
+
     // [thread-safe] Stop accepting connections.
     // `closewait_ms' is not used anymore.
     void StopAccept(int /*closewait_ms*/);
@@ -63,9 +80,13 @@ public:
     // Wait until all existing Sockets(defined in socket.h) are recycled.
     void Join();
 
-    // The parameter to StartAccept. Negative when acceptor is stopped.
+    // The parameter to StartAccept(the first one of `listened_fds').
+    // Negative when acceptor is stopped.
     int listened_fd() const { return _listened_fd; }
 
+    // Number of fds being listened.
+    size_t listener_count() const { return _acception_ids.size(); }
+
     // Get number of existing connections.
     size_t ConnectionCount() const;
 
@@ -77,6 +98,11 @@ public:
 
     Status status() const { return _status; }
 
+    // Transport data of accepted connections through shared memory if the
+    // clients ask for(shared_memory_transport.h), otherwise the clients go
+    // on with TCP. Call before StartAccept.
+    void set_use_shared_memory(bool use) { _use_shared_memory = use; }
+
 private:
     // Accept connections.
     static void OnNewConnectionsUntilEAGAIN(Socket* m);
@@ -87,6 +113,12 @@ private:
     // Initialize internal structure. 
     int Initialize();
 
+    // Accept connections from `fds[0..n)', bind each fd to an EventDispatcher
+    // iff `bind_dispatcher' is true.
+    int StartAccept(const int* fds, size_t n, bool bind_dispatcher,
+                    int idle_timeout_sec,
+                    const std::shared_ptr<SocketSSLContext>& ssl_ctx);
+
     // Remove the accepted socket `sock' from inside
     void BeforeRecycle(Socket* sock) override;
 
@@ -96,8 +128,12 @@ private:
     bthread_t _close_idle_tid;
 
     int _listened_fd;
-    // The Socket tso accept connections.
-    SocketId _acception_id;
+    // The Sockets to accept connections, one for each listened fd.
+    std::vector<SocketId> _acception_ids;
+    // The Socket receiving datagrams, counted in _nacception as well.
+    SocketId _datagram_id;
+    // Number of Sockets in _acception_ids and _datagram_id not recycled yet.
+    size_t _nacception;
 
     butil::Mutex _map_mutex;
     butil::ConditionVariable _empty_cond;
@@ -106,6 +142,8 @@ private:
     SocketMap _socket_map;
 
     std::shared_ptr<SocketSSLContext> _ssl_ctx;
+
+    bool _use_shared_memory;
 };
 
 } // namespace brpc
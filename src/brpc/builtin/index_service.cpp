@@ -35,6 +35,7 @@ void IndexService::GetTabInfo(TabInfoList* info_list) const {
 
 DECLARE_bool(enable_rpcz);
 DECLARE_bool(enable_dir_service);
+DECLARE_string(static_file_dir);
 DECLARE_bool(enable_threads_service);
 
 // Set in ProfilerLinker.
@@ -159,7 +160,9 @@ void IndexService::default_method(::google::protobuf::RpcController* controller,
        << Path("/threads", html_addr) << " : Check pstack"
        << (!FLAGS_enable_threads_service ? " (disabled)" : "") << NL
        << Path("/dir", html_addr) << " : Browse directories and files"
-       << (!FLAGS_enable_dir_service ? " (disabled)" : "") << NL;
+       << (!FLAGS_enable_dir_service ? " (disabled)" : "") << NL
+       << Path("/files", html_addr) << " : Download files under -static_file_dir"
+       << (FLAGS_static_file_dir.empty() ? " (disabled)" : "") << NL;
     if (use_html) {
         os << "</body></html>";
     }
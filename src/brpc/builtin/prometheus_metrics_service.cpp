@@ -53,10 +53,16 @@ public:
     }
 
     bool dump(const std::string& name, const butil::StringPiece& desc) override;
+    bool dump_comment(const std::string& name, const std::string& type) override;
+    bool dump_mvar(const std::string& name, const butil::StringPiece& desc) override;
 
 private:
     DISALLOW_COPY_AND_ASSIGN(PrometheusMetricsDumper);
 
+    // Return true iff name is a histogram of LatencyRecorder.
+    bool DumpLatencyHistogram(const std::string& name,
+                              const butil::StringPiece& desc);
+
     // Return true iff name ends with suffix output by LatencyRecorder.
     bool DumpLatencyRecorderSuffix(const butil::StringPiece& name,
                                    const butil::StringPiece& desc);
@@ -87,6 +93,9 @@ bool PrometheusMetricsDumper::dump(const std::string& name,
         // there is no necessary to monitor string in prometheus
         return true;
     }
+    if (DumpLatencyHistogram(name, desc)) {
+        return true;
+    }
     if (DumpLatencyRecorderSuffix(name, desc)) {
         // Has encountered name with suffix exposed by LatencyRecorder,
         // Leave it to DumpLatencyRecorderSuffix to output Summary.
@@ -98,6 +107,61 @@ bool PrometheusMetricsDumper::dump(const std::string& name,
     return true;
 }
 
+bool PrometheusMetricsDumper::dump_comment(const std::string& name,
+                                           const std::string& type) {
+    *_os << "# HELP " << name << '\n'
+         << "# TYPE " << name << ' ' << type << '\n';
+    return true;
+}
+
+bool PrometheusMetricsDumper::dump_mvar(const std::string& name,
+                                        const butil::StringPiece& desc) {
+    if (!desc.empty() && desc[0] == '"') {
+        return true;
+    }
+    // Labels are already in `name'.
+    *_os << name << ' ' << desc << '\n';
+    return true;
+}
+
+bool PrometheusMetricsDumper::DumpLatencyHistogram(
+    const std::string& name, const butil::StringPiece& desc) {
+    if (!butil::StringPiece(name).ends_with("_latency_histogram")) {
+        return false;
+    }
+    // {"count":N,"sum":S,"buckets":[[upper_bound,count],...]}, see
+    // bvar::detail::HistogramBuckets::describe().
+    const std::string desc_str = desc.as_string();
+    unsigned long long count = 0;
+    unsigned long long sum = 0;
+    if (sscanf(desc_str.c_str(), "{\"count\":%llu,\"sum\":%llu",
+               &count, &sum) != 2) {
+        return false;
+    }
+    *_os << "# HELP " << name << '\n'
+         << "# TYPE " << name << " histogram\n";
+    const char* p = strstr(desc_str.c_str(), "\"buckets\":[");
+    if (p != NULL) {
+        p += 11;
+        unsigned long long cumulative = 0;
+        while ((p = strchr(p, '[')) != NULL) {
+            char* endptr = NULL;
+            const unsigned long long upper_bound = strtoull(p + 1, &endptr, 10);
+            if (*endptr != ',') {
+                break;
+            }
+            cumulative += strtoull(endptr + 1, &endptr, 10);
+            *_os << name << "_bucket{le=\"" << upper_bound << "\"} "
+                 << cumulative << '\n';
+            p = endptr;
+        }
+    }
+    *_os << name << "_bucket{le=\"+Inf\"} " << count << '\n'
+         << name << "_sum " << sum << '\n'
+         << name << "_count " << count << '\n';
+    return true;
+}
+
 const PrometheusMetricsDumper::SummaryItems*
 PrometheusMetricsDumper::ProcessLatencyRecorderSuffix(const butil::StringPiece& name,
                                                       const butil::StringPiece& desc) {
@@ -199,8 +263,16 @@ int DumpPrometheusMetricsToIOBuf(butil::IOBuf* output) {
     if (ndump < 0) {
         return -1;
     }
+    // Labeled bvars are output with labels rather than mangled names.
+    if (bvar::MVariable::dump_exposed(&dumper, NULL) < 0) {
+        return -1;
+    }
     os.move_to(*output);
     return 0;
 }
 
+bvar::Dumper* NewPrometheusMetricsDumper(butil::IOBufBuilder* os) {
+    return new PrometheusMetricsDumper(os, g_server_info_prefix);
+}
+
 } // namespace brpc
@@ -21,6 +21,14 @@
 
 #include "brpc/builtin_service.pb.h"
 
+namespace bvar {
+class Dumper;
+}
+
+namespace butil {
+class IOBufBuilder;
+}
+
 namespace brpc {
 
 class PrometheusMetricsService : public brpc_metrics {
@@ -33,6 +41,11 @@ public:
 
 int DumpPrometheusMetricsToIOBuf(butil::IOBuf* output);
 
+// Create a dumper writing bvar into `os' in prometheus format, which is
+// used for converting values dumped elsewhere, e.g. binary dumps read by
+// tools/bvar_dump_reader. Delete the dumper after use.
+bvar::Dumper* NewPrometheusMetricsDumper(butil::IOBufBuilder* os);
+
 } // namepace brpc
 
 #endif  // BRPC_PROMETHEUS_METRICS_SERVICE_H
@@ -0,0 +1,100 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <fcntl.h>                     // O_RDONLY
+#include <sys/stat.h>                  // fstat
+#include <gflags/gflags.h>
+#include "butil/fd_guard.h"
+#include "butil/string_splitter.h"
+#include "brpc/closure_guard.h"        // ClosureGuard
+#include "brpc/controller.h"           // Controller
+#include "brpc/builtin/static_file_service.h"
+
+
+namespace brpc {
+
+DECLARE_string(static_file_dir);
+
+static const char* GuessContentType(const std::string& path) {
+    static const struct {
+        const char* ext;
+        const char* type;
+    } types[] = {
+        { ".html", "text/html" },
+        { ".htm", "text/html" },
+        { ".css", "text/css" },
+        { ".js", "application/javascript" },
+        { ".json", "application/json" },
+        { ".txt", "text/plain" },
+        { ".png", "image/png" },
+        { ".jpg", "image/jpeg" },
+        { ".jpeg", "image/jpeg" },
+        { ".gif", "image/gif" },
+        { ".svg", "image/svg+xml" },
+    };
+    const size_t dot = path.rfind('.');
+    if (dot != std::string::npos && path.find('/', dot) == std::string::npos) {
+        for (size_t i = 0; i < ARRAY_SIZE(types); ++i) {
+            if (strcasecmp(path.c_str() + dot, types[i].ext) == 0) {
+                return types[i].type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+// Files outside -static_file_dir are not accessible.
+static bool IsSafePath(const std::string& path) {
+    for (butil::StringSplitter sp(path.c_str(), '/'); sp; ++sp) {
+        if (sp.length() == 2 && memcmp(sp.field(), "..", 2) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void StaticFileService::default_method(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::StaticFileRequest*,
+    ::brpc::StaticFileResponse*,
+    ::google::protobuf::Closure* done) {
+    ClosureGuard done_guard(done);
+    Controller *cntl = static_cast<Controller*>(cntl_base);
+    const std::string& path = cntl->http_request().unresolved_path();
+    if (path.empty() || !IsSafePath(path)) {
+        cntl->SetFailed(EPERM, "Cannot access `%s'", path.c_str());
+        return;
+    }
+    std::string full_path = FLAGS_static_file_dir;
+    full_path.push_back('/');
+    full_path.append(path);
+
+    butil::fd_guard fd(open(full_path.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        cntl->http_response().set_status_code(HTTP_STATUS_NOT_FOUND);
+        cntl->SetFailed(ENOENT, "Cannot open `%s'", path.c_str());
+        return;
+    }
+    if (cntl->response_attachment().append_file(fd, 0, st.st_size) != 0) {
+        cntl->SetFailed(errno, "Cannot read `%s'", path.c_str());
+        return;
+    }
+    cntl->http_response().set_content_type(GuessContentType(path));
+}
+
+} // namespace brpc
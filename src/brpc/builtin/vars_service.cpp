@@ -17,13 +17,17 @@
 
 
 #include <ostream>
+#include <memory>                           // std::unique_ptr
 #include <vector>                           // std::vector
 #include "butil/string_splitter.h"
 #include "bvar/bvar.h"
+#include "bvar/binary_dump.h"
+#include "bthread/bthread.h"
 
 #include "brpc/closure_guard.h"        // ClosureGuard
 #include "brpc/controller.h"           // Controller
 #include "brpc/errno.pb.h"
+#include "brpc/progressive_attachment.h"
 #include "brpc/server.h"
 #include "brpc/builtin/common.h"
 #include "brpc/builtin/vars_service.h"
@@ -305,6 +309,39 @@ private:
     bool _use_html;
 };
 
+struct BinaryVarsStream {
+    butil::intrusive_ptr<ProgressiveAttachment> pa;
+    bvar::DumpOptions options;
+    int interval_s;
+};
+
+// Send a keyframe and then changed values every interval_s seconds until
+// the client goes away.
+static void* StreamBinaryVars(void* arg) {
+    std::unique_ptr<BinaryVarsStream> s(static_cast<BinaryVarsStream*>(arg));
+    bvar::BinaryDumpEncoder encoder;
+    for (bool keyframe = true; ; keyframe = false) {
+        encoder.begin_frame(keyframe);
+        if (bvar::Variable::dump_exposed(&encoder, &s->options) < 0 ||
+            bvar::MVariable::dump_exposed(&encoder, &s->options) < 0) {
+            LOG(WARNING) << "Fail to dump vars to " << s->pa->remote_side();
+            return NULL;
+        }
+        butil::IOBuf frame;
+        encoder.end_frame(&frame);
+        while (s->pa->Write(frame) != 0) {
+            if (errno != EOVERCROWDED || s->pa->WaitWritable() != 0) {
+                // The connection is broken.
+                return NULL;
+            }
+        }
+        if (bthread_usleep(s->interval_s * 1000000L) != 0) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
 void VarsService::default_method(::google::protobuf::RpcController* cntl_base,
                                  const ::brpc::VarsRequest*,
                                  ::brpc::VarsResponse*,
@@ -328,6 +365,36 @@ void VarsService::default_method(::google::protobuf::RpcController* cntl_base,
         }
         return;
     }
+    if (cntl->http_request().uri().GetQuery("binary") != NULL) {
+        // Stream values in the binary format of bvar/binary_dump.h
+        int interval_s = 1;
+        const std::string* interval_str =
+            cntl->http_request().uri().GetQuery("interval");
+        if (interval_str != NULL) {
+            char* endptr = NULL;
+            interval_s = strtol(interval_str->c_str(), &endptr, 10);
+            if (*endptr != '\0' || interval_s <= 0 || interval_s > 3600) {
+                cntl->SetFailed(EINVAL, "Invalid interval=%s",
+                                interval_str->c_str());
+                return;
+            }
+        }
+        std::unique_ptr<BinaryVarsStream> stream(new BinaryVarsStream);
+        stream->options.question_mark = '$';
+        stream->options.white_wildcards =
+            cntl->http_request().unresolved_path();
+        stream->interval_s = interval_s;
+        stream->pa = cntl->CreateProgressiveAttachment(FORCE_STOP);
+        cntl->http_response().set_content_type("application/octet-stream");
+        bthread_t th;
+        if (bthread_start_background(&th, NULL, StreamBinaryVars,
+                                     stream.get()) != 0) {
+            cntl->SetFailed(EPERM, "Fail to start bthread");
+            return;
+        }
+        stream.release();
+        return;
+    }
     const bool use_html = UseHTML(cntl->http_request());
     bool with_tabs = false;
     if (use_html && cntl->http_request().uri().GetQuery("dataonly") == NULL) {
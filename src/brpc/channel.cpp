@@ -52,6 +52,7 @@ ChannelOptions::ChannelOptions()
     , auth(NULL)
     , retry_policy(NULL)
     , ns_filter(NULL)
+    , use_shared_memory(false)
 {}
 
 ChannelSSLOptions* ChannelOptions::mutable_ssl_options() {
@@ -64,7 +65,8 @@ ChannelSSLOptions* ChannelOptions::mutable_ssl_options() {
 static ChannelSignature ComputeChannelSignature(const ChannelOptions& opt) {
     if (opt.auth == NULL &&
         !opt.has_ssl_options() &&
-        opt.connection_group.empty()) {
+        opt.connection_group.empty() &&
+        !opt.use_shared_memory) {
         // Returning zeroized result by default is more intuitive for users.
         return ChannelSignature();
     }
@@ -84,6 +86,9 @@ static ChannelSignature ComputeChannelSignature(const ChannelOptions& opt) {
             buf.append("|auth=");
             buf.append((char*)&opt.auth, sizeof(opt.auth));
         }
+        if (opt.use_shared_memory) {
+            buf.append("|shm");
+        }
         if (opt.has_ssl_options()) {
             const ChannelSSLOptions& ssl = opt.ssl_options();
             buf.push_back('|');
@@ -97,6 +102,9 @@ static ChannelSignature ComputeChannelSignature(const ChannelOptions& opt) {
             buf.append((char*)&verify.verify_depth, sizeof(verify.verify_depth));
             buf.push_back('|');
             buf.append(verify.ca_file_path);
+            if (!ssl.reuse_session) {
+                buf.append("|noreuse");
+            }
         } else {
             // All disabled ChannelSSLOptions are the same
         }
@@ -262,6 +270,10 @@ int Channel::Init(const char* server_addr, int port,
 static int CreateSocketSSLContext(const ChannelOptions& options,
                                   std::shared_ptr<SocketSSLContext>* ssl_ctx) {
     if (options.has_ssl_options()) {
+        if (options.use_shared_memory) {
+            LOG(ERROR) << "SSL does not work with shared memory";
+            return -1;
+        }
         SSL_CTX* raw_ctx = CreateClientSSLContext(options.ssl_options());
         if (!raw_ctx) {
             LOG(ERROR) << "Fail to CreateClientSSLContext";
@@ -270,6 +282,10 @@ static int CreateSocketSSLContext(const ChannelOptions& options,
         *ssl_ctx = std::make_shared<SocketSSLContext>();
         (*ssl_ctx)->raw_ctx = raw_ctx;
         (*ssl_ctx)->sni_name = options.ssl_options().sni_name;
+#ifndef USE_MESALINK
+        // Sessions are saved into the SocketSSLContext by callbacks of raw_ctx
+        SSL_CTX_set_app_data(raw_ctx, ssl_ctx->get());
+#endif
     } else {
         (*ssl_ctx) = NULL;
     }
@@ -296,7 +312,8 @@ int Channel::InitSingle(const butil::EndPoint& server_addr_and_port,
         }
     }
     const int port = server_addr_and_port.port;
-    if (port < 0 || port > 65535) {
+    if (!butil::is_unix_endpoint(server_addr_and_port) &&
+        (port < 0 || port > 65535)) {
         LOG(ERROR) << "Invalid port=" << port;
         return -1;
     }
@@ -307,7 +324,8 @@ int Channel::InitSingle(const butil::EndPoint& server_addr_and_port,
         return -1;
     }
     if (SocketMapInsert(SocketMapKey(server_addr_and_port, sig),
-                        &_server_id, ssl_ctx) != 0) {
+                        &_server_id, ssl_ctx,
+                        _options.use_shared_memory) != 0) {
         LOG(ERROR) << "Fail to insert into SocketMap";
         return -1;
     }
@@ -341,6 +359,7 @@ int Channel::Init(const char* ns_url,
     ns_opt.succeed_without_server = _options.succeed_without_server;
     ns_opt.log_succeed_without_server = _options.log_succeed_without_server;
     ns_opt.channel_signature = ComputeChannelSignature(_options);
+    ns_opt.use_shared_memory = _options.use_shared_memory;
     if (CreateSocketSSLContext(_options, &ns_opt.ssl_ctx) != 0) {
         return -1;
     }
@@ -129,6 +129,13 @@ struct ChannelOptions {
     // Default: ""
     std::string connection_group;
 
+    // Transport data through shared memory if the server is on the same
+    // host and enables ServerOptions.use_shared_memory as well, otherwise
+    // the connection goes on as a plain TCP one. Not work with SSL.
+    // Read src/brpc/shared_memory_transport.h for details.
+    // Default: false
+    bool use_shared_memory;
+
 private:
     // SSLOptions is large and not often used, allocate it on heap to
     // prevent ChannelOptions from being bloated in most cases.
@@ -113,6 +113,7 @@ friend class ControllerPrivateAccessor;
 friend class ServerPrivateAccessor;
 friend class SelectiveChannel;
 friend class ThriftStub;
+friend class ThriftMultiplexedService;
 friend class schan::Sender;
 friend class schan::SubDone;
 friend class policy::OnServerStreamCreated;
@@ -0,0 +1,179 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+
+#include <sys/resource.h>                  // getrusage
+#include <unistd.h>                        // sysconf
+#include <pthread.h>
+#include <gflags/gflags.h>
+#include "butil/time.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/adaptive_compression.h"
+
+namespace brpc {
+
+DEFINE_bool(adaptive_response_compression, false,
+            "Decide whether to compress each response by size, peer, "
+            "observed compression ratio of the method and cpu usage. "
+            "Compress types set by users are treated as hints");
+DEFINE_int32(adaptive_compress_min_size, 512, "Not compress responses "
+             "smaller than so many bytes");
+DEFINE_double(adaptive_compress_max_ratio, 0.8, "Not compress responses "
+              "of a method whose compressed/raw size is larger than this");
+DEFINE_double(adaptive_compress_max_cpu_usage, 0.8, "Not compress "
+              "responses when the process uses more than this fraction of "
+              "all cpu cores");
+DEFINE_bool(adaptive_compress_local_peer, false, "Compress responses to "
+            "peers on the same host");
+DEFINE_int32(adaptive_compress_probe_interval, 64, "Compress one of so "
+             "many responses skipped for poor ratio to refresh the ratio");
+BRPC_VALIDATE_GFLAG(adaptive_response_compression, PassValidate);
+BRPC_VALIDATE_GFLAG(adaptive_compress_min_size, NonNegativeInteger);
+BRPC_VALIDATE_GFLAG(adaptive_compress_max_ratio, PassValidate);
+BRPC_VALIDATE_GFLAG(adaptive_compress_max_cpu_usage, PassValidate);
+BRPC_VALIDATE_GFLAG(adaptive_compress_local_peer, PassValidate);
+BRPC_VALIDATE_GFLAG(adaptive_compress_probe_interval, PositiveInteger);
+
+static const int64_t CPU_USAGE_UPDATE_INTERVAL_US = 100000;
+
+static pthread_mutex_t s_cpu_usage_mutex = PTHREAD_MUTEX_INITIALIZER;
+static butil::static_atomic<int64_t> s_cpu_usage_update_us =
+    BUTIL_STATIC_ATOMIC_INIT(0);
+static butil::static_atomic<int> s_cpu_usage_permille =
+    BUTIL_STATIC_ATOMIC_INIT(0);
+static int64_t s_last_cputime_us = 0;
+static int64_t s_last_realtime_us = 0;
+
+static int64_t get_cputime_us() {
+    rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) {
+        return -1;
+    }
+    return ru.ru_utime.tv_sec * 1000000L + ru.ru_utime.tv_usec +
+        ru.ru_stime.tv_sec * 1000000L + ru.ru_stime.tv_usec;
+}
+
+double GetProcessCpuUsage() {
+    const int64_t now = butil::gettimeofday_us();
+    if (now - s_cpu_usage_update_us.load(butil::memory_order_relaxed)
+        >= CPU_USAGE_UPDATE_INTERVAL_US &&
+        pthread_mutex_trylock(&s_cpu_usage_mutex) == 0) {
+        // Only one thread refreshes, others use the cached value.
+        if (now - s_cpu_usage_update_us.load(butil::memory_order_relaxed)
+            >= CPU_USAGE_UPDATE_INTERVAL_US) {
+            static const long ncore = std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+            const int64_t cputime_us = get_cputime_us();
+            if (cputime_us >= 0 && s_last_realtime_us > 0 &&
+                now > s_last_realtime_us) {
+                const int64_t permille = (cputime_us - s_last_cputime_us) * 1000
+                    / ((now - s_last_realtime_us) * ncore);
+                s_cpu_usage_permille.store(permille, butil::memory_order_relaxed);
+            }
+            s_last_cputime_us = cputime_us;
+            s_last_realtime_us = now;
+            s_cpu_usage_update_us.store(now, butil::memory_order_relaxed);
+        }
+        pthread_mutex_unlock(&s_cpu_usage_mutex);
+    }
+    return s_cpu_usage_permille.load(butil::memory_order_relaxed) / 1000.0;
+}
+
+static bool IsLocalPeer(const butil::EndPoint& remote_side,
+                        const butil::EndPoint& local_side) {
+    const in_addr_t ip = ntohl(butil::ip2int(remote_side.ip));
+    return (ip >> 24) == 127 || remote_side.ip == local_side.ip;
+}
+
+AdaptiveCompression::AdaptiveCompression()
+    : _ratio_permille(0)
+    , _nskipped_by_ratio(0)
+    , _ratio_bvar(get_ratio, this) {
+}
+
+double AdaptiveCompression::get_ratio(void* arg) {
+    return static_cast<AdaptiveCompression*>(arg)->ratio();
+}
+
+CompressType AdaptiveCompression::Decide(
+    CompressType type, size_t raw_size,
+    const butil::EndPoint& remote_side, const butil::EndPoint& local_side) {
+    if (type == COMPRESS_TYPE_NONE || !FLAGS_adaptive_response_compression) {
+        return type;
+    }
+    if (raw_size < (size_t)FLAGS_adaptive_compress_min_size) {
+        _nskipped_small << 1;
+        return COMPRESS_TYPE_NONE;
+    }
+    if (!FLAGS_adaptive_compress_local_peer &&
+        IsLocalPeer(remote_side, local_side)) {
+        _nskipped_local << 1;
+        return COMPRESS_TYPE_NONE;
+    }
+    const int ratio = _ratio_permille.load(butil::memory_order_relaxed);
+    if (ratio > FLAGS_adaptive_compress_max_ratio * 1000) {
+        const int64_t n = _nskipped_by_ratio.fetch_add(
+            1, butil::memory_order_relaxed) + 1;
+        if (n % FLAGS_adaptive_compress_probe_interval != 0) {
+            _nskipped_ratio << 1;
+            return COMPRESS_TYPE_NONE;
+        }
+    }
+    if (GetProcessCpuUsage() > FLAGS_adaptive_compress_max_cpu_usage) {
+        _nskipped_cpu << 1;
+        return COMPRESS_TYPE_NONE;
+    }
+    return type;
+}
+
+void AdaptiveCompression::OnCompressed(size_t raw_size,
+                                       size_t compressed_size) {
+    if (raw_size == 0) {
+        return;
+    }
+    _ncompressed << 1;
+    const int cur = (int)std::min(compressed_size * 1000 / raw_size,
+                                  (size_t)10000);
+    int old = _ratio_permille.load(butil::memory_order_relaxed);
+    // Racing updates may lose samples, which is OK for a moving average.
+    const int updated = (old == 0 ? cur : (old * 7 + cur) / 8);
+    _ratio_permille.store(std::max(updated, 1), butil::memory_order_relaxed);
+}
+
+int AdaptiveCompression::Expose(const butil::StringPiece& prefix) {
+    if (_ncompressed.expose_as(prefix, "compress_compressed") != 0) {
+        return -1;
+    }
+    if (_nskipped_small.expose_as(prefix, "compress_skipped_small") != 0) {
+        return -1;
+    }
+    if (_nskipped_local.expose_as(prefix, "compress_skipped_local") != 0) {
+        return -1;
+    }
+    if (_nskipped_ratio.expose_as(prefix, "compress_skipped_ratio") != 0) {
+        return -1;
+    }
+    if (_nskipped_cpu.expose_as(prefix, "compress_skipped_cpu") != 0) {
+        return -1;
+    }
+    if (_ratio_bvar.expose_as(prefix, "compress_ratio") != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+} // namespace brpc
@@ -0,0 +1,86 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+
+#ifndef  BRPC_ADAPTIVE_COMPRESSION_H
+#define  BRPC_ADAPTIVE_COMPRESSION_H
+
+#include "butil/macros.h"                  // DISALLOW_COPY_AND_ASSIGN
+#include "butil/atomicops.h"
+#include "butil/endpoint.h"                // butil::EndPoint
+#include "bvar/bvar.h"                    // vars
+#include "brpc/options.pb.h"               // CompressType
+
+
+namespace brpc {
+
+// Decide whether to compress responses of a method, enabled by
+// -adaptive_response_compression. The compress type set by users via
+// Controller::set_response_compress_type() is treated as a hint and the
+// response is sent uncompressed when:
+//  - it's smaller than -adaptive_compress_min_size
+//  - the peer is on the same host (unless -adaptive_compress_local_peer)
+//  - compressed/raw size observed on this method is larger than
+//    -adaptive_compress_max_ratio. One of -adaptive_compress_probe_interval
+//    such responses is still compressed to refresh the ratio.
+//  - cpu usage of the process is higher than -adaptive_compress_max_cpu_usage
+class AdaptiveCompression {
+public:
+    AdaptiveCompression();
+
+    // Returns the compress type that the response of `raw_size' bytes
+    // should be compressed with, COMPRESS_TYPE_NONE to skip compression.
+    CompressType Decide(CompressType type, size_t raw_size,
+                        const butil::EndPoint& remote_side,
+                        const butil::EndPoint& local_side);
+
+    // Call this after compressing a response decided by Decide().
+    void OnCompressed(size_t raw_size, size_t compressed_size);
+
+    // Expose internal vars.
+    // Return 0 on success, -1 otherwise.
+    int Expose(const butil::StringPiece& prefix);
+
+    // Observed compressed/raw size, 0 if nothing was compressed yet.
+    double ratio() const {
+        return _ratio_permille.load(butil::memory_order_relaxed) / 1000.0;
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(AdaptiveCompression);
+
+    static double get_ratio(void* arg);
+
+    // Moving average of compressed/raw size in permille.
+    butil::atomic<int> _ratio_permille;
+    butil::atomic<int64_t> _nskipped_by_ratio;
+    bvar::Adder<int64_t> _ncompressed;
+    bvar::Adder<int64_t> _nskipped_small;
+    bvar::Adder<int64_t> _nskipped_local;
+    bvar::Adder<int64_t> _nskipped_ratio;
+    bvar::Adder<int64_t> _nskipped_cpu;
+    bvar::PassiveStatus<double> _ratio_bvar;
+};
+
+// Fraction of cpu time used by this process over all cores in recent
+// 100 milliseconds, cached and cheap to call.
+double GetProcessCpuUsage();
+
+} // namespace brpc
+
+#endif  //BRPC_ADAPTIVE_COMPRESSION_H
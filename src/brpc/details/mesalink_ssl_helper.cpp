@@ -315,6 +315,11 @@ SSL_CTX* CreateServerSSLContext(const std::string& certificate,
     return ssl_ctx.release();
 }
 
+int SetSharedSessionCache(SSL_CTX*, const std::string&, int) {
+    // Not supported by MesaLink, sessions are cached inside each SSL_CTX.
+    return 0;
+}
+
 SSL* CreateSSLSession(SSL_CTX* ctx, SocketId id, int fd, bool server_mode) {
     if (ctx == NULL) {
         LOG(WARNING) << "Lack SSL_ctx to create an SSL session";
@@ -344,6 +349,14 @@ void AddBIOBuffer(SSL* ssl, int fd, int bufsize) {
     // MesaLink uses buffered IO internally
 }
 
+void EnableKTLS(SSL*) {
+    // Not supported by MesaLink.
+}
+
+int GetKTLSDirections(SSL*) {
+    return 0;
+}
+
 SSLState DetectSSLState(int fd, int* error_code) {
     // Peek the first few bytes inside socket to detect whether
     // it's an SSL connection. If it is, create an SSL session
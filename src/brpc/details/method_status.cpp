@@ -65,6 +65,11 @@ int MethodStatus::Expose(const butil::StringPiece& prefix) {
             return -1;
         }
     }
+    // -adaptive_response_compression is reloadable, expose the vars even
+    // if it's off now.
+    if (_adaptive_compression.Expose(prefix) != 0) {
+        return -1;
+    }
     return 0;
 }
 
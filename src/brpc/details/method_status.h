@@ -23,6 +23,7 @@
 #include "bvar/bvar.h"                    // vars
 #include "brpc/describable.h"
 #include "brpc/concurrency_limiter.h"
+#include "brpc/details/adaptive_compression.h"
 
 
 namespace brpc {
@@ -58,6 +59,9 @@ public:
     // Current max_concurrency of the method.
     int MaxConcurrency() const { return _cl ? _cl->MaxConcurrency() : 0; }
 
+    // Decide whether to compress responses of the method.
+    AdaptiveCompression& adaptive_compression() { return _adaptive_compression; }
+
 private:
 friend class Server;
     DISALLOW_COPY_AND_ASSIGN(MethodStatus);
@@ -73,6 +77,7 @@ friend class Server;
     bvar::PassiveStatus<int>  _nconcurrency_bvar;
     bvar::PerSecond<bvar::Adder<int64_t>> _eps_bvar;
     bvar::PassiveStatus<int32_t> _max_concurrency_bvar;
+    AdaptiveCompression _adaptive_compression;
 };
 
 class ConcurrencyRemover {
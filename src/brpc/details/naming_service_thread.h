@@ -44,12 +44,14 @@ public:
 struct GetNamingServiceThreadOptions {
     GetNamingServiceThreadOptions()
         : succeed_without_server(false)
-        , log_succeed_without_server(true) {}
+        , log_succeed_without_server(true)
+        , use_shared_memory(false) {}
     
     bool succeed_without_server;
     bool log_succeed_without_server;
     ChannelSignature channel_signature;
     std::shared_ptr<SocketSSLContext> ssl_ctx;
+    bool use_shared_memory;
 };
 
 // A dedicated thread to map a name to ServerIds
@@ -24,15 +24,31 @@
 #include <openssl/err.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+#include <gflags/gflags.h>
 #include "butil/unique_ptr.h"
 #include "butil/logging.h"
+#include "butil/time.h"
+#include "butil/scoped_lock.h"
+#include "butil/containers/mru_cache.h"
 #include "butil/ssl_compat.h"
 #include "butil/string_splitter.h"
 #include "brpc/socket.h"
+#include "brpc/reloadable_flags.h"
 #include "brpc/details/ssl_helper.h"
 
 namespace brpc {
 
+DEFINE_int32(ssl_ticket_key_rotation_s, 3600,
+             "Rotate keys encrypting SSL session tickets every so many seconds");
+BRPC_VALIDATE_GFLAG(ssl_ticket_key_rotation_s, PositiveInteger);
+
 #ifndef OPENSSL_NO_DH
 static DH* g_dh_1024 = NULL;
 static DH* g_dh_2048 = NULL;
@@ -441,6 +457,18 @@ static int SetSSLOptions(SSL_CTX* ctx, const std::string& ciphers,
     return 0;
 }
 
+static int SSLNewClientSessionCallback(SSL* ssl, SSL_SESSION* session) {
+    SocketSSLContext* ctx = static_cast<SocketSSLContext*>(
+        SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    SocketUniquePtr s;
+    if (ctx != NULL &&
+        Socket::Address((SocketId)SSL_get_app_data(ssl), &s) == 0) {
+        ctx->SetSession(s->remote_side(), session);
+    }
+    // Not taking the reference of `session'
+    return 0;
+}
+
 SSL_CTX* CreateClientSSLContext(const ChannelSSLOptions& options) {
     std::unique_ptr<SSL_CTX, FreeSSLCTX> ssl_ctx(
         SSL_CTX_new(SSLv23_client_method()));
@@ -463,7 +491,14 @@ SSL_CTX* CreateClientSSLContext(const ChannelSSLOptions& options) {
         return NULL;
     }
 
-    SSL_CTX_set_session_cache_mode(ssl_ctx.get(), SSL_SESS_CACHE_CLIENT);
+    if (options.reuse_session) {
+        // Sessions are kept by the SocketSSLContext owning `ssl_ctx'
+        SSL_CTX_set_session_cache_mode(
+            ssl_ctx.get(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ssl_ctx.get(), SSLNewClientSessionCallback);
+    } else {
+        SSL_CTX_set_session_cache_mode(ssl_ctx.get(), SSL_SESS_CACHE_CLIENT);
+    }
     return ssl_ctx.release();
 }
 
@@ -524,6 +559,202 @@ SSL_CTX* CreateServerSSLContext(const std::string& certificate,
     return ssl_ctx.release();
 }
 
+// Keys encrypting session tickets, shared by all servers.
+struct SSLTicketKey {
+    unsigned char name[16];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+    int64_t create_time_s;
+};
+
+static butil::Mutex g_ticket_key_mutex;
+// [0] is the current key, [1] is the previous one.
+static SSLTicketKey g_ticket_keys[2];
+static int g_ticket_key_num = 0;
+
+// Generate a new key if the current one expires. Called with
+// g_ticket_key_mutex held.
+static int RotateTicketKeyIfNeeded() {
+    const int64_t now_s = butil::gettimeofday_s();
+    if (g_ticket_key_num > 0 &&
+        now_s - g_ticket_keys[0].create_time_s < FLAGS_ssl_ticket_key_rotation_s) {
+        return 0;
+    }
+    SSLTicketKey key;
+    if (RAND_bytes(key.name, sizeof(key.name)) != 1 ||
+        RAND_bytes(key.aes_key, sizeof(key.aes_key)) != 1 ||
+        RAND_bytes(key.hmac_key, sizeof(key.hmac_key)) != 1) {
+        LOG(ERROR) << "Fail to generate ticket key: " << SSLError(ERR_get_error());
+        return -1;
+    }
+    key.create_time_s = now_s;
+    g_ticket_keys[1] = g_ticket_keys[0];
+    g_ticket_keys[0] = key;
+    g_ticket_key_num = std::min(g_ticket_key_num + 1, 2);
+    return 0;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX SSLTicketMacCtx;
+
+static int InitTicketMac(EVP_MAC_CTX* ctx, const unsigned char* key) {
+    OSSL_PARAM params[2];
+    params[0] = OSSL_PARAM_construct_utf8_string(
+        OSSL_MAC_PARAM_DIGEST, const_cast<char*>("SHA256"), 0);
+    params[1] = OSSL_PARAM_construct_end();
+    return EVP_MAC_init(ctx, key, 32, params);
+}
+#else
+typedef HMAC_CTX SSLTicketMacCtx;
+
+static int InitTicketMac(HMAC_CTX* ctx, const unsigned char* key) {
+    return HMAC_Init_ex(ctx, key, 32, EVP_sha256(), NULL);
+}
+#endif  // OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+// Returns 1 on success, 2 if the ticket should be renewed, 0 if the ticket
+// is not decryptable and -1 on error, as required by OpenSSL.
+static int SSLTicketKeyCallback(SSL*, unsigned char* key_name,
+                                unsigned char* iv, EVP_CIPHER_CTX* cctx,
+                                SSLTicketMacCtx* mctx, int enc) {
+    SSLTicketKey key;
+    int rc = 1;
+    {
+        BAIDU_SCOPED_LOCK(g_ticket_key_mutex);
+        if (RotateTicketKeyIfNeeded() != 0) {
+            return -1;
+        }
+        if (enc) {
+            key = g_ticket_keys[0];
+        } else {
+            rc = 0;
+            for (int i = 0; i < g_ticket_key_num; ++i) {
+                if (memcmp(key_name, g_ticket_keys[i].name,
+                           sizeof(key.name)) == 0) {
+                    key = g_ticket_keys[i];
+                    rc = (i == 0 ? 1 : 2);
+                    break;
+                }
+            }
+            if (rc == 0) {
+                // Unknown or expired key, do a full handshake.
+                return 0;
+            }
+        }
+    }
+    if (enc) {
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1) {
+            return -1;
+        }
+        memcpy(key_name, key.name, sizeof(key.name));
+        if (EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL,
+                               key.aes_key, iv) != 1) {
+            return -1;
+        }
+    } else if (EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL,
+                                  key.aes_key, iv) != 1) {
+        return -1;
+    }
+    if (InitTicketMac(mctx, key.hmac_key) != 1) {
+        return -1;
+    }
+    return rc;
+}
+
+// Session ids => DER encoded sessions, shared by all servers.
+typedef butil::MRUCache<std::string, std::string> SSLSessionCache;
+static butil::Mutex g_session_cache_mutex;
+static SSLSessionCache* g_session_cache = NULL;
+// 0 means unlimited.
+static size_t g_session_cache_capacity = 0;
+
+static int SSLNewServerSessionCallback(SSL*, SSL_SESSION* session) {
+    unsigned int id_len = 0;
+    const unsigned char* id = SSL_SESSION_get_id(session, &id_len);
+    const int len = i2d_SSL_SESSION(session, NULL);
+    if (len <= 0) {
+        return 0;
+    }
+    std::string der;
+    der.resize(len);
+    unsigned char* p = reinterpret_cast<unsigned char*>(&der[0]);
+    i2d_SSL_SESSION(session, &p);
+
+    BAIDU_SCOPED_LOCK(g_session_cache_mutex);
+    g_session_cache->Put(std::string((const char*)id, id_len), der);
+    if (g_session_cache_capacity > 0) {
+        g_session_cache->ShrinkToSize(g_session_cache_capacity);
+    }
+    // Not taking the reference of `session'
+    return 0;
+}
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static SSL_SESSION* SSLGetServerSessionCallback(
+    SSL*, unsigned char* id, int len, int* copy) {
+#else
+static SSL_SESSION* SSLGetServerSessionCallback(
+    SSL*, const unsigned char* id, int len, int* copy) {
+#endif
+    *copy = 0;
+    std::string der;
+    {
+        BAIDU_SCOPED_LOCK(g_session_cache_mutex);
+        SSLSessionCache::iterator it =
+            g_session_cache->Get(std::string((const char*)id, len));
+        if (it == g_session_cache->end()) {
+            return NULL;
+        }
+        der = it->second;
+    }
+    // OpenSSL checks expiration and sid_ctx of the returned session.
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(der.data());
+    return d2i_SSL_SESSION(NULL, &p, der.size());
+}
+
+static void SSLRemoveServerSessionCallback(SSL_CTX*, SSL_SESSION* session) {
+    unsigned int id_len = 0;
+    const unsigned char* id = SSL_SESSION_get_id(session, &id_len);
+    BAIDU_SCOPED_LOCK(g_session_cache_mutex);
+    SSLSessionCache::iterator it =
+        g_session_cache->Peek(std::string((const char*)id, id_len));
+    if (it != g_session_cache->end()) {
+        g_session_cache->Erase(it);
+    }
+}
+
+int SetSharedSessionCache(SSL_CTX* ctx, const std::string& sid_ctx,
+                          int cache_size) {
+    if (SSL_CTX_set_session_id_context(
+            ctx, (const unsigned char*)sid_ctx.data(),
+            std::min(sid_ctx.size(), (size_t)SSL_MAX_SID_CTX_LENGTH)) != 1) {
+        LOG(ERROR) << "Fail to set session id context: "
+                   << SSLError(ERR_get_error());
+        return -1;
+    }
+    {
+        BAIDU_SCOPED_LOCK(g_session_cache_mutex);
+        if (g_session_cache == NULL) {
+            g_session_cache = new SSLSessionCache(SSLSessionCache::NO_AUTO_EVICT);
+            g_session_cache_capacity = std::max(cache_size, 0);
+        } else if (g_session_cache_capacity > 0) {
+            g_session_cache_capacity = (cache_size <= 0 ? 0 :
+                std::max(g_session_cache_capacity, (size_t)cache_size));
+        }
+    }
+    SSL_CTX_set_session_cache_mode(
+        ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_sess_set_new_cb(ctx, SSLNewServerSessionCallback);
+    SSL_CTX_sess_set_get_cb(ctx, SSLGetServerSessionCallback);
+    SSL_CTX_sess_set_remove_cb(ctx, SSLRemoveServerSessionCallback);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, SSLTicketKeyCallback);
+#elif defined(SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB)
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx, SSLTicketKeyCallback);
+#endif
+    return 0;
+}
+
 SSL* CreateSSLSession(SSL_CTX* ctx, SocketId id, int fd, bool server_mode) {
     if (ctx == NULL) {
         LOG(WARNING) << "Lack SSL_ctx to create an SSL session";
@@ -564,6 +795,25 @@ void AddBIOBuffer(SSL* ssl, int fd, int bufsize) {
     SSL_set_bio(ssl, rbio, wbio);
 }
 
+void EnableKTLS(SSL* ssl) {
+#if defined(SSL_OP_ENABLE_KTLS)
+    SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+#endif
+}
+
+int GetKTLSDirections(SSL* ssl) {
+    int directions = 0;
+#if defined(SSL_OP_ENABLE_KTLS)
+    if (BIO_get_ktls_send(SSL_get_wbio(ssl))) {
+        directions |= KTLS_SEND;
+    }
+    if (BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+        directions |= KTLS_RECV;
+    }
+#endif
+    return directions;
+}
+
 SSLState DetectSSLState(int fd, int* error_code) {
     // Peek the first few bytes inside socket to detect whether
     // it's an SSL connection. If it is, create an SSL session
@@ -86,6 +86,20 @@ SSL_CTX* CreateServerSSLContext(const std::string& certificate_file,
                                 const ServerSSLOptions& options,
                                 std::vector<std::string>* hostnames);
 
+// Make servers using `ctx' share SSL sessions through process-wide storage
+// so that sessions survive reloading of certificates and can be resumed by
+// any SSL_CTX of the same server:
+//   - Session ids are kept in a cache shared by all servers, holding at
+//     most `cache_size' sessions (the largest one if servers differ).
+//   - Session tickets are encrypted with keys shared by all servers and
+//     rotated every -ssl_ticket_key_rotation_s seconds. Tickets encrypted
+//     with the previous key are still accepted and renewed.
+// Sessions are only resumed by SSL_CTX with the same `sid_ctx' which should
+// be unique for each server.
+// Returns 0 on success, -1 otherwise.
+int SetSharedSessionCache(SSL_CTX* ctx, const std::string& sid_ctx,
+                          int cache_size);
+
 // Create a new SSL (per connection object) using configurations in `ctx'.
 // Set the required `fd' and mode. `id' will be set into SSL as app data.
 SSL* CreateSSLSession(SSL_CTX* ctx, SocketId id, int fd, bool server_mode);
@@ -94,6 +108,22 @@ SSL* CreateSSLSession(SSL_CTX* ctx, SocketId id, int fd, bool server_mode);
 // which can reduce the total number of calls to system read/write
 void AddBIOBuffer(SSL* ssl, int fd, int bufsize);
 
+// Directions of an SSL session offloaded to kernel TLS.
+enum KTLSDirection {
+    KTLS_SEND = 1 << 0,
+    KTLS_RECV = 1 << 1,
+};
+
+// Ask the SSL library to install keys into kernel(kTLS) after handshaking.
+// Must be called before handshaking and without BIO buffer layers. Nothing
+// happens if kTLS is not supported by the library.
+void EnableKTLS(SSL* ssl);
+
+// Bitwise OR of KTLSDirection which are offloaded to kernel, 0 if kTLS is
+// not enabled or supported by the kernel(e.g. module `tls' is not loaded,
+// or the cipher is not supported).
+int GetKTLSDirections(SSL* ssl);
+
 // Judge whether the underlying channel of `fd' is using SSL
 // If the return value is SSL_UNKNOWN, `error_code' will be
 // set to indicate the reason (0 for EOF)
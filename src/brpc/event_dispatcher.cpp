@@ -348,6 +348,7 @@ void EventDispatcher::Run() {
 }
 
 static EventDispatcher* g_edisp = NULL;
+static int g_edisp_num = 0;
 static pthread_once_t g_edisp_once = PTHREAD_ONCE_INIT;
 
 static void StopAndJoinGlobalDispatchers() {
@@ -357,6 +358,7 @@ static void StopAndJoinGlobalDispatchers() {
     }
 }
 void InitializeGlobalDispatchers() {
+    g_edisp_num = FLAGS_event_dispatcher_num;
     g_edisp = new EventDispatcher[FLAGS_event_dispatcher_num];
     for (int i = 0; i < FLAGS_event_dispatcher_num; ++i) {
         const bthread_attr_t attr = FLAGS_usercode_in_pthread ?
@@ -377,4 +379,17 @@ EventDispatcher& GetGlobalEventDispatcher(int fd) {
     return g_edisp[index];
 }
 
+EventDispatcher& GetGlobalEventDispatcher(int fd, int index) {
+    if (index < 0) {
+        return GetGlobalEventDispatcher(fd);
+    }
+    pthread_once(&g_edisp_once, InitializeGlobalDispatchers);
+    return g_edisp[index % g_edisp_num];
+}
+
+int GetGlobalEventDispatcherCount() {
+    pthread_once(&g_edisp_once, InitializeGlobalDispatchers);
+    return g_edisp_num;
+}
+
 } // namespace brpc
@@ -109,6 +109,13 @@ private:
 
 EventDispatcher& GetGlobalEventDispatcher(int fd);
 
+// Get the `index'-th(modulo -event_dispatcher_num) global dispatcher, or
+// the one chosen by `fd' when `index' is negative.
+EventDispatcher& GetGlobalEventDispatcher(int fd, int index);
+
+// Number of global dispatchers.
+int GetGlobalEventDispatcherCount();
+
 } // namespace brpc
 
 
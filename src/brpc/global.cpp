@@ -52,6 +52,12 @@
 #include "brpc/compress.h"
 #include "brpc/policy/gzip_compress.h"
 #include "brpc/policy/snappy_compress.h"
+#ifdef BRPC_WITH_LZ4
+#include "brpc/policy/lz4_compress.h"
+#endif
+#ifdef BRPC_WITH_ZSTD
+#include "brpc/policy/zstd_compress.h"
+#endif
 
 // Protocols
 #include "brpc/protocol.h"
@@ -388,6 +394,20 @@ static void GlobalInitializeOrDieImpl() {
     if (RegisterCompressHandler(COMPRESS_TYPE_SNAPPY, snappy_compress) != 0) {
         exit(1);
     }
+#ifdef BRPC_WITH_LZ4
+    const CompressHandler lz4_compress =
+        { LZ4Compress, LZ4Decompress, "lz4" };
+    if (RegisterCompressHandler(COMPRESS_TYPE_LZ4, lz4_compress) != 0) {
+        exit(1);
+    }
+#endif
+#ifdef BRPC_WITH_ZSTD
+    const CompressHandler zstd_compress =
+        { ZstdCompress, ZstdDecompress, "zstd" };
+    if (RegisterCompressHandler(COMPRESS_TYPE_ZSTD, zstd_compress) != 0) {
+        exit(1);
+    }
+#endif
 
     // Protocols
     Protocol baidu_protocol = { ParseRpcMessage,
@@ -488,7 +508,7 @@ static void GlobalInitializeOrDieImpl() {
     Protocol mc_binary_protocol = { ParseMemcacheMessage,
                                     SerializeMemcacheRequest,
                                     PackMemcacheRequest,
-                                    NULL, ProcessMemcacheResponse,
+                                    ProcessMemcacheRequest, ProcessMemcacheResponse,
                                     NULL, NULL, GetMemcacheMethodName,
                                     CONNECTION_TYPE_ALL, "memcache" };
     if (RegisterProtocol(PROTOCOL_MEMCACHE, mc_binary_protocol) != 0) {
@@ -17,16 +17,22 @@
 
 
 #include <gflags/gflags.h>
+#include <algorithm>                             // std::sort
+#include <poll.h>                                // poll
+#include <sys/ioctl.h>                           // FIONREAD
 #include "butil/fd_guard.h"                      // fd_guard
 #include "butil/logging.h"                       // CHECK
 #include "butil/time.h"                          // cpuwide_time_us
 #include "butil/fd_utility.h"                    // make_non_blocking
+#include "butil/object_pool.h"                   // get_object
 #include "bthread/bthread.h"                     // bthread_start_background
 #include "bthread/unstable.h"                   // bthread_flush
+#include "bthread/processor.h"                  // cpu_relax
 #include "bvar/bvar.h"                          // bvar::Adder
 #include "brpc/options.pb.h"               // ProtocolType
 #include "brpc/reloadable_flags.h"         // BRPC_VALIDATE_GFLAG
 #include "brpc/protocol.h"                 // ListProtocols
+#include "brpc/shared_memory_transport.h"  // RejectSharedMemoryHandshake
 #include "brpc/input_messenger.h"
 
 
@@ -52,8 +58,48 @@ DEFINE_bool(log_connection_close, false,
             "Print log when remote side closes the connection");
 BRPC_VALIDATE_GFLAG(log_connection_close, PassValidate);
 
+DEFINE_bool(sort_protocols_by_frequency, true,
+            "Try protocols in descending order of being chosen by previous "
+            "connections of the server rather than in the registering order, "
+            "which saves parsing attempts on new connections when many "
+            "protocols are enabled");
+BRPC_VALIDATE_GFLAG(sort_protocols_by_frequency, PassValidate);
+
+DEFINE_bool(read_size_by_fionread, false,
+            "Size each read from sockets by bytes queued in the kernel "
+            "(FIONREAD) instead of the average size of messages, which reads "
+            "bursts of messages in fewer syscalls");
+BRPC_VALIDATE_GFLAG(read_size_by_fionread, PassValidate);
+
+// Max value of -input_message_batch_size.
+static const int MAX_INPUT_MESSAGE_BATCH_SIZE = 64;
+
+DEFINE_int32(input_message_batch_size, 1,
+             "Process messages cut from one read of a connection in bthreads "
+             "of at most so many messages each instead of one bthread per "
+             "message, which saves the reading bthread from creating "
+             "bthreads for every message of connections pipelining lots of "
+             "small messages. At most 64");
+static bool ValidateInputMessageBatchSize(const char*, int32_t val) {
+    return val >= 1 && val <= MAX_INPUT_MESSAGE_BATCH_SIZE;
+}
+BRPC_VALIDATE_GFLAG(input_message_batch_size, ValidateInputMessageBatchSize);
+
+DEFINE_bool(server_pause_read_when_overcrowded, false,
+            "Stop reading requests from a connection until its responses "
+            "not written yet drop below -socket_unwritten_bytes_low_watermark, "
+            "rather than rejecting new requests with EOVERCROWDED, so that "
+            "clients sending faster than reading responses are slowed down "
+            "by TCP flow control");
+BRPC_VALIDATE_GFLAG(server_pause_read_when_overcrowded, PassValidate);
+
+// Re-sort protocols after so many selections.
+static const int64_t PROTOCOL_SORTING_INTERVAL = 128;
+
 DECLARE_bool(usercode_in_pthread);
 DECLARE_uint64(max_body_size);
+DECLARE_int32(socket_busy_poll_us);
+extern SocketVarsCollector* g_vars;
 
 const size_t MSG_SIZE_WINDOW = 10;  // Take last so many message into stat.
 const size_t MIN_ONCE_READ = 4096;
@@ -99,16 +145,34 @@ ParseResult InputMessenger::CutInputMessage(
         }
         m->set_preferred_index(-1);
     }
-    for (int i = 0; i <= max_index; ++i) {
-        if (i == preferred || _handlers[i].parse == NULL) {
-            // Don't try preferred handler(already tried) or invalid handler
+    // Try handlers in _trial_order first, then all handlers in the order of
+    // indexes to cover the ones missing from _trial_order which is possible
+    // when _trial_order is being re-sorted.
+    bool tried[max_index + 2];
+    memset(tried, 0, sizeof(tried));
+    if (preferred >= 0 && preferred <= max_index) {
+        // Already tried.
+        tried[preferred] = true;
+    }
+    const bool sorted = (_trial_order != NULL && FLAGS_sort_protocols_by_frequency);
+    for (int k = (sorted ? 0 : max_index + 1); k <= 2 * max_index + 1; ++k) {
+        const int i = (k <= max_index ?
+                       _trial_order[k].load(butil::memory_order_relaxed) :
+                       k - max_index - 1);
+        if (i < 0 || i > max_index || tried[i] || _handlers[i].parse == NULL) {
+            // Don't try handlers tried before or invalid handler
             continue;
         }
+        tried[i] = true;
         ParseResult result = _handlers[i].parse(&m->_read_buf, m, read_eof, _handlers[i].arg);
         if (result.is_ok() ||
             result.error() == PARSE_ERROR_NOT_ENOUGH_DATA) {
             m->set_preferred_index(i);
             *index = i;
+            // NOT_ENOUGH_DATA may be a wrong guess, don't count it.
+            if (result.is_ok() && _nselected != NULL) {
+                OnProtocolSelected(i);
+            }
             return result;
         } else if (result.error() != PARSE_ERROR_TRY_OTHERS) {
             // Critical error, return directly.
@@ -142,12 +206,31 @@ struct RunLastMessage {
     }
 };
 
-static void QueueMessage(InputMessageBase* to_run_msg,
-                         int* num_bthread_created,
-                         bthread_keytable_pool_t* keytable_pool) {
-    if (!to_run_msg) {
-        return;
+// Messages processed one by one in a bthread.
+struct InputMessageBatch {
+    int size;
+    InputMessageBase* msgs[MAX_INPUT_MESSAGE_BATCH_SIZE];
+};
+
+static void* ProcessInputMessages(void* void_arg) {
+    InputMessageBatch* batch = static_cast<InputMessageBatch*>(void_arg);
+    for (int i = 0; i < batch->size; ++i) {
+        ProcessInputMessage(batch->msgs[i]);
+    }
+    batch->size = 0;
+    butil::return_object(batch);
+    return NULL;
+}
+
+struct RunMessageBatch {
+    inline void operator()(InputMessageBatch* batch) {
+        ProcessInputMessages(batch);
     }
+};
+
+static void StartProcessing(void* (*fn)(void*), void* arg,
+                            int* num_bthread_created,
+                            bthread_keytable_pool_t* keytable_pool) {
     // Create bthread for last_msg. The bthread is not scheduled
     // until bthread_flush() is called (in the worse case).
                 
@@ -157,13 +240,96 @@ static void QueueMessage(InputMessageBase* to_run_msg,
                           BTHREAD_ATTR_PTHREAD :
                           BTHREAD_ATTR_NORMAL) | BTHREAD_NOSIGNAL;
     tmp.keytable_pool = keytable_pool;
-    if (bthread_start_background(
-            &th, &tmp, ProcessInputMessage, to_run_msg) == 0) {
+    if (bthread_start_background(&th, &tmp, fn, arg) == 0) {
         ++*num_bthread_created;
     } else {
         // Call the process of the corresponding protocol_ Request to process the messages from the cut
-        ProcessInputMessage(to_run_msg);
+        fn(arg);
+    }
+}
+
+static void QueueMessage(InputMessageBase* to_run_msg,
+                         int* num_bthread_created,
+                         bthread_keytable_pool_t* keytable_pool) {
+    if (!to_run_msg) {
+        return;
+    }
+    StartProcessing(ProcessInputMessage, to_run_msg,
+                    num_bthread_created, keytable_pool);
+}
+
+// Process the batch in a bthread.
+static void QueueMessageBatch(
+    std::unique_ptr<InputMessageBatch, RunMessageBatch>* batch,
+    int* num_bthread_created, bthread_keytable_pool_t* keytable_pool) {
+    if (batch->get() == NULL) {
+        return;
+    }
+    g_vars->ninput_message_batch << 1;
+    StartProcessing(ProcessInputMessages, batch->release(),
+                    num_bthread_created, keytable_pool);
+}
+
+// Add `to_run_msg' into `batch' which is queued when it's full, or queue
+// `to_run_msg' alone when batching is off.
+static void QueueMessage(
+    InputMessageBase* to_run_msg,
+    std::unique_ptr<InputMessageBatch, RunMessageBatch>* batch,
+    int* num_bthread_created, bthread_keytable_pool_t* keytable_pool) {
+    if (!to_run_msg) {
+        return;
+    }
+    const int max_batch_size = FLAGS_input_message_batch_size;
+    if (max_batch_size <= 1) {
+        return QueueMessage(to_run_msg, num_bthread_created, keytable_pool);
+    }
+    if (batch->get() == NULL) {
+        InputMessageBatch* b = butil::get_object<InputMessageBatch>();
+        if (b == NULL) {
+            return QueueMessage(to_run_msg, num_bthread_created, keytable_pool);
+        }
+        b->size = 0;
+        batch->reset(b);
+    }
+    (*batch)->msgs[(*batch)->size++] = to_run_msg;
+    if ((*batch)->size >= max_batch_size) {
+        QueueMessageBatch(batch, num_bthread_created, keytable_pool);
+    }
+}
+
+size_t InputMessenger::GetOnceReadSize(Socket* m) {
+    size_t once_read = m->_avg_msg_size * 16;
+    if (FLAGS_read_size_by_fionread && m->_conn == NULL) {
+        int nqueued = 0;
+        if (ioctl(m->fd(), FIONREAD, &nqueued) == 0 && nqueued > 0) {
+            once_read = nqueued;
+            g_vars->nfionread << 1;
+        }
     }
+    if (once_read < MIN_ONCE_READ) {
+        once_read = MIN_ONCE_READ;
+    } else if (once_read > MAX_ONCE_READ) {
+        once_read = MAX_ONCE_READ;
+    }
+    return once_read;
+}
+
+bool InputMessenger::BusyPoll(Socket* m) {
+    const int64_t deadline_us =
+        m->_last_readtime_us.load(butil::memory_order_relaxed) +
+        FLAGS_socket_busy_poll_us;
+    struct pollfd pfd;
+    pfd.fd = m->fd();
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    while (butil::cpuwide_time_us() < deadline_us) {
+        if (poll(&pfd, 1, 0) > 0) {
+            g_vars->nbusy_poll << 1;
+            return true;
+        }
+        cpu_relax();
+    }
+    return false;
 }
 
 void InputMessenger::OnNewMessages(Socket* m) {
@@ -186,19 +352,25 @@ void InputMessenger::OnNewMessages(Socket* m) {
     // OK in most cases.
     // First Create,last_msg.release() is NULL because of unique_ptr
     std::unique_ptr<InputMessageBase, RunLastMessage> last_msg;
+    // Messages before last_msg to be processed in one bthread, processed
+    // in-place before last_msg as well if not queued before returning.
+    std::unique_ptr<InputMessageBatch, RunMessageBatch> batch;
     bool read_eof = false;
     // Keep reading until it is finished
     while (!read_eof) {
+        if (FLAGS_server_pause_read_when_overcrowded &&
+            m->is_overcrowded() && !m->CreatedByConnect()) {
+            // Run the last message which may be waited by the client.
+            last_msg.reset();
+            if (m->WaitWritable(NULL) != 0) {
+                return;
+            }
+        }
         const int64_t received_us = butil::cpuwide_time_us();
         const int64_t base_realtime = butil::gettimeofday_us() - received_us;
 
         // Calculate bytes to be read.
-        size_t once_read = m->_avg_msg_size * 16;
-        if (once_read < MIN_ONCE_READ) {
-            once_read = MIN_ONCE_READ;
-        } else if (once_read > MAX_ONCE_READ) {
-            once_read = MAX_ONCE_READ;
-        }
+        const size_t once_read = GetOnceReadSize(m);
 
         // Once read.
         const ssize_t nr = m->DoRead(once_read);
@@ -218,6 +390,16 @@ void InputMessenger::OnNewMessages(Socket* m) {
                 m->SetFailed(saved_errno, "Fail to read from %s: %s",
                              m->description().c_str(), berror(saved_errno));
                 return;
+            } else if (FLAGS_socket_busy_poll_us > 0 && m->_conn == NULL) {
+                // Run the last message before polling which otherwise
+                // delays it.
+                last_msg.reset();
+                if (!BusyPoll(m) && !m->MoreReadEvents(&progress)) {
+                    return;
+                }
+                // Messages coming during the polling are read without
+                // waiting for epoll.
+                continue;
             } else if (!m->MoreReadEvents(&progress)) {
                 return;
             } else { // new events during processing
@@ -249,6 +431,17 @@ void InputMessenger::OnNewMessages(Socket* m) {
                     m->_last_msg_size += (last_size - m->_read_buf.length());
                     break;
                 } else if (pr.error() == PARSE_ERROR_TRY_OTHERS) {
+                    if (!m->CreatedByConnect() && m->ssl_state() == SSL_OFF) {
+                        // Clients asking for shared memory go on with TCP.
+                        const int rc = RejectSharedMemoryHandshake(
+                            m->fd(), &m->_read_buf);
+                        if (rc > 0) {
+                            last_size = m->_read_buf.length();
+                            continue;
+                        } else if (rc == 0) {
+                            break;
+                        }
+                    }
                     LOG(WARNING)
                         << "Close " << *m << " due to unknown message: "
                         << butil::ToPrintable(m->_read_buf);
@@ -297,8 +490,8 @@ void InputMessenger::OnNewMessages(Socket* m) {
             // If n messages are read from a fd consecutively (n>1), 
             // InputMessenger will start n-1 bthreads to process the first n-1 messages respectively, 
             // and the last message will be processed in place
-            QueueMessage(last_msg.release(), &num_bthread_created,
-                             m->_keytable_pool);
+            QueueMessage(last_msg.release(), &batch, &num_bthread_created,
+                         m->_keytable_pool);
             if (handlers[index].process == NULL) {
                 LOG(ERROR) << "process of index=" << index << " is NULL";
                 continue;
@@ -343,6 +536,7 @@ void InputMessenger::OnNewMessages(Socket* m) {
                 num_bthread_created = 0;
             }
         }
+        QueueMessageBatch(&batch, &num_bthread_created, m->_keytable_pool);
         if (num_bthread_created) {
             bthread_flush();
         }
@@ -357,12 +551,19 @@ InputMessenger::InputMessenger(size_t capacity)
     : _handlers(NULL)
     , _max_index(-1)
     , _non_protocol(false)
-    , _capacity(capacity) {
+    , _capacity(capacity)
+    , _trial_order(NULL)
+    , _nselected(NULL)
+    , _nselected_total(0) {
 }
 
 InputMessenger::~InputMessenger() {
     delete[] _handlers;
     _handlers = NULL;        
+    delete[] _trial_order;
+    _trial_order = NULL;
+    delete[] _nselected;
+    _nselected = NULL;
     _max_index.store(-1, butil::memory_order_relaxed);
     _capacity = 0;
 }
@@ -382,6 +583,16 @@ int InputMessenger::AddHandler(const InputMessageHandler& handler) {
         }
         memset(_handlers, 0, sizeof(*_handlers) * _capacity);
         _non_protocol = false;
+        _trial_order = new (std::nothrow) butil::atomic<int>[_capacity];
+        _nselected = new (std::nothrow) butil::atomic<int64_t>[_capacity];
+        if (NULL == _trial_order || NULL == _nselected) {
+            LOG(FATAL) << "Fail to new arrays for sorting protocols";
+            return -1;
+        }
+        for (size_t i = 0; i < _capacity; ++i) {
+            _trial_order[i].store(-1, butil::memory_order_relaxed);
+            _nselected[i].store(0, butil::memory_order_relaxed);
+        }
     }
     if (_non_protocol) {
         CHECK(false) << "AddNonProtocolHandler was invoked";
@@ -406,12 +617,75 @@ int InputMessenger::AddHandler(const InputMessageHandler& handler) {
         CHECK(_handlers[index].process == handler.process);
         return -1;
     }
+    const int max_index =
+        std::max(index, _max_index.load(butil::memory_order_relaxed));
+    {
+        BAIDU_SCOPED_LOCK(_sort_mutex);
+        SortTrialOrder(max_index);
+    }
     if (index > _max_index.load(butil::memory_order_relaxed)) {
         _max_index.store(index, butil::memory_order_release);
     }
     return 0;
 }
 
+void InputMessenger::OnProtocolSelected(int n) {
+    _nselected[n].fetch_add(1, butil::memory_order_relaxed);
+    if (_nselected_total.fetch_add(1, butil::memory_order_relaxed)
+        % PROTOCOL_SORTING_INTERVAL == PROTOCOL_SORTING_INTERVAL - 1) {
+        // Skip sorting if another thread is doing it.
+        if (_sort_mutex.try_lock()) {
+            SortTrialOrder(_max_index.load(butil::memory_order_acquire));
+            _sort_mutex.unlock();
+        }
+    }
+}
+
+void InputMessenger::SortTrialOrder(int max_index) {
+    // (-count, index): more selected first, then lower index first.
+    std::vector<std::pair<int64_t, int> > order;
+    order.reserve(max_index + 1);
+    for (int i = 0; i <= max_index; ++i) {
+        if (_handlers[i].parse != NULL) {
+            order.push_back(std::make_pair(
+                -_nselected[i].load(butil::memory_order_relaxed), i));
+        }
+    }
+    std::sort(order.begin(), order.end());
+    for (int k = 0; k <= max_index; ++k) {
+        _trial_order[k].store(k < (int)order.size() ? order[k].second : -1,
+                              butil::memory_order_relaxed);
+    }
+}
+
+int64_t InputMessenger::SelectedCountOfProtocol(int n) const {
+    if (_nselected == NULL || n < 0 || n >= (int)_capacity) {
+        return 0;
+    }
+    return _nselected[n].load(butil::memory_order_relaxed);
+}
+
+void InputMessenger::PrintSelectedProtocols(std::ostream& os) const {
+    if (_nselected == NULL) {
+        return;
+    }
+    std::vector<std::pair<int64_t, int> > order;
+    const int max_index = _max_index.load(butil::memory_order_acquire);
+    for (int i = 0; i <= max_index; ++i) {
+        const int64_t n = _nselected[i].load(butil::memory_order_relaxed);
+        if (n > 0 && _handlers[i].name != NULL) {
+            order.push_back(std::make_pair(-n, i));
+        }
+    }
+    std::sort(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (i != 0) {
+            os << ' ';
+        }
+        os << _handlers[order[i].second].name << ':' << -order[i].first;
+    }
+}
+
 int InputMessenger::AddNonProtocolHandler(const InputMessageHandler& handler) {
     if (handler.parse == NULL || handler.process == NULL 
             || handler.name == NULL) {
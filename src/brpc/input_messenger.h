@@ -96,6 +96,14 @@ public:
     // Get name of the n-th handler
     const char* NameOfProtocol(int n) const;
 
+    // Number of times that the n-th handler was chosen by connections
+    // trying protocols(new connections at server-side generally).
+    int64_t SelectedCountOfProtocol(int n) const;
+
+    // Print "name:count" of handlers ever selected, separated by spaces and
+    // in descending order of the counts.
+    void PrintSelectedProtocols(std::ostream& os) const;
+
     // Add a handler which doesn't belong to any registered protocol.
     // Note: Invoking this method indicates that you are using Socket without
     // Channel nor Server. 
@@ -107,10 +115,24 @@ protected:
     static void OnNewMessages(Socket* m);
     
 private:
+    // Bytes to read from `m' in one DoRead.
+    static size_t GetOnceReadSize(Socket* m);
+
+    // Poll m->fd() in user space until it's readable or -socket_busy_poll_us
+    // elapsed since last read. Returns true if readable.
+    static bool BusyPoll(Socket* m);
+
     // Find a valid scissor from `handlers' to cut off `header' and `payload'
     // from m->read_buf, save index of the scissor into `index'.
     ParseResult CutInputMessage(Socket* m, size_t* index, bool read_eof);
 
+    // Count the selection of the n-th handler and re-sort _trial_order
+    // periodically.
+    void OnProtocolSelected(int n);
+    // Sort handlers in [0, max_index] by times being selected into
+    // _trial_order. _sort_mutex must be held.
+    void SortTrialOrder(int max_index);
+
     // User-supplied scissors and handlers.
     // the index of handler is exactly the same as the protocol
     InputMessageHandler* _handlers;
@@ -119,7 +141,15 @@ private:
     bool _non_protocol;
     size_t _capacity;
 
+    // Indexes of handlers in descending order of being selected, tried before
+    // others when -sort_protocols_by_frequency is on. Entries may be stale
+    // while being re-sorted, handlers missing from it are tried afterwards.
+    butil::atomic<int>* _trial_order;
+    butil::atomic<int64_t>* _nselected;
+    butil::atomic<int64_t> _nselected_total;
+
     butil::Mutex _add_handler_mutex;
+    butil::Mutex _sort_mutex;
 };
 
 // Get the global InputMessenger at client-side.
@@ -874,4 +874,39 @@ bool MemcacheResponse::PopVersion(std::string* version) {
     return true;
 }
  
+MemcacheService::Status MemcacheService::Get(
+    const butil::StringPiece&, butil::IOBuf*, uint32_t*, uint64_t*) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
+MemcacheService::Status MemcacheService::Store(
+    StoreOperation, const butil::StringPiece&, const butil::IOBuf&,
+    uint32_t, uint32_t, uint64_t, uint64_t*) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
+MemcacheService::Status MemcacheService::Delete(
+    const butil::StringPiece&, uint64_t) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
+MemcacheService::Status MemcacheService::Counter(
+    bool, const butil::StringPiece&, uint64_t, uint64_t, uint32_t,
+    uint64_t*, uint64_t*) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
+MemcacheService::Status MemcacheService::Touch(
+    const butil::StringPiece&, uint32_t) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
+MemcacheService::Status MemcacheService::Flush(uint32_t) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
+MemcacheService::Status MemcacheService::Version(std::string*) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
 } // namespace brpc
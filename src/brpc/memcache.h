@@ -111,6 +111,8 @@ protected:
     ::google::protobuf::Metadata GetMetadata() const override;
     
 private:
+friend class MemcacheCoalescingChannel;
+
     bool GetOrDelete(uint8_t command, const butil::StringPiece& key);
     bool Counter(uint8_t command, const butil::StringPiece& key, uint64_t delta,
                  uint64_t initial_value, uint32_t exptime);
@@ -233,6 +235,66 @@ private:
     mutable int _cached_size_;
 };
 
+// Process memcache binary protocol in brpc servers. Set an instance to
+// ServerOptions.memcache_service and override methods of the operations
+// to support, others are answered with STATUS_UNKNOWN_COMMAND.
+// Operations from one connection are called one by one in the order that
+// they arrive, just like what memcached does. Quiet variants of operations
+// (GETQ, SETQ...) and NOOP are handled by brpc.
+// Example:
+//   class MyMemcacheService : public brpc::MemcacheService {
+//   public:
+//       Status Get(const butil::StringPiece& key, butil::IOBuf* value,
+//                  uint32_t* flags, uint64_t* cas_value) {
+//           ...
+//           return MemcacheResponse::STATUS_SUCCESS;
+//       }
+//   };
+//   brpc::ServerOptions options;
+//   options.memcache_service = new MyMemcacheService;
+class MemcacheService {
+public:
+    typedef MemcacheResponse::Status Status;
+
+    enum StoreOperation {
+        STORE_SET,
+        STORE_ADD,
+        STORE_REPLACE,
+        STORE_APPEND,
+        STORE_PREPEND
+    };
+
+    virtual ~MemcacheService() {}
+
+    // Fill `value', `flags' and `cas_value' of `key'.
+    // Return STATUS_KEY_ENOENT when the key does not exist.
+    virtual Status Get(const butil::StringPiece& key, butil::IOBuf* value,
+                       uint32_t* flags, uint64_t* cas_value);
+
+    // Store `value' of `key' according to `op'. If `cas_value' is non-zero,
+    // the operation must only succeed when the cas of the item matches.
+    // Set `new_cas_value' to cas of the stored item.
+    virtual Status Store(StoreOperation op, const butil::StringPiece& key,
+                         const butil::IOBuf& value, uint32_t flags,
+                         uint32_t exptime, uint64_t cas_value,
+                         uint64_t* new_cas_value);
+
+    virtual Status Delete(const butil::StringPiece& key, uint64_t cas_value);
+
+    // INCREMENT or DECREMENT the counter at `key' by `delta'. The counter is
+    // created with `initial_value' if it does not exist.
+    virtual Status Counter(bool increment, const butil::StringPiece& key,
+                           uint64_t delta, uint64_t initial_value,
+                           uint32_t exptime, uint64_t* new_value,
+                           uint64_t* new_cas_value);
+
+    virtual Status Touch(const butil::StringPiece& key, uint32_t exptime);
+
+    virtual Status Flush(uint32_t exptime);
+
+    virtual Status Version(std::string* version);
+};
+
 } // namespace brpc
 
 
@@ -0,0 +1,381 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <algorithm>
+#include <unordered_map>
+#include "butil/logging.h"
+#include "butil/sys_byteorder.h"
+#include "butil/time.h"
+#include "bthread/bthread.h"
+#include "bthread/unstable.h"                      // bthread_timer_add
+#include "bthread/countdown_event.h"
+#include "brpc/callback.h"
+#include "brpc/controller.h"
+#include "brpc/policy/memcache_binary_header.h"
+#include "brpc/memcache_coalescing_channel.h"
+
+
+namespace brpc {
+
+MemcacheCoalescingChannelOptions::MemcacheCoalescingChannelOptions()
+    : window_us(200)
+    , max_batch_size(64) {}
+
+struct MemcacheCoalescingChannel::Batch {
+    struct Waiter {
+        Controller* cntl;
+        MemcacheResponse* response;
+        google::protobuf::Closure* done;
+        size_t key_index;
+    };
+
+    explicit Batch(MemcacheCoalescingChannel* c)
+        : channel(c)
+        , has_request_code(false)
+        , request_code(0)
+        , timer(0)
+        , has_timer(false)
+        , detached(false)
+        , nref(2) {}
+
+    void RemoveRef() {
+        if (nref.fetch_sub(1, butil::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    MemcacheCoalescingChannel* channel;
+    bool has_request_code;
+    uint64_t request_code;
+    bthread_timer_t timer;
+    bool has_timer;
+    // Protected by channel->_mutex.
+    bool detached;
+    // One reference for the window timer, the other for sending.
+    butil::atomic<int> nref;
+    // Distinct keys, index of a key is used as opaque of its GETKQ.
+    std::vector<std::string> keys;
+    std::unordered_map<std::string, size_t> key_index;
+    std::vector<Waiter> waiters;
+
+    Controller cntl;
+    MemcacheRequest request;
+    MemcacheResponse response;
+};
+
+namespace {
+
+class SyncClosure : public google::protobuf::Closure {
+public:
+    void Run() { _event.signal(); }
+    void wait() { _event.wait(); }
+private:
+    bthread::CountdownEvent _event;
+};
+
+// Returns true and sets `key' if `request' contains exactly one GET.
+bool IsSingleGet(const MemcacheRequest& request, std::string* key) {
+    if (request.pipelined_count() != 1) {
+        return false;
+    }
+    const butil::IOBuf& buf = request.raw_buffer();
+    policy::MemcacheRequestHeader header;
+    if (buf.copy_to(&header, sizeof(header)) != sizeof(header) ||
+        header.command != (uint8_t)policy::MC_BINARY_GET ||
+        header.extras_length != 0) {
+        return false;
+    }
+    const uint16_t key_length = butil::NetToHost16(header.key_length);
+    if (butil::NetToHost32(header.total_body_length) != key_length ||
+        buf.size() != sizeof(header) + key_length) {
+        return false;
+    }
+    key->clear();
+    buf.copy_to(key, key_length, sizeof(header));
+    return true;
+}
+
+// Convert response of GETKQ in `msg' to response of GET.
+void ToGetResponse(butil::IOBuf* msg, butil::IOBuf* out) {
+    policy::MemcacheResponseHeader header;
+    msg->cutn(&header, sizeof(header));
+    butil::IOBuf extras;
+    msg->cutn(&extras, header.extras_length);
+    msg->pop_front(header.key_length);
+    header.command = policy::MC_BINARY_GET;
+    header.total_body_length -= header.key_length;
+    header.key_length = 0;
+    header.opaque = 0;
+    // Headers in MemcacheResponse are in host byte order.
+    out->append(&header, sizeof(header));
+    out->append(extras);
+    out->append(*msg);
+}
+
+void MissingGetResponse(butil::IOBuf* out) {
+    const char* msg = MemcacheResponse::status_str(
+        MemcacheResponse::STATUS_KEY_ENOENT);
+    const policy::MemcacheResponseHeader header = {
+        policy::MC_MAGIC_RESPONSE,
+        policy::MC_BINARY_GET,
+        0,
+        0,
+        policy::MC_BINARY_RAW_BYTES,
+        MemcacheResponse::STATUS_KEY_ENOENT,
+        (uint32_t)strlen(msg),
+        0,
+        0
+    };
+    out->append(&header, sizeof(header));
+    out->append(msg);
+}
+
+} // namespace
+
+MemcacheCoalescingChannel::MemcacheCoalescingChannel()
+    : _sub_channel(NULL)
+    , _ownership(DOESNT_OWN_CHANNEL)
+    , _default_batch(NULL) {}
+
+MemcacheCoalescingChannel::~MemcacheCoalescingChannel() {
+    if (_ownership == OWNS_CHANNEL) {
+        delete _sub_channel;
+    }
+    _sub_channel = NULL;
+}
+
+int MemcacheCoalescingChannel::Init(
+    ChannelBase* sub_channel, ChannelOwnership ownership,
+    const MemcacheCoalescingChannelOptions* options) {
+    if (sub_channel == NULL) {
+        LOG(ERROR) << "Param[sub_channel] is NULL";
+        return -1;
+    }
+    if (_sub_channel != NULL) {
+        LOG(ERROR) << "Already initialized";
+        return -1;
+    }
+    if (options) {
+        _options = *options;
+    }
+    if (_options.max_batch_size <= 0) {
+        LOG(ERROR) << "Invalid max_batch_size=" << _options.max_batch_size;
+        return -1;
+    }
+    _sub_channel = sub_channel;
+    _ownership = ownership;
+    return 0;
+}
+
+void MemcacheCoalescingChannel::CallMethod(
+    const google::protobuf::MethodDescriptor* method,
+    google::protobuf::RpcController* controller,
+    const google::protobuf::Message* request,
+    google::protobuf::Message* response,
+    google::protobuf::Closure* done) {
+    std::string key;
+    if (_options.window_us <= 0 || request == NULL || response == NULL ||
+        request->GetDescriptor() != MemcacheRequest::descriptor() ||
+        response->GetDescriptor() != MemcacheResponse::descriptor() ||
+        !IsSingleGet(*static_cast<const MemcacheRequest*>(request), &key)) {
+        return _sub_channel->CallMethod(method, controller, request, response, done);
+    }
+    Controller* cntl = static_cast<Controller*>(controller);
+    MemcacheResponse* mr = static_cast<MemcacheResponse*>(response);
+    if (done) {
+        return Enqueue(cntl, key, mr, done);
+    }
+    SyncClosure sync_done;
+    Enqueue(cntl, key, mr, &sync_done);
+    sync_done.wait();
+}
+
+void MemcacheCoalescingChannel::Enqueue(Controller* cntl, const std::string& key,
+                                        MemcacheResponse* response,
+                                        google::protobuf::Closure* done) {
+    Batch* full_batch = NULL;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        Batch** slot = (cntl->has_request_code() ?
+                        &_batches[cntl->request_code()] : &_default_batch);
+        Batch* b = *slot;
+        if (b == NULL) {
+            b = new Batch(this);
+            b->has_request_code = cntl->has_request_code();
+            b->request_code = cntl->request_code();
+            b->has_timer = (bthread_timer_add(
+                                &b->timer, butil::microseconds_from_now(_options.window_us),
+                                OnWindowTimer, b) == 0);
+            LOG_IF(WARNING, !b->has_timer) << "Fail to add timer, send the GET directly";
+            *slot = b;
+        }
+        std::pair<std::unordered_map<std::string, size_t>::iterator, bool> ret =
+            b->key_index.insert(std::make_pair(key, b->keys.size()));
+        if (ret.second) {
+            b->keys.push_back(key);
+        }
+        Batch::Waiter w = { cntl, response, done, ret.first->second };
+        b->waiters.push_back(w);
+        if ((int)b->waiters.size() >= _options.max_batch_size || !b->has_timer) {
+            Detach(b);
+            full_batch = b;
+        }
+    }
+    if (full_batch) {
+        // Release the reference of the timer if it's cancelled before running,
+        // otherwise the timer releases the reference after seeing the batch
+        // being detached.
+        if (!full_batch->has_timer || bthread_timer_del(full_batch->timer) == 0) {
+            full_batch->RemoveRef();
+        }
+        Flush(full_batch);
+    }
+}
+
+bool MemcacheCoalescingChannel::Detach(Batch* b) {
+    if (b->detached) {
+        return false;
+    }
+    b->detached = true;
+    if (b->has_request_code) {
+        _batches.erase(b->request_code);
+    } else {
+        _default_batch = NULL;
+    }
+    return true;
+}
+
+void MemcacheCoalescingChannel::OnWindowTimer(void* arg) {
+    // Don't send RPC in the timer thread.
+    bthread_t th;
+    if (bthread_start_background(&th, NULL, RunWindowTimer, arg) != 0) {
+        LOG(ERROR) << "Fail to start bthread";
+        RunWindowTimer(arg);
+    }
+}
+
+void* MemcacheCoalescingChannel::RunWindowTimer(void* arg) {
+    Batch* b = static_cast<Batch*>(arg);
+    MemcacheCoalescingChannel* c = b->channel;
+    bool detached = false;
+    {
+        BAIDU_SCOPED_LOCK(c->_mutex);
+        detached = c->Detach(b);
+    }
+    if (detached) {
+        c->Flush(b);
+    }
+    b->RemoveRef();
+    return NULL;
+}
+
+void MemcacheCoalescingChannel::Flush(Batch* b) {
+    butil::IOBuf& buf = b->request.raw_buffer();
+    for (size_t i = 0; i < b->keys.size(); ++i) {
+        const std::string& key = b->keys[i];
+        const policy::MemcacheRequestHeader header = {
+            policy::MC_MAGIC_REQUEST,
+            policy::MC_BINARY_GETKQ,
+            butil::HostToNet16(key.size()),
+            0,
+            policy::MC_BINARY_RAW_BYTES,
+            0,
+            butil::HostToNet32(key.size()),
+            butil::HostToNet32(i),
+            0
+        };
+        buf.append(&header, sizeof(header));
+        buf.append(key);
+    }
+    const policy::MemcacheRequestHeader noop = {
+        policy::MC_MAGIC_REQUEST,
+        policy::MC_BINARY_NOOP,
+        0, 0, policy::MC_BINARY_RAW_BYTES, 0, 0, 0, 0
+    };
+    buf.append(&noop, sizeof(noop));
+    // Only NOOP is always responded.
+    b->request._pipelined_count = 1;
+
+    int64_t timeout_ms = -1;
+    for (size_t i = 0; i < b->waiters.size(); ++i) {
+        const int64_t t = b->waiters[i].cntl->timeout_ms();
+        if (t == UNSET_MAGIC_NUM) {
+            // Use timeout of the sub channel.
+            timeout_ms = UNSET_MAGIC_NUM;
+            break;
+        }
+        timeout_ms = std::max(timeout_ms, t);
+    }
+    if (timeout_ms != UNSET_MAGIC_NUM) {
+        b->cntl.set_timeout_ms(timeout_ms);
+    }
+    if (b->has_request_code) {
+        b->cntl.set_request_code(b->request_code);
+    }
+    _sub_channel->CallMethod(NULL, &b->cntl, &b->request, &b->response,
+                             NewCallback(this, &MemcacheCoalescingChannel::OnBatchDone, b));
+}
+
+void MemcacheCoalescingChannel::OnBatchDone(Batch* b) {
+    std::vector<butil::IOBuf> hits(b->keys.size());
+    if (!b->cntl.Failed()) {
+        // Responses of hit GETKQs followed by the one of NOOP.
+        butil::IOBuf& buf = b->response.raw_buffer();
+        policy::MemcacheResponseHeader header;
+        while (buf.copy_to(&header, sizeof(header)) == sizeof(header)) {
+            butil::IOBuf msg;
+            buf.cutn(&msg, sizeof(header) + header.total_body_length);
+            if (header.command == policy::MC_BINARY_GETKQ &&
+                header.opaque < hits.size()) {
+                hits[header.opaque].swap(msg);
+            }
+        }
+    }
+    for (size_t i = 0; i < b->waiters.size(); ++i) {
+        const Batch::Waiter& w = b->waiters[i];
+        if (b->cntl.Failed()) {
+            w.cntl->SetFailed(b->cntl.ErrorCode(), "%s", b->cntl.ErrorText().c_str());
+        } else {
+            butil::IOBuf& out = w.response->raw_buffer();
+            out.clear();
+            if (hits[w.key_index].empty()) {
+                MissingGetResponse(&out);
+            } else {
+                // Waiters of a same key share the value.
+                butil::IOBuf msg = hits[w.key_index];
+                ToGetResponse(&msg, &out);
+            }
+        }
+        w.done->Run();
+    }
+    b->RemoveRef();
+}
+
+void MemcacheCoalescingChannel::Describe(
+    std::ostream& os, const DescribeOptions& options) const {
+    os << "MemcacheCoalescing[";
+    if (_sub_channel) {
+        _sub_channel->Describe(os, options);
+    }
+    os << ']';
+}
+
+int MemcacheCoalescingChannel::CheckHealth() {
+    return _sub_channel ? _sub_channel->CheckHealth() : -1;
+}
+
+} // namespace brpc
@@ -0,0 +1,105 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_MEMCACHE_COALESCING_CHANNEL_H
+#define BRPC_MEMCACHE_COALESCING_CHANNEL_H
+
+#include <map>
+#include "butil/synchronization/lock.h"
+#include "brpc/channel.h"
+#include "brpc/memcache.h"
+
+
+namespace brpc {
+
+struct MemcacheCoalescingChannelOptions {
+    // Constructed with default values.
+    MemcacheCoalescingChannelOptions();
+
+    // GETs issued within so many microseconds since the first one of a batch
+    // are sent together. Non-positive value disables coalescing.
+    // Default: 200
+    int64_t window_us;
+
+    // The batch is sent immediately when it has so many GETs.
+    // Default: 64
+    int max_batch_size;
+};
+
+// Coalesce concurrent single-GET MemcacheRequests into one request of quiet
+// multi-get(GETKQ...GETKQ NOOP) to cut the per-key overhead on both sides.
+// Misses cost nothing on the wire. Each caller still gets its own
+// MemcacheResponse as if the GET was sent alone. Other requests (SET,
+// pipelined operations...) are passed to the sub channel directly.
+// GETs are grouped by request_code of the controller, thus GETs to the same
+// server of a consistent-hashing cluster are coalesced as long as the
+// request_code is set to the hash of the key as usual.
+// NOTE: Callers of one batch share the timeout of the batched call, which is
+// the largest timeout among them. Fields of the controller other than the
+// error and timeout (e.g. remote_side) are not filled.
+class MemcacheCoalescingChannel : public ChannelBase {
+public:
+    MemcacheCoalescingChannel();
+    ~MemcacheCoalescingChannel();
+
+    // Coalesce GETs to `sub_channel' which must be a channel of
+    // PROTOCOL_MEMCACHE. `sub_channel' is deleted in destructor of this
+    // channel when `ownership' is OWNS_CHANNEL.
+    // This channel must not be destroyed before all RPCs finish.
+    // Returns 0 on success, -1 otherwise.
+    int Init(ChannelBase* sub_channel, ChannelOwnership ownership,
+             const MemcacheCoalescingChannelOptions* options);
+
+    void CallMethod(const google::protobuf::MethodDescriptor* method,
+                    google::protobuf::RpcController* controller,
+                    const google::protobuf::Message* request,
+                    google::protobuf::Message* response,
+                    google::protobuf::Closure* done);
+
+    void Describe(std::ostream&, const DescribeOptions&) const;
+
+    int CheckHealth();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MemcacheCoalescingChannel);
+
+    struct Batch;
+
+    static void OnWindowTimer(void* arg);
+    static void* RunWindowTimer(void* arg);
+    void Enqueue(Controller* cntl, const std::string& key,
+                 MemcacheResponse* response,
+                 google::protobuf::Closure* done);
+    // Remove `b' from _batches. Returns false if it was removed before.
+    bool Detach(Batch* b);
+    void Flush(Batch* b);
+    void OnBatchDone(Batch* b);
+
+    ChannelBase* _sub_channel;
+    ChannelOwnership _ownership;
+    MemcacheCoalescingChannelOptions _options;
+    butil::Mutex _mutex;
+    // Open batches indexed by request_code, GETs without request_code
+    // share _default_batch.
+    std::map<uint64_t, Batch*> _batches;
+    Batch* _default_batch;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_MEMCACHE_COALESCING_CHANNEL_H
@@ -24,8 +24,10 @@
 #include "butil/time.h"
 #include "butil/iobuf.h"                         // butil::IOBuf
 #include "butil/raw_pack.h"                      // RawPacker RawUnpacker
+#include "butil/synchronization/lock.h"
 #include "brpc/controller.h"                    // Controller
 #include "brpc/socket.h"                        // Socket
+#include "brpc/udp_transport.h"                 // IsServerDatagramSocket
 #include "brpc/server.h"                        // Server
 #include "brpc/span.h"
 #include "brpc/compress.h"                      // ParseFromCompressedData
@@ -38,6 +40,7 @@
 #include "brpc/details/usercode_backup_pool.h"
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/details/server_private_accessor.h"
+#include "brpc/reloadable_flags.h"
 
 extern "C" {
 void bthread_assign_data(void* data);
@@ -45,18 +48,214 @@ void bthread_assign_data(void* data);
 
 
 namespace brpc {
+
+DECLARE_bool(adaptive_response_compression);
+
 namespace policy {
 
 DEFINE_bool(baidu_protocol_use_fullname, true,
             "If this flag is true, baidu_std puts service.full_name in requests"
             ", otherwise puts service.name (required by jprotobuf).");
 
+DEFINE_int32(baidu_std_response_coalesce_us, 0,
+             "If positive, a response written to an idle connection waits at "
+             "most so many microseconds for responses completing meanwhile "
+             "and all of them are written in one syscall. Responses are "
+             "always combined when a write is in flight. See bvar "
+             "rpc_socket_write_batch_size for the average number of messages "
+             "per write");
+BRPC_VALIDATE_GFLAG(baidu_std_response_coalesce_us, NonNegativeInteger);
+
+DEFINE_bool(baidu_std_compact_meta, false,
+            "Intern methods as ids on single connections and send requests "
+            "in compact meta which is much cheaper to pack and parse than "
+            "protobuf. Servers not supporting compact meta are not affected");
+BRPC_VALIDATE_GFLAG(baidu_std_compact_meta, PassValidate);
+
 // Notes:
 // 1. 12-byte header [PRPC][body_size][meta_size]
 // 2. body_size and meta_size are in network byte order
 // 3. Use service->full_name() + method_name to specify the method to call
 // 4. `attachment_size' is set iff request/response has attachment
 // 5. Not supported: chunk_info
+//
+// Compact meta (-baidu_std_compact_meta):
+// 1. Client asks the server to intern a method as an id of the connection
+//    by setting RpcRequestMeta.compact_method_id in protobuf meta. Server
+//    responds all requests of the connection in compact meta since then.
+// 2. Server sets COMPACT_METHOD_INTERNED in compact responses to requests
+//    of interned methods. Receiving such a response, the client knows that
+//    the id is interned and sends requests of the method in compact meta.
+//    Servers not knowing compact_method_id never respond compact meta, so
+//    the client keeps using protobuf meta.
+// 3. Compact meta starts with 0 which is never the first byte of serialized
+//    RpcMeta(field number 0 is invalid), followed by fixed-size fields in
+//    network byte order and optionally a RpcMeta with less common fields
+//    (trace ids, authentication_data, stream_settings, error_text...):
+//      request:  [0][flags][compress_type][0][method_id:4]
+//                [correlation_id:8][log_id:8][attachment_size:4]
+//      response: [0][flags][compress_type][0][error_code:4]
+//                [correlation_id:8][attachment_size:4]
+// 4. Client assigns ids to methods in protocol_context of the socket and
+//    never reuses them. Confirmations are tagged with the connection epoch
+//    and negotiated again after reconnection. Server binds an id to the
+//    first method interned as it in parsing_context of the connection.
+//    Pooled and short connections always use protobuf meta.
+static const size_t COMPACT_REQUEST_META_SIZE = 28;
+static const size_t COMPACT_RESPONSE_META_SIZE = 20;
+static const uint8_t COMPACT_HAS_LOG_ID = 1;
+static const uint8_t COMPACT_HAS_ATTACHMENT_SIZE = 2;
+static const uint8_t COMPACT_METHOD_INTERNED = 4;
+static const uint32_t COMPACT_MAX_METHODS = 256;
+
+// [Client] Ids of methods called through a socket.
+class CompactMetaClientContext : public Destroyable {
+public:
+    CompactMetaClientContext() : _nmethod(0) {
+        for (uint32_t i = 0; i < COMPACT_MAX_METHODS; ++i) {
+            _methods[i].store(NULL, butil::memory_order_relaxed);
+            _confirmed_epoch[i].store(0, butil::memory_order_relaxed);
+        }
+    }
+
+    void Destroy() { delete this; }
+
+    // Get id of `method', assign one if absent. *confirmed is set to true
+    // if the server of connection `epoch' is known to have interned the id.
+    // Returns -1 when ids are used up.
+    int GetOrAssignId(const void* method, uint32_t epoch, bool* confirmed) {
+        int id = FindId(method);
+        if (id < 0) {
+            BAIDU_SCOPED_LOCK(_mutex);
+            id = FindId(method);
+            if (id < 0) {
+                const uint32_t n = _nmethod.load(butil::memory_order_relaxed);
+                if (n >= COMPACT_MAX_METHODS) {
+                    return -1;
+                }
+                _methods[n].store(method, butil::memory_order_relaxed);
+                _nmethod.store(n + 1, butil::memory_order_release);
+                id = n;
+            }
+        }
+        *confirmed = (_confirmed_epoch[id].load(butil::memory_order_relaxed)
+                      == epoch);
+        return id;
+    }
+
+    // Mark id of `method' as interned by the server of connection `epoch'.
+    void Confirm(const void* method, uint32_t epoch) {
+        const int id = FindId(method);
+        if (id >= 0) {
+            _confirmed_epoch[id].store(epoch, butil::memory_order_relaxed);
+        }
+    }
+
+private:
+    int FindId(const void* method) const {
+        const uint32_t n = _nmethod.load(butil::memory_order_acquire);
+        for (uint32_t i = 0; i < n; ++i) {
+            if (_methods[i].load(butil::memory_order_relaxed) == method) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // Serializes assignments of ids.
+    butil::Mutex _mutex;
+    butil::atomic<uint32_t> _nmethod;
+    butil::atomic<const void*> _methods[COMPACT_MAX_METHODS];
+    // Epochs start from 1, 0 means not confirmed.
+    butil::atomic<uint32_t> _confirmed_epoch[COMPACT_MAX_METHODS];
+};
+
+// [Server] Methods interned on an accepted connection.
+class CompactMetaServerContext : public Destroyable {
+public:
+    CompactMetaServerContext() : _max_id(-1) {
+        for (uint32_t i = 0; i < COMPACT_MAX_METHODS; ++i) {
+            _methods[i].store(NULL, butil::memory_order_relaxed);
+        }
+    }
+
+    void Destroy() { delete this; }
+
+    // Intern `mp' as `id'. An id is never rebound to another method, in
+    // case requests interning it are processed out of order.
+    // Returns true if `id' is bound to `mp'.
+    bool Register(uint32_t id, const Server::MethodProperty* mp) {
+        if (id >= COMPACT_MAX_METHODS) {
+            return false;
+        }
+        const Server::MethodProperty* expected = NULL;
+        if (!_methods[id].compare_exchange_strong(
+                expected, mp, butil::memory_order_release,
+                butil::memory_order_acquire)) {
+            return expected == mp;
+        }
+        int max_id = _max_id.load(butil::memory_order_relaxed);
+        while ((int)id > max_id &&
+               !_max_id.compare_exchange_weak(max_id, id,
+                                              butil::memory_order_release,
+                                              butil::memory_order_relaxed)) {}
+        return true;
+    }
+
+    // Get the method interned as `id', NULL if absent.
+    const Server::MethodProperty* Find(uint32_t id) const {
+        if (id >= COMPACT_MAX_METHODS) {
+            return NULL;
+        }
+        return _methods[id].load(butil::memory_order_acquire);
+    }
+
+    // True if `method' is interned. Ids are assigned by the client in
+    // order, thus only a few are checked.
+    bool IsInterned(const google::protobuf::MethodDescriptor* method) const {
+        const int max_id = _max_id.load(butil::memory_order_acquire);
+        for (int i = 0; i <= max_id; ++i) {
+            const Server::MethodProperty* mp =
+                _methods[i].load(butil::memory_order_acquire);
+            if (mp != NULL && mp->method == method) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    butil::atomic<int> _max_id;
+    butil::atomic<const Server::MethodProperty*> _methods[COMPACT_MAX_METHODS];
+};
+
+// Get CompactMetaClientContext in protocol_context of `s', create one if
+// absent. Returns NULL if the context belongs to another protocol.
+static CompactMetaClientContext* GetCompactMetaClientContext(Socket* s) {
+    Destroyable* ctx = s->protocol_context();
+    if (ctx == NULL) {
+        ctx = new CompactMetaClientContext;
+        if (s->initialize_protocol_context(&ctx)) {
+            return static_cast<CompactMetaClientContext*>(ctx);
+        }
+    }
+    return dynamic_cast<CompactMetaClientContext*>(ctx);
+}
+
+// Get CompactMetaServerContext in parsing_context of `s', create one if
+// `create' is true and the parsing_context is not set yet. Returns NULL if
+// absent or the context belongs to another protocol.
+static CompactMetaServerContext* GetCompactMetaServerContext(Socket* s,
+                                                             bool create) {
+    Destroyable* ctx = s->parsing_context();
+    if (ctx == NULL && create) {
+        ctx = new CompactMetaServerContext;
+        if (s->initialize_parsing_context(&ctx)) {
+            return static_cast<CompactMetaServerContext*>(ctx);
+        }
+    }
+    return dynamic_cast<CompactMetaServerContext*>(ctx);
+}
 
 // Pack header into `buf'
 inline void PackRpcHeader(char* rpc_header, int meta_size, int payload_size) {
@@ -89,6 +288,79 @@ static void SerializeRpcHeaderAndMeta(
     }
 }
 
+// Pack header and compact meta into `out'. `extra' holds fields not in the
+// fixed part and is appended when it's not empty.
+static void SerializeRpcHeaderAndCompactMeta(
+    butil::IOBuf* out, const char* fixed, size_t fixed_size,
+    const RpcMeta& extra, int payload_size) {
+    const int extra_size = extra.ByteSize();
+    char header_and_fixed[12 + COMPACT_REQUEST_META_SIZE];
+    PackRpcHeader(header_and_fixed, fixed_size + extra_size, payload_size);
+    memcpy(header_and_fixed + 12, fixed, fixed_size);
+    out->append(header_and_fixed, 12 + fixed_size);
+    if (extra_size > 0) {
+        butil::IOBufAsZeroCopyOutputStream buf_stream(out);
+        ::google::protobuf::io::CodedOutputStream coded_out(&buf_stream);
+        extra.SerializeWithCachedSizes(&coded_out);
+        CHECK(!coded_out.HadError());
+    }
+}
+
+// Parse `buf' in either protobuf or compact format into `meta'. *compact
+// is set to true if the meta is compact, in which case *flags is set to
+// the flags of compact meta and *method_id is set to the interned id of
+// the method for a request.
+static bool ParseRpcMeta(const butil::IOBuf& buf, bool is_request,
+                         RpcMeta* meta, bool* compact, uint8_t* flags,
+                         uint32_t* method_id) {
+    const void* first_byte = buf.fetch1();
+    if (first_byte == NULL || *(const char*)first_byte != 0) {
+        *compact = false;
+        return ParsePbFromIOBuf(meta, buf);
+    }
+    *compact = true;
+    char fixed[COMPACT_REQUEST_META_SIZE];
+    const size_t fixed_size = (is_request ? COMPACT_REQUEST_META_SIZE
+                               : COMPACT_RESPONSE_META_SIZE);
+    if (buf.copy_to(fixed, fixed_size) != fixed_size) {
+        return false;
+    }
+    if (buf.size() > fixed_size) {
+        butil::IOBuf extra;
+        buf.append_to(&extra, (size_t)-1L, fixed_size);
+        butil::IOBufAsZeroCopyInputStream stream(extra);
+        // Required names of RpcRequestMeta are absent.
+        if (!meta->ParsePartialFromZeroCopyStream(&stream)) {
+            return false;
+        }
+    }
+    *flags = fixed[1];
+    meta->set_compress_type((uint8_t)fixed[2]);
+    uint64_t correlation_id = 0;
+    uint32_t attachment_size = 0;
+    if (is_request) {
+        uint64_t log_id = 0;
+        butil::RawUnpacker(fixed + 4).unpack32(*method_id)
+            .unpack64(correlation_id).unpack64(log_id)
+            .unpack32(attachment_size);
+        if (*flags & COMPACT_HAS_LOG_ID) {
+            meta->mutable_request()->set_log_id(log_id);
+        }
+    } else {
+        uint32_t error_code = 0;
+        butil::RawUnpacker(fixed + 4).unpack32(error_code)
+            .unpack64(correlation_id).unpack32(attachment_size);
+        if (error_code != 0) {
+            meta->mutable_response()->set_error_code((int32_t)error_code);
+        }
+    }
+    meta->set_correlation_id(correlation_id);
+    if (*flags & COMPACT_HAS_ATTACHMENT_SIZE) {
+        meta->set_attachment_size(attachment_size);
+    }
+    return true;
+}
+
 ParseResult ParseRpcMessage(butil::IOBuf* source, Socket* socket,
                             bool /*read_eof*/, const void*) {
     char header_buf[12];
@@ -169,11 +441,36 @@ void SendRpcResponse(int64_t correlation_id,
             cntl->SetFailed(
                 ERESPONSE, "Missing required fields in response: %s", 
                 res->InitializationErrorString().c_str());
-        } else if (!SerializeAsCompressedData(*res, &res_body, type)) {
-            cntl->SetFailed(ERESPONSE, "Fail to serialize response, "
-                            "CompressType=%s", CompressTypeToCStr(type));
         } else {
-            append_body = true;
+            size_t raw_size = 0;
+            if (type != COMPRESS_TYPE_NONE && method_status != NULL &&
+                FLAGS_adaptive_response_compression) {
+                raw_size = res->ByteSize();
+                type = method_status->adaptive_compression().Decide(
+                    type, raw_size, cntl->remote_side(), cntl->local_side());
+                // Tell the client the actual compress type in meta.
+                cntl->set_response_compress_type(type);
+            }
+            bool serialized = false;
+            if (raw_size != 0 && type == COMPRESS_TYPE_NONE) {
+                // Reuse the size computed by ByteSize() above.
+                butil::IOBufAsZeroCopyOutputStream wrapper(&res_body);
+                ::google::protobuf::io::CodedOutputStream coded_out(&wrapper);
+                res->SerializeWithCachedSizes(&coded_out);
+                serialized = !coded_out.HadError();
+            } else {
+                serialized = SerializeAsCompressedData(*res, &res_body, type);
+            }
+            if (!serialized) {
+                cntl->SetFailed(ERESPONSE, "Fail to serialize response, "
+                                "CompressType=%s", CompressTypeToCStr(type));
+            } else {
+                append_body = true;
+                if (raw_size != 0 && type != COMPRESS_TYPE_NONE) {
+                    method_status->adaptive_compression().OnCompressed(
+                        raw_size, res_body.size());
+                }
+            }
         }
     }
 
@@ -191,18 +488,23 @@ void SendRpcResponse(int64_t correlation_id,
         // distinction between server error and client error
         error_code = EINTERNAL;
     }
+    // The client asked for compact meta on this connection.
+    const CompactMetaServerContext* compact_ctx =
+        GetCompactMetaServerContext(sock, false);
+    const bool compact = (compact_ctx != NULL);
     RpcMeta meta;
-    RpcResponseMeta* response_meta = meta.mutable_response();
-    response_meta->set_error_code(error_code);
+    if (!compact) {
+        meta.mutable_response()->set_error_code(error_code);
+        meta.set_correlation_id(correlation_id);
+        meta.set_compress_type(cntl->response_compress_type());
+        if (attached_size > 0) {
+            meta.set_attachment_size(attached_size);
+        }
+    }
     if (!cntl->ErrorText().empty()) {
         // Only set error_text when it's not empty since protobuf Message
         // always new the string no matter if it's empty or not.
-        response_meta->set_error_text(cntl->ErrorText());
-    }
-    meta.set_correlation_id(correlation_id);
-    meta.set_compress_type(cntl->response_compress_type());
-    if (attached_size > 0) {
-        meta.set_attachment_size(attached_size);
+        meta.mutable_response()->set_error_text(cntl->ErrorText());
     }
     SocketUniquePtr stream_ptr;
     if (response_stream_id != INVALID_STREAM_ID) {
@@ -217,7 +519,23 @@ void SendRpcResponse(int64_t correlation_id,
     }
 
     butil::IOBuf res_buf;
-    SerializeRpcHeaderAndMeta(&res_buf, meta, res_size + attached_size);
+    if (compact) {
+        char fixed[COMPACT_RESPONSE_META_SIZE];
+        fixed[0] = 0;
+        fixed[1] = (attached_size > 0 ? COMPACT_HAS_ATTACHMENT_SIZE : 0);
+        // Tell the client to send requests of the method in compact meta.
+        if (cntl->method() != NULL && compact_ctx->IsInterned(cntl->method())) {
+            fixed[1] |= COMPACT_METHOD_INTERNED;
+        }
+        fixed[2] = (char)cntl->response_compress_type();
+        fixed[3] = 0;
+        butil::RawPacker(fixed + 4).pack32(error_code)
+            .pack64(correlation_id).pack32(attached_size);
+        SerializeRpcHeaderAndCompactMeta(&res_buf, fixed, sizeof(fixed),
+                                         meta, res_size + attached_size);
+    } else {
+        SerializeRpcHeaderAndMeta(&res_buf, meta, res_size + attached_size);
+    }
     if (append_body) {
         res_buf.append(res_body.movable());
         if (attached_size) {
@@ -250,6 +568,7 @@ void SendRpcResponse(int64_t correlation_id,
         // users to set max_concurrency.
         Socket::WriteOptions wopt;
         wopt.ignore_eovercrowded = true;
+        wopt.coalesce_window_us = FLAGS_baidu_std_response_coalesce_us;
         if (sock->Write(&res_buf, &wopt) != 0) {
             const int errcode = errno;
             PLOG_IF(WARNING, errcode != EPIPE) << "Fail to write into " << *sock;
@@ -299,6 +618,38 @@ void EndRunningCallMethodInPool(
     return EndRunningUserCodeInPool(CallMethodInBackupThread, args);
 };
 
+// Intern the method of `request_meta' as compact_method_id on `socket'.
+// Called before any check on the request, so that the response to the
+// request is in compact meta even if the request fails.
+static void InternCompactMethod(const Server* server, Socket* socket,
+                                const RpcRequestMeta& request_meta) {
+    ServerPrivateAccessor server_accessor(server);
+    butil::StringPiece svc_name(request_meta.service_name());
+    if (svc_name.find('.') == butil::StringPiece::npos) {
+        const Server::ServiceProperty* sp =
+            server_accessor.FindServicePropertyByName(svc_name);
+        if (NULL == sp) {
+            return;
+        }
+        svc_name = sp->service->GetDescriptor()->full_name();
+    }
+    const Server::MethodProperty* mp =
+        server_accessor.FindMethodPropertyByFullName(
+            svc_name, request_meta.method_name());
+    if (NULL == mp ||
+        mp->service->GetDescriptor() == BadMethodService::descriptor()) {
+        return;
+    }
+    CompactMetaServerContext* ctx = GetCompactMetaServerContext(socket, true);
+    if (ctx != NULL &&
+        !ctx->Register(request_meta.compact_method_id(), mp)) {
+        LOG_EVERY_SECOND(WARNING) << "Fail to intern " << mp->method->full_name()
+                                  << " as compact_method_id="
+                                  << request_meta.compact_method_id()
+                                  << " on " << *socket;
+    }
+}
+
 void ProcessRpcRequest(InputMessageBase* msg_base) {
     const int64_t start_parse_us = butil::cpuwide_time_us();
     DestroyingPtr<MostCommonMessage> msg(static_cast<MostCommonMessage*>(msg_base));
@@ -308,18 +659,44 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
     ScopedNonServiceError non_service_error(server);
 
     RpcMeta meta;
-    if (!ParsePbFromIOBuf(&meta, msg->meta)) {
+    bool compact = false;
+    uint8_t compact_flags = 0;
+    uint32_t compact_method_id = 0;
+    if (!ParseRpcMeta(msg->meta, true, &meta, &compact, &compact_flags,
+                      &compact_method_id)) {
+        if (IsServerDatagramSocket(socket)) {
+            // The socket is shared by all senders, drop the message only.
+            DropBadDatagram();
+            return;
+        }
         LOG(WARNING) << "Fail to parse RpcMeta from " << *socket;
         socket->SetFailed(EREQUEST, "Fail to parse RpcMeta from %s",
                           socket->description().c_str());
         return;
     }
     const RpcRequestMeta &request_meta = meta.request();
+    // Method of compact meta, NULL if the id is not interned.
+    const Server::MethodProperty* compact_mp = NULL;
+    if (compact) {
+        CompactMetaServerContext* ctx =
+            GetCompactMetaServerContext(socket, false);
+        if (ctx != NULL) {
+            compact_mp = ctx->Find(compact_method_id);
+        }
+    } else if (request_meta.has_compact_method_id()) {
+        InternCompactMethod(server, socket, request_meta);
+    }
 
     SampledRequest* sample = AskToBeSampled();
     if (sample) {
-        sample->meta.set_service_name(request_meta.service_name());
-        sample->meta.set_method_name(request_meta.method_name());
+        if (compact_mp != NULL) {
+            sample->meta.set_service_name(
+                compact_mp->method->service()->full_name());
+            sample->meta.set_method_name(compact_mp->method->name());
+        } else {
+            sample->meta.set_service_name(request_meta.service_name());
+            sample->meta.set_method_name(request_meta.method_name());
+        }
         sample->meta.set_compress_type((CompressType)meta.compress_type());
         sample->meta.set_protocol_type(PROTOCOL_BAIDU_STD);
         sample->meta.set_attachment_size(meta.attachment_size());
@@ -403,34 +780,42 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             break;
         }
 
-        // NOTE(gejun): jprotobuf sends service names without packages. So the
-        // name should be changed to full when it's not.
-        butil::StringPiece svc_name(request_meta.service_name());
-        if (svc_name.find('.') == butil::StringPiece::npos) {
-            const Server::ServiceProperty* sp =
-                server_accessor.FindServicePropertyByName(svc_name);
-            if (NULL == sp) {
-                cntl->SetFailed(ENOSERVICE, "Fail to find service=%s",
-                                request_meta.service_name().c_str());
+        const Server::MethodProperty* mp = compact_mp;
+        if (compact) {
+            if (NULL == mp) {
+                cntl->SetFailed(ENOMETHOD, "Fail to find method of "
+                                "compact_method_id=%u", compact_method_id);
                 break;
             }
-            svc_name = sp->service->GetDescriptor()->full_name();
-        }
-        const Server::MethodProperty* mp =
-            server_accessor.FindMethodPropertyByFullName(
+        } else {
+            // NOTE(gejun): jprotobuf sends service names without packages. So
+            // the name should be changed to full when it's not.
+            butil::StringPiece svc_name(request_meta.service_name());
+            if (svc_name.find('.') == butil::StringPiece::npos) {
+                const Server::ServiceProperty* sp =
+                    server_accessor.FindServicePropertyByName(svc_name);
+                if (NULL == sp) {
+                    cntl->SetFailed(ENOSERVICE, "Fail to find service=%s",
+                                    request_meta.service_name().c_str());
+                    break;
+                }
+                svc_name = sp->service->GetDescriptor()->full_name();
+            }
+            mp = server_accessor.FindMethodPropertyByFullName(
                 svc_name, request_meta.method_name());
-        if (NULL == mp) {
-            cntl->SetFailed(ENOMETHOD, "Fail to find method=%s/%s",
-                            request_meta.service_name().c_str(),
-                            request_meta.method_name().c_str());
-            break;
-        } else if (mp->service->GetDescriptor()
-                   == BadMethodService::descriptor()) {
-            BadMethodRequest breq;
-            BadMethodResponse bres;
-            breq.set_service_name(request_meta.service_name());
-            mp->service->CallMethod(mp->method, cntl.get(), &breq, &bres, NULL);
-            break;
+            if (NULL == mp) {
+                cntl->SetFailed(ENOMETHOD, "Fail to find method=%s/%s",
+                                request_meta.service_name().c_str(),
+                                request_meta.method_name().c_str());
+                break;
+            } else if (mp->service->GetDescriptor()
+                       == BadMethodService::descriptor()) {
+                BadMethodRequest breq;
+                BadMethodResponse bres;
+                breq.set_service_name(request_meta.service_name());
+                mp->service->CallMethod(mp->method, cntl.get(), &breq, &bres, NULL);
+                break;
+            }
         }
         // Switch to service-specific error.
         non_service_error.release();
@@ -521,7 +906,11 @@ bool VerifyRpcRequest(const InputMessageBase* msg_base) {
     Socket* socket = msg->socket();
     
     RpcMeta meta;
-    if (!ParsePbFromIOBuf(&meta, msg->meta)) {
+    bool compact = false;
+    uint8_t compact_flags = 0;
+    uint32_t compact_method_id = 0;
+    if (!ParseRpcMeta(msg->meta, true, &meta, &compact, &compact_flags,
+                      &compact_method_id)) {
         LOG(WARNING) << "Fail to parse RpcRequestMeta";
         return false;
     }
@@ -542,7 +931,10 @@ void ProcessRpcResponse(InputMessageBase* msg_base) {
     const int64_t start_parse_us = butil::cpuwide_time_us();
     DestroyingPtr<MostCommonMessage> msg(static_cast<MostCommonMessage*>(msg_base));
     RpcMeta meta;
-    if (!ParsePbFromIOBuf(&meta, msg->meta)) {
+    bool compact = false;
+    uint8_t compact_flags = 0;
+    if (!ParseRpcMeta(msg->meta, false, &meta, &compact, &compact_flags,
+                      NULL)) {
         LOG(WARNING) << "Fail to parse from response meta";
         return;
     }
@@ -560,6 +952,17 @@ void ProcessRpcResponse(InputMessageBase* msg_base) {
     }
     
     ControllerPrivateAccessor accessor(cntl);
+    if (compact && (compact_flags & COMPACT_METHOD_INTERNED) &&
+        cntl->method() != NULL) {
+        // Responses of previous connections can't be locked since calls
+        // on failed sockets are retried with new versions of cid, thus
+        // the server of current connection interned the method.
+        Socket* s = msg->socket();
+        CompactMetaClientContext* ctx = GetCompactMetaClientContext(s);
+        if (ctx != NULL) {
+            ctx->Confirm(cntl->method(), s->connection_epoch());
+        }
+    }
     if (meta.has_stream_settings()) {
         accessor.set_remote_stream_settings(
                 new StreamSettings(meta.stream_settings()));
@@ -630,25 +1033,46 @@ void PackRpcRequest(butil::IOBuf* req_buf,
     }
 
     ControllerPrivateAccessor accessor(cntl);
-    RpcRequestMeta* request_meta = meta.mutable_request();
-    if (method) {
+    // Id of `method' interned on the connection, -1 if not used.
+    int compact_method_id = -1;
+    bool compact = false;
+    if (method && FLAGS_baidu_std_compact_meta &&
+        cntl->connection_type() == CONNECTION_TYPE_SINGLE) {
+        Socket* s = accessor.get_sending_socket();
+        CompactMetaClientContext* ctx = GetCompactMetaClientContext(s);
+        if (ctx != NULL) {
+            compact_method_id = ctx->GetOrAssignId(
+                method, s->connection_epoch(), &compact);
+        }
+    }
+    if (compact) {
+        // Method, compress_type, log_id, correlation_id and attachment_size
+        // are packed into the fixed part of compact meta.
+    } else if (method) {
+        RpcRequestMeta* request_meta = meta.mutable_request();
         request_meta->set_service_name(FLAGS_baidu_protocol_use_fullname ?
                                        method->service()->full_name() :
                                        method->service()->name());
         request_meta->set_method_name(method->name());
+        if (compact_method_id >= 0) {
+            request_meta->set_compact_method_id(compact_method_id);
+        }
         meta.set_compress_type(cntl->request_compress_type());
     } else if (cntl->sampled_request()) {
         // Replaying. Keep service-name as the one seen by server.
+        RpcRequestMeta* request_meta = meta.mutable_request();
         request_meta->set_service_name(cntl->sampled_request()->meta.service_name());
         request_meta->set_method_name(cntl->sampled_request()->meta.method_name());
         meta.set_compress_type(cntl->sampled_request()->meta.compress_type());
     } else {
         return cntl->SetFailed(ENOMETHOD, "%s.method is NULL", __FUNCTION__);
     }
-    if (cntl->has_log_id()) {
-        request_meta->set_log_id(cntl->log_id());
+    if (!compact) {
+        if (cntl->has_log_id()) {
+            meta.mutable_request()->set_log_id(cntl->log_id());
+        }
+        meta.set_correlation_id(correlation_id);
     }
-    meta.set_correlation_id(correlation_id);
     StreamId request_stream_id = accessor.request_stream();
     if (request_stream_id != INVALID_STREAM_ID) {
         SocketUniquePtr ptr;
@@ -663,17 +1087,32 @@ void PackRpcRequest(butil::IOBuf* req_buf,
     // Don't use res->ByteSize() since it may be compressed
     const size_t req_size = request_body.length(); 
     const size_t attached_size = cntl->request_attachment().length();
-    if (attached_size) {
+    if (attached_size && !compact) {
         meta.set_attachment_size(attached_size);
     }
     Span* span = accessor.span();
     if (span) {
+        RpcRequestMeta* request_meta = meta.mutable_request();
         request_meta->set_trace_id(span->trace_id());
         request_meta->set_span_id(span->span_id());
         request_meta->set_parent_span_id(span->parent_span_id());
     }
 
-    SerializeRpcHeaderAndMeta(req_buf, meta, req_size + attached_size);
+    if (compact) {
+        char fixed[COMPACT_REQUEST_META_SIZE];
+        fixed[0] = 0;
+        fixed[1] = (cntl->has_log_id() ? COMPACT_HAS_LOG_ID : 0) |
+            (attached_size ? COMPACT_HAS_ATTACHMENT_SIZE : 0);
+        fixed[2] = (char)cntl->request_compress_type();
+        fixed[3] = 0;
+        butil::RawPacker(fixed + 4).pack32(compact_method_id)
+            .pack64(correlation_id).pack64(cntl->log_id())
+            .pack32(attached_size);
+        SerializeRpcHeaderAndCompactMeta(req_buf, fixed, sizeof(fixed),
+                                         meta, req_size + attached_size);
+    } else {
+        SerializeRpcHeaderAndMeta(req_buf, meta, req_size + attached_size);
+    }
     req_buf->append(request_body);
     if (attached_size) {
         req_buf->append(cntl->request_attachment());
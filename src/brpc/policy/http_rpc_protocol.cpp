@@ -51,6 +51,7 @@ int is_failed_after_queries(const http_parser* parser);
 int is_failed_after_http_version(const http_parser* parser);
 DECLARE_bool(http_verbose);
 DECLARE_int32(http_verbose_max_body_length);
+DECLARE_bool(adaptive_response_compression);
 // Defined in grpc.cpp
 int64_t ConvertGrpcTimeoutToUS(const std::string* grpc_timeout);
 
@@ -831,11 +832,21 @@ HttpResponseSender::~HttpResponseSender() {
         // not set_content to enable chunked mode.
     } else if (cntl->response_compress_type() == COMPRESS_TYPE_GZIP) {
         const size_t response_size = cntl->response_attachment().size();
+        const bool adaptive = (_method_status != NULL &&
+                               FLAGS_adaptive_response_compression);
         if (response_size >= (size_t)FLAGS_http_body_compress_threshold
-            && (is_http2 || SupportGzip(cntl))) {
+            && (is_http2 || SupportGzip(cntl))
+            && (!adaptive ||
+                _method_status->adaptive_compression().Decide(
+                    COMPRESS_TYPE_GZIP, response_size, cntl->remote_side(),
+                    cntl->local_side()) != COMPRESS_TYPE_NONE)) {
             TRACEPRINTF("Compressing response=%lu", (unsigned long)response_size);
             butil::IOBuf tmpbuf;
             if (GzipCompress(cntl->response_attachment(), &tmpbuf, NULL)) {
+                if (adaptive) {
+                    _method_status->adaptive_compression().OnCompressed(
+                        response_size, tmpbuf.size());
+                }
                 cntl->response_attachment().swap(tmpbuf);
                 if (is_grpc) {
                     grpc_compressed = true;
@@ -1497,6 +1508,9 @@ void ProcessHttpRequest(InputMessageBase *msg) {
 }
 
 bool ParseHttpServerAddress(butil::EndPoint* point, const char* server_addr_and_port) {
+    if (strncmp(server_addr_and_port, "unix:", 5) == 0) {
+        return butil::str2endpoint(server_addr_and_port, point) == 0;
+    }
     std::string scheme;
     std::string host;
     int port = -1;
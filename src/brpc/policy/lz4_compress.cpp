@@ -0,0 +1,354 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+
+#define LZ4F_STATIC_LINKING_ONLY
+#include <lz4frame.h>                          // LZ4F_*
+#include <map>
+#include "butil/logging.h"
+#include "butil/crc32c.h"
+#include "butil/thread_local.h"
+#include "brpc/policy/lz4_compress.h"
+#include "brpc/protocol.h"
+
+
+namespace brpc {
+namespace policy {
+
+// Input is fed to LZ4F in chunks no larger than this value so that the
+// compressed output of one chunk usually fits into the left space of the
+// current IOBuf block and is written in-place.
+static const size_t LZ4_CHUNK_SIZE = 4096;
+// Blocks are flushed after each chunk(autoFlush), a flushed block costs a
+// 4-byte block header and the frame ends with a 4-byte end mark. The
+// checksums are disabled.
+static const size_t LZ4_CHUNK_OVERHEAD = 16;
+
+struct LZ4Dictionary {
+    std::string content;
+    uint32_t id;
+    LZ4F_CDict* cdict;
+};
+
+// Dictionaries are registered before any RPC and never removed, thus the
+// maps are read without locks.
+typedef std::map<std::string, LZ4Dictionary*> LZ4DictNameMap;
+typedef std::map<uint32_t, LZ4Dictionary*> LZ4DictIdMap;
+static LZ4DictNameMap* s_dict_by_name = NULL;
+static LZ4DictIdMap* s_dict_by_id = NULL;
+
+int RegisterLZ4Dictionary(const std::string& message_name,
+                          const std::string& dict) {
+    if (message_name.empty() || dict.empty()) {
+        LOG(ERROR) << "message_name or dict is empty";
+        return -1;
+    }
+    if (s_dict_by_name == NULL) {
+        s_dict_by_name = new LZ4DictNameMap;
+        s_dict_by_id = new LZ4DictIdMap;
+    }
+    if (s_dict_by_name->find(message_name) != s_dict_by_name->end()) {
+        LOG(ERROR) << "LZ4 dictionary of " << message_name
+                   << " was registered";
+        return -1;
+    }
+    // LZ4 dictionaries do not carry ids, identify them by the content.
+    // 0 means "no dictionary" in the frame header.
+    uint32_t id = butil::crc32c::Value(dict.data(), dict.size());
+    if (id == 0) {
+        id = 1;
+    }
+    LZ4DictIdMap::iterator it = s_dict_by_id->find(id);
+    if (it != s_dict_by_id->end()) {
+        if (it->second->content != dict) {
+            LOG(ERROR) << "Id of LZ4 dictionary of " << message_name
+                       << " conflicts with another dictionary";
+            return -1;
+        }
+        // Share the dictionary between message types.
+        (*s_dict_by_name)[message_name] = it->second;
+        return 0;
+    }
+    LZ4Dictionary* d = new LZ4Dictionary;
+    d->content = dict;
+    d->id = id;
+    d->cdict = LZ4F_createCDict(d->content.data(), d->content.size());
+    if (d->cdict == NULL) {
+        LOG(ERROR) << "Fail to create LZ4 dictionary of " << message_name;
+        delete d;
+        return -1;
+    }
+    (*s_dict_by_name)[message_name] = d;
+    (*s_dict_by_id)[id] = d;
+    return 0;
+}
+
+static const LZ4Dictionary* FindDictionaryByName(const std::string& name) {
+    if (s_dict_by_name == NULL) {
+        return NULL;
+    }
+    LZ4DictNameMap::const_iterator it = s_dict_by_name->find(name);
+    return (it != s_dict_by_name->end() ? it->second : NULL);
+}
+
+static const LZ4Dictionary* FindDictionaryById(uint32_t id) {
+    if (s_dict_by_id == NULL) {
+        return NULL;
+    }
+    LZ4DictIdMap::const_iterator it = s_dict_by_id->find(id);
+    return (it != s_dict_by_id->end() ? it->second : NULL);
+}
+
+// Creating LZ4F contexts allocates, reuse them within the thread.
+struct LZ4Contexts {
+    LZ4F_cctx* cctx;
+    LZ4F_dctx* dctx;
+
+    LZ4Contexts() : cctx(NULL), dctx(NULL) {}
+    ~LZ4Contexts() {
+        if (cctx) {
+            LZ4F_freeCompressionContext(cctx);
+        }
+        if (dctx) {
+            LZ4F_freeDecompressionContext(dctx);
+        }
+    }
+};
+
+static BAIDU_THREAD_LOCAL LZ4Contexts* tls_lz4_ctx = NULL;
+
+static LZ4Contexts* GetLZ4Contexts() {
+    LZ4Contexts* ctx = tls_lz4_ctx;
+    if (ctx == NULL) {
+        ctx = new (std::nothrow) LZ4Contexts;
+        if (ctx == NULL) {
+            return NULL;
+        }
+        tls_lz4_ctx = ctx;
+        butil::thread_atexit(butil::delete_object<LZ4Contexts>, ctx);
+    }
+    return ctx;
+}
+
+static bool AppendToStream(butil::IOBufAsZeroCopyOutputStream* out,
+                           const char* data, size_t n) {
+    void* dst = NULL;
+    int size = 0;
+    while (n > 0) {
+        if (!out->Next(&dst, &size)) {
+            return false;
+        }
+        const size_t ncp = std::min(n, (size_t)size);
+        memcpy(dst, data, ncp);
+        data += ncp;
+        n -= ncp;
+        if (ncp < (size_t)size) {
+            out->BackUp(size - ncp);
+        }
+    }
+    return true;
+}
+
+static bool LZ4CompressIOBuf(const butil::IOBuf& in, butil::IOBuf* out,
+                             const LZ4Dictionary* dict) {
+    LZ4Contexts* ctx = GetLZ4Contexts();
+    if (ctx == NULL) {
+        return false;
+    }
+    if (ctx->cctx == NULL) {
+        const LZ4F_errorCode_t rc =
+            LZ4F_createCompressionContext(&ctx->cctx, LZ4F_VERSION);
+        if (LZ4F_isError(rc)) {
+            LOG(WARNING) << "Fail to create LZ4 cctx: " << LZ4F_getErrorName(rc);
+            ctx->cctx = NULL;
+            return false;
+        }
+    }
+    LZ4F_preferences_t prefs;
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.autoFlush = 1;
+    prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+    prefs.frameInfo.contentSize = in.size();
+    prefs.frameInfo.dictID = (dict ? dict->id : 0);
+
+    butil::IOBufAsZeroCopyOutputStream stream(out);
+    char scratch[LZ4_CHUNK_SIZE + LZ4_CHUNK_OVERHEAD];
+    char header[LZ4F_HEADER_SIZE_MAX];
+    size_t rc = LZ4F_compressBegin_usingCDict(
+        ctx->cctx, header, sizeof(header), (dict ? dict->cdict : NULL), &prefs);
+    if (LZ4F_isError(rc)) {
+        LOG(WARNING) << "Fail to begin LZ4 frame: " << LZ4F_getErrorName(rc);
+        return false;
+    }
+    if (!AppendToStream(&stream, header, rc)) {
+        return false;
+    }
+    // Compress backing blocks of `in' one by one without flattening.
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; i < nblock; ++i) {
+        butil::StringPiece blk = in.backing_block(i);
+        while (!blk.empty()) {
+            const size_t nin = std::min(blk.size(), LZ4_CHUNK_SIZE);
+            void* dst = NULL;
+            int size = 0;
+            if (!stream.Next(&dst, &size)) {
+                return false;
+            }
+            if ((size_t)size >= nin + LZ4_CHUNK_OVERHEAD) {
+                rc = LZ4F_compressUpdate(ctx->cctx, dst, size,
+                                         blk.data(), nin, NULL);
+                if (LZ4F_isError(rc)) {
+                    stream.BackUp(size);
+                    LOG(WARNING) << "Fail to compress: "
+                                 << LZ4F_getErrorName(rc);
+                    return false;
+                }
+                stream.BackUp(size - rc);
+            } else {
+                // Not enough room in current block, compress into the
+                // scratch and copy.
+                stream.BackUp(size);
+                rc = LZ4F_compressUpdate(ctx->cctx, scratch, sizeof(scratch),
+                                         blk.data(), nin, NULL);
+                if (LZ4F_isError(rc)) {
+                    LOG(WARNING) << "Fail to compress: "
+                                 << LZ4F_getErrorName(rc);
+                    return false;
+                }
+                if (!AppendToStream(&stream, scratch, rc)) {
+                    return false;
+                }
+            }
+            blk.remove_prefix(nin);
+        }
+    }
+    rc = LZ4F_compressEnd(ctx->cctx, scratch, sizeof(scratch), NULL);
+    if (LZ4F_isError(rc)) {
+        LOG(WARNING) << "Fail to end LZ4 frame: " << LZ4F_getErrorName(rc);
+        return false;
+    }
+    return AppendToStream(&stream, scratch, rc);
+}
+
+static bool LZ4DecompressIOBuf(const butil::IOBuf& in, butil::IOBuf* out) {
+    LZ4Contexts* ctx = GetLZ4Contexts();
+    if (ctx == NULL) {
+        return false;
+    }
+    if (ctx->dctx == NULL) {
+        const LZ4F_errorCode_t rc =
+            LZ4F_createDecompressionContext(&ctx->dctx, LZ4F_VERSION);
+        if (LZ4F_isError(rc)) {
+            LOG(WARNING) << "Fail to create LZ4 dctx: " << LZ4F_getErrorName(rc);
+            ctx->dctx = NULL;
+            return false;
+        }
+    } else {
+        LZ4F_resetDecompressionContext(ctx->dctx);
+    }
+    // Decode the frame header first to find out the dictionary.
+    char header[LZ4F_HEADER_SIZE_MAX];
+    size_t header_size = in.copy_to(header, sizeof(header));
+    LZ4F_frameInfo_t info;
+    size_t hint = LZ4F_getFrameInfo(ctx->dctx, &info, header, &header_size);
+    if (LZ4F_isError(hint)) {
+        LOG(WARNING) << "Fail to decode LZ4 frame header: "
+                     << LZ4F_getErrorName(hint);
+        return false;
+    }
+    const LZ4Dictionary* dict = NULL;
+    if (info.dictID != 0) {
+        dict = FindDictionaryById(info.dictID);
+        if (dict == NULL) {
+            LOG(WARNING) << "Unknown LZ4 dictionary id=" << info.dictID;
+            return false;
+        }
+    }
+    butil::IOBuf body;
+    in.append_to(&body, (size_t)-1L, header_size);
+    butil::IOBufAsZeroCopyInputStream in_stream(body);
+    butil::IOBufAsZeroCopyOutputStream out_stream(out);
+    const void* data_in = NULL;
+    int size_in = 0;
+    void* data_out = NULL;
+    int size_out = 0;
+    while (hint != 0) {
+        if (size_in == 0 && !in_stream.Next(&data_in, &size_in)) {
+            break;
+        }
+        if (size_out == 0 && !out_stream.Next(&data_out, &size_out)) {
+            break;
+        }
+        size_t nin = size_in;
+        size_t nout = size_out;
+        hint = LZ4F_decompress_usingDict(
+            ctx->dctx, data_out, &nout, data_in, &nin,
+            (dict ? dict->content.data() : NULL),
+            (dict ? dict->content.size() : 0), NULL);
+        if (LZ4F_isError(hint)) {
+            LOG(WARNING) << "Fail to decompress: " << LZ4F_getErrorName(hint);
+            break;
+        }
+        data_in = (const char*)data_in + nin;
+        size_in -= nin;
+        data_out = (char*)data_out + nout;
+        size_out -= nout;
+    }
+    if (size_out != 0) {
+        out_stream.BackUp(size_out);
+    }
+    if (hint != 0 || size_in != 0 ||
+        (size_t)in_stream.ByteCount() != body.size()) {
+        // The frame is truncated or followed by garbage.
+        LOG_IF(WARNING, !LZ4F_isError(hint)) << "Invalid LZ4 frame";
+        return false;
+    }
+    return true;
+}
+
+bool LZ4Compress(const google::protobuf::Message& res, butil::IOBuf* buf) {
+    butil::IOBuf serialized_pb;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
+    if (res.SerializeToZeroCopyStream(&wrapper)) {
+        return LZ4CompressIOBuf(
+            serialized_pb, buf,
+            FindDictionaryByName(res.GetDescriptor()->full_name()));
+    }
+    LOG(WARNING) << "Fail to serialize input pb=" << &res;
+    return false;
+}
+
+bool LZ4Decompress(const butil::IOBuf& data, google::protobuf::Message* req) {
+    butil::IOBuf binary_pb;
+    if (LZ4DecompressIOBuf(data, &binary_pb)) {
+        return ParsePbFromIOBuf(req, binary_pb);
+    }
+    LOG(WARNING) << "Fail to LZ4Decompress, size=" << data.size();
+    return false;
+}
+
+bool LZ4Compress(const butil::IOBuf& in, butil::IOBuf* out) {
+    return LZ4CompressIOBuf(in, out, NULL);
+}
+
+bool LZ4Decompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    return LZ4DecompressIOBuf(in, out);
+}
+
+}  // namespace policy
+} // namespace brpc
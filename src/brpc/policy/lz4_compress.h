@@ -0,0 +1,57 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_POLICY_LZ4_COMPRESS_H
+#define BRPC_POLICY_LZ4_COMPRESS_H
+
+#include <string>
+#include <google/protobuf/message.h>          // Message
+#include "butil/iobuf.h"                       // IOBuf
+
+
+namespace brpc {
+namespace policy {
+
+// Compress serialized `msg' into `buf'. If a dictionary was registered for
+// the type of `msg', the frame is compressed with it.
+bool LZ4Compress(const google::protobuf::Message& msg, butil::IOBuf* buf);
+
+// Parse `msg' from decompressed `buf'
+bool LZ4Decompress(const butil::IOBuf& data, google::protobuf::Message* msg);
+
+// Put compressed `in' into `out'. No dictionary is used.
+bool LZ4Compress(const butil::IOBuf& in, butil::IOBuf* out);
+
+// Put decompressed `in' into `out'.
+bool LZ4Decompress(const butil::IOBuf& in, butil::IOBuf* out);
+
+// [NOT thread-safe] Compress messages of type `message_name' (full name of
+// the protobuf message, e.g. "example.EchoRequest") with pre-trained
+// dictionary `dict'. Both sides must register the same dictionary before
+// any RPC since the dictionary is identified by its id inside the frame.
+// Dictionaries pay off for small messages (several hundred bytes) which
+// are hardly compressible on their own.
+// Returns 0 on success, -1 otherwise
+int RegisterLZ4Dictionary(const std::string& message_name,
+                          const std::string& dict);
+
+}  // namespace policy
+} // namespace brpc
+
+
+#endif // BRPC_POLICY_LZ4_COMPRESS_H
@@ -16,6 +16,7 @@
 // under the License.
 
 
+#include <deque>
 #include <google/protobuf/descriptor.h>         // MethodDescriptor
 #include <google/protobuf/message.h>            // Message
 #include <gflags/gflags.h>
@@ -40,6 +41,7 @@
 namespace brpc {
 
 DECLARE_bool(enable_rpcz);
+DECLARE_uint64(max_body_size);
 
 namespace policy {
 
@@ -52,6 +54,9 @@ static pthread_once_t supported_cmd_map_once = PTHREAD_ONCE_INIT;
 static void InitSupportedCommandMap() {
     butil::bit_array_clear(supported_cmd_map, 256);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_GET);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_GETQ);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_GETK);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_GETKQ);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_SET);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_ADD);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_REPLACE);
@@ -66,6 +71,19 @@ static void InitSupportedCommandMap() {
     butil::bit_array_set(supported_cmd_map, MC_BINARY_STAT);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_TOUCH);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_SASL_AUTH);
+    // Quiet commands, see IsQuietCommand().
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_SETQ);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_ADDQ);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_REPLACEQ);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_DELETEQ);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_INCREMENTQ);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_DECREMENTQ);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_QUITQ);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_FLUSHQ);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_APPENDQ);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_PREPENDQ);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_GATQ);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_GATKQ);
 }
 
 inline bool IsSupportedCommand(uint8_t command) {
@@ -73,8 +91,345 @@ inline bool IsSupportedCommand(uint8_t command) {
     return butil::bit_array_get(supported_cmd_map, command);
 }
 
+static bool IsQuietCommand(uint8_t command) {
+    switch (command) {
+    case MC_BINARY_GETQ:
+    case MC_BINARY_GETKQ:
+    case MC_BINARY_SETQ:
+    case MC_BINARY_ADDQ:
+    case MC_BINARY_REPLACEQ:
+    case MC_BINARY_DELETEQ:
+    case MC_BINARY_INCREMENTQ:
+    case MC_BINARY_DECREMENTQ:
+    case MC_BINARY_QUITQ:
+    case MC_BINARY_FLUSHQ:
+    case MC_BINARY_APPENDQ:
+    case MC_BINARY_PREPENDQ:
+    case MC_BINARY_GATQ:
+    case MC_BINARY_GATKQ:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Append a response to `req' (in host byte order) to `appender'.
+static void AppendMemcacheResponse(butil::IOBufAppender* appender,
+                                   const MemcacheRequestHeader& req,
+                                   uint16_t status, uint64_t cas_value,
+                                   const void* extras, uint8_t extras_length,
+                                   const butil::StringPiece& key,
+                                   const butil::IOBuf& value) {
+    const MemcacheResponseHeader header = {
+        MC_MAGIC_RESPONSE,
+        req.command,
+        butil::HostToNet16(key.size()),
+        extras_length,
+        MC_BINARY_RAW_BYTES,
+        butil::HostToNet16(status),
+        butil::HostToNet32(extras_length + key.size() + value.size()),
+        butil::HostToNet32(req.opaque),
+        butil::HostToNet64(cas_value)
+    };
+    appender->append(&header, sizeof(header));
+    appender->append(extras, extras_length);
+    appender->append(key);
+    appender->append(value);
+}
+
+// Errors carry the description of the status as value.
+static void AppendMemcacheError(butil::IOBufAppender* appender,
+                                const MemcacheRequestHeader& req,
+                                MemcacheResponse::Status status,
+                                const butil::StringPiece& key) {
+    butil::IOBuf msg;
+    msg.append(MemcacheResponse::status_str(status));
+    AppendMemcacheResponse(appender, req, status, 0, NULL, 0, key, msg);
+}
+
+struct MemcacheStoreExtras {
+    uint32_t flags;
+    uint32_t exptime;
+} __attribute__((packed));
+
+struct MemcacheCounterExtras {
+    uint64_t delta;
+    uint64_t initial_value;
+    uint32_t exptime;
+} __attribute__((packed));
+
+// Run the command in `req' and `body' with `service' and append the
+// response(if any) to `appender'.
+static void ProcessMemcacheCommand(MemcacheService* service,
+                                   const MemcacheRequestHeader& req,
+                                   butil::IOBuf* body,
+                                   butil::IOBufAppender* appender) {
+    char extras[sizeof(MemcacheCounterExtras)];
+    if (req.extras_length > sizeof(extras) ||
+        req.extras_length + (uint32_t)req.key_length > req.total_body_length) {
+        return AppendMemcacheError(appender, req, MemcacheResponse::STATUS_EINVAL,
+                                   butil::StringPiece());
+    }
+    body->cutn(extras, req.extras_length);
+    std::string key;
+    body->cutn(&key, req.key_length);
+    // Remaining part of `body' is the value.
+    const butil::IOBuf empty;
+    const bool quiet = IsQuietCommand(req.command);
+    MemcacheResponse::Status st = MemcacheResponse::STATUS_SUCCESS;
+    uint64_t cas_value = 0;
+    switch (req.command) {
+    case MC_BINARY_GET:
+    case MC_BINARY_GETQ:
+    case MC_BINARY_GETK:
+    case MC_BINARY_GETKQ: {
+        const bool with_key = (req.command == MC_BINARY_GETK ||
+                               req.command == MC_BINARY_GETKQ);
+        const butil::StringPiece resp_key = (with_key ? key : butil::StringPiece());
+        butil::IOBuf value;
+        uint32_t flags = 0;
+        st = service->Get(key, &value, &flags, &cas_value);
+        if (st == MemcacheResponse::STATUS_SUCCESS) {
+            const uint32_t raw_flags = butil::HostToNet32(flags);
+            AppendMemcacheResponse(appender, req, st, cas_value, &raw_flags,
+                                   sizeof(raw_flags), resp_key, value);
+        } else if (!(quiet && st == MemcacheResponse::STATUS_KEY_ENOENT)) {
+            // Misses of quiet GETs are not responded.
+            AppendMemcacheError(appender, req, st, resp_key);
+        }
+        return;
+    }
+    case MC_BINARY_SET:
+    case MC_BINARY_SETQ:
+    case MC_BINARY_ADD:
+    case MC_BINARY_ADDQ:
+    case MC_BINARY_REPLACE:
+    case MC_BINARY_REPLACEQ:
+    case MC_BINARY_APPEND:
+    case MC_BINARY_APPENDQ:
+    case MC_BINARY_PREPEND:
+    case MC_BINARY_PREPENDQ: {
+        MemcacheService::StoreOperation op = MemcacheService::STORE_SET;
+        bool need_extras = true;
+        switch (req.command) {
+        case MC_BINARY_ADD: case MC_BINARY_ADDQ:
+            op = MemcacheService::STORE_ADD;
+            break;
+        case MC_BINARY_REPLACE: case MC_BINARY_REPLACEQ:
+            op = MemcacheService::STORE_REPLACE;
+            break;
+        case MC_BINARY_APPEND: case MC_BINARY_APPENDQ:
+            op = MemcacheService::STORE_APPEND;
+            need_extras = false;
+            break;
+        case MC_BINARY_PREPEND: case MC_BINARY_PREPENDQ:
+            op = MemcacheService::STORE_PREPEND;
+            need_extras = false;
+            break;
+        }
+        // APPEND/PREPEND must not have extras, but brpc clients send them
+        // anyway, just ignore.
+        MemcacheStoreExtras se = { 0, 0 };
+        if (req.extras_length == sizeof(se)) {
+            memcpy(&se, extras, sizeof(se));
+        } else if (need_extras || req.extras_length != 0) {
+            st = MemcacheResponse::STATUS_EINVAL;
+            break;
+        }
+        st = service->Store(op, key, *body, butil::NetToHost32(se.flags),
+                            butil::NetToHost32(se.exptime), req.cas_value,
+                            &cas_value);
+        break;
+    }
+    case MC_BINARY_DELETE:
+    case MC_BINARY_DELETEQ:
+        st = service->Delete(key, req.cas_value);
+        break;
+    case MC_BINARY_INCREMENT:
+    case MC_BINARY_INCREMENTQ:
+    case MC_BINARY_DECREMENT:
+    case MC_BINARY_DECREMENTQ: {
+        MemcacheCounterExtras ce;
+        if (req.extras_length != sizeof(ce)) {
+            st = MemcacheResponse::STATUS_EINVAL;
+            break;
+        }
+        memcpy(&ce, extras, sizeof(ce));
+        uint64_t new_value = 0;
+        st = service->Counter(req.command == MC_BINARY_INCREMENT ||
+                              req.command == MC_BINARY_INCREMENTQ, key,
+                              butil::NetToHost64(ce.delta),
+                              butil::NetToHost64(ce.initial_value),
+                              butil::NetToHost32(ce.exptime),
+                              &new_value, &cas_value);
+        if (st == MemcacheResponse::STATUS_SUCCESS && !quiet) {
+            const uint64_t raw_value = butil::HostToNet64(new_value);
+            butil::IOBuf value;
+            value.append(&raw_value, sizeof(raw_value));
+            AppendMemcacheResponse(appender, req, st, cas_value, NULL, 0,
+                                   butil::StringPiece(), value);
+            return;
+        }
+        break;
+    }
+    case MC_BINARY_TOUCH: {
+        uint32_t exptime = 0;
+        if (req.extras_length != sizeof(exptime)) {
+            st = MemcacheResponse::STATUS_EINVAL;
+            break;
+        }
+        memcpy(&exptime, extras, sizeof(exptime));
+        st = service->Touch(key, butil::NetToHost32(exptime));
+        break;
+    }
+    case MC_BINARY_FLUSH:
+    case MC_BINARY_FLUSHQ: {
+        uint32_t exptime = 0;
+        if (req.extras_length == sizeof(exptime)) {
+            memcpy(&exptime, extras, sizeof(exptime));
+        } else if (req.extras_length != 0) {
+            st = MemcacheResponse::STATUS_EINVAL;
+            break;
+        }
+        st = service->Flush(butil::NetToHost32(exptime));
+        break;
+    }
+    case MC_BINARY_VERSION: {
+        std::string version;
+        st = service->Version(&version);
+        if (st == MemcacheResponse::STATUS_SUCCESS) {
+            butil::IOBuf value;
+            value.append(version);
+            AppendMemcacheResponse(appender, req, st, 0, NULL, 0,
+                                   butil::StringPiece(), value);
+            return;
+        }
+        break;
+    }
+    case MC_BINARY_NOOP:
+        break;
+    default:
+        st = MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+        break;
+    }
+    if (st != MemcacheResponse::STATUS_SUCCESS) {
+        AppendMemcacheError(appender, req, st, butil::StringPiece());
+    } else if (!quiet) {
+        AppendMemcacheResponse(appender, req, st, cas_value, NULL, 0,
+                               butil::StringPiece(), empty);
+    }
+}
+
+// Requests of a server-side connection. Batches of requests cut by
+// ParseMemcacheMessage() are queued here and run one after another by
+// ProcessMemcacheRequest(), so that responses are in the order of requests
+// even if messages of the connection are processed in different bthreads.
+class MemcacheServerContext : public Destroyable {
+public:
+    MemcacheServerContext() : _processing(false) {
+        pthread_mutex_init(&_mutex, NULL);
+    }
+    ~MemcacheServerContext() {
+        pthread_mutex_destroy(&_mutex);
+    }
+
+    // Queue `batch'. Returns true if the caller should process the queue.
+    bool Push(butil::IOBuf* batch) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        _pending.push_back(butil::IOBuf());
+        _pending.back().swap(*batch);
+        if (_processing) {
+            return false;
+        }
+        _processing = true;
+        return true;
+    }
+
+    // Get the first queued batch. Returns false and stops processing when
+    // the queue is empty.
+    bool Pop(butil::IOBuf* batch) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_pending.empty()) {
+            _processing = false;
+            return false;
+        }
+        batch->swap(_pending.front());
+        _pending.pop_front();
+        return true;
+    }
+
+    // @Destroyable
+    void Destroy() override { delete this; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MemcacheServerContext);
+
+    pthread_mutex_t _mutex;
+    bool _processing;
+    std::deque<butil::IOBuf> _pending;
+};
+
+// Cut all complete requests in `source' into one message.
+static ParseResult ParseMemcacheRequests(butil::IOBuf* source, Socket* socket) {
+    MemcacheServerContext* ctx =
+        static_cast<MemcacheServerContext*>(socket->parsing_context());
+    butil::IOBuf batch;
+    ParseResult result = MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+    while (true) {
+        const uint8_t* p_mcmagic = (const uint8_t*)source->fetch1();
+        if (NULL == p_mcmagic) {
+            break;
+        }
+        if (*p_mcmagic != (uint8_t)MC_MAGIC_REQUEST) {
+            // Requests were parsed on this connection, it's not others.
+            result = MakeParseError(ctx != NULL || !batch.empty() ?
+                                    PARSE_ERROR_ABSOLUTELY_WRONG :
+                                    PARSE_ERROR_TRY_OTHERS);
+            break;
+        }
+        char buf[24];
+        const MemcacheRequestHeader* header =
+            (const MemcacheRequestHeader*)source->fetch(buf, sizeof(buf));
+        if (NULL == header) {
+            break;
+        }
+        const uint32_t total_body_length = butil::NetToHost32(header->total_body_length);
+        if (total_body_length > FLAGS_max_body_size) {
+            LOG(ERROR) << "body_size=" << total_body_length << " from "
+                       << socket->remote_side() << " is too large";
+            result = MakeParseError(PARSE_ERROR_TOO_BIG_DATA);
+            break;
+        }
+        if (source->size() < sizeof(*header) + total_body_length) {
+            break;
+        }
+        source->cutn(&batch, sizeof(*header) + total_body_length);
+    }
+    if (batch.empty()) {
+        return result;
+    }
+    if (ctx == NULL) {
+        ctx = new MemcacheServerContext;
+        socket->reset_parsing_context(ctx);
+    }
+    if (!ctx->Push(&batch)) {
+        // ProcessMemcacheRequest() of a former message is still running and
+        // will take the batch. Errors after the batch are found again in
+        // next parsing.
+        return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+    }
+    return MakeMessage(MostCommonMessage::Get());
+}
+
 ParseResult ParseMemcacheMessage(butil::IOBuf* source,
-                                 Socket* socket, bool /*read_eof*/, const void */*arg*/) {
+                                 Socket* socket, bool /*read_eof*/, const void* arg) {
+    const Server* server = static_cast<const Server*>(arg);
+    if (server) {
+        if (!server->options().memcache_service) {
+            return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+        }
+        return ParseMemcacheRequests(source, socket);
+    }
     while (1) {
         const uint8_t* p_mcmagic = (const uint8_t*)source->fetch1();
         if (NULL == p_mcmagic) {
@@ -137,6 +492,11 @@ ParseResult ParseMemcacheMessage(butil::IOBuf* source,
             DestroyingPtr<MostCommonMessage> auth_msg(
                  static_cast<MostCommonMessage*>(socket->release_parsing_context()));
             socket->GivebackPipelinedInfo(pi);
+        } else if (IsQuietCommand(header->command)) {
+            // Quiet commands are responded for GET hits and errors only,
+            // which are not counted and delivered along with the response
+            // of the next non-quiet command.
+            socket->GivebackPipelinedInfo(pi);
         } else {
             if (++msg->pi.count >= pi.count) {
                 CHECK_EQ(msg->pi.count, pi.count);
@@ -191,6 +551,49 @@ void ProcessMemcacheResponse(InputMessageBase* msg_base) {
     accessor.OnResponse(cid, saved_error);
 }
 
+void ProcessMemcacheRequest(InputMessageBase* msg_base) {
+    DestroyingPtr<MostCommonMessage> msg(static_cast<MostCommonMessage*>(msg_base));
+    SocketUniquePtr socket_guard(msg->ReleaseSocket());
+    Socket* socket = socket_guard.get();
+    const Server* server = static_cast<const Server*>(msg_base->arg());
+    MemcacheService* service = server->options().memcache_service;
+    // Created before the message and destroyed along with the socket.
+    MemcacheServerContext* ctx =
+        static_cast<MemcacheServerContext*>(socket->parsing_context());
+    butil::IOBuf batch;
+    while (ctx->Pop(&batch)) {
+        // Responses of all requests in the batch are sent in one write.
+        butil::IOBufAppender appender;
+        while (!batch.empty()) {
+            MemcacheRequestHeader header;
+            batch.cutn(&header, sizeof(header));
+            // endianness conversions.
+            const MemcacheRequestHeader local_header = {
+                header.magic,
+                header.command,
+                butil::NetToHost16(header.key_length),
+                header.extras_length,
+                header.data_type,
+                butil::NetToHost16(header.vbucket_id),
+                butil::NetToHost32(header.total_body_length),
+                butil::NetToHost32(header.opaque),
+                butil::NetToHost64(header.cas_value),
+            };
+            butil::IOBuf body;
+            batch.cutn(&body, local_header.total_body_length);
+            ProcessMemcacheCommand(service, local_header, &body, &appender);
+        }
+        butil::IOBuf sendbuf;
+        appender.move_to(sendbuf);
+        if (!sendbuf.empty()) {
+            Socket::WriteOptions wopt;
+            wopt.ignore_eovercrowded = true;
+            LOG_IF(WARNING, socket->Write(&sendbuf, &wopt) != 0)
+                << "Fail to send memcache response";
+        }
+    }
+}
+
 void SerializeMemcacheRequest(butil::IOBuf* buf,
                               Controller* cntl,
                               const google::protobuf::Message* request) {
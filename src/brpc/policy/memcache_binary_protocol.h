@@ -32,6 +32,10 @@ ParseResult ParseMemcacheMessage(butil::IOBuf* source, Socket *socket, bool read
 // Actions to a memcache response.
 void ProcessMemcacheResponse(InputMessageBase* msg);
 
+// Run requests cut by ParseMemcacheMessage() with
+// ServerOptions.memcache_service and send back the responses in order.
+void ProcessMemcacheRequest(InputMessageBase* msg);
+
 // Serialize a memcache request.
 void SerializeMemcacheRequest(butil::IOBuf* buf,
                               Controller* cntl,
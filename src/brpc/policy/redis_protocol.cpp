@@ -17,18 +17,21 @@
 
 //          Jiashun Zhu(zhujiashun2010@gmail.com)
 
+#include <deque>
 #include <google/protobuf/descriptor.h>         // MethodDescriptor
 #include <google/protobuf/message.h>            // Message
 #include <gflags/gflags.h>
 #include "butil/logging.h"                       // LOG()
 #include "butil/time.h"
 #include "butil/iobuf.h"                         // butil::IOBuf
+#include "butil/scoped_lock.h"
 #include "brpc/controller.h"               // Controller
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/socket.h"                   // Socket
 #include "brpc/server.h"                   // Server
 #include "brpc/details/server_private_accessor.h"
 #include "brpc/span.h"
+#include "brpc/shared_object.h"
 #include "brpc/redis.h"
 #include "brpc/redis_command.h"
 #include "brpc/policy/redis_protocol.h"
@@ -53,6 +56,134 @@ struct InputResponse : public InputMessageBase {
     }
 };
 
+// Replies of a connection waiting for asynchronous commands before them.
+// Replies are written into the socket strictly in the order of commands.
+// Shared by the connection and its in-flight asynchronous commands.
+class RedisReplyQueue : public SharedObject {
+public:
+    explicit RedisReplyQueue(SocketId id)
+        : _socket_id(id), _first_seq(0), _npending(0) {}
+
+    // True if some asynchronous commands of the connection are not done.
+    bool has_pending() const {
+        return _npending.load(butil::memory_order_acquire) != 0;
+    }
+
+    // Append replies that are already filled.
+    void PushReady(butil::IOBuf* replies);
+
+    // Reserve a place for the reply of an asynchronous command, returns
+    // the sequence to be passed to Complete().
+    uint64_t PushPending();
+
+    // Fill the reply reserved by PushPending().
+    void Complete(uint64_t seq, butil::IOBuf* reply);
+
+private:
+    struct Slot {
+        Slot() : ready(false) {}
+        bool ready;
+        butil::IOBuf buf;
+    };
+    // Write ready replies at front. Called with _mutex held so that replies
+    // enter the write queue of the socket in order.
+    void FlushReadyLocked();
+
+    SocketId _socket_id;
+    butil::Mutex _mutex;
+    std::deque<Slot> _slots;
+    // Sequence of _slots.front().
+    uint64_t _first_seq;
+    butil::atomic<int> _npending;
+};
+
+void RedisReplyQueue::PushReady(butil::IOBuf* replies) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (_slots.empty() || !_slots.back().ready) {
+        _slots.push_back(Slot());
+        _slots.back().ready = true;
+    }
+    _slots.back().buf.append(butil::IOBuf::Movable(*replies));
+    FlushReadyLocked();
+}
+
+uint64_t RedisReplyQueue::PushPending() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    _npending.fetch_add(1, butil::memory_order_relaxed);
+    _slots.push_back(Slot());
+    return _first_seq + _slots.size() - 1;
+}
+
+void RedisReplyQueue::Complete(uint64_t seq, butil::IOBuf* reply) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    Slot& slot = _slots[seq - _first_seq];
+    slot.ready = true;
+    slot.buf.swap(*reply);
+    FlushReadyLocked();
+    // Decrease after writing so that the parsing bthread seeing no pending
+    // commands writes following replies after this one.
+    _npending.fetch_sub(1, butil::memory_order_release);
+}
+
+void RedisReplyQueue::FlushReadyLocked() {
+    butil::IOBuf sendbuf;
+    while (!_slots.empty() && _slots.front().ready) {
+        sendbuf.append(butil::IOBuf::Movable(_slots.front().buf));
+        _slots.pop_front();
+        ++_first_seq;
+    }
+    if (sendbuf.empty()) {
+        return;
+    }
+    SocketUniquePtr ptr;
+    if (Socket::Address(_socket_id, &ptr) != 0) {
+        // The connection is broken, drop the replies.
+        return;
+    }
+    Socket::WriteOptions wopt;
+    wopt.ignore_eovercrowded = true;
+    LOG_IF(WARNING, ptr->Write(&sendbuf, &wopt) != 0)
+        << "Fail to send redis reply";
+}
+
+// Run by RedisAsyncCommandHandler when `output' is filled.
+class RedisAsyncDone : public google::protobuf::Closure {
+public:
+    RedisAsyncDone(RedisReplyQueue* queue,
+                   const std::vector<butil::StringPiece>& args)
+        : _queue(queue)
+        , _seq(queue->PushPending())
+        , output(&_arena) {
+        // `args' refers to the arena of the connection which is cleared
+        // after parsing, copy them.
+        this->args.reserve(args.size());
+        for (size_t i = 0; i < args.size(); ++i) {
+            // Round up to keep following allocations in the arena aligned.
+            char* d = (char*)_arena.allocate((args[i].size()/8 + 1) * 8);
+            memcpy(d, args[i].data(), args[i].size());
+            this->args.push_back(butil::StringPiece(d, args[i].size()));
+        }
+    }
+
+    void Run() override {
+        butil::IOBuf reply;
+        butil::IOBufAppender appender;
+        output.SerializeTo(&appender);
+        appender.move_to(reply);
+        _queue->Complete(_seq, &reply);
+        delete this;
+    }
+
+private:
+    butil::intrusive_ptr<RedisReplyQueue> _queue;
+    uint64_t _seq;
+    butil::Arena _arena;
+
+public:
+    std::vector<butil::StringPiece> args;
+    RedisReply output;
+};
+
 // This class is as parsing_context in socket.
 class RedisConnContext : public Destroyable  {
 public:
@@ -71,14 +202,37 @@ public:
     // >0 if command handler is run in batched mode.
     int batched_size;
 
+    // Created when the first asynchronous command arrives.
+    butil::intrusive_ptr<RedisReplyQueue> reply_queue;
+
     RedisCommandParser parser;
     butil::Arena arena;
 };
 
+// Send replies in `appender' to the client, after replies of pending
+// asynchronous commands if there're.
+static void SendReplies(RedisConnContext* ctx, Socket* socket,
+                        butil::IOBufAppender* appender) {
+    butil::IOBuf sendbuf;
+    appender->move_to(sendbuf);
+    if (sendbuf.empty()) {
+        return;
+    }
+    if (ctx->reply_queue != NULL && ctx->reply_queue->has_pending()) {
+        ctx->reply_queue->PushReady(&sendbuf);
+        return;
+    }
+    Socket::WriteOptions wopt;
+    wopt.ignore_eovercrowded = true;
+    LOG_IF(WARNING, socket->Write(&sendbuf, &wopt) != 0)
+        << "Fail to send redis reply";
+}
+
 int ConsumeCommand(RedisConnContext* ctx,
                    const std::vector<butil::StringPiece>& args,
                    bool flush_batched,
-                   butil::IOBufAppender* appender) {
+                   butil::IOBufAppender* appender,
+                   Socket* socket) {
     RedisReply output(&ctx->arena);
     RedisCommandHandlerResult result = REDIS_CMD_HANDLED;
     if (ctx->transaction_handler) {
@@ -90,7 +244,19 @@ int ConsumeCommand(RedisConnContext* ctx,
             return -1;
         }
     } else {
-        RedisCommandHandler* ch = ctx->redis_service->FindCommandHandler(args[0]);
+        RedisAsyncCommandHandler* ach = NULL;
+        RedisCommandHandler* ch =
+            ctx->redis_service->FindCommandHandler(args[0], &ach);
+        if (ach != NULL && ctx->batched_size == 0) {
+            if (ctx->reply_queue == NULL) {
+                ctx->reply_queue.reset(new RedisReplyQueue(socket->id()));
+            }
+            // Replies of previous commands must go first.
+            SendReplies(ctx, socket, appender);
+            RedisAsyncDone* done = new RedisAsyncDone(ctx->reply_queue.get(), args);
+            ach->RunAsync(done->args, &done->output, done);
+            return 0;
+        }
         if (!ch) {
             char buf[64];
             snprintf(buf, sizeof(buf), "ERR unknown command `%s`", args[0].as_string().c_str());
@@ -173,22 +339,16 @@ ParseResult ParseRedisMessage(butil::IOBuf* source, Socket* socket,
             if (err != PARSE_OK) {
                 break;
             }
-            if (ConsumeCommand(ctx, current_args, false, &appender) != 0) {
+            if (ConsumeCommand(ctx, current_args, false, &appender, socket) != 0) {
                 return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
             }
             current_args.swap(next_args);
         }
         if (ConsumeCommand(ctx, current_args,
-                    true /*must be the last message*/, &appender) != 0) {
+                    true /*must be the last message*/, &appender, socket) != 0) {
             return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
         }
-        butil::IOBuf sendbuf;
-        appender.move_to(sendbuf);
-        CHECK(!sendbuf.empty());
-        Socket::WriteOptions wopt;
-        wopt.ignore_eovercrowded = true;
-        LOG_IF(WARNING, socket->Write(&sendbuf, &wopt) != 0)
-            << "Fail to send redis reply";
+        SendReplies(ctx, socket, &appender);
         ctx->arena.clear();
         return MakeParseError(err);
     } else {
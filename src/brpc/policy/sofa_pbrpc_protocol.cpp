@@ -78,6 +78,9 @@ SofaCompressType CompressType2Sofa(CompressType type) {
     case COMPRESS_TYPE_LZ4:
         LOG(ERROR) << "sofa-pbrpc does not support LZ4";
         return SOFA_COMPRESS_TYPE_NONE;
+    case COMPRESS_TYPE_ZSTD:
+        LOG(ERROR) << "sofa-pbrpc does not support Zstd";
+        return SOFA_COMPRESS_TYPE_NONE;
     default:
         LOG(ERROR) << "Unknown SofaCompressType=" << type;
         return SOFA_COMPRESS_TYPE_NONE;
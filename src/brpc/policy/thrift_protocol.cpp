@@ -35,7 +35,8 @@
 #include "brpc/details/usercode_backup_pool.h"
 
 #include <thrift/Thrift.h>
-#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TVirtualTransport.h>
+#include <thrift/transport/TTransportException.h>
 #include <thrift/protocol/TBinaryProtocol.h>
 #include <thrift/TApplicationException.h>
 
@@ -120,17 +121,115 @@ WriteThriftMessageBegin(char* buf,
     *p = htonl(seq_id);
 }
 
+// Read thrift data from blocks of an IOBuf directly rather than copying the
+// IOBuf into a TMemoryBuffer first. Strings are borrowed from the blocks when
+// they're not across blocks.
+class ThriftIOBufReader : public ::apache::thrift::transport::TVirtualTransport<
+    ThriftIOBufReader> {
+public:
+    explicit ThriftIOBufReader(const butil::IOBuf& buf)
+        : _buf(buf), _block(0) {}
+
+    uint32_t read(uint8_t* buf, uint32_t len) {
+        uint32_t nc = 0;
+        while (nc < len) {
+            if (_cur.empty() && !NextBlock()) {
+                break;
+            }
+            const size_t n = std::min((size_t)(len - nc), _cur.size());
+            memcpy(buf + nc, _cur.data(), n);
+            _cur.remove_prefix(n);
+            nc += n;
+        }
+        return nc;
+    }
+
+    // Hide the one calling virtual read().
+    uint32_t readAll(uint8_t* buf, uint32_t len) {
+        if (_cur.size() >= len) {
+            memcpy(buf, _cur.data(), len);
+            _cur.remove_prefix(len);
+            return len;
+        }
+        if (read(buf, len) != len) {
+            throw ::apache::thrift::transport::TTransportException(
+                ::apache::thrift::transport::TTransportException::END_OF_FILE,
+                "No more data to read.");
+        }
+        return len;
+    }
+
+    const uint8_t* borrow(uint8_t* /*buf*/, uint32_t* len) {
+        if (_cur.empty()) {
+            NextBlock();
+        }
+        if (_cur.size() < *len) {
+            return NULL;
+        }
+        *len = (uint32_t)std::min(_cur.size(), (size_t)UINT32_MAX);
+        return (const uint8_t*)_cur.data();
+    }
+
+    // Always called after a successful borrow().
+    void consume(uint32_t len) { _cur.remove_prefix(len); }
+
+private:
+    bool NextBlock() {
+        while (_block < _buf.backing_block_num()) {
+            _cur = _buf.backing_block(_block++);
+            if (!_cur.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const butil::IOBuf& _buf;
+    size_t _block;
+    // Unread part of the current block.
+    butil::StringPiece _cur;
+};
+
+// Write thrift data into IOBuf directly rather than into a TMemoryBuffer
+// which has to be copied into IOBuf again.
+class ThriftIOBufWriter : public ::apache::thrift::transport::TVirtualTransport<
+    ThriftIOBufWriter> {
+public:
+    void write(const uint8_t* buf, uint32_t len) { _appender.append(buf, len); }
+
+    // Append a frame of written data to `out'.
+    void MoveFrameTo(butil::IOBuf* out) {
+        butil::IOBuf body;
+        _appender.move_to(body);
+        const thrift_head_t head = { htonl(body.size()) };
+        out->append(&head, sizeof(head));
+        out->append(butil::IOBuf::Movable(body));
+    }
+
+private:
+    butil::IOBufAppender _appender;
+};
+
+typedef ::apache::thrift::protocol::TBinaryProtocolT<ThriftIOBufReader>
+ThriftIOBufInputProtocol;
+typedef ::apache::thrift::protocol::TBinaryProtocolT<ThriftIOBufWriter>
+ThriftIOBufOutputProtocol;
+
+// Protocols take shared_ptr of transports which are on stack here.
+struct DoNothingDeleter {
+    void operator()(void*) const {}
+};
+
+template <typename T>
+inline THRIFT_STDCXX::shared_ptr<T> UnownedTransport(T* transport) {
+    return THRIFT_STDCXX::shared_ptr<T>(transport, DoNothingDeleter());
+}
+
 bool ReadThriftStruct(const butil::IOBuf& body,
                       ThriftMessageBase* raw_msg,
                       int16_t expected_fid) {
-    const size_t body_len  = body.size();
-    uint8_t* thrift_buffer = (uint8_t*)malloc(body_len);
-    body.copy_to(thrift_buffer, body_len);
-    auto in_buffer =
-        THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>(
-            thrift_buffer, body_len,
-            ::apache::thrift::transport::TMemoryBuffer::TAKE_OWNERSHIP);
-    apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> iprot(in_buffer);
+    ThriftIOBufReader reader(body);
+    ThriftIOBufInputProtocol iprot(UnownedTransport(&reader));
 
     // The following code was taken from thrift auto generate code
     std::string fname;
@@ -160,24 +259,15 @@ bool ReadThriftStruct(const butil::IOBuf& body,
     }
 
     xfer += iprot.readStructEnd();
-    iprot.getTransport()->readEnd();
     return success;
 }
 
 void ReadThriftException(const butil::IOBuf& body,
                          ::apache::thrift::TApplicationException* x) {
-    size_t body_len  = body.size();
-    uint8_t* thrift_buffer = (uint8_t*)malloc(body_len);
-    body.copy_to(thrift_buffer, body_len);
-    auto in_buffer =
-        THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>(
-            thrift_buffer, body_len,
-            ::apache::thrift::transport::TMemoryBuffer::TAKE_OWNERSHIP);
-    apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> iprot(in_buffer);
-
+    ThriftIOBufReader reader(body);
+    ThriftIOBufInputProtocol iprot(UnownedTransport(&reader));
     x->read(&iprot);
     iprot.readMessageEnd();
-    iprot.getTransport()->readEnd();
 }
 
 // The continuation of request processing. Namely send response back to client.
@@ -280,27 +370,17 @@ void ThriftClosure::DoRun() {
 
     // The following code was taken and modified from thrift auto generated code
     if (_controller.Failed()) {
-        auto out_buffer =
-            THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>();
-        apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> oprot(out_buffer);
+        ThriftIOBufWriter writer;
+        ThriftIOBufOutputProtocol oprot(UnownedTransport(&writer));
         ::apache::thrift::TApplicationException x(_controller.ErrorText());
         oprot.writeMessageBegin(
             method_name, ::apache::thrift::protocol::T_EXCEPTION, seq_id);
         x.write(&oprot);
         oprot.writeMessageEnd();
-        oprot.getTransport()->writeEnd();
-        oprot.getTransport()->flush();
-
-        uint8_t* buf;
-        uint32_t sz;
-        out_buffer->getBuffer(&buf, &sz);
-        const thrift_head_t head = { htonl(sz) };
-        write_buf.append(&head, sizeof(head));
-        write_buf.append(buf, sz);
+        writer.MoveFrameTo(&write_buf);
     } else if (_response.raw_instance()) {
-        auto out_buffer =
-            THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>();
-        apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> oprot(out_buffer);
+        ThriftIOBufWriter writer;
+        ThriftIOBufOutputProtocol oprot(UnownedTransport(&writer));
         oprot.writeMessageBegin(
             method_name, ::apache::thrift::protocol::T_REPLY, seq_id);
 
@@ -315,15 +395,7 @@ void ThriftClosure::DoRun() {
         xfer += oprot.writeStructEnd();
 
         oprot.writeMessageEnd();
-        oprot.getTransport()->writeEnd();
-        oprot.getTransport()->flush();
-
-        uint8_t* buf;
-        uint32_t sz;
-        out_buffer->getBuffer(&buf, &sz);
-        const thrift_head_t head = { htonl(sz) };
-        write_buf.append(&head, sizeof(head));
-        write_buf.append(buf, sz);
+        writer.MoveFrameTo(&write_buf);
     } else {
         const size_t mb_size = ThriftMessageBeginSize(method_name);
         char buf[sizeof(thrift_head_t) + mb_size];
@@ -601,7 +673,12 @@ void ProcessThriftResponse(InputMessageBase* msg_base) {
             cntl->SetFailed(ERESPONSE, "message_type is not T_REPLY");
             break;
         }
-        if (fname != cntl->thrift_method_name()) {
+        // Requests of TMultiplexedProtocol are named "service:method" while
+        // responses are named "method".
+        const std::string& req_name = cntl->thrift_method_name();
+        const size_t colon_pos = req_name.find(':');
+        if (colon_pos == std::string::npos ? fname != req_name :
+            butil::StringPiece(req_name).substr(colon_pos + 1) != fname) {
             cntl->SetFailed(ERESPONSE,
                             "response.method_name=%s does not match request.method_name=%s",
                             fname.c_str(), cntl->thrift_method_name().c_str());
@@ -668,9 +745,8 @@ void SerializeThriftRequest(butil::IOBuf* request_buf, Controller* cntl,
 
     // xxx_pargs write
     if (req->raw_instance()) {
-        auto out_buffer =
-            THRIFT_STDCXX::make_shared<apache::thrift::transport::TMemoryBuffer>();
-        apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer> oprot(out_buffer);
+        ThriftIOBufWriter writer;
+        ThriftIOBufOutputProtocol oprot(UnownedTransport(&writer));
 
         oprot.writeMessageBegin(
             method_name, ::apache::thrift::protocol::T_CALL, 0/*seq_id*/);
@@ -697,16 +773,7 @@ void SerializeThriftRequest(butil::IOBuf* request_buf, Controller* cntl,
         xfer += oprot.writeStructEnd();
 
         oprot.writeMessageEnd();
-        oprot.getTransport()->writeEnd();
-        oprot.getTransport()->flush();
-
-        uint8_t* buf;
-        uint32_t sz;
-        out_buffer->getBuffer(&buf, &sz);
-
-        const thrift_head_t head = { htonl(sz) };
-        request_buf->append(&head, sizeof(head));
-        request_buf->append(buf, sz);
+        writer.MoveFrameTo(request_buf);
     } else {
         const size_t mb_size = ThriftMessageBeginSize(method_name);
         char buf[sizeof(thrift_head_t) + mb_size];
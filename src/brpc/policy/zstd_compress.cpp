@@ -0,0 +1,304 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+
+#include <zstd.h>                              // ZSTD_*
+#include <map>
+#include "butil/logging.h"
+#include "butil/thread_local.h"
+#include "brpc/policy/zstd_compress.h"
+#include "brpc/protocol.h"
+
+
+namespace brpc {
+namespace policy {
+
+// Enough to hold the largest frame header(ZSTD_FRAMEHEADERSIZE_MAX).
+static const size_t ZSTD_FRAME_HEADER_SIZE_MAX = 18;
+// Faster than the default level and good enough for RPC payloads.
+static const int ZSTD_COMPRESS_LEVEL = 1;
+
+struct ZstdDictionary {
+    unsigned id;
+    ZSTD_CDict* cdict;
+    ZSTD_DDict* ddict;
+};
+
+// Dictionaries are registered before any RPC and never removed, thus the
+// maps are read without locks.
+typedef std::map<std::string, ZstdDictionary*> ZstdDictNameMap;
+typedef std::map<unsigned, ZstdDictionary*> ZstdDictIdMap;
+static ZstdDictNameMap* s_dict_by_name = NULL;
+static ZstdDictIdMap* s_dict_by_id = NULL;
+
+int RegisterZstdDictionary(const std::string& message_name,
+                           const std::string& dict) {
+    if (message_name.empty() || dict.empty()) {
+        LOG(ERROR) << "message_name or dict is empty";
+        return -1;
+    }
+    if (s_dict_by_name == NULL) {
+        s_dict_by_name = new ZstdDictNameMap;
+        s_dict_by_id = new ZstdDictIdMap;
+    }
+    if (s_dict_by_name->find(message_name) != s_dict_by_name->end()) {
+        LOG(ERROR) << "Zstd dictionary of " << message_name
+                   << " was registered";
+        return -1;
+    }
+    // Dictionaries trained by `zstd --train' or ZDICT_trainFromBuffer carry
+    // ids which are written into frames, raw-content dictionaries don't and
+    // can't be found by the decompressing side.
+    const unsigned id = ZSTD_getDictID_fromDict(dict.data(), dict.size());
+    if (id == 0) {
+        LOG(ERROR) << "Zstd dictionary of " << message_name
+                   << " has no id, train it with `zstd --train'";
+        return -1;
+    }
+    ZstdDictIdMap::iterator it = s_dict_by_id->find(id);
+    if (it != s_dict_by_id->end()) {
+        // Share the dictionary between message types.
+        (*s_dict_by_name)[message_name] = it->second;
+        return 0;
+    }
+    ZstdDictionary* d = new ZstdDictionary;
+    d->id = id;
+    d->cdict = ZSTD_createCDict(dict.data(), dict.size(), ZSTD_COMPRESS_LEVEL);
+    d->ddict = ZSTD_createDDict(dict.data(), dict.size());
+    if (d->cdict == NULL || d->ddict == NULL) {
+        LOG(ERROR) << "Fail to create Zstd dictionary of " << message_name;
+        ZSTD_freeCDict(d->cdict);
+        ZSTD_freeDDict(d->ddict);
+        delete d;
+        return -1;
+    }
+    (*s_dict_by_name)[message_name] = d;
+    (*s_dict_by_id)[id] = d;
+    return 0;
+}
+
+static const ZstdDictionary* FindDictionaryByName(const std::string& name) {
+    if (s_dict_by_name == NULL) {
+        return NULL;
+    }
+    ZstdDictNameMap::const_iterator it = s_dict_by_name->find(name);
+    return (it != s_dict_by_name->end() ? it->second : NULL);
+}
+
+static const ZstdDictionary* FindDictionaryById(unsigned id) {
+    if (s_dict_by_id == NULL) {
+        return NULL;
+    }
+    ZstdDictIdMap::const_iterator it = s_dict_by_id->find(id);
+    return (it != s_dict_by_id->end() ? it->second : NULL);
+}
+
+// Zstd contexts own large workspaces, reuse them within the thread.
+struct ZstdContexts {
+    ZSTD_CCtx* cctx;
+    ZSTD_DCtx* dctx;
+
+    ZstdContexts() : cctx(NULL), dctx(NULL) {}
+    ~ZstdContexts() {
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+    }
+};
+
+static BAIDU_THREAD_LOCAL ZstdContexts* tls_zstd_ctx = NULL;
+
+static ZstdContexts* GetZstdContexts() {
+    ZstdContexts* ctx = tls_zstd_ctx;
+    if (ctx == NULL) {
+        ctx = new (std::nothrow) ZstdContexts;
+        if (ctx == NULL) {
+            return NULL;
+        }
+        tls_zstd_ctx = ctx;
+        butil::thread_atexit(butil::delete_object<ZstdContexts>, ctx);
+    }
+    return ctx;
+}
+
+static bool ZstdCompressIOBuf(const butil::IOBuf& in, butil::IOBuf* out,
+                              const ZstdDictionary* dict) {
+    ZstdContexts* ctx = GetZstdContexts();
+    if (ctx == NULL) {
+        return false;
+    }
+    if (ctx->cctx == NULL) {
+        ctx->cctx = ZSTD_createCCtx();
+        if (ctx->cctx == NULL) {
+            LOG(WARNING) << "Fail to create ZSTD_CCtx";
+            return false;
+        }
+    }
+    ZSTD_CCtx* cctx = ctx->cctx;
+    ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+    size_t rc = 0;
+    if (dict) {
+        rc = ZSTD_CCtx_refCDict(cctx, dict->cdict);
+    } else {
+        rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                                    ZSTD_COMPRESS_LEVEL);
+    }
+    if (ZSTD_isError(rc)) {
+        LOG(WARNING) << "Fail to init ZSTD_CCtx: " << ZSTD_getErrorName(rc);
+        return false;
+    }
+    // Let zstd size its window and tables by the input.
+    ZSTD_CCtx_setPledgedSrcSize(cctx, in.size());
+
+    butil::IOBufAsZeroCopyOutputStream stream(out);
+    ZSTD_outBuffer output = { NULL, 0, 0 };
+    // Compress backing blocks of `in' one by one without flattening.
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; i <= nblock; ++i) {
+        const bool last = (i == nblock);
+        butil::StringPiece blk;
+        if (!last) {
+            blk = in.backing_block(i);
+        }
+        ZSTD_inBuffer input = { blk.data(), blk.size(), 0 };
+        const ZSTD_EndDirective mode = (last ? ZSTD_e_end : ZSTD_e_continue);
+        do {
+            if (output.pos == output.size) {
+                void* data = NULL;
+                int size = 0;
+                if (!stream.Next(&data, &size)) {
+                    return false;
+                }
+                output.dst = data;
+                output.size = size;
+                output.pos = 0;
+            }
+            rc = ZSTD_compressStream2(cctx, &output, &input, mode);
+            if (ZSTD_isError(rc)) {
+                stream.BackUp(output.size - output.pos);
+                LOG(WARNING) << "Fail to compress: " << ZSTD_getErrorName(rc);
+                return false;
+            }
+            // ZSTD_e_end returns 0 when the frame is completely flushed.
+        } while (last ? rc != 0 : input.pos < input.size);
+    }
+    stream.BackUp(output.size - output.pos);
+    return true;
+}
+
+static bool ZstdDecompressIOBuf(const butil::IOBuf& in, butil::IOBuf* out) {
+    ZstdContexts* ctx = GetZstdContexts();
+    if (ctx == NULL) {
+        return false;
+    }
+    if (ctx->dctx == NULL) {
+        ctx->dctx = ZSTD_createDCtx();
+        if (ctx->dctx == NULL) {
+            LOG(WARNING) << "Fail to create ZSTD_DCtx";
+            return false;
+        }
+    }
+    ZSTD_DCtx* dctx = ctx->dctx;
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters);
+    char header[ZSTD_FRAME_HEADER_SIZE_MAX];
+    const size_t header_size = in.copy_to(header, sizeof(header));
+    const unsigned dict_id = ZSTD_getDictID_fromFrame(header, header_size);
+    if (dict_id != 0) {
+        const ZstdDictionary* dict = FindDictionaryById(dict_id);
+        if (dict == NULL) {
+            LOG(WARNING) << "Unknown Zstd dictionary id=" << dict_id;
+            return false;
+        }
+        ZSTD_DCtx_refDDict(dctx, dict->ddict);
+    }
+
+    butil::IOBufAsZeroCopyOutputStream stream(out);
+    ZSTD_outBuffer output = { NULL, 0, 0 };
+    size_t rc = 1;
+    const size_t nblock = in.backing_block_num();
+    for (size_t i = 0; i < nblock; ++i) {
+        butil::StringPiece blk = in.backing_block(i);
+        ZSTD_inBuffer input = { blk.data(), blk.size(), 0 };
+        // Keep calling until the input is consumed and the output is not
+        // full, which means zstd has nothing buffered internally.
+        while (input.pos < input.size || output.pos == output.size) {
+            if (rc == 0) {
+                if (input.pos == input.size) {
+                    break;
+                }
+                // A complete frame was decoded but input remains.
+                stream.BackUp(output.size - output.pos);
+                LOG(WARNING) << "Unexpected data after Zstd frame";
+                return false;
+            }
+            if (output.pos == output.size) {
+                void* data = NULL;
+                int size = 0;
+                if (!stream.Next(&data, &size)) {
+                    return false;
+                }
+                output.dst = data;
+                output.size = size;
+                output.pos = 0;
+            }
+            rc = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(rc)) {
+                stream.BackUp(output.size - output.pos);
+                LOG(WARNING) << "Fail to decompress: " << ZSTD_getErrorName(rc);
+                return false;
+            }
+        }
+    }
+    stream.BackUp(output.size - output.pos);
+    if (rc != 0) {
+        LOG(WARNING) << "Zstd frame is truncated";
+        return false;
+    }
+    return true;
+}
+
+bool ZstdCompress(const google::protobuf::Message& res, butil::IOBuf* buf) {
+    butil::IOBuf serialized_pb;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
+    if (res.SerializeToZeroCopyStream(&wrapper)) {
+        return ZstdCompressIOBuf(
+            serialized_pb, buf,
+            FindDictionaryByName(res.GetDescriptor()->full_name()));
+    }
+    LOG(WARNING) << "Fail to serialize input pb=" << &res;
+    return false;
+}
+
+bool ZstdDecompress(const butil::IOBuf& data, google::protobuf::Message* req) {
+    butil::IOBuf binary_pb;
+    if (ZstdDecompressIOBuf(data, &binary_pb)) {
+        return ParsePbFromIOBuf(req, binary_pb);
+    }
+    LOG(WARNING) << "Fail to ZstdDecompress, size=" << data.size();
+    return false;
+}
+
+bool ZstdCompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    return ZstdCompressIOBuf(in, out, NULL);
+}
+
+bool ZstdDecompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    return ZstdDecompressIOBuf(in, out);
+}
+
+}  // namespace policy
+} // namespace brpc
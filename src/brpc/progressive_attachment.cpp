@@ -224,6 +224,14 @@ void ProgressiveAttachment::MarkRPCAsDone(bool rpc_failed) {
     } while (true);
 }
 
+int ProgressiveAttachment::WaitWritable(const timespec* abstime) {
+    if (!_httpsock) {
+        errno = EINVAL;
+        return -1;
+    }
+    return _httpsock->WaitWritable(abstime);
+}
+
 butil::EndPoint ProgressiveAttachment::remote_side() const {
     return _httpsock ? _httpsock->remote_side() : butil::EndPoint();
 }
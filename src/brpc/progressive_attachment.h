@@ -39,6 +39,14 @@ public:
     int Write(const butil::IOBuf& data);
     int Write(const void* data, size_t n);
 
+    // Wait until the underlying connection is not overcrowded, or broken,
+    // or `abstime' is reached(NULL means no timeout). Call this after Write()
+    // failed with EOVERCROWDED instead of retrying in a loop. Before the RPC
+    // is done, data is buffered rather than written, thus this function
+    // returns immediately.
+    // Returns 0 when writable, -1 otherwise and errno is set.
+    int WaitWritable(const timespec* abstime = NULL);
+
     // Get ip/port of peer/self.
     butil::EndPoint remote_side() const;
     butil::EndPoint local_side() const;
@@ -20,6 +20,7 @@
 #include <gflags/gflags.h>
 #include "butil/status.h"
 #include "butil/strings/string_util.h"          // StringToLowerASCII
+#include "bthread/countdown_event.h"
 #include "brpc/redis.h"
 #include "brpc/redis_command.h"
 
@@ -443,21 +444,56 @@ bool RedisService::AddCommandHandler(const std::string& name, RedisCommandHandle
         LOG(ERROR) << "redis command name=" << name << " exist";
         return false;
     }
-    _command_map[lcname] = handler;
+    HandlerEntry& entry = _command_map[lcname];
+    entry.handler = handler;
+    entry.async_handler = dynamic_cast<RedisAsyncCommandHandler*>(handler);
     return true;
 }
  
 RedisCommandHandler* RedisService::FindCommandHandler(const butil::StringPiece& name) const {
     auto it = _command_map.find(name.as_string());
     if (it != _command_map.end()) {
-        return it->second;
+        return it->second.handler;
     }
     return NULL;
 }
 
+RedisCommandHandler* RedisService::FindCommandHandler(
+    const butil::StringPiece& name,
+    RedisAsyncCommandHandler** async_handler) const {
+    auto it = _command_map.find(name.as_string());
+    if (it != _command_map.end()) {
+        *async_handler = it->second.async_handler;
+        return it->second.handler;
+    }
+    *async_handler = NULL;
+    return NULL;
+}
+
 RedisCommandHandler* RedisCommandHandler::NewTransactionHandler() {
     LOG(ERROR) << "NewTransactionHandler is not implemented";
     return NULL;
 }
 
+namespace {
+class WaitRedisAsyncDone : public google::protobuf::Closure {
+public:
+    WaitRedisAsyncDone() : _event(1) {}
+    void Run() override { _event.signal(); }
+    void wait() { _event.wait(); }
+private:
+    bthread::CountdownEvent _event;
+};
+} // namespace
+
+RedisCommandHandlerResult RedisAsyncCommandHandler::Run(
+    const std::vector<butil::StringPiece>& args,
+    brpc::RedisReply* output,
+    bool /*flush_batched*/) {
+    WaitRedisAsyncDone done;
+    RunAsync(args, output, &done);
+    done.wait();
+    return REDIS_CMD_HANDLED;
+}
+
 } // namespace brpc
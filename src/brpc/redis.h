@@ -214,6 +214,7 @@ std::ostream& operator<<(std::ostream& os, const RedisRequest&);
 std::ostream& operator<<(std::ostream& os, const RedisResponse&);
 
 class RedisCommandHandler;
+class RedisAsyncCommandHandler;
 
 // Container of CommandHandlers.
 // Assign an instance to ServerOption.redis_service to enable redis support. 
@@ -227,8 +228,18 @@ public:
     // This function should not be touched by user and used by brpc deverloper only.
     RedisCommandHandler* FindCommandHandler(const butil::StringPiece& name) const;
 
+    // Same as above, besides `async_handler' is set to the handler if it's a
+    // RedisAsyncCommandHandler, NULL otherwise.
+    RedisCommandHandler* FindCommandHandler(
+        const butil::StringPiece& name,
+        RedisAsyncCommandHandler** async_handler) const;
+
 private:
-    typedef std::unordered_map<std::string, RedisCommandHandler*> CommandMap;
+    struct HandlerEntry {
+        RedisCommandHandler* handler;
+        RedisAsyncCommandHandler* async_handler;
+    };
+    typedef std::unordered_map<std::string, HandlerEntry> CommandMap;
     CommandMap _command_map;
 };
 
@@ -282,6 +293,31 @@ public:
     virtual RedisCommandHandler* NewTransactionHandler();
 };
 
+// The Command handler which fills the reply asynchronously. User should
+// implement RunAsync().
+// Commands of a connection are still dispatched one by one, but the server
+// goes on parsing and dispatching following commands without waiting for
+// `done', so that slow commands(calling other RPC, reading disk...) don't
+// block the connection. Replies are always sent back in the same order as
+// the commands, no matter in which order the `done's are run.
+class RedisAsyncCommandHandler : public RedisCommandHandler {
+public:
+    // `args' and `output' are valid until `done->Run()' is called, which can
+    // be called in any thread after filling `output'. Don't block in this
+    // method, start the asynchronous operation and return instead.
+    // NOTE: Batching is not supported by asynchronous handlers, and commands
+    // inside a transaction are always run by the transaction handler.
+    virtual void RunAsync(const std::vector<butil::StringPiece>& args,
+                          brpc::RedisReply* output,
+                          google::protobuf::Closure* done) = 0;
+
+    // Call RunAsync() and wait for `done'. Used when the reply must be got
+    // synchronously, e.g. a batched process is in progress on the connection.
+    RedisCommandHandlerResult Run(const std::vector<butil::StringPiece>& args,
+                                  brpc::RedisReply* output,
+                                  bool flush_batched) override;
+};
+
 } // namespace brpc
 
 #endif  // BRPC_REDIS_H
@@ -0,0 +1,485 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "butil/logging.h"
+#include "butil/string_printf.h"
+#include "butil/strings/string_split.h"
+#include "bthread/bthread.h"
+#include "brpc/controller.h"
+#include "brpc/redis_command.h"
+#include "brpc/redis_cluster.h"
+
+
+namespace brpc {
+
+namespace {
+
+// CRC16-CCITT(XMODEM): polynomial 0x1021, initial value 0.
+struct Crc16Table {
+    Crc16Table() {
+        for (int i = 0; i < 256; ++i) {
+            uint16_t crc = (uint16_t)(i << 8);
+            for (int j = 0; j < 8; ++j) {
+                crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021)
+                                     : (uint16_t)(crc << 1);
+            }
+            table[i] = crc;
+        }
+    }
+    uint16_t table[256];
+};
+
+uint16_t Crc16(const char* data, size_t len) {
+    static const Crc16Table s_table;
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; ++i) {
+        crc = (uint16_t)((crc << 8) ^
+                         s_table.table[((crc >> 8) ^ (uint8_t)data[i]) & 0xFF]);
+    }
+    return crc;
+}
+
+// Index of the key deciding the slot in `args', -1 if there's no key.
+int KeyIndex(const std::vector<butil::StringPiece>& args) {
+    if (args.size() < 2) {
+        return -1;
+    }
+    // Name of the command is lowercased by RedisCommandParser.
+    if (args[0] == "eval" || args[0] == "evalsha") {
+        // EVAL script numkeys key [key ...] arg [arg ...]
+        return (args.size() >= 4 && args[2] != "0") ? 3 : -1;
+    }
+    return 1;
+}
+
+// Parse "MOVED <slot> <host:port>" or "ASK <slot> <host:port>".
+bool ParseRedirect(const butil::StringPiece& error, bool* ask,
+                   int* slot, std::string* addr) {
+    butil::StringPiece rest;
+    if (error.starts_with("MOVED ")) {
+        *ask = false;
+        rest = error.substr(6);
+    } else if (error.starts_with("ASK ")) {
+        *ask = true;
+        rest = error.substr(4);
+    } else {
+        return false;
+    }
+    const size_t space = rest.find(' ');
+    if (space == butil::StringPiece::npos || space + 1 >= rest.size()) {
+        return false;
+    }
+    char* endptr = NULL;
+    const std::string slot_str = rest.substr(0, space).as_string();
+    const long s = strtol(slot_str.c_str(), &endptr, 10);
+    if (*endptr != '\0' || s < 0 || s >= REDIS_CLUSTER_SLOT_COUNT) {
+        return false;
+    }
+    *slot = (int)s;
+    rest.substr(space + 1).CopyToString(addr);
+    return true;
+}
+
+// Commands of a RedisRequest sent to one node.
+struct SubCall {
+    Controller cntl;
+    RedisRequest request;
+    RedisResponse response;
+    // Indexes of commands in the original request, -1 for ASKING.
+    std::vector<int> indexes;
+};
+
+} // namespace
+
+int RedisClusterKeySlot(const butil::StringPiece& key) {
+    // Only the part between the first '{' and the following '}' is hashed
+    // if it's not empty, so that related keys can be put in the same slot.
+    const size_t start = key.find('{');
+    if (start != butil::StringPiece::npos) {
+        const size_t end = key.find('}', start + 1);
+        if (end != butil::StringPiece::npos && end != start + 1) {
+            return Crc16(key.data() + start + 1, end - start - 1) &
+                (REDIS_CLUSTER_SLOT_COUNT - 1);
+        }
+    }
+    return Crc16(key.data(), key.size()) & (REDIS_CLUSTER_SLOT_COUNT - 1);
+}
+
+RedisClusterChannelOptions::RedisClusterChannelOptions()
+    : max_redirect(5) {
+}
+
+RedisClusterChannel::RedisClusterChannel() {
+    memset(_slots, 0, sizeof(_slots));
+}
+
+RedisClusterChannel::~RedisClusterChannel() {
+    for (std::map<std::string, Channel*>::iterator
+             it = _nodes.begin(); it != _nodes.end(); ++it) {
+        delete it->second;
+    }
+    _nodes.clear();
+}
+
+int RedisClusterChannel::Init(const char* seeds,
+                              const RedisClusterChannelOptions* options) {
+    if (options) {
+        _options = *options;
+    }
+    _options.protocol = PROTOCOL_REDIS;
+    if (_options.max_redirect < 0) {
+        _options.max_redirect = 0;
+    }
+    butil::SplitString(seeds ? seeds : "", ',', &_seeds);
+    for (size_t i = 0; i < _seeds.size(); ) {
+        if (_seeds[i].empty()) {
+            _seeds.erase(_seeds.begin() + i);
+        } else {
+            ++i;
+        }
+    }
+    if (_seeds.empty()) {
+        LOG(ERROR) << "No seed nodes in `" << (seeds ? seeds : "") << "'";
+        return -1;
+    }
+    for (size_t i = 0; i < _seeds.size(); ++i) {
+        if (GetOrNewNode(_seeds[i]) == NULL) {
+            return -1;
+        }
+    }
+    return RefreshSlots();
+}
+
+Channel* RedisClusterChannel::GetOrNewNode(const std::string& addr) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    Channel*& node = _nodes[addr];
+    if (node == NULL) {
+        Channel* ch = new Channel;
+        if (ch->Init(addr.c_str(), &_options) != 0) {
+            LOG(ERROR) << "Fail to init channel to redis node=" << addr;
+            delete ch;
+            _nodes.erase(addr);
+            return NULL;
+        }
+        node = ch;
+    }
+    return node;
+}
+
+Channel* RedisClusterChannel::GetNodeOfSlot(int slot) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (slot >= 0 && _slots[slot] != NULL) {
+        return _slots[slot];
+    }
+    // The node replies MOVED if it does not own the slot.
+    return _nodes.empty() ? NULL : _nodes.begin()->second;
+}
+
+void RedisClusterChannel::SetNodeOfSlot(int slot, Channel* node) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    _slots[slot] = node;
+}
+
+int RedisClusterChannel::RefreshSlots() {
+    std::vector<std::string> addrs = _seeds;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        for (std::map<std::string, Channel*>::const_iterator
+                 it = _nodes.begin(); it != _nodes.end(); ++it) {
+            addrs.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < addrs.size(); ++i) {
+        Channel* node = GetOrNewNode(addrs[i]);
+        if (node == NULL) {
+            continue;
+        }
+        RedisRequest request;
+        RedisResponse response;
+        Controller cntl;
+        request.AddCommand("CLUSTER SLOTS");
+        node->CallMethod(NULL, &cntl, &request, &response, NULL);
+        if (cntl.Failed()) {
+            LOG(WARNING) << "Fail to get CLUSTER SLOTS from " << addrs[i]
+                         << ": " << cntl.ErrorText();
+            continue;
+        }
+        const RedisReply& slots = response.reply(0);
+        if (!slots.is_array()) {
+            LOG(WARNING) << "Invalid CLUSTER SLOTS from " << addrs[i]
+                         << ": " << slots;
+            continue;
+        }
+        // Every element is [start, end, [host, port, ...], replicas...]
+        std::vector<Channel*> new_slots(REDIS_CLUSTER_SLOT_COUNT, NULL);
+        bool ok = true;
+        for (size_t j = 0; ok && j < slots.size(); ++j) {
+            const RedisReply& range = slots[j];
+            if (!range.is_array() || range.size() < 3 ||
+                !range[0].is_integer() || !range[1].is_integer() ||
+                !range[2].is_array() || range[2].size() < 2 ||
+                !range[2][0].is_string() || !range[2][1].is_integer()) {
+                LOG(WARNING) << "Invalid slot range from " << addrs[i]
+                             << ": " << range;
+                ok = false;
+                break;
+            }
+            const int64_t start = range[0].integer();
+            const int64_t end = range[1].integer();
+            if (start < 0 || end >= REDIS_CLUSTER_SLOT_COUNT || start > end) {
+                LOG(WARNING) << "Invalid slot range [" << start << ", "
+                             << end << "] from " << addrs[i];
+                ok = false;
+                break;
+            }
+            std::string host = range[2][0].data().as_string();
+            if (host.empty()) {
+                // Empty host means the node being asked.
+                host = addrs[i].substr(0, addrs[i].rfind(':'));
+            }
+            const std::string addr = butil::string_printf(
+                "%s:%" PRId64, host.c_str(), range[2][1].integer());
+            Channel* owner = GetOrNewNode(addr);
+            if (owner == NULL) {
+                ok = false;
+                break;
+            }
+            for (int64_t s = start; s <= end; ++s) {
+                new_slots[s] = owner;
+            }
+        }
+        if (!ok) {
+            continue;
+        }
+        BAIDU_SCOPED_LOCK(_mutex);
+        std::copy(new_slots.begin(), new_slots.end(), _slots);
+        return 0;
+    }
+    LOG(ERROR) << "Fail to get CLUSTER SLOTS from any node";
+    return -1;
+}
+
+struct RedisClusterChannel::CallArgs {
+    RedisClusterChannel* channel;
+    Controller* cntl;
+    const RedisRequest* request;
+    RedisResponse* response;
+    google::protobuf::Closure* done;
+};
+
+void* RedisClusterChannel::RunCall(void* void_args) {
+    CallArgs* args = static_cast<CallArgs*>(void_args);
+    args->channel->Call(args->cntl, args->request, args->response);
+    args->done->Run();
+    delete args;
+    return NULL;
+}
+
+void RedisClusterChannel::CallMethod(
+    const google::protobuf::MethodDescriptor* /*method*/,
+    google::protobuf::RpcController* controller_base,
+    const google::protobuf::Message* request,
+    google::protobuf::Message* response,
+    google::protobuf::Closure* done) {
+    Controller* cntl = static_cast<Controller*>(controller_base);
+    const RedisRequest* req = dynamic_cast<const RedisRequest*>(request);
+    RedisResponse* res = dynamic_cast<RedisResponse*>(response);
+    if (req == NULL || res == NULL) {
+        cntl->SetFailed(EREQUEST, "RedisClusterChannel only accepts "
+                        "RedisRequest and RedisResponse");
+        if (done) {
+            done->Run();
+        }
+        return;
+    }
+    if (done == NULL) {
+        return Call(cntl, req, res);
+    }
+    CallArgs* args = new CallArgs;
+    args->channel = this;
+    args->cntl = cntl;
+    args->request = req;
+    args->response = res;
+    args->done = done;
+    bthread_t th;
+    if (bthread_start_background(&th, NULL, RunCall, args) != 0) {
+        LOG(FATAL) << "Fail to start bthread";
+        RunCall(args);
+    }
+}
+
+void RedisClusterChannel::Call(Controller* cntl, const RedisRequest* request,
+                               RedisResponse* response) {
+    // Split the pipeline into commands.
+    butil::IOBuf buf;
+    if (!request->SerializeTo(&buf)) {
+        cntl->SetFailed(EREQUEST, "Fail to serialize RedisRequest");
+        return;
+    }
+    butil::Arena arena;
+    RedisCommandParser parser;
+    std::vector<std::vector<butil::StringPiece> > commands;
+    while (!buf.empty()) {
+        commands.push_back(std::vector<butil::StringPiece>());
+        if (parser.Consume(buf, &commands.back(), &arena) != PARSE_OK) {
+            cntl->SetFailed(EREQUEST, "Fail to parse RedisRequest");
+            return;
+        }
+    }
+    const int ncommand = (int)commands.size();
+    std::vector<int> slots(ncommand, -1);
+    for (int i = 0; i < ncommand; ++i) {
+        const int key_index = KeyIndex(commands[i]);
+        if (key_index >= 0) {
+            slots[i] = RedisClusterKeySlot(commands[i][key_index]);
+        }
+    }
+
+    std::vector<butil::IOBuf> replies(ncommand);
+    // Target of ASK redirections, empty if the command goes to slot owner.
+    std::vector<std::string> ask_addrs(ncommand);
+    std::vector<int> pending(ncommand);
+    for (int i = 0; i < ncommand; ++i) {
+        pending[i] = i;
+    }
+    for (int round = 0; !pending.empty(); ++round) {
+        // Group commands by nodes and send the groups in parallel.
+        std::map<Channel*, SubCall*> groups;
+        for (size_t i = 0; i < pending.size(); ++i) {
+            const int index = pending[i];
+            Channel* node = (ask_addrs[index].empty() ?
+                             GetNodeOfSlot(slots[index]) :
+                             GetOrNewNode(ask_addrs[index]));
+            if (node == NULL) {
+                cntl->SetFailed(EHOSTDOWN, "No redis node for slot=%d",
+                                slots[index]);
+                break;
+            }
+            SubCall*& sub = groups[node];
+            if (sub == NULL) {
+                sub = new SubCall;
+                if (cntl->timeout_ms() != UNSET_MAGIC_NUM) {
+                    sub->cntl.set_timeout_ms(cntl->timeout_ms());
+                }
+            }
+            if (!ask_addrs[index].empty()) {
+                // The node accepts the command of a migrating slot only
+                // after ASKING.
+                sub->request.AddCommand("ASKING");
+                sub->indexes.push_back(-1);
+            }
+            sub->request.AddCommandByComponents(
+                &commands[index][0], commands[index].size());
+            sub->indexes.push_back(index);
+        }
+        if (!cntl->Failed()) {
+            for (std::map<Channel*, SubCall*>::iterator
+                     it = groups.begin(); it != groups.end(); ++it) {
+                SubCall* sub = it->second;
+                it->first->CallMethod(NULL, &sub->cntl, &sub->request,
+                                      &sub->response, DoNothing());
+            }
+            for (std::map<Channel*, SubCall*>::iterator
+                     it = groups.begin(); it != groups.end(); ++it) {
+                Join(it->second->cntl.call_id());
+            }
+        }
+        pending.clear();
+        for (std::map<Channel*, SubCall*>::iterator
+                 it = groups.begin(); it != groups.end(); ++it) {
+            SubCall* sub = it->second;
+            if (cntl->Failed()) {
+                delete sub;
+                continue;
+            }
+            if (sub->cntl.Failed()) {
+                cntl->SetFailed(sub->cntl.ErrorCode(), "Fail to access %s: %s",
+                                butil::endpoint2str(sub->cntl.remote_side()).c_str(),
+                                sub->cntl.ErrorText().c_str());
+                delete sub;
+                continue;
+            }
+            if (sub->response.reply_size() != (int)sub->indexes.size()) {
+                cntl->SetFailed(ERESPONSE, "Expected %d replies, actually %d",
+                                (int)sub->indexes.size(),
+                                sub->response.reply_size());
+                delete sub;
+                continue;
+            }
+            for (size_t i = 0; i < sub->indexes.size(); ++i) {
+                const int index = sub->indexes[i];
+                if (index < 0) {
+                    continue;
+                }
+                const RedisReply& reply = sub->response.reply(i);
+                ask_addrs[index].clear();
+                bool ask = false;
+                int slot = -1;
+                std::string addr;
+                if (reply.is_error() && round < _options.max_redirect &&
+                    ParseRedirect(reply.error_message(), &ask, &slot, &addr)) {
+                    if (ask) {
+                        ask_addrs[index] = addr;
+                        pending.push_back(index);
+                        continue;
+                    }
+                    Channel* owner = GetOrNewNode(addr);
+                    if (owner != NULL) {
+                        SetNodeOfSlot(slot, owner);
+                        pending.push_back(index);
+                        continue;
+                    }
+                }
+                butil::IOBufAppender appender;
+                reply.SerializeTo(&appender);
+                appender.move_to(replies[index]);
+            }
+            delete sub;
+        }
+        if (cntl->Failed()) {
+            return;
+        }
+    }
+
+    butil::IOBuf merged;
+    for (int i = 0; i < ncommand; ++i) {
+        merged.append(butil::IOBuf::Movable(replies[i]));
+    }
+    if (response->ConsumePartialIOBuf(merged, ncommand) != PARSE_OK) {
+        cntl->SetFailed(ERESPONSE, "Fail to merge replies from redis nodes");
+    }
+}
+
+void RedisClusterChannel::Describe(std::ostream& os,
+                                   const DescribeOptions&) const {
+    os << "RedisClusterChannel[seeds=";
+    for (size_t i = 0; i < _seeds.size(); ++i) {
+        if (i != 0) {
+            os << ',';
+        }
+        os << _seeds[i];
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    os << " nodes=" << _nodes.size() << ']';
+}
+
+int RedisClusterChannel::CheckHealth() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    return _nodes.empty() ? -1 : 0;
+}
+
+} // namespace brpc
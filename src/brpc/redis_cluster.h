@@ -0,0 +1,110 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_REDIS_CLUSTER_H
+#define BRPC_REDIS_CLUSTER_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "butil/strings/string_piece.h"
+#include "butil/synchronization/lock.h"
+#include "brpc/channel.h"
+#include "brpc/redis.h"
+
+
+namespace brpc {
+
+// Number of hash slots in a redis cluster.
+const int REDIS_CLUSTER_SLOT_COUNT = 16384;
+
+// Get the hash slot of `key' according to the redis cluster specification:
+// CRC16(XMODEM) of the key or of its hash tag ("{...}") modulo 16384.
+int RedisClusterKeySlot(const butil::StringPiece& key);
+
+struct RedisClusterChannelOptions : public ChannelOptions {
+    // Constructed with default values.
+    RedisClusterChannelOptions();
+
+    // Max number of MOVED/ASK redirections followed for a command. The
+    // error reply is returned to user when the limit is reached.
+    // Default: 5
+    int max_redirect;
+};
+
+// Access a redis cluster. Commands in a RedisRequest are routed to the nodes
+// owning the hash slots of their keys, pipelines involving multiple nodes
+// are split and sent to the nodes in parallel, and replies are merged back
+// in the same order as the commands. MOVED and ASK redirections are followed
+// transparently.
+// NOTE: Keys of a multi-key command(MGET, DEL k1 k2...) must be in the same
+// slot, as required by redis cluster. Commands without keys go to an
+// arbitrary node.
+class RedisClusterChannel : public ChannelBase {
+public:
+    RedisClusterChannel();
+    ~RedisClusterChannel();
+
+    // Initialize with comma-separated "host:port"s of some nodes of the
+    // cluster, which are used for fetching slots with CLUSTER SLOTS.
+    // protocol in `options' is always PROTOCOL_REDIS.
+    // Returns 0 on success, -1 otherwise.
+    int Init(const char* seeds, const RedisClusterChannelOptions* options);
+
+    // `request' and `response' must be RedisRequest and RedisResponse.
+    // The RPC fails if any sub call to the nodes fails.
+    void CallMethod(const google::protobuf::MethodDescriptor* method,
+                    google::protobuf::RpcController* controller,
+                    const google::protobuf::Message* request,
+                    google::protobuf::Message* response,
+                    google::protobuf::Closure* done);
+
+    // Fetch CLUSTER SLOTS from known nodes and replace the slot map.
+    // Called by Init(), call it again when the cluster is resharded
+    // massively. Returns 0 on success, -1 otherwise.
+    int RefreshSlots();
+
+    void Describe(std::ostream&, const DescribeOptions&) const;
+
+    int CheckHealth();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(RedisClusterChannel);
+
+    struct CallArgs;
+    static void* RunCall(void* arg);
+    void Call(Controller* cntl, const RedisRequest* request,
+              RedisResponse* response);
+
+    // Get the channel to the node at `addr', create it if not existing.
+    // Returns NULL on error.
+    Channel* GetOrNewNode(const std::string& addr);
+    // Get the node owning `slot' or any node if the owner is unknown.
+    Channel* GetNodeOfSlot(int slot);
+    void SetNodeOfSlot(int slot, Channel* node);
+
+    RedisClusterChannelOptions _options;
+    std::vector<std::string> _seeds;
+    mutable butil::Mutex _mutex;
+    std::map<std::string, Channel*> _nodes;
+    Channel* _slots[REDIS_CLUSTER_SLOT_COUNT];
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_REDIS_CLUSTER_H
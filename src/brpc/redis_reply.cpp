@@ -17,12 +17,20 @@
 
 
 #include <limits>
+#include <gflags/gflags.h>
 #include "butil/logging.h"
 #include "butil/string_printf.h"
+#include "brpc/reloadable_flags.h"
 #include "brpc/redis_reply.h"
 
 namespace brpc {
 
+DEFINE_int32(redis_reply_iobuf_min_size, 0,
+             "Bulk strings in redis replies not shorter than this value "
+             "reference the input IOBuf instead of being copied into arena, "
+             "0 means disabled");
+BRPC_VALIDATE_GFLAG(redis_reply_iobuf_min_size, NonNegativeInteger);
+
 //BAIDU_CASSERT(sizeof(RedisReply) == 24, size_match);
 const int RedisReply::npos = -1;
 
@@ -38,7 +46,25 @@ const char* RedisReplyTypeToString(RedisReplyType type) {
     }
 }
 
-bool RedisReply::SerializeTo(butil::IOBufAppender* appender) {
+static void DestroyIOBuf(void* arg) {
+    static_cast<butil::IOBuf*>(arg)->~IOBuf();
+}
+
+// Create an IOBuf on `arena' which is destroyed along with the arena.
+static butil::IOBuf* NewIOBufOnArena(butil::Arena* arena) {
+    void* mem = arena->allocate(sizeof(butil::IOBuf));
+    if (mem == NULL) {
+        return NULL;
+    }
+    butil::IOBuf* buf = new (mem) butil::IOBuf;
+    if (arena->add_cleanup(DestroyIOBuf, buf) != 0) {
+        buf->~IOBuf();
+        return NULL;
+    }
+    return buf;
+}
+
+bool RedisReply::SerializeTo(butil::IOBufAppender* appender) const {
     switch (_type) {
         case REDIS_REPLY_ERROR:
             // fall through
@@ -63,6 +89,8 @@ bool RedisReply::SerializeTo(butil::IOBufAppender* appender) {
             if (_length != npos) {
                 if (_length < (int)sizeof(_data.short_str)) {
                     appender->append(_data.short_str, _length);
+                } else if (_data.bulk.buf != NULL) {
+                    appender->append(*_data.bulk.buf);
                 } else {
                     appender->append(_data.long_str, _length);
                 }
@@ -141,7 +169,8 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
         CHECK_EQ(len, str.copy_to_cstr(d, (size_t)-1L, 1/*skip fc*/));
         _type = (fc == '-' ? REDIS_REPLY_ERROR : REDIS_REPLY_STATUS);
         _length = len;
-        _data.long_str = d;
+        _data.bulk.str = d;
+        _data.bulk.buf = NULL;
         return PARSE_OK;
     }
     case '$':   // Bulk String   "$<length>\r\n<string>\r\n"
@@ -192,6 +221,20 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
                 buf.pop_front(crlf_pos + 2);
                 buf.cutn(_data.short_str, len);
                 _data.short_str[len] = '\0';
+            } else if (FLAGS_redis_reply_iobuf_min_size > 0 &&
+                       len >= FLAGS_redis_reply_iobuf_min_size) {
+                // Reference the input, c_str() flattens it when needed.
+                butil::IOBuf* str = NewIOBufOnArena(_arena);
+                if (str == NULL) {
+                    LOG(FATAL) << "Fail to allocate IOBuf";
+                    return PARSE_ERROR_ABSOLUTELY_WRONG;
+                }
+                buf.pop_front(crlf_pos + 2/*CRLF*/);
+                buf.cutn(str, len);
+                _type = REDIS_REPLY_STRING;
+                _length = len;
+                _data.bulk.str = NULL;
+                _data.bulk.buf = str;
             } else {
                 char* d = (char*)_arena->allocate((len/8 + 1)*8);
                 if (d == NULL) {
@@ -203,7 +246,8 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
                 d[len] = '\0';
                 _type = REDIS_REPLY_STRING;
                 _length = len;
-                _data.long_str = d;
+                _data.bulk.str = d;
+                _data.bulk.buf = NULL;
             }
             char crlf[2];
             buf.cutn(crlf, sizeof(crlf));
@@ -320,7 +364,7 @@ void RedisReply::Print(std::ostream& os) const {
         if (_length < (int)sizeof(_data.short_str)) {
             os << RedisStringPrinter(_data.short_str, _length);
         } else {
-            os << RedisStringPrinter(_data.long_str, _length);
+            os << RedisStringPrinter(long_str(), _length);
         }
         os << '"';
         break;
@@ -347,7 +391,7 @@ void RedisReply::Print(std::ostream& os) const {
         if (_length < (int)sizeof(_data.short_str)) {
             os << RedisStringPrinter(_data.short_str, _length);
         } else {
-            os << RedisStringPrinter(_data.long_str, _length);
+            os << RedisStringPrinter(long_str(), _length);
         }
         break;
     default:
@@ -395,6 +439,16 @@ void RedisReply::CopyFromDifferentArena(const RedisReply& other) {
     case REDIS_REPLY_STATUS:
         if (_length < (int)sizeof(_data.short_str)) {
             memcpy(_data.short_str, other._data.short_str, _length + 1);
+        } else if (other._data.bulk.buf != NULL) {
+            // Share blocks with the IOBuf of `other'.
+            butil::IOBuf* buf = NewIOBufOnArena(_arena);
+            if (buf == NULL) {
+                LOG(FATAL) << "Fail to allocate IOBuf";
+                return;
+            }
+            *buf = *other._data.bulk.buf;
+            _data.bulk.str = NULL;
+            _data.bulk.buf = buf;
         } else {
             char* d = (char*)_arena->allocate((_length/8 + 1)*8);
             if (d == NULL) {
@@ -402,7 +456,8 @@ void RedisReply::CopyFromDifferentArena(const RedisReply& other) {
                 return;
             }
             memcpy(d, other._data.long_str, _length + 1);
-            _data.long_str = d;
+            _data.bulk.str = d;
+            _data.bulk.buf = NULL;
         }
         break;
     }
@@ -448,12 +503,70 @@ void RedisReply::SetStringImpl(const butil::StringPiece& str, RedisReplyType typ
         }
         memcpy(d, str.data(), size);
         d[size] = '\0';
-        _data.long_str = d;
+        _data.bulk.str = d;
+        _data.bulk.buf = NULL;
     }
     _type = type;
     _length = size;
 }
 
+void RedisReply::SetString(const butil::IOBuf& str) {
+    if (_type != REDIS_REPLY_NIL) {
+        Reset();
+    }
+    const size_t size = str.size();
+    if (size < sizeof(_data.short_str)) {
+        str.copy_to_cstr(_data.short_str);
+    } else {
+        butil::IOBuf* buf = NewIOBufOnArena(_arena);
+        if (buf == NULL) {
+            LOG(FATAL) << "Fail to allocate IOBuf";
+            return;
+        }
+        *buf = str;
+        _data.bulk.str = NULL;
+        _data.bulk.buf = buf;
+    }
+    _type = REDIS_REPLY_STRING;
+    _length = size;
+}
+
+void RedisReply::SetUserString(void* data, size_t size, void (*deleter)(void*)) {
+    butil::IOBuf buf;
+    if (buf.append_user_data(data, size, deleter) != 0) {
+        LOG(FATAL) << "Fail to append user data";
+        return;
+    }
+    SetString(buf);
+}
+
+void RedisReply::AppendDataTo(butil::IOBuf* out) const {
+    if (!is_string()) {
+        CHECK(false) << "The reply is " << RedisReplyTypeToString(_type)
+                     << ", not a string";
+        return;
+    }
+    if (_length < (int)sizeof(_data.short_str)) {
+        out->append(_data.short_str, _length);
+    } else if (_data.bulk.buf != NULL) {
+        out->append(*_data.bulk.buf);
+    } else {
+        out->append(_data.long_str, _length);
+    }
+}
+
+const char* RedisReply::FlattenIOBufString() const {
+    char* d = (char*)_arena->allocate((_length/8 + 1) * 8);
+    if (d == NULL) {
+        LOG(FATAL) << "Fail to allocate string[" << _length << "]";
+        return "";
+    }
+    _data.bulk.buf->copy_to_cstr(d);
+    // Cache the flattened data, the IOBuf is still used for serializing.
+    const_cast<RedisReply*>(this)->_data.bulk.str = d;
+    return d;
+}
+
 void RedisReply::FormatStringImpl(const char* fmt, va_list args, RedisReplyType type) {
     va_list copied_args;
     va_copy(copied_args, args);
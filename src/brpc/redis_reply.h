@@ -82,6 +82,16 @@ public:
     void SetString(const butil::StringPiece& str);
     void FormatString(const char* fmt, ...);
 
+    // Set this reply to a (bulk) string referencing `str'. Long strings are
+    // not copied into the arena and serialized by reference, which saves
+    // two copies for large values.
+    void SetString(const butil::IOBuf& str);
+
+    // Set this reply to a (bulk) string referencing user-owned `data' which
+    // is released by calling `deleter(data)' after the reply is serialized
+    // and sent. See IOBuf::append_user_data() for details.
+    void SetUserString(void* data, size_t size, void (*deleter)(void*));
+
     // Convert the reply into a signed 64-bit integer(according to
     // http://redis.io/topics/protocol). If the reply is not an integer,
     // call stacks are logged and 0 is returned.
@@ -100,6 +110,15 @@ public:
     // If you need a std::string, call .data().as_string() (which allocates mem)
     butil::StringPiece data() const;
 
+    // Append the string to `out'. If the string references an IOBuf, which
+    // is set by SetString(const IOBuf&) or parsed from a bulk string not
+    // shorter than -redis_reply_iobuf_min_size, data is appended by
+    // reference. If the reply is not a string, call stacks are logged and
+    // nothing is appended.
+    // NOTE: c_str() and data() on such a string flatten the data into arena
+    // at the first call, don't call them concurrently.
+    void AppendDataTo(butil::IOBuf* out) const;
+
     // Return number of sub replies in the array if this reply is an array, or
     // return the length of string if this reply is a string, otherwise 0 is
     // returned (call stacks are not logged).
@@ -122,7 +141,7 @@ public:
     ParseError ConsumePartialIOBuf(butil::IOBuf& buf);
 
     // Serialize to iobuf appender using redis protocol
-    bool SerializeTo(butil::IOBufAppender* appender);
+    bool SerializeTo(butil::IOBufAppender* appender) const;
 
     // Swap internal fields with another reply.
     void Swap(RedisReply& other);
@@ -148,6 +167,9 @@ private:
 
     void FormatStringImpl(const char* fmt, va_list args, RedisReplyType type);
     void SetStringImpl(const butil::StringPiece& str, RedisReplyType type);
+    // Data of a string not fitting short_str.
+    const char* long_str() const;
+    const char* FlattenIOBufString() const;
     
     RedisReplyType _type;
     int _length;  // length of short_str/long_str, count of replies
@@ -155,6 +177,12 @@ private:
         int64_t integer;
         char short_str[16];
         const char* long_str;
+        struct {
+            // Same as long_str, NULL until flattened if `buf' is not NULL.
+            const char* str;
+            // Not NULL if the string references this IOBuf on arena.
+            butil::IOBuf* buf;
+        } bulk;
         struct {
             int32_t last_index;  // >= 0 if previous parsing suspends on replies.
             RedisReply* replies;
@@ -257,12 +285,16 @@ inline void RedisReply::FormatString(const char* fmt, ...) {
     va_end(ap);
 }
 
+inline const char* RedisReply::long_str() const {
+    return _data.long_str != NULL ? _data.long_str : FlattenIOBufString();
+}
+
 inline const char* RedisReply::c_str() const {
     if (is_string()) {
         if (_length < (int)sizeof(_data.short_str)) { // SSO
             return _data.short_str;
         } else {
-            return _data.long_str;
+            return long_str();
         }
     }
     CHECK(false) << "The reply is " << RedisReplyTypeToString(_type)
@@ -275,7 +307,7 @@ inline butil::StringPiece RedisReply::data() const {
         if (_length < (int)sizeof(_data.short_str)) { // SSO
             return butil::StringPiece(_data.short_str, _length);
         } else {
-            return butil::StringPiece(_data.long_str, _length);
+            return butil::StringPiece(long_str(), _length);
         }
     }
     CHECK(false) << "The reply is " << RedisReplyTypeToString(_type)
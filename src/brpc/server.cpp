@@ -37,9 +37,11 @@
 #include "brpc/global.h"
 #include "brpc/socket_map.h"                   // SocketMapList
 #include "brpc/acceptor.h"                     // Acceptor
+#include "brpc/event_dispatcher.h"             // GetGlobalEventDispatcherCount
 #include "brpc/details/ssl_helper.h"           // CreateServerSSLContext
 #include "brpc/protocol.h"                     // ListProtocols
 #include "brpc/nshead_service.h"               // NsheadService
+#include "brpc/memcache.h"                     // MemcacheService
 #ifdef ENABLE_THRIFT_FRAMED_PROTOCOL
 #include "brpc/thrift_service.h"               // ThriftService
 #endif
@@ -59,6 +61,7 @@
 #include "brpc/builtin/vars_service.h"         // VarsService
 #include "brpc/builtin/rpcz_service.h"         // RpczService
 #include "brpc/builtin/dir_service.h"          // DirService
+#include "brpc/builtin/static_file_service.h"  // StaticFileService
 #include "brpc/builtin/pprof_service.h"        // PProfService
 #include "brpc/builtin/bthreads_service.h"     // BthreadsService
 #include "brpc/builtin/ids_service.h"          // IdsService
@@ -73,6 +76,7 @@
 #include "brpc/trackme.h"
 #include "brpc/restful.h"
 #include "brpc/rtmp.h"
+#include "brpc/udp_transport.h"                // UdpListen
 #include "brpc/builtin/common.h"               // GetProgramName
 #include "brpc/details/tcmalloc_extension.h"
 
@@ -108,6 +112,8 @@ butil::static_atomic<int> g_running_server_count = BUTIL_STATIC_ATOMIC_INIT(0);
 
 // Following services may have security issues and are disabled by default.
 DEFINE_bool(enable_dir_service, false, "Enable /dir");
+DEFINE_string(static_file_dir, "", "Serve files under this directory at "
+              "/files, empty means disabled");
 DEFINE_bool(enable_threads_service, false, "Enable /threads");
 
 DECLARE_int32(usercode_backup_threads);
@@ -140,7 +146,11 @@ ServerOptions::ServerOptions()
     , http_master_service(NULL)
     , health_reporter(NULL)
     , rtmp_service(NULL)
-    , redis_service(NULL) {
+    , redis_service(NULL)
+    , memcache_service(NULL)
+    , listen_per_dispatcher(false)
+    , use_shared_memory(false)
+    , enable_udp(false) {
     if (s_ncore > 0) {
         num_threads = s_ncore + 1;
     }
@@ -268,6 +278,10 @@ static bvar::Vector<unsigned, 2> GetSessionLocalDataCount(void* arg) {
     return v;
 }
 
+static void PrintSelectedProtocols(std::ostream& os, void* arg) {
+    static_cast<const Acceptor*>(arg)->PrintSelectedProtocols(os);
+}
+
 std::string Server::ServerPrefix() const {
     return butil::string_printf("%s_%d", g_server_info_prefix, listen_address().port);
 }
@@ -304,6 +318,20 @@ void* Server::UpdateDerivedVars(void* arg) {
         nsessiondata_st.set_vector_names("using,free");
     }
 
+    // How many connections were detected as each protocol, on the port
+    // and the internal port respectively.
+    bvar::PassiveStatus<std::string> protocol_st(
+        PrintSelectedProtocols, server->_am);
+    if (server->_am) {
+        protocol_st.expose_as(prefix, "protocol_selected_count");
+    }
+    bvar::PassiveStatus<std::string> internal_protocol_st(
+        PrintSelectedProtocols, server->_internal_am);
+    if (server->_internal_am) {
+        internal_protocol_st.expose_as(
+            prefix, "internal_port_protocol_selected_count");
+    }
+
     std::string mprefix = prefix;
     for (MethodMap::iterator it = server->_method_map.begin();
          it != server->_method_map.end(); ++it) {
@@ -436,6 +464,8 @@ Server::~Server() {
 
     delete _options.redis_service;
     _options.redis_service = NULL;
+    delete _options.memcache_service;
+    _options.memcache_service = NULL;
 }
 
 int Server::AddBuiltinServices() {
@@ -516,6 +546,11 @@ int Server::AddBuiltinServices() {
         LOG(ERROR) << "Fail to add DirService";
         return -1;
     }
+    if (!FLAGS_static_file_dir.empty() &&
+        AddBuiltinService(new (std::nothrow) StaticFileService)) {
+        LOG(ERROR) << "Fail to add StaticFileService";
+        return -1;
+    }
     if (AddBuiltinService(new (std::nothrow) BthreadsService)) {
         LOG(ERROR) << "Fail to add BthreadsService";
         return -1;
@@ -559,6 +594,7 @@ Acceptor* Server::BuildAcceptor() {
         LOG(ERROR) << "Fail to new Acceptor";
         return NULL;
     }
+    acceptor->set_use_shared_memory(_options.use_shared_memory);
     InputMessageHandler handler;
     std::vector<Protocol> protocols;
     // Get all the protocols supported by registration
@@ -945,9 +981,31 @@ int Server::StartInternal(const butil::ip_t& ip,
         return -1;
     }
     _listen_addr.ip = ip;
+    const bool is_unix = (port_range.min_port == butil::UNIX_ENDPOINT_PORT);
+    int nlistener = (_options.listen_per_dispatcher ?
+                     GetGlobalEventDispatcherCount() : 1);
+    if (is_unix && nlistener > 1) {
+        LOG(WARNING) << "ServerOptions.listen_per_dispatcher does not work "
+            "with unix domain sockets, listen once instead";
+        nlistener = 1;
+    }
+    if (_options.enable_udp) {
+        if (is_unix) {
+            LOG(ERROR) << "ServerOptions.enable_udp does not work with "
+                "unix domain sockets";
+            return -1;
+        }
+        if (_options.auth) {
+            LOG(ERROR) << "ServerOptions.enable_udp does not work with "
+                "ServerOptions.auth";
+            return -1;
+        }
+    }
+    // Bound to the same port as the tcp one.
+    butil::fd_guard udp_fd;
     for (int port = port_range.min_port; port <= port_range.max_port; ++port) {
         _listen_addr.port = port;
-        butil::fd_guard sockfd(tcp_listen(_listen_addr));
+        butil::fd_guard sockfd(tcp_listen(_listen_addr, nlistener > 1));
         if (sockfd < 0) {
             if (port != port_range.max_port) { // not the last port, try next
                 continue;
@@ -970,6 +1028,16 @@ int Server::StartInternal(const butil::ip_t& ip,
                 return -1;
             }
         }
+        if (_options.enable_udp) {
+            udp_fd.reset(UdpListen(_listen_addr));
+            if (udp_fd < 0) {
+                if (port != port_range.max_port) { // try next
+                    continue;
+                }
+                PLOG(ERROR) << "Fail to listen udp://" << _listen_addr;
+                return -1;
+            }
+        }
         if (_am == NULL) {
             _am = BuildAcceptor();
             if (NULL == _am) {
@@ -984,6 +1052,34 @@ int Server::StartInternal(const butil::ip_t& ip,
         GenerateVersionIfNeeded();
         g_running_server_count.fetch_add(1, butil::memory_order_relaxed);
 
+        if (nlistener > 1) {
+            // Listen to the (possibly kernel-selected) port again for
+            // other dispatchers.
+            std::vector<int> sockfds;
+            sockfds.push_back(sockfd.release());
+            for (int i = 1; i < nlistener; ++i) {
+                const int fd = tcp_listen(_listen_addr, true);
+                if (fd < 0) {
+                    PLOG(ERROR) << "Fail to listen " << _listen_addr
+                                << " with SO_REUSEPORT";
+                    break;
+                }
+                sockfds.push_back(fd);
+            }
+            // Pass ownership of `sockfds' to `_am'
+            if ((int)sockfds.size() != nlistener) {
+                for (size_t i = 0; i < sockfds.size(); ++i) {
+                    close(sockfds[i]);
+                }
+                return -1;
+            }
+            if (_am->StartAccept(sockfds, _options.idle_timeout_sec,
+                                 _default_ssl_ctx) != 0) {
+                LOG(ERROR) << "Fail to start acceptor";
+                return -1;
+            }
+            break; // stop trying
+        }
         // Pass ownership of `sockfd' to `_am'
         if (_am->StartAccept(sockfd, _options.idle_timeout_sec,
                              _default_ssl_ctx) != 0) {
@@ -993,7 +1089,19 @@ int Server::StartInternal(const butil::ip_t& ip,
         sockfd.release();
         break; // stop trying
     }
+    if (udp_fd >= 0) {
+        // Pass ownership of `udp_fd' to `_am'
+        if (_am->AcceptDatagrams(udp_fd.release()) != 0) {
+            LOG(ERROR) << "Fail to receive datagrams";
+            return -1;
+        }
+    }
     if (_options.internal_port >= 0 && _options.has_builtin_services) {
+        if (is_unix) {
+            LOG(ERROR) << "ServerOptions.internal_port does not work with "
+                       << _listen_addr;
+            return -1;
+        }
         if (_options.internal_port  == _listen_addr.port) {
             LOG(ERROR) << "ServerOptions.internal_port=" << _options.internal_port
                        << " is same with port=" << _listen_addr.port << " to Start()";
@@ -1041,6 +1149,12 @@ int Server::StartInternal(const butil::ip_t& ip,
     // Print tips to server launcher.
     int http_port = _listen_addr.port;
     std::ostringstream server_info;
+    if (is_unix) {
+        LOG(INFO) << "Server[" << version() << "] is serving on "
+                  << _listen_addr << '.';
+        revert_server.release();
+        return 0;
+    }
     server_info << "Server[" << version() << "] is serving on port="
                 << _listen_addr.port;
     if (_options.internal_port >= 0 && _options.has_builtin_services) {
@@ -1111,6 +1225,11 @@ int Server::Stop(int timeout_ms) {
         // TODO: calculate timeout?
         _internal_am->StopAccept(timeout_ms);
     }
+    const char* unix_path = butil::endpoint2unix_path(_listen_addr);
+    if (unix_path != NULL && unix_path[0] != '@') {
+        // Make clients fail fast instead of connecting to a stale file.
+        unlink(unix_path);
+    }
     return 0;
 }
 
@@ -1596,7 +1715,8 @@ void Server::GenerateVersionIfNeeded() {
         return;
     }
     int extra_count = !!_options.nshead_service + !!_options.rtmp_service +
-        !!_options.thrift_service + !!_options.redis_service;
+        !!_options.thrift_service + !!_options.redis_service +
+        !!_options.memcache_service;
     _version.reserve((extra_count + service_count()) * 20);
     for (ServiceMap::const_iterator it = _fullname_service_map.begin();
          it != _fullname_service_map.end(); ++it) {
@@ -1636,6 +1756,13 @@ void Server::GenerateVersionIfNeeded() {
         }
         _version.append(butil::class_name_str(*_options.redis_service));
     }
+
+    if (_options.memcache_service) {
+        if (!_version.empty()) {
+            _version.push_back('+');
+        }
+        _version.append(butil::class_name_str(*_options.memcache_service));
+    }
 }
 
 static std::string ExpandPath(const std::string &path) {
@@ -1847,6 +1974,10 @@ int Server::AddCertificate(const CertInfo& cert) {
         return -1;
     }
     ssl_ctx.ctx->raw_ctx = raw_ctx;
+    if (SetSharedSessionCache(raw_ctx, SSLSessionIdContext(),
+                              _options.ssl_options().session_cache_size) != 0) {
+        return -1;
+    }
 
 #ifdef SSL_CTRL_SET_TLSEXT_HOSTNAME
     SSL_CTX_set_tlsext_servername_callback(ssl_ctx.ctx->raw_ctx, SSLSwitchCTXByHostname);
@@ -1861,6 +1992,11 @@ int Server::AddCertificate(const CertInfo& cert) {
     return 0;
 }
 
+std::string Server::SSLSessionIdContext() const {
+    const Server* self = this;
+    return std::string((const char*)&self, sizeof(self));
+}
+
 bool Server::AddCertMapping(CertMaps& bg, const SSLContext& ssl_ctx) {
     if (!bg.cert_map.initialized()
         && bg.cert_map.init(INITIAL_CERT_MAP) != 0) {
@@ -1971,6 +2107,10 @@ int Server::ResetCertificates(const std::vector<CertInfo>& certs) {
         if (ssl_ctx.ctx->raw_ctx == NULL) {
             return -1;
         }
+        if (SetSharedSessionCache(ssl_ctx.ctx->raw_ctx, SSLSessionIdContext(),
+                                  _options.ssl_options().session_cache_size) != 0) {
+            return -1;
+        }
 
 #ifdef SSL_CTRL_SET_TLSEXT_HOSTNAME
         SSL_CTX_set_tlsext_servername_callback(ssl_ctx.ctx->raw_ctx, SSLSwitchCTXByHostname);
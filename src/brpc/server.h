@@ -53,6 +53,7 @@ class MongoServiceAdaptor;
 class RestfulMap;
 class RtmpService;
 class RedisService;
+class MemcacheService;
 struct SocketSSLContext;
 
 struct ServerOptions {
@@ -241,6 +242,35 @@ struct ServerOptions {
     // Default: NULL (disabled)
     RedisService* redis_service;
 
+    // For processing memcache binary protocol. Read src/brpc/memcache.h
+    // for details.
+    // Owned by Server and deleted in server's destructor.
+    // Default: NULL (disabled)
+    MemcacheService* memcache_service;
+
+    // Listen to the port with one SO_REUSEPORT socket for each of the
+    // -event_dispatcher_num EventDispatchers, so that new connections are
+    // accepted in parallel and served by the dispatcher of the socket
+    // accepting them. Helps servers handling lots of short connections.
+    // Ignored when there's only one dispatcher.
+    // NOTE: other SO_REUSEPORT sockets of the same user may listen to the
+    // port as well, choose the port carefully.
+    // Default: false
+    bool listen_per_dispatcher;
+
+    // Transport data through shared memory for clients on the same host
+    // asking for it by ChannelOptions.use_shared_memory, other clients are
+    // not affected. Read src/brpc/shared_memory_transport.h for details.
+    // Default: false
+    bool use_shared_memory;
+
+    // Receive one-way baidu_std requests sent by UdpChannel from the UDP
+    // port of the same number as the listened TCP port. Responses to
+    // these requests are dropped and Controller.remote_side() is not set.
+    // Not compatible with `auth', datagrams are not encrypted by SSL.
+    // Default: false
+    bool enable_udp;
+
 private:
     // SSLOptions is large and not often used, allocate it on heap to
     // prevent ServerOptions from being bloated in most cases.
@@ -376,7 +406,7 @@ public:
     //   stopped by Stop() and Join().
     // * port can be 0, which makes kernel to choose a port dynamically.
     
-    // Start on an address in form of "0.0.0.0:8000".
+    // Start on an address in form of "0.0.0.0:8000" or "unix:/tmp/foo.sock".
     int Start(const char* ip_port_str, const ServerOptions* opt);
     int Start(const butil::EndPoint& ip_port, const ServerOptions* opt);
     // Start on IP_ANY:port.
@@ -606,6 +636,9 @@ friend class Controller;
 
     void FreeSSLContexts();
 
+    // Identify sessions of this server in the process-wide SSL session cache.
+    std::string SSLSessionIdContext() const;
+
     static int SSLSwitchCTXByHostname(struct ssl_st* ssl,
                                       int* al, Server* server);
 
@@ -0,0 +1,613 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <inttypes.h>                            // PRIu64
+#include <fcntl.h>                               // O_CREAT
+#include <sys/mman.h>                            // shm_open, mmap
+#include <sys/socket.h>                          // recv
+#include <sys/stat.h>                            // fstat
+#include <netinet/in.h>                          // IN_LOOPBACKNET
+#include <gflags/gflags.h>
+#include <openssl/err.h>
+#include "butil/fd_guard.h"
+#include "butil/logging.h"
+#include "butil/string_printf.h"
+#include "butil/time.h"
+#include "bthread/bthread.h"
+#include "bthread/butex.h"
+#include "bthread/unstable.h"                    // bthread_fd_timedwait
+#include "brpc/errno.pb.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/ssl_helper.h"             // SSLError
+#include "brpc/shared_memory_transport.h"
+#if defined(OS_LINUX)
+#include <sys/epoll.h>                           // EPOLLIN
+#elif defined(OS_MACOSX)
+#include <sys/event.h>                           // EVFILT_READ
+#endif
+
+
+namespace brpc {
+
+DEFINE_int32(shared_memory_ring_size, 4 * 1024 * 1024,
+             "Bytes of the ring in each direction of a new shared-memory "
+             "connection, must be power of 2 and not less than 4096");
+static bool ValidateRingSize(const char*, int32_t val) {
+    return val >= 4096 && (val & (val - 1)) == 0;
+}
+BRPC_VALIDATE_GFLAG(shared_memory_ring_size, ValidateRingSize);
+
+DEFINE_int32(shared_memory_handshake_timeout_ms, 1000,
+             "Fail the connection if the server does not reply the "
+             "shared-memory handshake within so many milliseconds");
+BRPC_VALIDATE_GFLAG(shared_memory_handshake_timeout_ms, PositiveInteger);
+
+// Control block of a ring, placed in shared memory. Positions increase
+// monotonically, bytes in [read_pos, write_pos) are readable.
+struct SharedMemoryRing {
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<uint64_t> write_pos;
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<uint64_t> read_pos;
+    // Set by the reader before sleeping, the writer wakes it up by writing
+    // DOORBELL_DATA into the TCP connection.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<int> reader_sleeping;
+    // Set by the writer when the ring is full, the reader wakes it up by
+    // writing DOORBELL_SPACE.
+    butil::atomic<int> writer_waiting;
+};
+
+// rings[0] is written by client, rings[1] is written by server. Data of
+// the rings follow.
+struct SharedMemorySegment {
+    SharedMemoryRing rings[2];
+};
+
+static const char SHM_MAGIC[8] = { 'B', 'R', 'P', 'C', '_', 'S', 'H', 'M' };
+static const char SHM_NAME_PREFIX[] = "/brpc_shm_";
+static const uint32_t MAX_RING_SIZE = 1024 * 1024 * 1024;
+static const char DOORBELL_DATA = 'D';
+static const char DOORBELL_SPACE = 'S';
+// Wait for space of the ring at most so long before returning EAGAIN to
+// KeepWrite, the same as WAIT_EPOLLOUT_TIMEOUT_MS in socket.cpp
+static const int WAIT_SPACE_TIMEOUT_MS = 50;
+
+// Sent by client after TCP connected.
+struct SharedMemoryHello {
+    char magic[8];
+    uint32_t ring_size;
+    uint32_t reserved;
+    char name[48];
+};
+
+// Replied by server. Non-zero error_code means the server failed to map
+// the shared memory, the connection continues as a plain one.
+struct SharedMemoryAck {
+    char magic[8];
+    int32_t error_code;
+    uint32_t reserved;
+};
+
+SharedMemoryConnection::SharedMemoryConnection(bool server_side)
+    : _state(server_side ? STATE_DETECTING : STATE_OFF)
+    , _server_side(server_side)
+    , _base(NULL)
+    , _map_size(0)
+    , _ring_size(0)
+    , _in(NULL)
+    , _in_data(NULL)
+    , _out(NULL)
+    , _out_data(NULL)
+    , _out_full(false)
+    , _space_butex(bthread::butex_create_checked<butil::atomic<int> >()) {
+    _name[0] = '\0';
+    _space_butex->store(0, butil::memory_order_relaxed);
+}
+
+SharedMemoryConnection::~SharedMemoryConnection() {
+    UnmapSegment();
+    bthread::butex_destroy(_space_butex);
+}
+
+void SharedMemoryConnection::BeforeRecycle(Socket*) {
+    delete this;
+}
+
+int SharedMemoryConnection::Connect(
+    Socket* s, const timespec* abstime,
+    int (*on_connect)(int, int, void*), void* data) {
+    // Reconnecting, the shared memory is created again in StartConnect.
+    UnmapSegment();
+    _state.store(STATE_OFF, butil::memory_order_release);
+    return s->Connect(abstime, on_connect, data);
+}
+
+static size_t SegmentSize(uint32_t ring_size) {
+    return sizeof(SharedMemorySegment) + 2 * (size_t)ring_size;
+}
+
+int SharedMemoryConnection::CreateSegment(uint32_t ring_size) {
+    UnmapSegment();
+    static butil::atomic<uint64_t> s_nsegment(0);
+    snprintf(_name, sizeof(_name), "%s%d_%" PRIu64, SHM_NAME_PREFIX,
+             (int)getpid(), s_nsegment.fetch_add(1, butil::memory_order_relaxed));
+    butil::fd_guard fd(shm_open(_name, O_CREAT | O_EXCL | O_RDWR, 0600));
+    if (fd < 0) {
+        const int saved_errno = errno;
+        PLOG(WARNING) << "Fail to shm_open " << _name;
+        _name[0] = '\0';
+        return saved_errno;
+    }
+    const size_t size = SegmentSize(ring_size);
+    void* base = MAP_FAILED;
+    if (ftruncate(fd, size) != 0 ||
+        (base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0)) == MAP_FAILED) {
+        const int saved_errno = errno;
+        PLOG(WARNING) << "Fail to map " << _name << " of " << size << " bytes";
+        shm_unlink(_name);
+        _name[0] = '\0';
+        return saved_errno;
+    }
+    SharedMemorySegment* seg = new (base) SharedMemorySegment;
+    for (int i = 0; i < 2; ++i) {
+        seg->rings[i].write_pos.store(0, butil::memory_order_relaxed);
+        seg->rings[i].read_pos.store(0, butil::memory_order_relaxed);
+        // Readers are sleeping initially so that first writes wake them up.
+        seg->rings[i].reader_sleeping.store(1, butil::memory_order_relaxed);
+        seg->rings[i].writer_waiting.store(0, butil::memory_order_relaxed);
+    }
+    _base = base;
+    _map_size = size;
+    _ring_size = ring_size;
+    char* data = (char*)base + sizeof(SharedMemorySegment);
+    _out = &seg->rings[0];
+    _out_data = data;
+    _in = &seg->rings[1];
+    _in_data = data + ring_size;
+    return 0;
+}
+
+int SharedMemoryConnection::MapSegment(const char* name, uint32_t ring_size) {
+    if (ring_size < 4096 || ring_size > MAX_RING_SIZE ||
+        (ring_size & (ring_size - 1)) != 0) {
+        LOG(WARNING) << "Invalid ring_size=" << ring_size;
+        return EINVAL;
+    }
+    // Only map segments named by CreateSegment.
+    if (strncmp(name, SHM_NAME_PREFIX, strlen(SHM_NAME_PREFIX)) != 0 ||
+        strchr(name + 1, '/') != NULL) {
+        LOG(WARNING) << "Invalid shared memory name=" << name;
+        return EINVAL;
+    }
+    butil::fd_guard fd(shm_open(name, O_RDWR, 0600));
+    if (fd < 0) {
+        const int saved_errno = errno;
+        PLOG(WARNING) << "Fail to shm_open " << name;
+        return saved_errno;
+    }
+    // The segment must be created by the same user, in the size matching
+    // ring_size, otherwise the rings may be beyond the mapped memory.
+    const size_t size = SegmentSize(ring_size);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        const int saved_errno = errno;
+        PLOG(WARNING) << "Fail to fstat " << name;
+        return saved_errno;
+    }
+    if (st.st_uid != geteuid()) {
+        LOG(WARNING) << name << " is owned by another user, uid=" << st.st_uid;
+        return EPERM;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_size < 0 || (size_t)st.st_size != size) {
+        LOG(WARNING) << "Size of " << name << " is " << st.st_size
+                     << " instead of " << size;
+        return EINVAL;
+    }
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        const int saved_errno = errno;
+        PLOG(WARNING) << "Fail to mmap " << name;
+        return saved_errno;
+    }
+    _base = base;
+    _map_size = size;
+    _ring_size = ring_size;
+    SharedMemorySegment* seg = static_cast<SharedMemorySegment*>(base);
+    char* data = (char*)base + sizeof(SharedMemorySegment);
+    _in = &seg->rings[0];
+    _in_data = data;
+    _out = &seg->rings[1];
+    _out_data = data + ring_size;
+    return 0;
+}
+
+void SharedMemoryConnection::UnmapSegment() {
+    if (_name[0] != '\0') {
+        shm_unlink(_name);
+        _name[0] = '\0';
+    }
+    if (_base) {
+        munmap(_base, _map_size);
+        _base = NULL;
+        _map_size = 0;
+        _in = _out = NULL;
+        _in_data = _out_data = NULL;
+    }
+    _out_full = false;
+}
+
+static void RingDoorbell(int fd, char bell) {
+    if (write(fd, &bell, 1) != 1) {
+        // The peer keeps draining doorbells, the socket buffer should never
+        // be full. Other errors will be found by reading.
+        PLOG_EVERY_SECOND(WARNING) << "Fail to ring doorbell of fd=" << fd;
+    }
+}
+
+ssize_t SharedMemoryConnection::CutMessageIntoFileDescriptor(
+    int fd, butil::IOBuf** data_list, size_t ndata) {
+    if (_state.load(butil::memory_order_relaxed) != STATE_ON) {
+        return butil::IOBuf::cut_multiple_into_file_descriptor(
+            fd, data_list, ndata);
+    }
+    // Socket ensures that there's at most one writer.
+    const uint64_t mask = _ring_size - 1;
+    uint64_t w = _out->write_pos.load(butil::memory_order_relaxed);
+    uint64_t space = _ring_size -
+        (w - _out->read_pos.load(butil::memory_order_acquire));
+    if (space == 0) {
+        if (!_out_full) {
+            // Don't block Socket::Write() which is the first to find the
+            // ring full, KeepWrite will retry and wait.
+            _out_full = true;
+            errno = EAGAIN;
+            return -1;
+        }
+        const int expected_val = _space_butex->load(butil::memory_order_relaxed);
+        _out->writer_waiting.store(1, butil::memory_order_relaxed);
+        butil::atomic_thread_fence(butil::memory_order_seq_cst);
+        space = _ring_size - (w - _out->read_pos.load(butil::memory_order_acquire));
+        if (space == 0) {
+            const timespec duetime =
+                butil::milliseconds_from_now(WAIT_SPACE_TIMEOUT_MS);
+            bthread::butex_wait(_space_butex, expected_val, &duetime);
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    _out_full = false;
+    size_t nw = 0;
+    for (size_t i = 0; i < ndata && space > 0; ++i) {
+        butil::IOBuf* p = data_list[i];
+        while (!p->empty() && space > 0) {
+            const uint64_t offset = (w & mask);
+            const size_t len = p->cutn(_out_data + offset,
+                                       std::min(space, _ring_size - offset));
+            w += len;
+            space -= len;
+            nw += len;
+        }
+        if (!p->empty()) {
+            break;
+        }
+    }
+    _out->write_pos.store(w, butil::memory_order_release);
+    butil::atomic_thread_fence(butil::memory_order_seq_cst);
+    if (_out->reader_sleeping.load(butil::memory_order_relaxed) &&
+        _out->reader_sleeping.exchange(0, butil::memory_order_relaxed)) {
+        RingDoorbell(fd, DOORBELL_DATA);
+    }
+    return nw;
+}
+
+ssize_t SharedMemoryConnection::CutMessageIntoSSLChannel(
+    SSL* ssl, butil::IOBuf** data_list, size_t ndata) {
+    // Shared memory is never used with SSL, write as Socket::DoWrite does.
+    int ssl_error = 0;
+    ssize_t nw = butil::IOBuf::cut_multiple_into_SSL_channel(
+        ssl, data_list, ndata, &ssl_error);
+    switch (ssl_error) {
+    case SSL_ERROR_NONE:
+        break;
+    case SSL_ERROR_WANT_READ:
+        // Disable renegotiation
+        errno = EPROTO;
+        return -1;
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        break;
+    default: {
+        const unsigned long e = ERR_get_error();
+        if (e != 0) {
+            LOG(WARNING) << "Fail to write into ssl: " << SSLError(e);
+            errno = ESSL;
+        }
+        break;
+    }
+    }
+    return nw;
+}
+
+ssize_t SharedMemoryConnection::AppendFromFileDescriptor(
+    int fd, butil::IOPortal* buf, size_t size_hint) {
+    switch (_state.load(butil::memory_order_acquire)) {
+    case STATE_ON:
+        return ReadRing(fd, buf, size_hint);
+    case STATE_DETECTING:
+        return DetectHandshake(fd, buf, size_hint);
+    case STATE_HANDSHAKING:
+        // The reply is read by DoHandshake.
+        errno = EAGAIN;
+        return -1;
+    }
+    return buf->append_from_file_descriptor(fd, size_hint);
+}
+
+// True if the peer of `fd' is on the same host.
+static bool IsLocalPeer(int fd) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getpeername(fd, (struct sockaddr*)&addr, &len) != 0) {
+        return false;
+    }
+    switch (addr.ss_family) {
+    case AF_UNIX:
+        return true;
+    case AF_INET:
+        return (ntohl(((struct sockaddr_in*)&addr)->sin_addr.s_addr) >> 24)
+            == IN_LOOPBACKNET;
+    case AF_INET6: {
+        const struct in6_addr* a6 = &((struct sockaddr_in6*)&addr)->sin6_addr;
+        return IN6_IS_ADDR_LOOPBACK(a6) ||
+            (IN6_IS_ADDR_V4MAPPED(a6) && a6->s6_addr[12] == IN_LOOPBACKNET);
+    }
+    }
+    return false;
+}
+
+ssize_t SharedMemoryConnection::DetectHandshake(
+    int fd, butil::IOPortal* buf, size_t size_hint) {
+    SharedMemoryHello hello;
+    const ssize_t n = recv(fd, &hello, sizeof(hello), MSG_PEEK);
+    if (n <= 0) {
+        return n;
+    }
+    if (memcmp(hello.magic, SHM_MAGIC,
+               std::min((size_t)n, sizeof(SHM_MAGIC))) != 0) {
+        _state.store(STATE_OFF, butil::memory_order_relaxed);
+        return buf->append_from_file_descriptor(fd, size_hint);
+    }
+    if ((size_t)n < sizeof(hello)) {
+        // Wait for the remaining part.
+        errno = EAGAIN;
+        return -1;
+    }
+    if (read(fd, &hello, sizeof(hello)) != (ssize_t)sizeof(hello)) {
+        return -1;
+    }
+    hello.name[sizeof(hello.name) - 1] = '\0';
+    SharedMemoryAck ack;
+    memcpy(ack.magic, SHM_MAGIC, sizeof(ack.magic));
+    if (!IsLocalPeer(fd)) {
+        LOG(WARNING) << "Reject shared-memory handshake from remote fd=" << fd;
+        ack.error_code = EPERM;
+    } else {
+        ack.error_code = MapSegment(hello.name, hello.ring_size);
+    }
+    ack.reserved = 0;
+    // The client writes nothing until the ack is received, thus there's
+    // no data after the hello and no responses to write.
+    if (write(fd, &ack, sizeof(ack)) != (ssize_t)sizeof(ack)) {
+        PLOG(WARNING) << "Fail to reply shared-memory handshake of fd=" << fd;
+        if (errno == EAGAIN) {
+            errno = EPROTO;
+        }
+        return -1;
+    }
+    _state.store(ack.error_code == 0 ? STATE_ON : STATE_OFF,
+                 butil::memory_order_release);
+    return AppendFromFileDescriptor(fd, buf, size_hint);
+}
+
+ssize_t SharedMemoryConnection::ReadRing(
+    int fd, butil::IOPortal* buf, size_t size_hint) {
+    // Drain doorbells, the fd must be read until EAGAIN before returning
+    // EAGAIN since events are edge-triggered.
+    bool eof = false;
+    while (true) {
+        char bells[64];
+        const ssize_t nr = read(fd, bells, sizeof(bells));
+        if (nr > 0) {
+            if (memchr(bells, DOORBELL_SPACE, nr) != NULL) {
+                _space_butex->fetch_add(1, butil::memory_order_relaxed);
+                bthread::butex_wake_all(_space_butex);
+            }
+            continue;
+        }
+        if (nr == 0) {
+            eof = true;
+            break;
+        }
+        if (errno == EAGAIN) {
+            break;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    for (int ntry = 0; ntry < 2; ++ntry) {
+        const uint64_t r = _in->read_pos.load(butil::memory_order_relaxed);
+        const uint64_t w = _in->write_pos.load(butil::memory_order_acquire);
+        if (w != r) {
+            const size_t n = std::min((size_t)(w - r), std::max(size_hint, (size_t)1));
+            const size_t offset = (r & (_ring_size - 1));
+            const size_t first = std::min(n, (size_t)_ring_size - offset);
+            buf->append(_in_data + offset, first);
+            if (n > first) {
+                buf->append(_in_data, n - first);
+            }
+            _in->read_pos.store(r + n, butil::memory_order_release);
+            _in->reader_sleeping.store(0, butil::memory_order_relaxed);
+            butil::atomic_thread_fence(butil::memory_order_seq_cst);
+            if (_in->writer_waiting.load(butil::memory_order_relaxed) &&
+                _in->writer_waiting.exchange(0, butil::memory_order_relaxed)) {
+                RingDoorbell(fd, DOORBELL_SPACE);
+            }
+            return n;
+        }
+        if (eof) {
+            return 0;
+        }
+        if (ntry == 0) {
+            // Nothing to read, check again after telling the writer to
+            // wake us up, otherwise the data written in-between is missed.
+            _in->reader_sleeping.store(1, butil::memory_order_relaxed);
+            butil::atomic_thread_fence(butil::memory_order_seq_cst);
+        }
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+struct SharedMemoryHandshakeArgs {
+    SharedMemoryConnection* conn;
+    SocketId socket_id;
+    int fd;
+    void (*done)(int err, void* data);
+    void* data;
+};
+
+void* SharedMemoryConnection::DoHandshake(void* void_args) {
+    SharedMemoryHandshakeArgs* args =
+        static_cast<SharedMemoryHandshakeArgs*>(void_args);
+    SharedMemoryConnection* conn = args->conn;
+    SharedMemoryHello hello;
+    memset(&hello, 0, sizeof(hello));
+    memcpy(hello.magic, SHM_MAGIC, sizeof(hello.magic));
+    hello.ring_size = conn->_ring_size;
+    memcpy(hello.name, conn->_name, sizeof(hello.name));
+    int err = 0;
+    if (write(args->fd, &hello, sizeof(hello)) != (ssize_t)sizeof(hello)) {
+        // Writing a small message into a new connection should not be
+        // partial or blocked.
+        err = (errno ? errno : EPROTO);
+        PLOG(WARNING) << "Fail to write shared-memory handshake into fd="
+                      << args->fd;
+    }
+    SharedMemoryAck ack;
+    size_t nack = 0;
+    const timespec duetime = butil::milliseconds_from_now(
+        FLAGS_shared_memory_handshake_timeout_ms);
+    while (err == 0 && nack < sizeof(ack)) {
+        const ssize_t nr = read(args->fd, (char*)&ack + nack, sizeof(ack) - nack);
+        if (nr > 0) {
+            nack += nr;
+        } else if (nr == 0) {
+            err = ECONNRESET;
+        } else if (errno == EAGAIN) {
+#if defined(OS_LINUX)
+            const unsigned events = EPOLLIN;
+#elif defined(OS_MACOSX)
+            const unsigned events = EVFILT_READ;
+#endif
+            if (bthread_fd_timedwait(args->fd, events, &duetime) != 0 &&
+                errno != EINTR) {
+                err = errno;
+            }
+        } else if (errno != EINTR) {
+            err = errno;
+        }
+    }
+    if (err == 0 && memcmp(ack.magic, SHM_MAGIC, sizeof(ack.magic)) != 0) {
+        LOG(WARNING) << "Invalid shared-memory handshake reply from fd="
+                     << args->fd;
+        err = EPROTO;
+    }
+    // The server has mapped the memory(or failed), remove the name.
+    shm_unlink(conn->_name);
+    conn->_name[0] = '\0';
+    if (err == 0 && ack.error_code == 0) {
+        conn->_state.store(STATE_ON, butil::memory_order_release);
+    } else {
+        if (err == 0) {
+            LOG(WARNING) << "Server fails to map shared memory: "
+                         << berror(ack.error_code) << ", use TCP instead";
+        }
+        conn->UnmapSegment();
+        conn->_state.store(STATE_OFF, butil::memory_order_release);
+    }
+    args->done(err, args->data);
+    delete args;
+    return NULL;
+}
+
+void SharedMemoryConnect::StartConnect(
+    const Socket* const_socket, void (*done)(int err, void* data), void* data) {
+    Socket* s = const_cast<Socket*>(const_socket);
+    SharedMemoryConnection* conn =
+        static_cast<SharedMemoryConnection*>(s->_conn);
+    if (conn == NULL) {
+        conn = new SharedMemoryConnection(false);
+        s->_conn = conn;
+    }
+    if (conn->CreateSegment(FLAGS_shared_memory_ring_size) != 0) {
+        // Continue with TCP.
+        conn->_state.store(SharedMemoryConnection::STATE_OFF,
+                           butil::memory_order_relaxed);
+        return done(0, data);
+    }
+    conn->_state.store(SharedMemoryConnection::STATE_HANDSHAKING,
+                       butil::memory_order_release);
+    SharedMemoryHandshakeArgs* args = new SharedMemoryHandshakeArgs;
+    args->conn = conn;
+    args->socket_id = s->id();
+    args->fd = s->fd();
+    args->done = done;
+    args->data = data;
+    // Don't block the caller which may be the EventDispatcher.
+    bthread_t th;
+    if (bthread_start_background(&th, &BTHREAD_ATTR_NORMAL,
+                                 SharedMemoryConnection::DoHandshake,
+                                 args) != 0) {
+        PLOG(ERROR) << "Fail to start bthread";
+        SharedMemoryConnection::DoHandshake(args);
+    }
+}
+
+int RejectSharedMemoryHandshake(int fd, butil::IOBuf* buf) {
+    SharedMemoryHello hello;
+    const size_t n = buf->copy_to(&hello, sizeof(hello));
+    if (n == 0 || memcmp(hello.magic, SHM_MAGIC, std::min(n, sizeof(SHM_MAGIC))) != 0) {
+        return -1;
+    }
+    if (n < sizeof(hello)) {
+        return 0;
+    }
+    buf->pop_front(sizeof(hello));
+    SharedMemoryAck ack;
+    memcpy(ack.magic, SHM_MAGIC, sizeof(ack.magic));
+    ack.error_code = ENOTSUP;
+    ack.reserved = 0;
+    // The client writes nothing until the ack is received.
+    if (write(fd, &ack, sizeof(ack)) != (ssize_t)sizeof(ack)) {
+        PLOG(WARNING) << "Fail to reply shared-memory handshake of fd=" << fd;
+        return -1;
+    }
+    return 1;
+}
+
+} // namespace brpc
@@ -0,0 +1,122 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_SHARED_MEMORY_TRANSPORT_H
+#define BRPC_SHARED_MEMORY_TRANSPORT_H
+
+#include "butil/atomicops.h"
+#include "brpc/socket.h"
+
+
+namespace brpc {
+
+struct SharedMemoryRing;
+
+// Transport data of a TCP connection between processes on the same host
+// through a pair of rings in shared memory. The TCP connection is still
+// used for establishing the connection, detecting failures and waking up
+// the peer: a byte is written into it only when the peer is sleeping.
+//
+// After connected, the client creates the shared memory and sends its name
+// to the server (SharedMemoryConnect). The server maps the memory and
+// replies. The server only maps memory created by the same user for peers
+// on the same host, and rejects the handshake if it does not enable shared
+// memory, the connection goes on as a plain TCP one then. Protocols are not
+// aware of the transport.
+//
+// Enabled by ChannelOptions.use_shared_memory and
+// ServerOptions.use_shared_memory.
+class SharedMemoryConnection : public SocketConnection {
+friend class SharedMemoryConnect;
+public:
+    // `server_side' connections detect the handshake from clients in the
+    // first read.
+    explicit SharedMemoryConnection(bool server_side);
+    ~SharedMemoryConnection();
+
+    // True if data is transported through shared memory.
+    bool enabled() const {
+        return _state.load(butil::memory_order_relaxed) == STATE_ON;
+    }
+
+    // Implement SocketConnection
+    void BeforeRecycle(Socket*) override;
+    int Connect(Socket*, const timespec*,
+                int (*on_connect)(int, int, void*), void*) override;
+    ssize_t CutMessageIntoFileDescriptor(int, butil::IOBuf**, size_t) override;
+    ssize_t CutMessageIntoSSLChannel(SSL*, butil::IOBuf**, size_t) override;
+    ssize_t AppendFromFileDescriptor(int, butil::IOPortal*, size_t) override;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(SharedMemoryConnection);
+
+    enum State {
+        STATE_DETECTING = 0,   // server waiting for the handshake
+        STATE_HANDSHAKING = 1, // client waiting for the reply
+        STATE_ON = 2,
+        STATE_OFF = 3,         // plain TCP
+    };
+
+    // Create(client) or map(server) the shared memory. Returns 0 on success,
+    // error code otherwise.
+    int CreateSegment(uint32_t ring_size);
+    int MapSegment(const char* name, uint32_t ring_size);
+    void UnmapSegment();
+    // Handle the handshake from client. Returns bytes read, -1 otherwise.
+    ssize_t DetectHandshake(int fd, butil::IOPortal* buf, size_t size_hint);
+    ssize_t ReadRing(int fd, butil::IOPortal* buf, size_t size_hint);
+    static void* DoHandshake(void* arg);
+
+    butil::atomic<int> _state;
+    const bool _server_side;
+    // Name of the shared memory, only set in client before handshaking.
+    char _name[48];
+    void* _base;
+    size_t _map_size;
+    uint32_t _ring_size;
+    SharedMemoryRing* _in;
+    char* _in_data;
+    SharedMemoryRing* _out;
+    char* _out_data;
+    // Last write found the output ring full.
+    bool _out_full;
+    // Writer waits on this butex for space of the output ring.
+    butil::atomic<int>* _space_butex;
+};
+
+// Make client sockets handshake with the server to use shared memory.
+// Set as SocketOptions.app_connect when ChannelOptions.use_shared_memory
+// is true.
+class SharedMemoryConnect : public AppConnect {
+public:
+    void StartConnect(const Socket* socket,
+                      void (*done)(int err, void* data),
+                      void* data) override;
+    void StopConnect(Socket*) override {}
+};
+
+// Reply ENOTSUP to the handshake at the beginning of `buf' which is read
+// from `fd' of a server without shared memory, so that the client goes on
+// with TCP. Called on messages unknown to all protocols.
+// Returns 1 if a handshake is consumed from `buf', 0 if `buf' may be part
+// of a handshake, -1 otherwise.
+int RejectSharedMemoryHandshake(int fd, butil::IOBuf* buf);
+
+} // namespace brpc
+
+
+#endif  // BRPC_SHARED_MEMORY_TRANSPORT_H
@@ -19,6 +19,7 @@
 #include "butil/compat.h"                        // OS_MACOSX
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include "butil/ssl_compat.h"                    // SSL_SESSION_up_ref
 #ifdef USE_MESALINK
 #include <mesalink/openssl/ssl.h>
 #include <mesalink/openssl/err.h>
@@ -34,6 +35,9 @@
 #include "butil/logging.h"                        // CHECK
 #include "butil/macros.h"
 #include "butil/class_name.h"                     // butil::class_name
+#include "butil/memory/singleton_on_pthread_once.h"
+#include "bthread/mutex.h"                       // bthread::Mutex
+#include "bthread/condition_variable.h"          // bthread::ConditionVariable
 #include "brpc/log.h"
 #include "brpc/reloadable_flags.h"          // BRPC_VALIDATE_GFLAG
 #include "brpc/errno.pb.h"
@@ -79,10 +83,35 @@ DEFINE_int32(socket_send_buffer_size, -1,
 
 DEFINE_int32(ssl_bio_buffer_size, 16*1024, "Set buffer size for SSL read/write");
 
+DEFINE_bool(ssl_ktls, false, "Offload encryption of SSL connections to kernel"
+            "(kTLS) after handshaking when supported by OpenSSL and kernel, "
+            "otherwise encrypt in userspace as before");
+
+DEFINE_int32(ssl_max_concurrent_handshakes, 0,
+             "Max number of SSL handshakes computing at the same time, "
+             "others wait until one finishes. Limiting this prevents "
+             "handshake storms from occupying all worker threads. "
+             "<= 0 means unlimited");
+BRPC_VALIDATE_GFLAG(ssl_max_concurrent_handshakes, PassValidate);
+
+DEFINE_int32(socket_busy_poll_us, 0,
+             "Sockets keep polling for so many microseconds after reading "
+             "all data instead of waiting for epoll, which trades CPU for "
+             "lower latency. SO_BUSY_POLL is also set to the same value for "
+             "TCP sockets created afterwards. 0 means disabled");
+BRPC_VALIDATE_GFLAG(socket_busy_poll_us, NonNegativeInteger);
+
 DEFINE_int64(socket_max_unwritten_bytes, 64 * 1024 * 1024,
              "Max unwritten bytes in each socket, if the limit is reached,"
              " Socket.Write fails with EOVERCROWDED");
 
+DEFINE_int64(socket_unwritten_bytes_low_watermark, 0,
+             "An overcrowded socket becomes writable again when its unwritten "
+             "bytes drop below this value, so that producers waiting for it "
+             "don't resume as soon as the peer reads a little. Non-positive "
+             "value means -socket_max_unwritten_bytes");
+BRPC_VALIDATE_GFLAG(socket_unwritten_bytes_low_watermark, PassValidate);
+
 DEFINE_int32(max_connection_pool_size, 100,
              "Max number of pooled connections to a single endpoint");
 BRPC_VALIDATE_GFLAG(max_connection_pool_size, PassValidate);
@@ -422,6 +451,7 @@ Socket::Socket(Forbidden)
     , _fd(-1)
     , _tos(0)
     , _reset_fd_real_us(-1)
+    , _connection_epoch(0)
     , _on_edge_triggered_events(NULL)
     , _user(NULL)
     , _conn(NULL)
@@ -432,6 +462,7 @@ Socket::Socket(Forbidden)
     , _avg_msg_size(0)
     , _last_readtime_us(0)
     , _parsing_context(NULL)
+    , _protocol_context(NULL)
     , _correlation_id(0)
     , _health_check_interval_s(-1)
     , _ninprocess(1)
@@ -451,18 +482,22 @@ Socket::Socket(Forbidden)
     , _last_writetime_us(0)
     , _unwritten_bytes(0)
     , _epollout_butex(NULL)
+    , _writable_butex(NULL)
     , _write_head(NULL)
+    , _keep_write_delay_us(0)
     , _stream_set(NULL)
     , _ninflight_app_health_check(0)
 {
     CreateVarsOnce();
     pthread_mutex_init(&_id_wait_list_mutex, NULL);
     _epollout_butex = bthread::butex_create_checked<butil::atomic<int> >();
+    _writable_butex = bthread::butex_create_checked<butil::atomic<int> >();
 }
 
 Socket::~Socket() {
     pthread_mutex_destroy(&_id_wait_list_mutex);
     bthread::butex_destroy(_epollout_butex);
+    bthread::butex_destroy(_writable_butex);
 }
 
 void Socket::ReturnSuccessfulWriteRequest(Socket::WriteRequest* p) {
@@ -524,6 +559,7 @@ int Socket::ResetFileDescriptor(int fd) {
     // race conditions with the callback function inside epoll
     _fd.store(fd, butil::memory_order_release);
     _reset_fd_real_us = butil::gettimeofday_us();
+    _connection_epoch.fetch_add(1, butil::memory_order_release);
     if (!ValidFileDescriptor(fd)) {
         return 0;
     }
@@ -545,11 +581,27 @@ int Socket::ResetFileDescriptor(int fd) {
     // turn off nagling.
     // OK to fail, namely unix domain socket does not support this.
     butil::make_no_delay(fd);
-    if (_tos > 0 &&
+    if (_tos > 0 && !butil::is_unix_endpoint(_local_side) &&
         setsockopt(fd, IPPROTO_IP, IP_TOS, &_tos, sizeof(_tos)) < 0) {
         PLOG(FATAL) << "Fail to set tos of fd=" << fd << " to " << _tos;
     }
 
+#if defined(SO_BUSY_POLL)
+    if (FLAGS_socket_busy_poll_us > 0 && !butil::is_unix_endpoint(_local_side)) {
+        int busy_poll_us = FLAGS_socket_busy_poll_us;
+        // Values larger than sysctl net.core.busy_read require CAP_NET_ADMIN
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+                       &busy_poll_us, sizeof(busy_poll_us)) != 0) {
+            PLOG_EVERY_SECOND(WARNING) << "Fail to set SO_BUSY_POLL of fd="
+                                       << fd << " to " << busy_poll_us;
+        }
+#if defined(SO_PREFER_BUSY_POLL)
+        int prefer = 1;
+        setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer));
+#endif
+    }
+#endif  // SO_BUSY_POLL
+
     if (FLAGS_socket_send_buffer_size > 0) {
         int buff_size = FLAGS_socket_send_buffer_size;
         socklen_t size = sizeof(buff_size);
@@ -569,7 +621,8 @@ int Socket::ResetFileDescriptor(int fd) {
     }
 
     if (_on_edge_triggered_events) {
-        if (GetGlobalEventDispatcher(fd).AddConsumer(id(), fd) != 0) {
+        if (GetGlobalEventDispatcher(fd, _event_dispatcher_index)
+            .AddConsumer(id(), fd) != 0) {
             PLOG(ERROR) << "Fail to add SocketId=" << id() 
                         << " into EventDispatcher";
             _fd.store(-1, butil::memory_order_release);
@@ -594,6 +647,7 @@ int Socket::Create(const SocketOptions& options, SocketId* id) {
     m->_nevent.store(0, butil::memory_order_relaxed);
     m->_keytable_pool = options.keytable_pool;
     m->_tos = 0;
+    m->_event_dispatcher_index = options.event_dispatcher_index;
     m->_remote_side = options.remote_side;
     m->_on_edge_triggered_events = options.on_edge_triggered_events;
     m->_user = options.user;
@@ -625,6 +679,7 @@ int Socket::Create(const SocketOptions& options, SocketId* id) {
     // Disable SSL check if there is no SSL context
     m->_ssl_state = (options.initial_ssl_ctx == NULL ? SSL_OFF : SSL_UNKNOWN);
     m->_ssl_session = NULL;
+    m->_ssl_ktls = 0;
     m->_ssl_ctx = options.initial_ssl_ctx;
     m->_connection_type_for_progressive_read = CONNECTION_TYPE_UNKNOWN;
     m->_controller_released_socket.store(false, butil::memory_order_relaxed);
@@ -690,7 +745,8 @@ int Socket::WaitAndReset(int32_t expected_nref) {
     const int prev_fd = _fd.exchange(-1, butil::memory_order_relaxed);
     if (ValidFileDescriptor(prev_fd)) {
         if (_on_edge_triggered_events != NULL) {
-            GetGlobalEventDispatcher(prev_fd).RemoveConsumer(prev_fd);
+            GetGlobalEventDispatcher(prev_fd, _event_dispatcher_index)
+                .RemoveConsumer(prev_fd);
         }
         close(prev_fd);
         if (CreatedByConnect()) {
@@ -702,6 +758,7 @@ int Socket::WaitAndReset(int32_t expected_nref) {
         SSL_free(_ssl_session);
         _ssl_session = NULL;
     }        
+    _ssl_ktls = 0;
     _ssl_state = SSL_UNKNOWN;
     _nevent.store(0, butil::memory_order_relaxed);
     // parsing_context is very likely to be associated with the fd,
@@ -844,6 +901,9 @@ int Socket::SetFailed(int error_code, const char* error_fmt, ...) {
             // Wake up all threads waiting on EPOLLOUT when closing fd
             _epollout_butex->fetch_add(1, butil::memory_order_relaxed);
             bthread::butex_wake_all(_epollout_butex);
+            // Wake up producers waiting for the socket to be writable.
+            _writable_butex->fetch_add(1, butil::memory_order_release);
+            bthread::butex_wake_all(_writable_butex);
 
             // Wake up all unresponded RPC.
             CHECK_EQ(0, bthread_id_list_reset2_pthreadsafe(
@@ -969,7 +1029,8 @@ void Socket::OnRecycle() {
     const int prev_fd = _fd.exchange(-1, butil::memory_order_relaxed);
     if (ValidFileDescriptor(prev_fd)) {
         if (_on_edge_triggered_events != NULL) {
-            GetGlobalEventDispatcher(prev_fd).RemoveConsumer(prev_fd);
+            GetGlobalEventDispatcher(prev_fd, _event_dispatcher_index)
+                .RemoveConsumer(prev_fd);
         }
         close(prev_fd);
         if (create_by_connect) {
@@ -994,6 +1055,12 @@ void Socket::OnRecycle() {
     delete _pipeline_q;
     _pipeline_q = NULL;
 
+    Destroyable* protocol_ctx =
+        _protocol_context.exchange(NULL, butil::memory_order_acquire);
+    if (protocol_ctx) {
+        protocol_ctx->Destroy();
+    }
+
     delete _auth_context;
     _auth_context = NULL;
 
@@ -1115,7 +1182,7 @@ int Socket::WaitEpollOut(int fd, bool pollin, const timespec* abstime) {
     // Do not need to check addressable since it will be called by
     // health checker which called `SetFailed' before
     const int expected_val = _epollout_butex->load(butil::memory_order_relaxed);
-    EventDispatcher& edisp = GetGlobalEventDispatcher(fd);
+    EventDispatcher& edisp = GetGlobalEventDispatcher(fd, _event_dispatcher_index);
     if (edisp.AddEpollOut(id(), fd, pollin) != 0) {
         return -1;
     }
@@ -1141,7 +1208,15 @@ int Socket::Connect(const timespec* abstime,
     } else {
         _ssl_state = SSL_OFF;
     }
-    butil::fd_guard sockfd(socket(AF_INET, SOCK_STREAM, 0));
+    struct sockaddr_storage serv_addr;
+    socklen_t serv_addr_len = 0;
+    const int family = butil::endpoint2sockaddr(
+        remote_side(), &serv_addr, &serv_addr_len);
+    if (family < 0) {
+        PLOG(ERROR) << "Invalid address=" << remote_side();
+        return -1;
+    }
+    butil::fd_guard sockfd(socket(family, SOCK_STREAM, 0));
     if (sockfd < 0) {
         PLOG(ERROR) << "Fail to create socket";
         return -1;
@@ -1150,13 +1225,8 @@ int Socket::Connect(const timespec* abstime,
     // We need to do async connect (to manage the timeout by ourselves).
     CHECK_EQ(0, butil::make_non_blocking(sockfd));
     
-    struct sockaddr_in serv_addr;
-    bzero((char*)&serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr = remote_side().ip;
-    serv_addr.sin_port = htons(remote_side().port);
     const int rc = ::connect(
-        sockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
+        sockfd, (struct sockaddr*)&serv_addr, serv_addr_len);
     if (rc != 0 && errno != EINPROGRESS) {
         PLOG(WARNING) << "Fail to connect to " << remote_side();
         return -1;
@@ -1243,13 +1313,12 @@ int Socket::CheckConnected(int sockfd) {
         return -1;
     }
 
-    struct sockaddr_in client;
-    socklen_t size = sizeof(client);
-    CHECK_EQ(0, getsockname(sockfd, (struct sockaddr*) &client, &size));
+    butil::EndPoint local_point;
+    CHECK_EQ(0, butil::get_local_side(sockfd, &local_point));
     LOG_IF(INFO, FLAGS_log_connected)
             << "Connected to " << remote_side()
             << " via fd=" << (int)sockfd << " SocketId=" << id()
-            << " local_port=" << ntohs(client.sin_port);
+            << " local_side=" << local_point;
     if (CreatedByConnect()) {
         g_vars->channel_conn << 1;
     }
@@ -1554,6 +1623,8 @@ int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
 
     // We've got the right to write.
     req->next = NULL;
+    // Only the writer touches this field.
+    _keep_write_delay_us = opt.coalesce_window_us;
     
     // Connect to remote_side() if not.
     int ret = ConnectIfNot(opt.abstime, req);
@@ -1579,6 +1650,11 @@ int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
         // in the background.
         goto KEEPWRITE_IN_BACKGROUND;
     }
+
+    if (_keep_write_delay_us > 0) {
+        // Wait for more writes in KeepWrite.
+        goto KEEPWRITE_IN_BACKGROUND;
+    }
     
     // Write once in the calling thread. If the write is not complete,
     // continue it in KeepWrite thread.
@@ -1600,6 +1676,7 @@ int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
         }
     } else {
         AddOutputBytes(nw);
+        g_vars->write_batch_size << 1;
     }
     // If the writing is finished, write once in place within the current thread.  
     // Other,start another thread to write before it is finished
@@ -1652,6 +1729,13 @@ void* Socket::KeepWrite(void* void_arg) {
     // returning directly otherwise _write_head is permantly non-NULL which
     // makes later Write() abnormal.
     WriteRequest* cur_tail = NULL;
+    if (s->_keep_write_delay_us > 0) {
+        bthread_usleep(s->_keep_write_delay_us);
+        // Link requests issued during the sleep after `req' so that they're
+        // written in the first syscall. Never returns true since `req' is
+        // not a singular node.
+        s->IsWriteComplete(req, false, &cur_tail);
+    }
     do {
         // req was written, skip it.
         // Finish the current req first
@@ -1752,6 +1836,7 @@ ssize_t Socket::DoWrite(WriteRequest* req) {
         data_list[ndata++] = &p->data;
     }
 
+    g_vars->write_batch_size << ndata;
     if (ssl_state() == SSL_OFF) {
         // Write IOBuf in the batch array into the fd.
         if (_conn) {
@@ -1768,6 +1853,11 @@ ssize_t Socket::DoWrite(WriteRequest* req) {
         // TODO: Separate SSL stuff from SocketConnection
         return _conn->CutMessageIntoSSLChannel(_ssl_session, data_list, ndata);
     }
+    if (_ssl_ktls & KTLS_SEND) {
+        // Kernel encrypts the data into records.
+        return butil::IOBuf::cut_multiple_into_file_descriptor(
+            fd(), data_list, ndata);
+    }
     int ssl_error = 0;
     ssize_t nw = butil::IOBuf::cut_multiple_into_SSL_channel(
         _ssl_session, data_list, ndata, &ssl_error);
@@ -1800,6 +1890,49 @@ ssize_t Socket::DoWrite(WriteRequest* req) {
     return nw;
 }
 
+// Bound SSL handshakes computing concurrently. A slot is held during each
+// call to SSL_do_handshake and not held while waiting for the peer.
+class SSLHandshakeLimiter {
+public:
+    SSLHandshakeLimiter() : _running(0) {}
+
+    // Returns true if a slot is taken and must be released.
+    bool Acquire() {
+        if (FLAGS_ssl_max_concurrent_handshakes <= 0) {
+            return false;
+        }
+        std::unique_lock<bthread::Mutex> mu(_mutex);
+        while (FLAGS_ssl_max_concurrent_handshakes > 0 &&
+               _running >= FLAGS_ssl_max_concurrent_handshakes) {
+            _cond.wait(mu);
+        }
+        ++_running;
+        return true;
+    }
+
+    void Release() {
+        std::unique_lock<bthread::Mutex> mu(_mutex);
+        --_running;
+        _cond.notify_one();
+    }
+
+private:
+    bthread::Mutex _mutex;
+    bthread::ConditionVariable _cond;
+    int _running;
+};
+
+static int DoSSLHandshakeLimited(SSL* ssl) {
+    SSLHandshakeLimiter* limiter =
+        butil::get_leaky_singleton<SSLHandshakeLimiter>();
+    const bool limited = limiter->Acquire();
+    const int rc = SSL_do_handshake(ssl);
+    if (limited) {
+        limiter->Release();
+    }
+    return rc;
+}
+
 int Socket::SSLHandshake(int fd, bool server_mode) {
     if (_ssl_ctx == NULL) {
         if (server_mode) {
@@ -1809,7 +1942,6 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
         return 0;
     }
 
-    // TODO: Reuse ssl session id for client
     if (_ssl_session) {
         // Free the last session, which may be deprecated when socket failed
         SSL_free(_ssl_session);
@@ -1819,11 +1951,24 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
         LOG(ERROR) << "Fail to CreateSSLSession";
         return -1;
     }
+    _ssl_ktls = 0;
+    if (FLAGS_ssl_ktls) {
+        EnableKTLS(_ssl_session);
+    }
 #if defined(SSL_CTRL_SET_TLSEXT_HOSTNAME) || defined(USE_MESALINK)
     if (!_ssl_ctx->sni_name.empty()) {
         SSL_set_tlsext_host_name(_ssl_session, _ssl_ctx->sni_name.c_str());
     }
 #endif
+#ifndef USE_MESALINK
+    if (!server_mode) {
+        SSL_SESSION* session = _ssl_ctx->GetSession(_remote_side);
+        if (session != NULL) {
+            SSL_set_session(_ssl_session, session);
+            SSL_SESSION_free(session);
+        }
+    }
+#endif
 
     _ssl_state = SSL_CONNECTING;
 
@@ -1831,10 +1976,23 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
     // we use bthread_fd_wait as polling mechanism instead of EventDispatcher
     // as it may confuse the origin event processing code.
     while (true) {
-        int rc = SSL_do_handshake(_ssl_session);
+        int rc = DoSSLHandshakeLimited(_ssl_session);
         if (rc == 1) {
+            g_vars->nssl_handshake << 1;
+#ifndef USE_MESALINK
+            if (SSL_session_reused(_ssl_session)) {
+                g_vars->nssl_session_reused << 1;
+            }
+#endif
+            _ssl_ktls = (FLAGS_ssl_ktls ? GetKTLSDirections(_ssl_session) : 0);
             _ssl_state = SSL_CONNECTED;
-            AddBIOBuffer(_ssl_session, fd, FLAGS_ssl_bio_buffer_size);
+            if (_ssl_ktls == 0) {
+                AddBIOBuffer(_ssl_session, fd, FLAGS_ssl_bio_buffer_size);
+            } else {
+                // OpenSSL reads and writes kTLS sockets directly, buffer
+                // layers would hide kTLS from it.
+                g_vars->nktls << 1;
+            }
             return 0;
         }
 
@@ -1907,10 +2065,22 @@ ssize_t Socket::DoRead(size_t size_hint) {
     }
     // _ssl_state has been set
     if (ssl_state() == SSL_OFF) {
+        if (_conn) {
+            return _conn->AppendFromFileDescriptor(fd(), &_read_buf, size_hint);
+        }
         return _read_buf.append_from_file_descriptor(fd(), size_hint);
     }
 
     CHECK_EQ(SSL_CONNECTED, ssl_state());
+    if (_ssl_ktls & KTLS_RECV) {
+        // Kernel decrypts application data. Other records(alerts, session
+        // tickets...) fail plain reads with EIO and are left in the socket
+        // for SSL_read below.
+        const ssize_t nr = _read_buf.append_from_file_descriptor(fd(), size_hint);
+        if (nr >= 0 || errno != EIO) {
+            return nr;
+        }
+    }
     int ssl_error = 0;
     ssize_t nr = _read_buf.append_from_SSL_channel(_ssl_session, &ssl_error, size_hint);
     switch (ssl_error) {
@@ -2206,7 +2376,9 @@ void Socket::DebugSocket(std::ostream& os, SocketId id) {
     }
     os << "\ncid=" << ptr->_correlation_id
        << "\nwrite_head=" << ptr->_write_head.load(butil::memory_order_relaxed)
-       << "\nssl_state=" << SSLStateToString(ssl_state);
+       << "\nssl_state=" << SSLStateToString(ssl_state)
+       << "\nssl_ktls_send=" << !!(ptr->_ssl_ktls & KTLS_SEND)
+       << "\nssl_ktls_recv=" << !!(ptr->_ssl_ktls & KTLS_RECV);
     const SocketSSLContext* ssl_ctx = ptr->_ssl_ctx.get();
     if (ssl_ctx) {
         os << "\ninitial_ssl_ctx=" << ssl_ctx->raw_ctx;
@@ -2661,12 +2833,69 @@ void Socket::AddInputMessages(size_t count) {
     GetOrNewSharedPart()->in_num_messages.fetch_add(count, butil::memory_order_relaxed);
 }
 void Socket::CancelUnwrittenBytes(size_t bytes) {
-    const int64_t before_minus =
-        _unwritten_bytes.fetch_sub(bytes, butil::memory_order_relaxed);
-    if (before_minus < (int64_t)bytes + FLAGS_socket_max_unwritten_bytes) {
+    const int64_t after_minus =
+        _unwritten_bytes.fetch_sub(bytes, butil::memory_order_relaxed) -
+        (int64_t)bytes;
+    int64_t low_watermark = FLAGS_socket_unwritten_bytes_low_watermark;
+    if (low_watermark <= 0 || low_watermark > FLAGS_socket_max_unwritten_bytes) {
+        low_watermark = FLAGS_socket_max_unwritten_bytes;
+    }
+    if (_overcrowded && after_minus < low_watermark) {
         _overcrowded = false;
+        _writable_butex->fetch_add(1, butil::memory_order_release);
+        bthread::butex_wake_all(_writable_butex);
+    }
+}
+
+int Socket::WaitWritable(const timespec* abstime) {
+    while (true) {
+        const int expected_val =
+            _writable_butex->load(butil::memory_order_acquire);
+        if (Failed()) {
+            errno = EFAILEDSOCKET;
+            return -1;
+        }
+        if (!_overcrowded) {
+            return 0;
+        }
+        if (bthread::butex_wait(_writable_butex, expected_val, abstime) < 0 &&
+            errno != EWOULDBLOCK && errno != EINTR) {
+            return -1;
+        }
     }
 }
+
+struct WritableNotification {
+    SocketUniquePtr socket;
+    void (*on_writable)(int, void*);
+    void* arg;
+};
+
+static void* RunOnWritable(void* void_arg) {
+    std::unique_ptr<WritableNotification> n(
+        static_cast<WritableNotification*>(void_arg));
+    const int rc = n->socket->WaitWritable(NULL);
+    n->on_writable((rc == 0 ? 0 : errno), n->arg);
+    return NULL;
+}
+
+int Socket::NotifyOnWritable(void (*on_writable)(int, void*), void* arg) {
+    WritableNotification* n = new (std::nothrow) WritableNotification;
+    if (n == NULL) {
+        LOG(FATAL) << "Fail to new WritableNotification";
+        return -1;
+    }
+    ReAddress(&n->socket);
+    n->on_writable = on_writable;
+    n->arg = arg;
+    bthread_t th;
+    if (bthread_start_background(&th, NULL, RunOnWritable, n) != 0) {
+        LOG(FATAL) << "Fail to start bthread";
+        delete n;
+        return -1;
+    }
+    return 0;
+}
 void Socket::AddOutputBytes(size_t bytes) {
     GetOrNewSharedPart()->out_size.fetch_add(bytes, butil::memory_order_relaxed);
     _last_writetime_us.store(butil::cpuwide_time_us(),
@@ -2710,7 +2939,7 @@ std::string Socket::description() const {
     butil::string_appendf(&result, " addr=%s",
                           butil::endpoint2str(remote_side()).c_str());
     const int local_port = local_side().port;
-    if (local_port > 0) {
+    if (local_port > 0 && !butil::is_unix_endpoint(local_side())) {
         butil::string_appendf(&result, ":%d", local_port);
     }
     butil::string_appendf(&result, "} (0x%p)", this);
@@ -2725,7 +2954,40 @@ SocketSSLContext::~SocketSSLContext() {
     if (raw_ctx) {
         SSL_CTX_free(raw_ctx);
     }
+#ifndef USE_MESALINK
+    for (std::map<butil::EndPoint, SSL_SESSION*>::iterator
+             it = _sessions.begin(); it != _sessions.end(); ++it) {
+        SSL_SESSION_free(it->second);
+    }
+#endif
+}
+
+#ifndef USE_MESALINK
+SSL_SESSION* SocketSSLContext::GetSession(const butil::EndPoint& server) {
+    BAIDU_SCOPED_LOCK(_session_mutex);
+    std::map<butil::EndPoint, SSL_SESSION*>::iterator it = _sessions.find(server);
+    if (it == _sessions.end()) {
+        return NULL;
+    }
+    SSL_SESSION_up_ref(it->second);
+    return it->second;
+}
+
+void SocketSSLContext::SetSession(const butil::EndPoint& server,
+                                  SSL_SESSION* session) {
+    SSL_SESSION_up_ref(session);
+    SSL_SESSION* old = NULL;
+    {
+        BAIDU_SCOPED_LOCK(_session_mutex);
+        SSL_SESSION*& slot = _sessions[server];
+        old = slot;
+        slot = session;
+    }
+    if (old != NULL) {
+        SSL_SESSION_free(old);
+    }
 }
+#endif  // USE_MESALINK
 
 } // namespace brpc
 
@@ -2740,7 +3002,7 @@ ostream& operator<<(ostream& os, const brpc::Socket& sock) {
     }
     os << " addr=" << sock.remote_side();
     const int local_port = sock.local_side().port;
-    if (local_port > 0) {
+    if (local_port > 0 && !butil::is_unix_endpoint(sock.local_side())) {
         os << ':' << local_port;
     }
     os << "} (" << (void*)&sock << ')';
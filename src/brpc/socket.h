@@ -22,12 +22,14 @@
 #include <iostream>                            // std::ostream
 #include <deque>                               // std::deque
 #include <set>                                 // std::set
+#include <map>                                 // std::map
 #include "butil/atomicops.h"                    // butil::atomic
 #include "bthread/types.h"                      // bthread_id_t
 #include "butil/iobuf.h"                        // butil::IOBuf, IOPortal
 #include "butil/macros.h"                       // DISALLOW_COPY_AND_ASSIGN
 #include "butil/endpoint.h"                     // butil::EndPoint
 #include "butil/resource_pool.h"                // butil::ResourceId
+#include "butil/synchronization/lock.h"        // butil::Mutex
 #include "bthread/butex.h"                      // butex_create_checked
 #include "brpc/authenticator.h"           // Authenticator
 #include "brpc/errno.pb.h"                // EFAILEDSOCKET
@@ -89,6 +91,13 @@ public:
     // Cut IOBufs into fd or SSL Channel
     virtual ssize_t CutMessageIntoFileDescriptor(int, butil::IOBuf**, size_t) = 0;
     virtual ssize_t CutMessageIntoSSLChannel(SSL*, butil::IOBuf**, size_t) = 0;
+
+    // Read from the connection into IOBuf instead of reading fd directly.
+    // Returns bytes read, 0 on EOF, -1 otherwise and errno is set.
+    virtual ssize_t AppendFromFileDescriptor(int fd, butil::IOPortal* buf,
+                                             size_t size_hint) {
+        return buf->append_from_file_descriptor(fd, size_hint);
+    }
 };
 
 // Application-level connect. After TCP connected, the client sends some
@@ -136,6 +145,15 @@ struct SocketVarsCollector {
         , nkeepwrite_second("rpc_keepwrite_second", &nkeepwrite)
         , nwaitepollout("rpc_waitepollout_count")
         , nwaitepollout_second("rpc_waitepollout_second", &nwaitepollout)
+        , write_batch_size("rpc_socket_write_batch_size")
+        , nktls("rpc_ssl_ktls_count")
+        , nssl_handshake("rpc_ssl_handshake_count")
+        , nssl_handshake_second("rpc_ssl_handshake_second", &nssl_handshake)
+        , nssl_session_reused("rpc_ssl_session_reused_count")
+        , nudp_dropped("rpc_udp_dropped_datagram_count")
+        , nbusy_poll("rpc_socket_busy_poll_count")
+        , nfionread("rpc_socket_fionread_count")
+        , ninput_message_batch("rpc_input_message_batch_count")
     {}
 
     bvar::Adder<int64_t> nsocket;
@@ -147,6 +165,22 @@ struct SocketVarsCollector {
     bvar::PerSecond<bvar::Adder<int64_t> > nkeepwrite_second;
     bvar::Adder<int64_t> nwaitepollout;
     bvar::PerSecond<bvar::Adder<int64_t> > nwaitepollout_second;
+    // Number of WriteRequests written in one syscall.
+    bvar::IntRecorder write_batch_size;
+    // Number of SSL handshakes offloaded to kernel TLS.
+    bvar::Adder<int64_t> nktls;
+    // Number of completed SSL handshakes and those resuming sessions.
+    bvar::Adder<int64_t> nssl_handshake;
+    bvar::PerSecond<bvar::Adder<int64_t> > nssl_handshake_second;
+    bvar::Adder<int64_t> nssl_session_reused;
+    // Number of UDP datagrams dropped by UdpConnection.
+    bvar::Adder<int64_t> nudp_dropped;
+    // Number of busy-pollings finding data before epoll reports it.
+    bvar::Adder<int64_t> nbusy_poll;
+    // Number of reads sized by FIONREAD.
+    bvar::Adder<int64_t> nfionread;
+    // Number of bthreads created for batches of input messages.
+    bvar::Adder<int64_t> ninput_message_batch;
 };
 
 struct PipelinedInfo {
@@ -167,6 +201,19 @@ struct SocketSSLContext {
     
     SSL_CTX* raw_ctx;           // owned
     std::string sni_name;       // useful for clients
+
+#ifndef USE_MESALINK
+    // Sessions negotiated by clients using this context, one for each
+    // server. Handshakes to the server try to resume the session.
+    // GetSession returns a new reference or NULL.
+    SSL_SESSION* GetSession(const butil::EndPoint& server);
+    // Take a new reference of `session'.
+    void SetSession(const butil::EndPoint& server, SSL_SESSION* session);
+
+private:
+    butil::Mutex _session_mutex;
+    std::map<butil::EndPoint, SSL_SESSION*> _sessions;
+#endif
 };
 
 // TODO: Comment fields
@@ -193,6 +240,9 @@ struct SocketOptions {
     std::shared_ptr<AppConnect> app_connect;
     // The created socket will set parsing_context with this value.
     Destroyable* initial_parsing_context;
+    // Index of the global EventDispatcher watching `fd'. Negative value
+    // means the dispatcher is chosen by hashing `fd'.
+    int event_dispatcher_index;
 };
 
 // Abstractions on reading from and writing into file descriptors.
@@ -212,6 +262,8 @@ friend class HealthCheckTask;
 friend class OnAppHealthCheckDone;
 friend class HealthCheckManager;
 friend class policy::H2GlobalStreamCreator;
+friend class SharedMemoryConnection;
+friend class SharedMemoryConnect;
     class SharedPart;
     struct Forbidden {};
     struct WriteRequest;
@@ -262,10 +314,18 @@ public:
         // Default: false
         bool ignore_eovercrowded;
 
+        // Writes issued while another write is in flight are always combined
+        // into one syscall. If this field is positive and no write is in
+        // flight, the data is written by a background bthread after so many
+        // microseconds instead of in the calling thread, so that writes
+        // issued in the window are combined as well.
+        // Default: 0
+        int64_t coalesce_window_us;
+
         WriteOptions()
             : id_wait(INVALID_BTHREAD_ID), abstime(NULL)
             , pipelined_count(0), with_auth(false)
-            , ignore_eovercrowded(false) {}
+            , ignore_eovercrowded(false), coalesce_window_us(0) {}
     };
     int Write(butil::IOBuf *msg, const WriteOptions* options = NULL);
     
@@ -308,6 +368,19 @@ public:
     // _parsing_context, and false is returned. This process is thread-safe.
     template <typename T> bool initialize_parsing_context(T** ctx);
 
+    // Saved context of the protocol. Unlike parsing_context, it's kept
+    // across reconnections and destroyed when the socket is recycled, thus
+    // valid as long as the socket is referenced.
+    Destroyable* protocol_context() const
+    { return _protocol_context.load(butil::memory_order_consume); }
+    // Same as initialize_parsing_context, but for protocol_context.
+    template <typename T> bool initialize_protocol_context(T** ctx);
+
+    // Incremented each time the fd is reset, telling connections of the
+    // socket apart.
+    uint32_t connection_epoch() const
+    { return _connection_epoch.load(butil::memory_order_acquire); }
+
     // Connection-specific result of authentication.
     const AuthContext* auth_context() const { return _auth_context; }
     AuthContext* mutable_auth_context();
@@ -526,6 +599,19 @@ public:
     // Returns true if the remote side is overcrowded.
     bool is_overcrowded() const { return _overcrowded; }
 
+    // Wait until this socket is not overcrowded, namely bytes not written
+    // yet dropped below -socket_unwritten_bytes_low_watermark, or the socket
+    // failed, or `abstime' was reached(NULL means no timeout). Producers
+    // getting EOVERCROWDED should wait with this rather than retrying.
+    // Returns 0 when writable, -1 otherwise and errno is set.
+    int WaitWritable(const timespec* abstime);
+
+    // Call on_writable(error_code, arg) in a bthread when WaitWritable(NULL)
+    // returns, `error_code' is 0 when the socket is writable.
+    // Returns 0 on success, -1 otherwise.
+    int NotifyOnWritable(void (*on_writable)(int error_code, void* arg),
+                         void* arg);
+
     bthread_keytable_pool_t* keytable_pool() const { return _keytable_pool; }
 
 private:
@@ -692,6 +778,11 @@ private:
     butil::atomic<int> _fd;  // -1 when not connected.
     int _tos;                // Type of service which is actually only 8bits.
     int64_t _reset_fd_real_us; // When _fd was reset, in microseconds.
+    butil::atomic<uint32_t> _connection_epoch;
+
+    // Index of the EventDispatcher watching _fd, negative for the one
+    // chosen by _fd. Initialized by SocketOptions.event_dispatcher_index.
+    int _event_dispatcher_index;
 
     // Address of peer. Initialized by SocketOptions.remote_side.
     butil::EndPoint _remote_side;
@@ -740,6 +831,9 @@ private:
     // Saved context for parsing, reset before trying other protocols.
     butil::atomic<Destroyable*> _parsing_context;
 
+    // Saved context of the protocol, destroyed in OnRecycle().
+    butil::atomic<Destroyable*> _protocol_context;
+
     // Saving the correlation_id of RPC on protocols that cannot put
     // correlation_id on-wire and do not send multiple requests on one
     // connection simultaneously.
@@ -771,6 +865,8 @@ private:
 
     SSLState _ssl_state;
     SSL* _ssl_session;               // owner
+    // Bitwise OR of KTLSDirection offloaded to kernel in _ssl_session.
+    int _ssl_ktls;
     std::shared_ptr<SocketSSLContext> _ssl_ctx;
 
     // Pass from controller, for progressive reading.
@@ -812,9 +908,15 @@ private:
     // Butex to wait for EPOLLOUT event
     butil::atomic<int>* _epollout_butex;
 
+    // Butex to wait for the socket to be not overcrowded
+    butil::atomic<int>* _writable_butex;
+
     // Storing data that are not flushed into `fd' yet.
     butil::atomic<WriteRequest*> _write_head;
 
+    // WriteOptions.coalesce_window_us of the write which starts KeepWrite.
+    int64_t _keep_write_delay_us;
+
     butil::Mutex _stream_mutex;
     std::set<StreamId> *_stream_set;
 
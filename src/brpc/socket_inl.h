@@ -61,6 +61,7 @@ inline SocketOptions::SocketOptions()
     , conn(NULL)
     , app_connect(NULL)
     , initial_parsing_context(NULL)
+    , event_dispatcher_index(-1)
 {}
 
 inline int Socket::Dereference() {
@@ -306,6 +307,20 @@ bool Socket::initialize_parsing_context(T** ctx) {
     }
 }
 
+template <typename T>
+bool Socket::initialize_protocol_context(T** ctx) {
+    Destroyable* expected = NULL;
+    if (_protocol_context.compare_exchange_strong(
+            expected, *ctx, butil::memory_order_acq_rel,
+            butil::memory_order_acquire)) {
+        return true;
+    } else {
+        (*ctx)->Destroy();
+        *ctx = static_cast<T*>(expected);
+        return false;
+    }
+}
+
 // NOTE: Push/Pop may be called from different threads simultaneously.
 inline void Socket::PushPipelinedInfo(const PipelinedInfo& pi) {
     BAIDU_SCOPED_LOCK(_pipeline_mutex);
@@ -26,6 +26,7 @@
 #include "brpc/protocol.h"
 #include "brpc/input_messenger.h"
 #include "brpc/reloadable_flags.h"
+#include "brpc/shared_memory_transport.h"
 #include "brpc/socket_map.h"
 
 namespace brpc {
@@ -87,8 +88,10 @@ SocketMap* get_or_new_client_side_socket_map() {
 }
 
 int SocketMapInsert(const SocketMapKey& key, SocketId* id,
-                    const std::shared_ptr<SocketSSLContext>& ssl_ctx) {
-    return get_or_new_client_side_socket_map()->Insert(key, id, ssl_ctx);
+                    const std::shared_ptr<SocketSSLContext>& ssl_ctx,
+                    bool use_shared_memory) {
+    return get_or_new_client_side_socket_map()->Insert(
+        key, id, ssl_ctx, use_shared_memory);
 }    
 
 int SocketMapFind(const SocketMapKey& key, SocketId* id) {
@@ -210,7 +213,8 @@ void SocketMap::PrintSocketMap(std::ostream& os, void* arg) {
 }
 
 int SocketMap::Insert(const SocketMapKey& key, SocketId* id,
-                      const std::shared_ptr<SocketSSLContext>& ssl_ctx) {
+                      const std::shared_ptr<SocketSSLContext>& ssl_ctx,
+                      bool use_shared_memory) {
     std::unique_lock<butil::Mutex> mu(_mutex);
     SingleConnection* sc = _map.seek(key);
     if (sc) {
@@ -232,6 +236,9 @@ int SocketMap::Insert(const SocketMapKey& key, SocketId* id,
     SocketOptions opt;
     opt.remote_side = key.peer.addr;
     opt.initial_ssl_ctx = ssl_ctx;
+    if (use_shared_memory) {
+        opt.app_connect = std::make_shared<SharedMemoryConnect>();
+    }
     if (_options.socket_creator->CreateSocket(opt, &tmp_id) != 0) {
         PLOG(FATAL) << "Fail to create socket to " << key.peer;
         return -1;
@@ -79,12 +79,21 @@ struct SocketMapKeyHasher {
 // The corresponding SocketId is written to `*id'. If this function returns
 // successfully, SocketMapRemove() MUST be called when the Socket is not needed.
 // Return 0 on success, -1 otherwise.
+// Connections of the Socket transport data through shared memory when
+// `use_shared_memory' is true(shared_memory_transport.h).
+// Return 0 on success, -1 otherwise.
 int SocketMapInsert(const SocketMapKey& key, SocketId* id,
-                    const std::shared_ptr<SocketSSLContext>& ssl_ctx);
+                    const std::shared_ptr<SocketSSLContext>& ssl_ctx,
+                    bool use_shared_memory);
+
+inline int SocketMapInsert(const SocketMapKey& key, SocketId* id,
+                           const std::shared_ptr<SocketSSLContext>& ssl_ctx) {
+    return SocketMapInsert(key, id, ssl_ctx, false);
+}
 
 inline int SocketMapInsert(const SocketMapKey& key, SocketId* id) {
     std::shared_ptr<SocketSSLContext> empty_ptr;
-    return SocketMapInsert(key, id, empty_ptr);
+    return SocketMapInsert(key, id, empty_ptr, false);
 }
 
 // Find the SocketId associated with `key'.
@@ -144,10 +153,11 @@ public:
     ~SocketMap();
     int Init(const SocketMapOptions&);
     int Insert(const SocketMapKey& key, SocketId* id,
-               const std::shared_ptr<SocketSSLContext>& ssl_ctx);
+               const std::shared_ptr<SocketSSLContext>& ssl_ctx,
+               bool use_shared_memory);
     int Insert(const SocketMapKey& key, SocketId* id) {
         std::shared_ptr<SocketSSLContext> empty_ptr;
-        return Insert(key, id, empty_ptr);
+        return Insert(key, id, empty_ptr, false);
     }
 
     void Remove(const SocketMapKey& key, SocketId expected_id);
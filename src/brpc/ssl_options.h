@@ -84,6 +84,13 @@ struct ChannelSSLOptions {
     // Default: see above
     VerifyOptions verify;
 
+    // Resume the session of the last handshake when connections to the
+    // same server are established again, which saves most CPU of the
+    // handshakes. Sessions are shared by connections using the same
+    // options to the same server.
+    // Default: true
+    bool reuse_session;
+
     // TODO: Support CRL
 };
 
@@ -121,6 +128,10 @@ struct ServerSSLOptions {
     // Default: false
     bool release_buffer;
 
+    // Sessions are cached in storage shared by all servers in the process
+    // and tickets are encrypted with keys rotated every
+    // -ssl_ticket_key_rotation_s seconds, so that sessions survive reloading
+    // of certificates.
     // Maximum lifetime for a session to be cached inside OpenSSL in seconds.
     // A session can be reused (initiated by client) to save handshake before
     // it reaches this timeout.
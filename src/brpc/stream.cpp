@@ -158,7 +158,12 @@ ssize_t Stream::CutMessageIntoFileDescriptor(int /*fd*/,
 }
 
 void Stream::WriteToHostSocket(butil::IOBuf* b) {
-    BRPC_HANDLE_EOVERCROWDED(_host_socket->Write(b));
+    // Wait for the host socket to drain rather than polling it.
+    while (_host_socket->Write(b) != 0 && errno == EOVERCROWDED) {
+        if (_host_socket->WaitWritable(NULL) != 0) {
+            break;
+        }
+    }
 }
 
 ssize_t Stream::CutMessageIntoSSLChannel(SSL*, butil::IOBuf**, size_t) {
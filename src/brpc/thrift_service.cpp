@@ -49,5 +49,53 @@ void ThriftService::Expose(const butil::StringPiece& prefix) {
     _status->Expose(s);
 }
 
+ThriftMultiplexedService::~ThriftMultiplexedService() {
+    for (std::map<std::string, ThriftService*>::iterator
+             it = _services.begin(); it != _services.end(); ++it) {
+        delete it->second;
+    }
+    _services.clear();
+}
+
+int ThriftMultiplexedService::AddService(const std::string& name,
+                                         ThriftService* service) {
+    if (name.empty() || name.find(':') != std::string::npos) {
+        LOG(ERROR) << "Invalid service name=`" << name << '\'';
+        return -1;
+    }
+    if (service == NULL) {
+        LOG(ERROR) << "Param[service] is NULL";
+        return -1;
+    }
+    if (!_services.insert(std::make_pair(name, service)).second) {
+        LOG(ERROR) << "Service=" << name << " was added before";
+        return -1;
+    }
+    return 0;
+}
+
+void ThriftMultiplexedService::ProcessThriftFramedRequest(
+    Controller* cntl,
+    ThriftFramedMessage* request,
+    ThriftFramedMessage* response,
+    ::google::protobuf::Closure* done) {
+    std::string& method_name = cntl->_thrift_method_name;
+    const size_t pos = method_name.find(':');
+    if (pos == std::string::npos) {
+        cntl->SetFailed(ENOMETHOD, "method=%s is not multiplexed",
+                        method_name.c_str());
+        return done->Run();
+    }
+    std::map<std::string, ThriftService*>::const_iterator it =
+        _services.find(method_name.substr(0, pos));
+    if (it == _services.end()) {
+        cntl->SetFailed(ENOSERVICE, "Fail to find service of method=%s",
+                        method_name.c_str());
+        return done->Run();
+    }
+    method_name.erase(0, pos + 1);
+    it->second->ProcessThriftFramedRequest(cntl, request, response, done);
+}
+
 } // namespace brpc
 
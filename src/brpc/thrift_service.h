@@ -19,6 +19,7 @@
 #ifndef BRPC_THRIFT_SERVICE_H
 #define BRPC_THRIFT_SERVICE_H
 
+#include <map>
 #include "brpc/controller.h"                        // Controller
 #include "brpc/thrift_message.h"                    // ThriftFramedMessage
 #include "brpc/describable.h"
@@ -68,6 +69,35 @@ private:
     MethodStatus* _status;
 };
 
+// Serve multiple ThriftServices in one server, compatible with clients using
+// TMultiplexedProtocol which names methods as "ServiceName:MethodName".
+// Set ServerOptions.thrift_service to an instance of this class.
+// Example:
+//   brpc::ThriftMultiplexedService* mux = new brpc::ThriftMultiplexedService;
+//   mux->AddService("EchoService", new EchoServiceImpl);
+//   options.thrift_service = mux;
+class ThriftMultiplexedService : public ThriftService {
+public:
+    ThriftMultiplexedService() {}
+    // Added services are deleted.
+    ~ThriftMultiplexedService();
+
+    // Requests of method "`name':xxx" are dispatched to `service' whose
+    // controller->thrift_method_name() is "xxx". The response is named as
+    // "xxx" as well, which is expected by TMultiplexedProtocol.
+    // Returns 0 on success, -1 otherwise.
+    int AddService(const std::string& name, ThriftService* service);
+
+    void ProcessThriftFramedRequest(
+        Controller* controller,
+        ThriftFramedMessage* request,
+        ThriftFramedMessage* response,
+        ::google::protobuf::Closure* done) override;
+
+private:
+    std::map<std::string, ThriftService*> _services;
+};
+
 } // namespace brpc
 
 #endif // BRPC_THRIFT_SERVICE_H
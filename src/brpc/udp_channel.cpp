@@ -0,0 +1,120 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "butil/logging.h"
+#include "brpc/closure_guard.h"
+#include "brpc/compress.h"                       // SerializeAsCompressedData
+#include "brpc/controller.h"
+#include "brpc/errno.pb.h"
+#include "brpc/global.h"                         // GlobalInitializeOrDie
+#include "brpc/socket.h"
+#include "brpc/udp_transport.h"
+#include "brpc/policy/baidu_rpc_protocol.h"      // PackRpcRequest
+#include "brpc/udp_channel.h"
+
+
+namespace brpc {
+
+UdpChannel::UdpChannel()
+    : _socket_id(INVALID_SOCKET_ID) {
+}
+
+UdpChannel::~UdpChannel() {
+    if (_socket_id != INVALID_SOCKET_ID) {
+        Socket::SetFailed(_socket_id);
+    }
+}
+
+int UdpChannel::Init(const char* server_addr_and_port) {
+    butil::EndPoint point;
+    if (butil::str2endpoint(server_addr_and_port, &point) != 0 &&
+        butil::hostname2endpoint(server_addr_and_port, &point) != 0) {
+        LOG(ERROR) << "Invalid address=`" << server_addr_and_port << '\'';
+        return -1;
+    }
+    return Init(point);
+}
+
+int UdpChannel::Init(const butil::EndPoint& server_addr_and_port) {
+    GlobalInitializeOrDie();
+    if (_socket_id != INVALID_SOCKET_ID) {
+        LOG(ERROR) << "UdpChannel was initialized";
+        return -1;
+    }
+    if (butil::is_unix_endpoint(server_addr_and_port)) {
+        LOG(ERROR) << "UdpChannel does not support " << server_addr_and_port;
+        return -1;
+    }
+    SocketOptions options;
+    options.remote_side = server_addr_and_port;
+    // The fd is created and connected by UdpConnection at first write.
+    // Deleted in Socket::OnRecycle.
+    options.conn = new UdpConnection(false);
+    if (Socket::Create(options, &_socket_id) != 0) {
+        LOG(ERROR) << "Fail to create socket to udp://" << server_addr_and_port;
+        _socket_id = INVALID_SOCKET_ID;
+        return -1;
+    }
+    _server_address = server_addr_and_port;
+    return 0;
+}
+
+void UdpChannel::CallMethod(const google::protobuf::MethodDescriptor* method,
+                            google::protobuf::RpcController* controller_base,
+                            const google::protobuf::Message* request,
+                            google::protobuf::Message* /*response*/,
+                            google::protobuf::Closure* done) {
+    ClosureGuard done_guard(done);
+    Controller* cntl = static_cast<Controller*>(controller_base);
+    butil::IOBuf request_body;
+    if (request == NULL ||
+        !SerializeAsCompressedData(*request, &request_body,
+                                   cntl->request_compress_type())) {
+        return cntl->SetFailed(EREQUEST, "Fail to serialize request");
+    }
+    butil::IOBuf packet;
+    // No response is expected, thus no correlation_id.
+    policy::PackRpcRequest(&packet, NULL, 0, method, cntl, request_body, NULL);
+    if (cntl->Failed()) {
+        return;
+    }
+    if (packet.size() > UDP_MAX_DATAGRAM_SIZE) {
+        return cntl->SetFailed(EREQUEST, "Request of %zu bytes can't be put "
+                               "in a datagram", packet.size());
+    }
+    SocketUniquePtr sock;
+    if (Socket::Address(_socket_id, &sock) != 0) {
+        return cntl->SetFailed(EFAILEDSOCKET, "UdpChannel to %s is not usable",
+                               butil::endpoint2str(_server_address).c_str());
+    }
+    if (sock->Write(&packet) != 0) {
+        const int saved_errno = errno;
+        return cntl->SetFailed(saved_errno, "Fail to write into %s: %s",
+                               sock->description().c_str(),
+                               berror(saved_errno));
+    }
+}
+
+void UdpChannel::Describe(std::ostream& os, const DescribeOptions&) const {
+    os << "Udp[" << _server_address << ']';
+}
+
+int UdpChannel::CheckHealth() {
+    return (_socket_id != INVALID_SOCKET_ID ? 0 : -1);
+}
+
+} // namespace brpc
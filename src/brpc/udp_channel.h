@@ -0,0 +1,70 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_UDP_CHANNEL_H
+#define BRPC_UDP_CHANNEL_H
+
+#include "butil/endpoint.h"
+#include "brpc/channel_base.h"
+#include "brpc/socket_id.h"
+
+
+namespace brpc {
+
+// Send one-way baidu_std requests over UDP to a server started with
+// ServerOptions.enable_udp, for producers of lots of tiny messages (e.g.
+// metrics) that don't care about responses or occasional losses.
+// Each request along with the attachment is sent as one datagram, thus
+// must not be larger than 64KB. A RPC ends as soon as the request is queued
+// for sending: the response is never filled and the RPC fails only when
+// the request can't be sent at all. Requests sent concurrently are batched
+// by sendmmsg(udp_transport.h). Timeout, retry, backup request, streaming
+// and authentication are not supported.
+class UdpChannel : public ChannelBase {
+public:
+    UdpChannel();
+    ~UdpChannel();
+
+    // Send requests to `server_addr_and_port'.
+    // Returns 0 on success, -1 otherwise.
+    int Init(const char* server_addr_and_port);
+    int Init(const butil::EndPoint& server_addr_and_port);
+
+    // `response' is not touched and `done', if not NULL, runs in-place
+    // before this function returns.
+    void CallMethod(const google::protobuf::MethodDescriptor* method,
+                    google::protobuf::RpcController* controller,
+                    const google::protobuf::Message* request,
+                    google::protobuf::Message* response,
+                    google::protobuf::Closure* done);
+
+    void Describe(std::ostream&, const DescribeOptions&) const;
+
+    // Always 0 after Init since UDP has no connection.
+    int CheckHealth();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(UdpChannel);
+
+    butil::EndPoint _server_address;
+    SocketId _socket_id;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_UDP_CHANNEL_H
@@ -0,0 +1,377 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <algorithm>                             // std::min
+#include <netinet/in.h>
+#include <netinet/udp.h>                         // UDP_SEGMENT, UDP_GRO
+#include <sys/socket.h>                          // recvmmsg, sendmmsg
+#include <gflags/gflags.h>
+#include "butil/compat.h"                        // OS_LINUX
+#include "butil/fd_guard.h"
+#include "butil/fd_utility.h"                    // make_non_blocking
+#include "butil/logging.h"
+#include "butil/raw_pack.h"
+#include "brpc/protocol.h"                       // FLAGS_max_body_size
+#include "brpc/reloadable_flags.h"
+#include "brpc/udp_transport.h"
+
+
+namespace brpc {
+
+DEFINE_bool(udp_gso, true, "Send consecutive UDP datagrams of the same size "
+            "in one message with UDP_SEGMENT if the kernel supports");
+BRPC_VALIDATE_GFLAG(udp_gso, PassValidate);
+
+extern SocketVarsCollector* g_vars;
+
+// Datagrams received by one recvmmsg.
+static const size_t UDP_RECV_BATCH = 32;
+// Large enough for a datagram or a GRO-coalesced one.
+static const size_t UDP_RECV_BUF_SIZE = 65536;
+// Messages sent by one sendmmsg.
+static const size_t UDP_SEND_BATCH = 64;
+static const size_t UDP_MAX_IOV = 1024;
+// Limits of the kernel on segments of one GSO message.
+static const size_t UDP_MAX_SEGMENTS = 64;
+// Segments larger than the MTU are rejected, use the payload size of
+// ethernet.
+static const size_t UDP_MAX_SEGMENT_SIZE = 1472;
+
+#if !defined(OS_LINUX)
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
+static int recvmmsg(int fd, struct mmsghdr* msgs, unsigned int n,
+                    int flags, struct timespec*) {
+    unsigned int i = 0;
+    for (; i < n; ++i) {
+        const ssize_t nr = recvmsg(fd, &msgs[i].msg_hdr, flags);
+        if (nr < 0) {
+            return i ? (int)i : -1;
+        }
+        msgs[i].msg_len = nr;
+    }
+    return i;
+}
+
+static int sendmmsg(int fd, struct mmsghdr* msgs, unsigned int n, int flags) {
+    unsigned int i = 0;
+    for (; i < n; ++i) {
+        const ssize_t nw = sendmsg(fd, &msgs[i].msg_hdr, flags);
+        if (nw < 0) {
+            return i ? (int)i : -1;
+        }
+        msgs[i].msg_len = nw;
+    }
+    return i;
+}
+#endif  // OS_LINUX
+
+// True if `data' is exactly one baidu_std message.
+static bool IsBaiduStdDatagram(const char* data, size_t size) {
+    if (size < 12 || memcmp(data, "PRPC", 4) != 0) {
+        return false;
+    }
+    uint32_t body_size;
+    uint32_t meta_size;
+    butil::RawUnpacker(data + 4).unpack32(body_size).unpack32(meta_size);
+    return body_size + 12 == size && meta_size <= body_size &&
+        body_size <= FLAGS_max_body_size;
+}
+
+UdpConnection::UdpConnection(bool server_side)
+    : _server_side(server_side)
+    , _gso(true)
+    , _recv_buf(NULL) {
+}
+
+UdpConnection::~UdpConnection() {
+    free(_recv_buf);
+}
+
+void UdpConnection::BeforeRecycle(Socket*) {
+    delete this;
+}
+
+int UdpConnection::Connect(Socket* s, const timespec*,
+                           int (*on_connect)(int, int, void*), void* data) {
+    struct sockaddr_storage serv_addr;
+    socklen_t serv_addr_len = 0;
+    const int family = butil::endpoint2sockaddr(
+        s->remote_side(), &serv_addr, &serv_addr_len);
+    if (family < 0) {
+        PLOG(ERROR) << "Invalid address=" << s->remote_side();
+        return -1;
+    }
+    butil::fd_guard sockfd(socket(family, SOCK_DGRAM, 0));
+    if (sockfd < 0) {
+        PLOG(ERROR) << "Fail to create udp socket";
+        return -1;
+    }
+    // Connecting an UDP socket only sets the default destination, which
+    // finishes immediately.
+    if (::connect(sockfd, (struct sockaddr*)&serv_addr, serv_addr_len) != 0) {
+        PLOG(WARNING) << "Fail to connect to udp://" << s->remote_side();
+        return -1;
+    }
+    if (on_connect == NULL) {
+        return sockfd.release();
+    }
+    on_connect(sockfd.release(), 0, data);
+    return 0;
+}
+
+ssize_t UdpConnection::CutMessageIntoSSLChannel(SSL*, butil::IOBuf**, size_t) {
+    LOG(ERROR) << "SSL is not supported by UDP";
+    errno = EINVAL;
+    return -1;
+}
+
+ssize_t UdpConnection::CutMessageIntoFileDescriptor(
+    int fd, butil::IOBuf** data_list, size_t ndata) {
+    ssize_t nw = 0;
+    if (_server_side) {
+        // The server socket is shared by all senders, there's nowhere
+        // to send responses.
+        for (size_t i = 0; i < ndata; ++i) {
+            nw += data_list[i]->size();
+            data_list[i]->clear();
+        }
+        return nw;
+    }
+    struct mmsghdr msgs[UDP_SEND_BATCH];
+    struct iovec iovs[UDP_MAX_IOV];
+#if defined(UDP_SEGMENT)
+    char ctrls[UDP_SEND_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+#endif
+    // Number of datagrams in each message.
+    size_t ndgrams[UDP_SEND_BATCH];
+#if defined(UDP_SEGMENT)
+    const bool gso = _gso && FLAGS_udp_gso;
+#else
+    const bool gso = false;
+#endif
+    // Datagrams in data_list[0, ndone) are sent or dropped.
+    size_t ndone = 0;
+    size_t nmsg = 0;
+    size_t niov = 0;
+    size_t i = 0;
+    while (i < ndata && nmsg < UDP_SEND_BATCH) {
+        const size_t seg_size = data_list[i]->size();
+        if (nmsg == 0 && data_list[i]->backing_block_num() > UDP_MAX_IOV) {
+            // Never fits, only happens for extremely fragmented buffers.
+            LOG_EVERY_SECOND(WARNING) << "Drop datagram of "
+                << data_list[i]->backing_block_num() << " blocks";
+            g_vars->nudp_dropped << 1;
+            nw += seg_size;
+            data_list[i++]->clear();
+            ++ndone;
+            continue;
+        }
+        struct msghdr* h = &msgs[nmsg].msg_hdr;
+        memset(&msgs[nmsg], 0, sizeof(msgs[nmsg]));
+        h->msg_iov = iovs + niov;
+        size_t n = 0;
+        size_t total = 0;
+        while (i < ndata) {
+            const butil::IOBuf* buf = data_list[i];
+            const size_t size = buf->size();
+            const size_t nblock = buf->backing_block_num();
+            if (niov + nblock > UDP_MAX_IOV) {
+                break;
+            }
+            if (n > 0 && (!gso || size > seg_size ||
+                          seg_size > UDP_MAX_SEGMENT_SIZE ||
+                          n >= UDP_MAX_SEGMENTS ||
+                          total + size > UDP_MAX_DATAGRAM_SIZE)) {
+                break;
+            }
+            for (size_t j = 0; j < nblock; ++j) {
+                const butil::StringPiece block = buf->backing_block(j);
+                iovs[niov].iov_base = const_cast<char*>(block.data());
+                iovs[niov].iov_len = block.size();
+                ++niov;
+            }
+            total += size;
+            ++n;
+            ++i;
+            if (size < seg_size) {
+                // Only the last segment can be shorter.
+                break;
+            }
+        }
+        if (n == 0) {
+            break;  // run out of iovecs
+        }
+        h->msg_iovlen = (iovs + niov) - h->msg_iov;
+#if defined(UDP_SEGMENT)
+        if (n > 1) {
+            h->msg_control = ctrls[nmsg];
+            h->msg_controllen = sizeof(ctrls[nmsg]);
+            struct cmsghdr* cm = CMSG_FIRSTHDR(h);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            const uint16_t gso_size = seg_size;
+            memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+        }
+#endif
+        ndgrams[nmsg++] = n;
+    }
+    if (nmsg == 0) {
+        return nw;
+    }
+    int nsent = sendmmsg(fd, msgs, nmsg, 0);
+    bool dropped = false;
+    if (nsent < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+            return nw ? nw : -1;
+        }
+        if (ndgrams[0] > 1 && (errno == EINVAL || errno == EIO)) {
+            // Kernel or the NIC does not support GSO of this size.
+            PLOG(WARNING) << "Fail to send datagrams with UDP_SEGMENT, "
+                "send them separately";
+            _gso = false;
+            return nw ? nw : CutMessageIntoFileDescriptor(fd, data_list, ndata);
+        }
+        // Drop the first message just like the network does.
+        PLOG_EVERY_SECOND(WARNING) << "Fail to send to fd=" << fd;
+        nsent = 1;
+        dropped = true;
+    }
+    for (int k = 0; k < nsent; ++k) {
+        if (dropped) {
+            g_vars->nudp_dropped << ndgrams[k];
+        }
+        for (size_t j = 0; j < ndgrams[k]; ++j, ++ndone) {
+            nw += data_list[ndone]->size();
+            data_list[ndone]->clear();
+        }
+    }
+    return nw;
+}
+
+ssize_t UdpConnection::AppendFromFileDescriptor(
+    int fd, butil::IOPortal* buf, size_t /*size_hint*/) {
+    if (_recv_buf == NULL) {
+        _recv_buf = (char*)malloc(UDP_RECV_BATCH * UDP_RECV_BUF_SIZE);
+        if (_recv_buf == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    struct mmsghdr msgs[UDP_RECV_BATCH];
+    struct iovec iovs[UDP_RECV_BATCH];
+#if defined(UDP_GRO)
+    char ctrls[UDP_RECV_BATCH][CMSG_SPACE(sizeof(int))];
+#endif
+    ssize_t nr = 0;
+    // Loop until a valid datagram is appended, otherwise returning 0
+    // would be treated as EOF.
+    while (nr == 0) {
+        memset(msgs, 0, sizeof(msgs));
+        for (size_t i = 0; i < UDP_RECV_BATCH; ++i) {
+            iovs[i].iov_base = _recv_buf + i * UDP_RECV_BUF_SIZE;
+            iovs[i].iov_len = UDP_RECV_BUF_SIZE;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+#if defined(UDP_GRO)
+            msgs[i].msg_hdr.msg_control = ctrls[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(ctrls[i]);
+#endif
+        }
+        const int n = recvmmsg(fd, msgs, UDP_RECV_BATCH, 0, NULL);
+        if (n < 0) {
+            return -1;
+        }
+        for (int i = 0; i < n; ++i) {
+            const struct msghdr* h = &msgs[i].msg_hdr;
+            const char* data = (const char*)iovs[i].iov_base;
+            const size_t len = msgs[i].msg_len;
+            if (h->msg_flags & MSG_TRUNC) {
+                g_vars->nudp_dropped << 1;
+                continue;
+            }
+            // Coalesced datagrams are split by the size of segments.
+            size_t seg_size = len;
+#if defined(UDP_GRO)
+            for (struct cmsghdr* cm = CMSG_FIRSTHDR(h); cm != NULL;
+                 cm = CMSG_NXTHDR(const_cast<struct msghdr*>(h), cm)) {
+                if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                    int gso_size = 0;
+                    memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+                    if (gso_size > 0) {
+                        seg_size = gso_size;
+                    }
+                }
+            }
+#endif
+            for (size_t off = 0; off < len; off += seg_size) {
+                const size_t size = std::min(seg_size, len - off);
+                if (IsBaiduStdDatagram(data + off, size)) {
+                    buf->append(data + off, size);
+                    nr += size;
+                } else {
+                    g_vars->nudp_dropped << 1;
+                }
+            }
+        }
+    }
+    return nr;
+}
+
+bool IsServerDatagramSocket(const Socket* s) {
+    const UdpConnection* conn = dynamic_cast<const UdpConnection*>(s->conn());
+    return conn != NULL && conn->server_side();
+}
+
+void DropBadDatagram() {
+    g_vars->nudp_dropped << 1;
+}
+
+int UdpListen(const butil::EndPoint& point) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = 0;
+    const int family = butil::endpoint2sockaddr(point, &addr, &addr_len);
+    if (family < 0 || family == AF_UNIX) {
+        errno = EINVAL;
+        return -1;
+    }
+    butil::fd_guard sockfd(socket(family, SOCK_DGRAM, 0));
+    if (sockfd < 0) {
+        return -1;
+    }
+    const int on = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0) {
+        return -1;
+    }
+    if (bind(sockfd, (struct sockaddr*)&addr, addr_len) != 0) {
+        return -1;
+    }
+    if (butil::make_non_blocking(sockfd) != 0) {
+        return -1;
+    }
+#if defined(UDP_GRO)
+    // OK to fail, datagrams are received one by one then.
+    setsockopt(sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on));
+#endif
+    return sockfd.release();
+}
+
+} // namespace brpc
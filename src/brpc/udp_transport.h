@@ -0,0 +1,85 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_UDP_TRANSPORT_H
+#define BRPC_UDP_TRANSPORT_H
+
+#include "butil/endpoint.h"
+#include "brpc/socket.h"
+
+
+namespace brpc {
+
+// Largest payload of an UDP datagram.
+static const size_t UDP_MAX_DATAGRAM_SIZE = 65507;
+
+// Transport one-way baidu_std messages over UDP, one message per datagram.
+//
+// At server-side, datagrams are received in batches by recvmmsg(coalesced
+// ones are split when UDP_GRO is on) and the ones carrying a complete
+// baidu_std message are appended to the read buffer, thus the protocol
+// parses them as if they came from a TCP connection. Other datagrams are
+// dropped and counted in rpc_udp_dropped_datagram_count. Responses are
+// dropped as well since the Socket is shared by all senders.
+//
+// At client-side, the fd is connected to the server and each WriteRequest
+// is sent as a datagram. Requests written concurrently are sent together
+// by sendmmsg and consecutive ones of the same size are sent as one
+// message when UDP_SEGMENT(GSO) is supported. Datagrams failing to be sent
+// (e.g. ECONNREFUSED caused by ICMP) are dropped as if lost in the network.
+class UdpConnection : public SocketConnection {
+public:
+    explicit UdpConnection(bool server_side);
+    ~UdpConnection();
+
+    // Implement SocketConnection
+    void BeforeRecycle(Socket*) override;
+    int Connect(Socket*, const timespec*,
+                int (*on_connect)(int, int, void*), void*) override;
+    ssize_t CutMessageIntoFileDescriptor(int, butil::IOBuf**, size_t) override;
+    ssize_t CutMessageIntoSSLChannel(SSL*, butil::IOBuf**, size_t) override;
+    ssize_t AppendFromFileDescriptor(int, butil::IOPortal*, size_t) override;
+
+    bool server_side() const { return _server_side; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(UdpConnection);
+
+    const bool _server_side;
+    // Send consecutive datagrams of the same size with UDP_SEGMENT. Turned
+    // off when the kernel rejects it. Only touched by the writing thread.
+    bool _gso;
+    // Buffers of recvmmsg, allocated at first read.
+    char* _recv_buf;
+};
+
+// Create a non-blocking UDP socket bound to `point', with UDP_GRO on if
+// supported. Returns the fd, -1 otherwise and errno is set.
+int UdpListen(const butil::EndPoint& point);
+
+// True if `s' receives datagrams from all senders at server-side. Such a
+// Socket must not be SetFailed() for a bad message, call
+// DropBadDatagram() instead.
+bool IsServerDatagramSocket(const Socket* s);
+
+// Count a received message which is dropped for being malformed.
+void DropBadDatagram();
+
+} // namespace brpc
+
+
+#endif  // BRPC_UDP_TRANSPORT_H
@@ -31,11 +31,18 @@ ArenaOptions::ArenaOptions()
 Arena::Arena(const ArenaOptions& options)
     : _cur_block(NULL)
     , _isolated_blocks(NULL)
+    , _cleanups(NULL)
     , _block_size(options.initial_block_size)
     , _options(options) {
 }
 
 Arena::~Arena() {
+    // Cleanups are allocated in blocks, run them before freeing blocks.
+    while (_cleanups != NULL) {
+        Cleanup* const saved_next = _cleanups->next;
+        _cleanups->fn(_cleanups->arg);
+        _cleanups = saved_next;
+    }
     while (_cur_block != NULL) {
         Block* const saved_next = _cur_block->next;
         free(_cur_block);
@@ -51,6 +58,7 @@ Arena::~Arena() {
 void Arena::swap(Arena& other) {
     std::swap(_cur_block, other._cur_block);
     std::swap(_isolated_blocks, other._isolated_blocks);
+    std::swap(_cleanups, other._cleanups);
     std::swap(_block_size, other._block_size);
     const ArenaOptions tmp = _options;
     _options = other._options;
@@ -63,6 +71,18 @@ void Arena::clear() {
     swap(a);
 }
 
+int Arena::add_cleanup(void (*fn)(void*), void* arg) {
+    Cleanup* c = (Cleanup*)allocate(sizeof(Cleanup));
+    if (NULL == c) {
+        return -1;
+    }
+    c->next = _cleanups;
+    c->fn = fn;
+    c->arg = arg;
+    _cleanups = c;
+    return 0;
+}
+
 void* Arena::allocate_new_block(size_t n) {
     Block* b = (Block*)malloc(offsetof(Block, data) + n);
     b->next = _isolated_blocks;
@@ -45,6 +45,12 @@ public:
     void* allocate_aligned(size_t n);  // not implemented.
     void clear();
 
+    // Call `fn(arg)' when the arena is cleared or destroyed, in the reverse
+    // order of registrations. Use this to destroy objects with non-trivial
+    // destructors placed on the arena.
+    // Returns 0 on success, -1 otherwise.
+    int add_cleanup(void (*fn)(void*), void* arg);
+
 private:
     DISALLOW_COPY_AND_ASSIGN(Arena);
 
@@ -57,6 +63,12 @@ private:
         char data[0];
     };
 
+    struct Cleanup {
+        Cleanup* next;
+        void (*fn)(void*);
+        void* arg;
+    };
+
     void* allocate_in_other_blocks(size_t n);
     void* allocate_new_block(size_t n);
     Block* pop_block(Block* & head) {
@@ -67,6 +79,7 @@ private:
     
     Block* _cur_block;
     Block* _isolated_blocks;
+    Cleanup* _cleanups;
     size_t _block_size;
     ArenaOptions _options;
 };
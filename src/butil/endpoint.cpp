@@ -25,8 +25,17 @@
 #include <string.h>                            // strcpy
 #include <stdio.h>                             // snprintf
 #include <stdlib.h>                            // strtol
+#include <stddef.h>                            // offsetof
+#include <pthread.h>
+#include <sys/un.h>                            // sockaddr_un
+#include <sys/stat.h>                          // lstat
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
 #include <gflags/gflags.h>
 #include "butil/fd_guard.h"                    // fd_guard
+#include "butil/fd_utility.h"                  // make_non_blocking
 #include "butil/endpoint.h"                    // ip_t
 #include "butil/logging.h"
 #include "butil/memory/singleton_on_pthread_once.h"
@@ -98,8 +107,133 @@ int ip2hostname(ip_t ip, std::string* host) {
     return -1;
 }
 
+// Interned paths of unix domain sockets, never removed. Only paths given by
+// users and the empty path are interned, thus the table is bounded.
+struct UnixPathTable {
+    pthread_mutex_t mutex;
+    std::vector<const std::string*> paths;
+    std::map<std::string, int> ids;
+
+    UnixPathTable() {
+        pthread_mutex_init(&mutex, NULL);
+    }
+};
+
+// Set `point' to the interned `path'. The empty path is used instead if
+// `path' is not interned and `intern' is false.
+static void intern_unix_path(const char* path, bool intern, EndPoint* point) {
+    UnixPathTable* table = get_leaky_singleton<UnixPathTable>();
+    int id = 0;
+    pthread_mutex_lock(&table->mutex);
+    std::map<std::string, int>::iterator it = table->ids.find(path);
+    if (it == table->ids.end() && !intern) {
+        path = "";
+        it = table->ids.find(path);
+    }
+    if (it != table->ids.end()) {
+        id = it->second;
+    } else {
+        id = (int)table->paths.size();
+        it = table->ids.insert(std::make_pair(std::string(path), id)).first;
+        table->paths.push_back(&it->first);
+    }
+    pthread_mutex_unlock(&table->mutex);
+    point->ip = int2ip(id);
+    point->port = UNIX_ENDPOINT_PORT;
+}
+
+int unix_path2endpoint(const char* path, EndPoint* point) {
+    const size_t len = (path ? strlen(path) : 0);
+    if (len == 0 || len >= sizeof(((sockaddr_un*)NULL)->sun_path)) {
+        return -1;
+    }
+    intern_unix_path(path, true, point);
+    return 0;
+}
+
+const char* endpoint2unix_path(const EndPoint& point) {
+    if (!is_unix_endpoint(point)) {
+        return NULL;
+    }
+    UnixPathTable* table = get_leaky_singleton<UnixPathTable>();
+    const size_t id = ip2int(point.ip);
+    const char* path = NULL;
+    pthread_mutex_lock(&table->mutex);
+    if (id < table->paths.size()) {
+        // Strings in std::map are never moved.
+        path = table->paths[id]->c_str();
+    }
+    pthread_mutex_unlock(&table->mutex);
+    return path ? path : "";
+}
+
+int endpoint2sockaddr(const EndPoint& point, sockaddr_storage* addr,
+                      socklen_t* addr_len) {
+    bzero(addr, sizeof(*addr));
+    if (!is_unix_endpoint(point)) {
+        sockaddr_in* in = (sockaddr_in*)addr;
+        in->sin_family = AF_INET;
+        in->sin_addr = point.ip;
+        in->sin_port = htons(point.port);
+        *addr_len = sizeof(*in);
+        return AF_INET;
+    }
+    const char* path = endpoint2unix_path(point);
+    const size_t len = strlen(path);
+    sockaddr_un* un = (sockaddr_un*)addr;
+    if (len == 0 || len >= sizeof(un->sun_path)) {
+        errno = EINVAL;
+        return -1;
+    }
+    un->sun_family = AF_UNIX;
+    memcpy(un->sun_path, path, len);
+    if (path[0] == '@') {
+        // Abstract namespace, not terminated by '\0'.
+        un->sun_path[0] = '\0';
+        *addr_len = offsetof(sockaddr_un, sun_path) + len;
+    } else {
+        *addr_len = sizeof(*un);
+    }
+    return AF_UNIX;
+}
+
+int sockaddr2endpoint(const sockaddr_storage* addr, socklen_t addr_len,
+                      EndPoint* point) {
+    if (addr->ss_family == AF_INET) {
+        *point = EndPoint(*(const sockaddr_in*)addr);
+        return 0;
+    }
+    if (addr->ss_family != AF_UNIX) {
+        return -1;
+    }
+    const sockaddr_un* un = (const sockaddr_un*)addr;
+    const size_t offset = offsetof(sockaddr_un, sun_path);
+    char path[sizeof(un->sun_path) + 1];
+    size_t len = 0;
+    if (addr_len > offset) {
+        len = std::min((size_t)addr_len - offset, sizeof(un->sun_path));
+        memcpy(path, un->sun_path, len);
+        if (len > 0 && path[0] == '\0') {
+            path[0] = '@';
+        } else {
+            len = strnlen(path, len);
+        }
+    }
+    path[len] = '\0';
+    // Sockets connected without binding are unnamed, whose path is empty.
+    // Paths bound by peers are not interned, otherwise the table grows with
+    // every client binding a distinct path.
+    intern_unix_path(path, false, point);
+    return 0;
+}
+
 EndPointStr endpoint2str(const EndPoint& point) {
     EndPointStr str;
+    if (is_unix_endpoint(point)) {
+        snprintf(str._buf, sizeof(str._buf), "unix:%s",
+                 endpoint2unix_path(point));
+        return str;
+    }
     if (inet_ntop(AF_INET, &point.ip, str._buf, INET_ADDRSTRLEN) == NULL) {
         return endpoint2str(EndPoint(IP_NONE, 0));
     }
@@ -173,6 +307,10 @@ const char* my_hostname() {
 }
 
 int str2endpoint(const char* str, EndPoint* point) {
+    for (; isspace(*str); ++str);
+    if (strncmp(str, "unix:", 5) == 0) {
+        return unix_path2endpoint(str + 5, point);
+    }
     // Should be enough to hold ip address
     char buf[64];
     size_t i = 0;
@@ -215,6 +353,9 @@ int str2endpoint(const char* ip_str, int port, EndPoint* point) {
 }
 
 int hostname2endpoint(const char* str, EndPoint* point) {
+    if (strncmp(str, "unix:", 5) == 0) {
+        return unix_path2endpoint(str + 5, point);
+    }
     // Should be enough to hold ip address
     char buf[64];
     size_t i = 0;
@@ -260,6 +401,14 @@ int hostname2endpoint(const char* name_str, int port, EndPoint* point) {
 }
 
 int endpoint2hostname(const EndPoint& point, char* host, size_t host_len) {
+    if (is_unix_endpoint(point)) {
+        if (host == NULL || host_len == 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        snprintf(host, host_len, "%s", endpoint2str(point).c_str());
+        return 0;
+    }
     if (ip2hostname(point.ip, host, host_len) == 0) {
         size_t len = strlen(host);
         if (len + 1 < host_len) {
@@ -280,26 +429,27 @@ int endpoint2hostname(const EndPoint& point, std::string* host) {
 }
 
 int tcp_connect(EndPoint point, int* self_port) {
-    fd_guard sockfd(socket(AF_INET, SOCK_STREAM, 0));
+    struct sockaddr_storage serv_addr;
+    socklen_t serv_addr_len = 0;
+    const int family = endpoint2sockaddr(point, &serv_addr, &serv_addr_len);
+    if (family < 0) {
+        return -1;
+    }
+    fd_guard sockfd(socket(family, SOCK_STREAM, 0));
     if (sockfd < 0) {
         return -1;
     }
-    struct sockaddr_in serv_addr;
-    bzero((char*)&serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr = point.ip;
-    serv_addr.sin_port = htons(point.port);
     int rc = 0;
     if (bthread_connect != NULL) {
         rc = bthread_connect(sockfd, (struct sockaddr*)&serv_addr,
-                             sizeof(serv_addr));
+                             serv_addr_len);
     } else {
-        rc = ::connect(sockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
+        rc = ::connect(sockfd, (struct sockaddr*)&serv_addr, serv_addr_len);
     }
     if (rc < 0) {
         return -1;
     }
-    if (self_port != NULL) {
+    if (self_port != NULL && family == AF_INET) {
         EndPoint pt;
         if (get_local_side(sockfd, &pt) == 0) {
             *self_port = pt.port;
@@ -310,13 +460,69 @@ int tcp_connect(EndPoint point, int* self_port) {
     return sockfd.release();
 }
 
+// Remove the unix socket at the path of `addr' if it's left by a dead
+// process, so that the path can be bound again. Returns 0 if the path is
+// free now, -1 otherwise with errno set, EADDRINUSE if the path is not a
+// socket or a server is still listening on it.
+static int remove_stale_unix_socket(const sockaddr_storage* addr,
+                                    socklen_t addr_len) {
+    const sockaddr_un* un = (const sockaddr_un*)addr;
+    if (un->sun_path[0] == '\0') {
+        // Abstract names are freed along with the sockets.
+        return 0;
+    }
+    struct stat st;
+    if (lstat(un->sun_path, &st) != 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        LOG(ERROR) << un->sun_path << " exists and is not a socket";
+        errno = EADDRINUSE;
+        return -1;
+    }
+    fd_guard probe(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (probe < 0 || make_non_blocking(probe) != 0) {
+        return -1;
+    }
+    if (connect(probe, (const sockaddr*)addr, addr_len) == 0 ||
+        errno != ECONNREFUSED) {
+        // Connected or the backlog is full (EAGAIN), someone is serving.
+        errno = EADDRINUSE;
+        return -1;
+    }
+    // Nobody listens, the socket was left by a previous process.
+    if (unlink(un->sun_path) != 0 && errno != ENOENT) {
+        return -1;
+    }
+    return 0;
+}
+
 int tcp_listen(EndPoint point) {
-    fd_guard sockfd(socket(AF_INET, SOCK_STREAM, 0));
+    return tcp_listen(point, false);
+}
+
+int tcp_listen(EndPoint point, bool reuse_port) {
+    struct sockaddr_storage serv_addr;
+    socklen_t serv_addr_len = 0;
+    const int family = endpoint2sockaddr(point, &serv_addr, &serv_addr_len);
+    if (family < 0) {
+        return -1;
+    }
+    if (family == AF_UNIX && reuse_port) {
+        // Removing the file below would break the sockets listened before.
+        LOG(ERROR) << "SO_REUSEPORT does not work with " << point;
+        errno = EINVAL;
+        return -1;
+    }
+    fd_guard sockfd(socket(family, SOCK_STREAM, 0));
     if (sockfd < 0) {
         return -1;
     }
-
-    if (FLAGS_reuse_addr) {
+    if (family == AF_UNIX) {
+        if (remove_stale_unix_socket(&serv_addr, serv_addr_len) != 0) {
+            return -1;
+        }
+    } else if (FLAGS_reuse_addr) {
 #if defined(SO_REUSEADDR)
         const int on = 1;
         if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR,
@@ -329,25 +535,23 @@ int tcp_listen(EndPoint point) {
 #endif
     }
 
-    if (FLAGS_reuse_port) {
+    if (family == AF_INET && (reuse_port || FLAGS_reuse_port)) {
 #if defined(SO_REUSEPORT)
         const int on = 1;
         if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT,
                        &on, sizeof(on)) != 0) {
             LOG(WARNING) << "Fail to setsockopt SO_REUSEPORT of sockfd=" << sockfd;
+            if (reuse_port) {
+                return -1;
+            }
         }
 #else
-        LOG(ERROR) << "Missing def of SO_REUSEPORT while -reuse_port is on";
+        LOG(ERROR) << "Missing def of SO_REUSEPORT while reuse_port is on";
         return -1;
 #endif
     }
 
-    struct sockaddr_in serv_addr;
-    bzero((char*)&serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr = point.ip;
-    serv_addr.sin_port = htons(point.port);
-    if (bind(sockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) != 0) {
+    if (bind(sockfd, (struct sockaddr*)&serv_addr, serv_addr_len) != 0) {
         return -1;
     }
     if (listen(sockfd, 65535) != 0) {
@@ -360,27 +564,27 @@ int tcp_listen(EndPoint point) {
 }
 
 int get_local_side(int fd, EndPoint *out) {
-    struct sockaddr addr;
+    struct sockaddr_storage addr;
     socklen_t socklen = sizeof(addr);
-    const int rc = getsockname(fd, &addr, &socklen);
+    const int rc = getsockname(fd, (struct sockaddr*)&addr, &socklen);
     if (rc != 0) {
         return rc;
     }
     if (out) {
-        *out = butil::EndPoint(*(sockaddr_in*)&addr);
+        return sockaddr2endpoint(&addr, socklen, out);
     }
     return 0;
 }
 
 int get_remote_side(int fd, EndPoint *out) {
-    struct sockaddr addr;
+    struct sockaddr_storage addr;
     socklen_t socklen = sizeof(addr);
-    const int rc = getpeername(fd, &addr, &socklen);
+    const int rc = getpeername(fd, (struct sockaddr*)&addr, &socklen);
     if (rc != 0) {
         return rc;
     }
     if (out) {
-        *out = butil::EndPoint(*(sockaddr_in*)&addr);
+        return sockaddr2endpoint(&addr, socklen, out);
     }
     return 0;
 }
@@ -23,6 +23,7 @@
 #define BUTIL_ENDPOINT_H
 
 #include <netinet/in.h>                          // in_addr
+#include <sys/socket.h>                          // sockaddr_storage
 #include <iostream>                              // std::ostream
 #include "butil/containers/hash_tables.h"         // hashing functions
 
@@ -79,7 +80,7 @@ ip_t my_ip();
 // String form.
 const char* my_ip_cstr();
 
-// ipv4 + port
+// ipv4 + port, or path of an unix domain socket(see below).
 struct EndPoint {
     EndPoint() : ip(IP_ANY), port(0) {}
     EndPoint(ip_t ip2, int port2) : ip(ip2), port(port2) {}
@@ -90,9 +91,41 @@ struct EndPoint {
     int port;
 };
 
+// EndPoint of an unix domain socket has `port' set to UNIX_ENDPOINT_PORT
+// which is not a valid TCP port, and `ip' set to the id of its path. Paths
+// are interned so that such EndPoints can be copied, compared and hashed
+// as others. Strings in form of "unix:<path>" are parsed into unix
+// EndPoints by str2endpoint(), a path beginning with '@' is in the abstract
+// namespace(linux only).
+static const int UNIX_ENDPOINT_PORT = 0x7FFF0000;
+
+inline bool is_unix_endpoint(const EndPoint& point) {
+    return point.port == UNIX_ENDPOINT_PORT;
+}
+
+// Convert `path' of an unix domain socket to an EndPoint *point.
+// Returns 0 on success, -1 otherwise.
+int unix_path2endpoint(const char* path, EndPoint* point);
+
+// Path of the unix domain socket, NULL if `point' is not an unix EndPoint.
+const char* endpoint2unix_path(const EndPoint& point);
+
+// Convert `point' to sockaddr for socket(), bind() or connect().
+// Returns the address family(AF_INET or AF_UNIX), -1 otherwise.
+int endpoint2sockaddr(const EndPoint& point, sockaddr_storage* addr,
+                      socklen_t* addr_len);
+
+// Convert an address returned by accept() or getsockname() to EndPoint.
+// Paths of unix domain sockets not converted by unix_path2endpoint() or
+// str2endpoint() before are converted to the empty path.
+// Returns 0 on success, -1 otherwise.
+int sockaddr2endpoint(const sockaddr_storage* addr, socklen_t addr_len,
+                      EndPoint* point);
+
 struct EndPointStr {
     const char* c_str() const { return _buf; }
-    char _buf[INET_ADDRSTRLEN + 16];
+    // Long enough for "unix:" + path of an unix domain socket.
+    char _buf[128];
 };
 
 // Convert EndPoint to c-style string. Notice that you can serialize 
@@ -117,16 +150,26 @@ int endpoint2hostname(const EndPoint& point, char* hostname, size_t hostname_len
 int endpoint2hostname(const EndPoint& point, std::string* host);
 
 // Create a TCP socket and connect it to `server'. Write port of this side
-// into `self_port' if it's not NULL.
+// into `self_port' if it's not NULL. An unix domain socket is created
+// instead if `server' is an unix EndPoint.
 // Returns the socket descriptor, -1 otherwise and errno is set.
 int tcp_connect(EndPoint server, int* self_port);
 
 // Create and listen to a TCP socket bound with `ip_and_port'.
 // To enable SO_REUSEADDR for the whole program, enable gflag -reuse_addr
 // To enable SO_REUSEPORT for the whole program, enable gflag -reuse_port
+// If `ip_and_port' is an unix EndPoint, an unix domain socket is listened.
+// A socket file left at the path by a closed server is removed before
+// binding, other files fail this function with EADDRINUSE.
 // Returns the socket descriptor, -1 otherwise and errno is set.
 int tcp_listen(EndPoint ip_and_port);
 
+// Same as above, and SO_REUSEPORT is always enabled when `reuse_port' is
+// true so that multiple sockets can listen to the same port. Failing to
+// enable SO_REUSEPORT fails this function in this case, so do unix
+// EndPoints.
+int tcp_listen(EndPoint ip_and_port, bool reuse_port);
+
 // Get the local end of a socket connection
 int get_local_side(int fd, EndPoint *out);
 
@@ -185,6 +228,9 @@ inline bool operator!=(EndPoint p1, EndPoint p2) {
 }
 
 inline std::ostream& operator<<(std::ostream& os, const EndPoint& ep) {
+    if (is_unix_endpoint(ep)) {
+        return os << "unix:" << endpoint2unix_path(ep);
+    }
     return os << ep.ip << ':' << ep.port;
 }
 inline std::ostream& operator<<(std::ostream& os, const EndPointStr& ep_str) {
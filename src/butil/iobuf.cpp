@@ -28,6 +28,9 @@
 #include <fcntl.h>                         // O_RDONLY
 #include <errno.h>                         // errno
 #include <limits.h>                        // CHAR_BIT
+#include <sys/mman.h>                      // mmap
+#include <sys/stat.h>                      // fstat
+#include <unistd.h>                        // dup
 #include <stdexcept>                       // std::invalid_argument
 #include "butil/build_config.h"             // ARCH_CPU_X86_64
 #include "butil/atomicops.h"                // butil::atomic
@@ -36,6 +39,9 @@
 #include "butil/logging.h"                  // CHECK, LOG
 #include "butil/fd_guard.h"                 // butil::fd_guard
 #include "butil/iobuf.h"
+#if defined(OS_LINUX)
+#include <sys/sendfile.h>                  // sendfile
+#endif
 
 namespace butil {
 namespace iobuf {
@@ -194,6 +200,18 @@ struct UserDataExtension {
     UserDataDeleter deleter;
 };
 
+const uint16_t IOBUF_BLOCK_FLAGS_FILE = 0x2;
+
+// Range of a file mapped into memory. The pages are only read by the
+// kernel when the data is accessed from user space. Writing into file
+// descriptors sends the file directly instead.
+struct FileExtension {
+    int fd;             // owned
+    off_t offset;       // position of `data' in the file
+    void* map_base;
+    size_t map_size;
+};
+
 struct IOBuf::Block {
     butil::atomic<int> nshared;
     uint16_t flags;
@@ -230,12 +248,29 @@ struct IOBuf::Block {
         get_user_data_extension()->deleter = deleter;
     }
 
+    Block(char* data_in, uint32_t data_size, const FileExtension& file)
+        : nshared(1)
+        , flags(IOBUF_BLOCK_FLAGS_FILE)
+        , abi_check(0)
+        , size(data_size)
+        , cap(data_size)
+        , portal_next(NULL)
+        , data(data_in) {
+        *get_file_extension() = file;
+    }
+
     // Undefined behavior when (flags & IOBUF_BLOCK_FLAGS_USER_DATA) is 0.
     UserDataExtension* get_user_data_extension() {
         char* p = (char*)this;
         return (UserDataExtension*)(p + sizeof(Block));
     }
 
+    // Undefined behavior when (flags & IOBUF_BLOCK_FLAGS_FILE) is 0.
+    FileExtension* get_file_extension() {
+        char* p = (char*)this;
+        return (FileExtension*)(p + sizeof(Block));
+    }
+
     inline void check_abi() {
 #ifndef NDEBUG
         if (abi_check != 0) {
@@ -264,6 +299,12 @@ struct IOBuf::Block {
                 get_user_data_extension()->deleter(data);
                 this->~Block();
                 free(this);
+            } else if (flags & IOBUF_BLOCK_FLAGS_FILE) {
+                FileExtension* file = get_file_extension();
+                munmap(file->map_base, file->map_size);
+                ::close(file->fd);
+                this->~Block();
+                free(this);
             }
         }
     }
@@ -293,6 +334,30 @@ uint32_t block_size(IOBuf::Block const* b) {
     return b->size;
 }
 
+// True if `r' should be sent by sendfile() rather than written from memory.
+inline bool is_sendfile_ref(const IOBuf::BlockRef& r) {
+#if defined(OS_LINUX)
+    return r.block->flags & IOBUF_BLOCK_FLAGS_FILE;
+#else
+    return false;
+#endif
+}
+
+// Send the file range referenced by `r' into `fd' without copying it into
+// user space.
+ssize_t sendfile_ref(int fd, const IOBuf::BlockRef& r) {
+#if defined(OS_LINUX)
+    const FileExtension* file = r.block->get_file_extension();
+    off_t off = file->offset + r.offset;
+    const ssize_t nw = ::sendfile(fd, file->fd, &off, r.length);
+    if (nw >= 0 || (errno != EINVAL && errno != ENOSYS)) {
+        return nw;
+    }
+    // `fd' does not support sendfile(), write the mapped data instead.
+#endif
+    return ::write(fd, r.block->data + r.offset, r.length);
+}
+
 inline IOBuf::Block* create_block(const size_t block_size) {
     if (block_size > 0xFFFFFFFFULL) {
         LOG(FATAL) << "block_size=" << block_size << " is too large";
@@ -920,6 +985,14 @@ ssize_t IOBuf::pcut_into_file_descriptor(int fd, off_t offset, size_t size_hint)
         return 0;
     }
     
+    if (offset < 0 && iobuf::is_sendfile_ref(_ref_at(0))) {
+        const ssize_t nw = iobuf::sendfile_ref(fd, _ref_at(0));
+        if (nw > 0) {
+            pop_front(nw);
+        }
+        return nw;
+    }
+
     const size_t nref = std::min(_ref_num(), IOBUF_IOV_MAX);
     struct iovec vec[nref];
     size_t nvec = 0;
@@ -927,6 +1000,10 @@ ssize_t IOBuf::pcut_into_file_descriptor(int fd, off_t offset, size_t size_hint)
 
     do {
         IOBuf::BlockRef const& r = _ref_at(nvec);
+        if (offset < 0 && iobuf::is_sendfile_ref(r)) {
+            // Sent in next call
+            break;
+        }
         vec[nvec].iov_base = r.block->data + r.offset;
         vec[nvec].iov_len = r.length;
         ++nvec;
@@ -1050,18 +1127,27 @@ ssize_t IOBuf::pcut_multiple_into_file_descriptor(
     }
     struct iovec vec[IOBUF_IOV_MAX];
     size_t nvec = 0;
-    for (size_t i = 0; i < count; ++i) {
+    // Data before the first file range is written together, the file range
+    // is sent by sendfile() when it's the first.
+    const IOBuf::BlockRef* file_ref = NULL;
+    for (size_t i = 0; i < count && file_ref == NULL; ++i) {
         const IOBuf* p = pieces[i];
         const size_t nref = p->_ref_num();
         for (size_t j = 0; j < nref && nvec < IOBUF_IOV_MAX; ++j, ++nvec) {
             IOBuf::BlockRef const& r = p->_ref_at(j);
+            if (offset < 0 && iobuf::is_sendfile_ref(r)) {
+                file_ref = &r;
+                break;
+            }
             vec[nvec].iov_base = r.block->data + r.offset;
             vec[nvec].iov_len = r.length;
         }
     }
 
     ssize_t nw = 0;
-    if (offset >= 0) {
+    if (nvec == 0 && file_ref != NULL) {
+        nw = iobuf::sendfile_ref(fd, *file_ref);
+    } else if (offset >= 0) {
         static iobuf::iov_function pwritev_func = iobuf::get_pwritev_func();
         nw = pwritev_func(fd, vec, nvec, offset);
     } else {
@@ -1225,6 +1311,57 @@ int IOBuf::append_user_data(void* data, size_t size, void (*deleter)(void*)) {
     return 0;
 }
 
+int IOBuf::append_file(int fd, off_t offset, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    struct stat st;
+    if (offset < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        (size_t)st.st_size < (size_t)offset + size) {
+        LOG(ERROR) << "Invalid range [" << offset << ", " << offset + size
+                   << ") of fd=" << fd;
+        errno = EINVAL;
+        return -1;
+    }
+    // Size of blocks is 32-bit, split large files.
+    const size_t MAX_FILE_BLOCK_SIZE = 1024 * 1024 * 1024;
+    const off_t page_size = sysconf(_SC_PAGESIZE);
+    IOBuf tmp;
+    while (size > 0) {
+        const size_t len = std::min(size, MAX_FILE_BLOCK_SIZE);
+        FileExtension file;
+        file.offset = offset;
+        const off_t map_offset = offset / page_size * page_size;
+        file.map_size = len + (offset - map_offset);
+        file.map_base = mmap(NULL, file.map_size, PROT_READ, MAP_SHARED,
+                             fd, map_offset);
+        if (file.map_base == MAP_FAILED) {
+            PLOG(ERROR) << "Fail to mmap fd=" << fd;
+            return -1;
+        }
+        file.fd = dup(fd);
+        char* mem = NULL;
+        if (file.fd < 0 ||
+            (mem = (char*)malloc(sizeof(IOBuf::Block) +
+                                 sizeof(FileExtension))) == NULL) {
+            PLOG(ERROR) << "Fail to reference fd=" << fd;
+            if (file.fd >= 0) {
+                ::close(file.fd);
+            }
+            munmap(file.map_base, file.map_size);
+            return -1;
+        }
+        char* data = (char*)file.map_base + (offset - map_offset);
+        IOBuf::Block* b = new (mem) IOBuf::Block(data, len, file);
+        const IOBuf::BlockRef r = { 0, b->cap, b };
+        tmp._move_back_ref(r);
+        offset += len;
+        size -= len;
+    }
+    append(Movable(tmp));
+    return 0;
+}
+
 int IOBuf::resize(size_t n, char c) {
     const size_t saved_len = length();
     if (n < saved_len) {
@@ -248,6 +248,15 @@ public:
     // deleted using the deleter func when no IOBuf references it anymore.
     int append_user_data(void* data, size_t size, void (*deleter)(void*));
 
+    // Append `size' bytes of file `fd' starting at `offset' to back side
+    // WITHOUT reading the file. When cut into file descriptors(e.g. sockets)
+    // the data is sent from the page cache by sendfile(), otherwise it's
+    // read into memory when being accessed. `fd' is duplicated and can be
+    // closed after the call. The range should not be modified or truncated
+    // before the IOBuf is destroyed.
+    // Returns 0 on success, -1 otherwise.
+    int append_file(int fd, off_t offset, size_t size);
+
     // Resizes the buf to a length of n characters.
     // If n is smaller than the current length, all bytes after n will be
     // truncated.
@@ -669,6 +678,11 @@ public:
     int append(const void* data, size_t n);
     int append(const butil::StringPiece& str);
 
+    // Append `buf' to back side of the internal buffer by referencing its
+    // blocks, no data is copied. Useful for large payloads.
+    // Returns 0 on success, -1 otherwise.
+    int append(const IOBuf& buf);
+
     // Format integer |d| to back side of the internal buffer, which is much faster
     // than snprintf(..., "%lu", d).
     // Returns 0 on success, -1 otherwise.
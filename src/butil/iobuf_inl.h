@@ -284,6 +284,14 @@ inline int IOBufAppender::append(const StringPiece& str) {
     return append(str.data(), str.size());
 }
 
+inline int IOBufAppender::append(const IOBuf& buf) {
+    // Give back unused space of current block so that following appending
+    // continues after `buf'.
+    shrink();
+    _buf.append(buf);
+    return 0;
+}
+
 inline int IOBufAppender::append_decimal(long d) {
     char buf[24];  // enough for decimal 64-bit integers
     size_t n = sizeof(buf);
@@ -0,0 +1,442 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <ctype.h>                              // isdigit
+#include <errno.h>
+#include <inttypes.h>                           // PRId64
+#include <stdio.h>
+#include <stdlib.h>                             // strtoll
+#include <string.h>
+#include <algorithm>                            // std::sort
+#include "butil/logging.h"
+#include "butil/time.h"                         // gettimeofday_us
+#include "bvar/binary_dump.h"
+
+namespace bvar {
+
+static const char BINARY_DUMP_MAGIC[4] = { 'B', 'V', 'D', '1' };
+// Magic and the varint of body size.
+static const size_t MAX_FRAME_HEADER_SIZE = sizeof(BINARY_DUMP_MAGIC) + 10;
+
+static void append_varint(std::string* out, uint64_t v) {
+    while (v >= 0x80) {
+        out->push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out->push_back((char)v);
+}
+
+static bool parse_varint(const char** p, const char* end, uint64_t* v) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        const uint8_t b = (uint8_t)*(*p)++;
+        result |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void append_string(std::string* out, const butil::StringPiece& s) {
+    append_varint(out, s.size());
+    out->append(s.data(), s.size());
+}
+
+static bool parse_string(const char** p, const char* end, std::string* s) {
+    uint64_t size = 0;
+    if (!parse_varint(p, end, &size) || size > (uint64_t)(end - *p)) {
+        return false;
+    }
+    s->assign(*p, size);
+    *p += size;
+    return true;
+}
+
+inline uint64_t zigzag_encode(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t v) {
+    return (int64_t)((v >> 1) ^ (~(v & 1) + 1));
+}
+
+// True if `s' is an integer printed by ostream, which is restored exactly.
+static bool parse_integer(const butil::StringPiece& s, int64_t* v) {
+    char buf[24];
+    if (s.empty() || s.size() >= sizeof(buf) ||
+        !(isdigit(s[0]) || (s[0] == '-' && s.size() > 1))) {
+        return false;
+    }
+    memcpy(buf, s.data(), s.size());
+    buf[s.size()] = '\0';
+    char* endptr = NULL;
+    errno = 0;
+    const long long x = strtoll(buf, &endptr, 10);
+    if (*endptr != '\0' || errno != 0) {
+        return false;
+    }
+    // Reject "007", "-0" etc.
+    char canonical[24];
+    snprintf(canonical, sizeof(canonical), "%lld", x);
+    if (strcmp(canonical, buf) != 0) {
+        return false;
+    }
+    *v = x;
+    return true;
+}
+
+BinaryDumpEncoder::BinaryDumpEncoder()
+    : _next_id(0)
+    , _seq(0)
+    , _keyframe(true)
+    , _time_us(0)
+    , _family(0)
+    , _nname(0)
+    , _nvalue(0) {
+    CHECK_EQ(0, _entries.init(1024, 80));
+}
+
+BinaryDumpEncoder::~BinaryDumpEncoder() {}
+
+void BinaryDumpEncoder::begin_frame(bool keyframe) {
+    _keyframe = (keyframe || _seq == 0);
+    if (_keyframe) {
+        _entries.clear();
+        _next_id = 0;
+    }
+    ++_seq;
+    _time_us = butil::gettimeofday_us();
+    _family = 0;
+    _nname = 0;
+    _nvalue = 0;
+    _names.clear();
+    _values.clear();
+}
+
+uint32_t BinaryDumpEncoder::put(BinaryDumpKind kind, const std::string& name,
+                                const butil::StringPiece& desc) {
+    // Variables and families of labeled variables are in different
+    // namespaces.
+    _key.clear();
+    _key.push_back('0' + kind);
+    _key.append(name);
+    Entry* e = _entries.seek(_key);
+    if (e == NULL) {
+        e = &_entries[_key];
+        e->id = _next_id++;
+        e->seq = 0;
+        e->has_value = false;
+        e->is_integer = false;
+        e->integer = 0;
+        append_varint(&_names, kind);
+        if (kind == BINARY_DUMP_MVAR) {
+            append_varint(&_names, _family);
+        }
+        append_string(&_names, name);
+        ++_nname;
+    }
+    e->seq = _seq;
+    if (e->has_value && desc == e->desc) {
+        return e->id;
+    }
+    int64_t integer = 0;
+    const bool is_integer = parse_integer(desc, &integer);
+    append_varint(&_values, e->id);
+    if (is_integer) {
+        append_varint(&_values, BINARY_DUMP_INTEGER);
+        append_varint(&_values, zigzag_encode(
+                          (int64_t)((uint64_t)integer - (uint64_t)e->integer)));
+        e->integer = integer;
+    } else {
+        append_varint(&_values, BINARY_DUMP_STRING);
+        append_string(&_values, desc);
+    }
+    e->has_value = true;
+    e->is_integer = is_integer;
+    e->desc.assign(desc.data(), desc.size());
+    ++_nvalue;
+    return e->id;
+}
+
+bool BinaryDumpEncoder::dump(const std::string& name,
+                             const butil::StringPiece& desc) {
+    put(BINARY_DUMP_VAR, name, desc);
+    return true;
+}
+
+bool BinaryDumpEncoder::dump_comment(const std::string& name,
+                                     const std::string& type) {
+    _family = put(BINARY_DUMP_COMMENT, name, type) + 1;
+    return true;
+}
+
+bool BinaryDumpEncoder::dump_mvar(const std::string& name,
+                                  const butil::StringPiece& desc) {
+    put(BINARY_DUMP_MVAR, name, desc);
+    return true;
+}
+
+int BinaryDumpEncoder::end_frame(butil::IOBuf* out) {
+    // Variables not dumped in this frame are removed.
+    std::vector<std::string> removed_keys;
+    std::string removed;
+    for (butil::FlatMap<std::string, Entry>::const_iterator
+             it = _entries.begin(); it != _entries.end(); ++it) {
+        if (it->second.seq != _seq) {
+            removed_keys.push_back(it->first);
+            append_varint(&removed, it->second.id);
+        }
+    }
+    for (size_t i = 0; i < removed_keys.size(); ++i) {
+        _entries.erase(removed_keys[i]);
+    }
+
+    std::string body;
+    body.reserve(_names.size() + _values.size() + removed.size() + 32);
+    append_varint(&body, _keyframe ? BINARY_DUMP_KEYFRAME : 0);
+    append_varint(&body, _time_us);
+    append_varint(&body, _nname);
+    body.append(_names);
+    append_varint(&body, _nvalue);
+    body.append(_values);
+    append_varint(&body, removed_keys.size());
+    body.append(removed);
+
+    std::string header(BINARY_DUMP_MAGIC, sizeof(BINARY_DUMP_MAGIC));
+    append_varint(&header, body.size());
+    out->append(header);
+    out->append(body);
+    _names.clear();
+    _values.clear();
+    return _nvalue;
+}
+
+BinaryDumpDecoder::BinaryDumpDecoder()
+    : _has_keyframe(false)
+    , _time_us(0) {
+}
+
+int BinaryDumpDecoder::decode(butil::IOBuf* buf) {
+    int nframe = 0;
+    while (!buf->empty()) {
+        char header[MAX_FRAME_HEADER_SIZE];
+        const size_t n = buf->copy_to(header, sizeof(header));
+        if (n < sizeof(BINARY_DUMP_MAGIC)) {
+            break;
+        }
+        if (memcmp(header, BINARY_DUMP_MAGIC, sizeof(BINARY_DUMP_MAGIC)) != 0) {
+            LOG(ERROR) << "Invalid magic of binary bvar dump";
+            return -1;
+        }
+        const char* p = header + sizeof(BINARY_DUMP_MAGIC);
+        uint64_t body_size = 0;
+        if (!parse_varint(&p, header + n, &body_size)) {
+            if (n < sizeof(header)) {
+                break;
+            }
+            LOG(ERROR) << "Invalid frame size of binary bvar dump";
+            return -1;
+        }
+        const size_t header_size = p - header;
+        if (buf->size() < header_size + body_size) {
+            break;
+        }
+        buf->pop_front(header_size);
+        std::string body;
+        buf->cutn(&body, body_size);
+        if (decode_body(body.data(), body.data() + body.size()) != 0) {
+            LOG(ERROR) << "Fail to decode frame of binary bvar dump";
+            return -1;
+        }
+        ++nframe;
+    }
+    return nframe;
+}
+
+int BinaryDumpDecoder::decode_body(const char* p, const char* end) {
+    uint64_t flags = 0;
+    uint64_t time_us = 0;
+    if (!parse_varint(&p, end, &flags) || !parse_varint(&p, end, &time_us)) {
+        return -1;
+    }
+    if (flags & BINARY_DUMP_KEYFRAME) {
+        _entries.clear();
+        _has_keyframe = true;
+    } else if (!_has_keyframe) {
+        // Values in this frame are relative to unknown frames.
+        return 0;
+    }
+    _time_us = time_us;
+
+    uint64_t nname = 0;
+    if (!parse_varint(&p, end, &nname)) {
+        return -1;
+    }
+    for (uint64_t i = 0; i < nname; ++i) {
+        uint64_t kind = 0;
+        uint64_t family = 0;
+        if (!parse_varint(&p, end, &kind) || kind > BINARY_DUMP_MVAR) {
+            return -1;
+        }
+        if (kind == BINARY_DUMP_MVAR &&
+            (!parse_varint(&p, end, &family) || family > _entries.size())) {
+            return -1;
+        }
+        Entry e;
+        e.kind = (BinaryDumpKind)kind;
+        e.family = family;
+        e.removed = false;
+        e.has_value = false;
+        e.is_integer = false;
+        e.integer = 0;
+        if (!parse_string(&p, end, &e.name)) {
+            return -1;
+        }
+        _entries.push_back(e);
+    }
+
+    uint64_t nvalue = 0;
+    if (!parse_varint(&p, end, &nvalue)) {
+        return -1;
+    }
+    for (uint64_t i = 0; i < nvalue; ++i) {
+        uint64_t id = 0;
+        uint64_t type = 0;
+        if (!parse_varint(&p, end, &id) || id >= _entries.size() ||
+            !parse_varint(&p, end, &type)) {
+            return -1;
+        }
+        Entry& e = _entries[id];
+        if (type == BINARY_DUMP_INTEGER) {
+            uint64_t delta = 0;
+            if (!parse_varint(&p, end, &delta)) {
+                return -1;
+            }
+            e.integer = (int64_t)((uint64_t)e.integer +
+                                  (uint64_t)zigzag_decode(delta));
+            char buf[24];
+            snprintf(buf, sizeof(buf), "%" PRId64, e.integer);
+            e.value = buf;
+            e.is_integer = true;
+        } else if (type == BINARY_DUMP_STRING) {
+            if (!parse_string(&p, end, &e.value)) {
+                return -1;
+            }
+            e.is_integer = false;
+        } else {
+            return -1;
+        }
+        e.has_value = true;
+    }
+
+    uint64_t nremoved = 0;
+    if (!parse_varint(&p, end, &nremoved)) {
+        return -1;
+    }
+    for (uint64_t i = 0; i < nremoved; ++i) {
+        uint64_t id = 0;
+        if (!parse_varint(&p, end, &id) || id >= _entries.size()) {
+            return -1;
+        }
+        _entries[id].removed = true;
+        _entries[id].value.clear();
+    }
+    return p == end ? 0 : -1;
+}
+
+namespace {
+struct CompareEntryName {
+    explicit CompareEntryName(const std::vector<BinaryDumpDecoder::Entry>* e)
+        : entries(e) {}
+    bool operator()(size_t i, size_t j) const {
+        const BinaryDumpDecoder::Entry& e1 = (*entries)[i];
+        const BinaryDumpDecoder::Entry& e2 = (*entries)[j];
+        if (e1.family != e2.family) {
+            return e1.family < e2.family;
+        }
+        return e1.name < e2.name;
+    }
+    const std::vector<BinaryDumpDecoder::Entry>* entries;
+};
+
+struct FamilyLess {
+    explicit FamilyLess(const std::vector<BinaryDumpDecoder::Entry>* e)
+        : entries(e) {}
+    bool operator()(size_t i, uint32_t family) const {
+        return (*entries)[i].family < family;
+    }
+    const std::vector<BinaryDumpDecoder::Entry>* entries;
+};
+}  // namespace
+
+int BinaryDumpDecoder::dump(Dumper* dumper) const {
+    std::vector<size_t> vars;
+    std::vector<size_t> comments;
+    std::vector<size_t> mvars;
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        const Entry& e = _entries[i];
+        if (e.removed || !e.has_value) {
+            continue;
+        }
+        switch (e.kind) {
+        case BINARY_DUMP_VAR:
+            vars.push_back(i);
+            break;
+        case BINARY_DUMP_COMMENT:
+            comments.push_back(i);
+            break;
+        case BINARY_DUMP_MVAR:
+            mvars.push_back(i);
+            break;
+        }
+    }
+    // Families of vars and comments are 0, mvars are sorted by families.
+    CompareEntryName cmp(&_entries);
+    std::sort(vars.begin(), vars.end(), cmp);
+    std::sort(comments.begin(), comments.end(), cmp);
+    std::sort(mvars.begin(), mvars.end(), cmp);
+
+    int count = 0;
+    for (size_t i = 0; i < vars.size(); ++i) {
+        const Entry& e = _entries[vars[i]];
+        if (!dumper->dump(e.name, e.value)) {
+            return -1;
+        }
+        ++count;
+    }
+    for (size_t i = 0; i < comments.size(); ++i) {
+        const Entry& c = _entries[comments[i]];
+        if (!dumper->dump_comment(c.name, c.value)) {
+            return -1;
+        }
+        const uint32_t family = comments[i] + 1;
+        for (std::vector<size_t>::const_iterator it = std::lower_bound(
+                 mvars.begin(), mvars.end(), family, FamilyLess(&_entries));
+             it != mvars.end() && _entries[*it].family == family; ++it) {
+            const Entry& e = _entries[*it];
+            if (!dumper->dump_mvar(e.name, e.value)) {
+                return -1;
+            }
+            ++count;
+        }
+    }
+    return count;
+}
+
+}  // namespace bvar
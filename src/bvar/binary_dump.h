@@ -0,0 +1,170 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_BINARY_DUMP_H
+#define  BVAR_BINARY_DUMP_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "butil/iobuf.h"                        // butil::IOBuf
+#include "butil/containers/flat_map.h"          // butil::FlatMap
+#include "bvar/variable.h"                      // Dumper
+
+namespace bvar {
+
+// A compact binary format of dumped bvar. Names are sent once and values
+// are sent only when they're changed, which saves most of cpu and I/O when
+// there're lots of variables and most of them are idle.
+//
+// The dump is a sequence of frames, integers are varints:
+//   frame := "BVD1" body_size body
+//   body  := flags time_us
+//            nname (kind [family_id+1] name_size name){nname}
+//            nvalue (id type value){nvalue}
+//            nremoved (id){nremoved}
+// * flags: BINARY_DUMP_KEYFRAME means that all names and values restart
+//   from this frame, decoders can only start from keyframes.
+// * Names are numbered from 0 in the order they appear since last keyframe.
+//   kind is one of BinaryDumpKind, labeled variables have id of their
+//   family (a comment) plus 1.
+// * value of type BINARY_DUMP_INTEGER is zigzag-encoded difference from the
+//   last integer value of the same name (or 0), value of BINARY_DUMP_STRING
+//   is value_size followed by the description.
+// * Names of removed variables are not reused until next keyframe.
+enum BinaryDumpFlags {
+    BINARY_DUMP_KEYFRAME = 1,
+};
+
+enum BinaryDumpKind {
+    BINARY_DUMP_VAR = 0,        // Dumper::dump()
+    BINARY_DUMP_COMMENT = 1,    // Dumper::dump_comment(), value is the type
+    BINARY_DUMP_MVAR = 2,       // Dumper::dump_mvar()
+};
+
+enum BinaryDumpValueType {
+    BINARY_DUMP_STRING = 0,
+    BINARY_DUMP_INTEGER = 1,
+};
+
+// Encode dumped bvar into frames, the state is kept between frames so that
+// unchanged values are skipped.
+// Example:
+//   BinaryDumpEncoder encoder;
+//   for (bool keyframe = true; ...; keyframe = false) {
+//       encoder.begin_frame(keyframe);
+//       Variable::dump_exposed(&encoder, &options);
+//       MVariable::dump_exposed(&encoder, &options);
+//       butil::IOBuf frame;
+//       encoder.end_frame(&frame);
+//       ... send or write the frame ...
+//   }
+class BinaryDumpEncoder : public Dumper {
+public:
+    BinaryDumpEncoder();
+    ~BinaryDumpEncoder();
+
+    // Start a frame. The frame is a keyframe if `keyframe' is true or this
+    // is the first frame.
+    void begin_frame(bool keyframe);
+
+    // Append the frame started by begin_frame() to `out'.
+    // Returns number of values in the frame.
+    int end_frame(butil::IOBuf* out);
+
+    bool dump(const std::string& name, const butil::StringPiece& desc) override;
+    bool dump_comment(const std::string& name, const std::string& type) override;
+    bool dump_mvar(const std::string& name, const butil::StringPiece& desc) override;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(BinaryDumpEncoder);
+
+    struct Entry {
+        uint32_t id;
+        // Sequence number of the frame dumping this entry last time.
+        uint64_t seq;
+        bool has_value;
+        bool is_integer;
+        int64_t integer;
+        std::string desc;
+    };
+
+    // Returns id of the entry.
+    uint32_t put(BinaryDumpKind kind, const std::string& name,
+                 const butil::StringPiece& desc);
+
+    butil::FlatMap<std::string, Entry> _entries;
+    std::string _key;
+    uint32_t _next_id;
+    uint64_t _seq;
+    bool _keyframe;
+    int64_t _time_us;
+    // Id of the family being dumped plus 1, 0 means none.
+    uint32_t _family;
+    uint32_t _nname;
+    uint32_t _nvalue;
+    std::string _names;
+    std::string _values;
+};
+
+// Decode frames generated by BinaryDumpEncoder and keep latest values.
+class BinaryDumpDecoder {
+public:
+    struct Entry {
+        BinaryDumpKind kind;
+        // Id of the family plus 1 for BINARY_DUMP_MVAR.
+        uint32_t family;
+        bool removed;
+        bool has_value;
+        bool is_integer;
+        int64_t integer;
+        std::string name;
+        std::string value;
+    };
+
+    BinaryDumpDecoder();
+
+    // Decode and remove complete frames at the front of `buf'. Incomplete
+    // frame is left in `buf' to be decoded with more data. Frames before
+    // the first keyframe are skipped.
+    // Returns number of frames decoded, -1 on malformed data.
+    int decode(butil::IOBuf* buf);
+
+    // Time of the last decoded frame.
+    int64_t time_us() const { return _time_us; }
+
+    const std::vector<Entry>& entries() const { return _entries; }
+
+    // Put latest values into `dumper' in the same way as they're dumped:
+    // variables sorted by names, then families sorted by names, each of
+    // which is a dump_comment() followed by dump_mvar() of its variables.
+    // Returns number of dumped values, -1 when `dumper' fails.
+    int dump(Dumper* dumper) const;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(BinaryDumpDecoder);
+
+    int decode_body(const char* p, const char* end);
+
+    std::vector<Entry> _entries;
+    bool _has_keyframe;
+    int64_t _time_us;
+};
+
+}  // namespace bvar
+
+#endif  // BVAR_BINARY_DUMP_H
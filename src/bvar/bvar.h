@@ -21,10 +21,12 @@
 #define  BVAR_BVAR_H
 
 #include "bvar/reducer.h"
+#include "bvar/per_cpu_adder.h"
 #include "bvar/recorder.h"
 #include "bvar/status.h"
 #include "bvar/passive_status.h"
 #include "bvar/latency_recorder.h"
+#include "bvar/multi_dimension.h"
 #include "bvar/gflag.h"
 #include "bvar/scoped_timer.h"
 
@@ -123,7 +123,13 @@ public:
     }
 
     inline void exchange(T* prev, T new_value) {
-        *prev = _value.exchange(new_value, butil::memory_order_relaxed);
+        // Samplers reset agents of all threads every second, most of which
+        // are unchanged. Skipping the RMW on them avoids invalidating cache
+        // lines of the writing threads.
+        *prev = _value.load(butil::memory_order_relaxed);
+        if (*prev != new_value) {
+            *prev = _value.exchange(new_value, butil::memory_order_relaxed);
+        }
     }
 
     // [Unique]
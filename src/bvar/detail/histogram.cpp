@@ -0,0 +1,87 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "butil/logging.h"
+#include "butil/scoped_lock.h"
+#include "bvar/detail/histogram.h"
+
+namespace bvar {
+namespace detail {
+
+struct AddToHistogram {
+    void operator()(ThreadLocalHistogramBuckets& buckets,
+                    const int64_t& latency) const {
+        buckets.add(latency);
+    }
+};
+
+Histogram::Histogram() : _combiner(NULL), _sampler(NULL) {
+    _combiner = new combiner_type;
+    pthread_mutex_init(&_total_mutex, NULL);
+}
+
+Histogram::~Histogram() {
+    // Have to destroy sampler first to avoid the race between destruction and
+    // sampler
+    if (_sampler != NULL) {
+        _sampler->destroy();
+        _sampler = NULL;
+    }
+    delete _combiner;
+    pthread_mutex_destroy(&_total_mutex);
+}
+
+Histogram::value_type Histogram::reset() {
+    BAIDU_SCOPED_LOCK(_total_mutex);
+    value_type v = _combiner->reset_all_agents();
+    _total.merge(v);
+    return v;
+}
+
+Histogram::value_type Histogram::get_value() const {
+    return _combiner->combine_agents();
+}
+
+Histogram::value_type Histogram::get_cumulative_value() const {
+    BAIDU_SCOPED_LOCK(_total_mutex);
+    value_type v = _combiner->combine_agents();
+    v.merge(_total);
+    return v;
+}
+
+Histogram& Histogram::operator<<(int64_t latency) {
+    agent_type* agent = _combiner->get_or_create_tls_agent();
+    if (BAIDU_UNLIKELY(!agent)) {
+        LOG(FATAL) << "Fail to create agent";
+        return *this;
+    }
+    if (latency < 0) {
+        if (!_debug_name.empty()) {
+            LOG(WARNING) << "Input=" << latency << " to `" << _debug_name
+                       << "' is negative, drop";
+        } else {
+            LOG(WARNING) << "Input=" << latency << " to Histogram("
+                       << (void*)this << ") is negative, drop";
+        }
+        return *this;
+    }
+    agent->element.modify(AddToHistogram(), latency);
+    return *this;
+}
+
+}  // namespace detail
+}  // namespace bvar
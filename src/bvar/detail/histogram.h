@@ -0,0 +1,240 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_DETAIL_HISTOGRAM_H
+#define  BVAR_DETAIL_HISTOGRAM_H
+
+#include <stdint.h>                     // uint32_t
+#include <math.h>                       // ceil
+#include <algorithm>                    // std::fill
+#include <limits>                       // std::numeric_limits
+#include <ostream>                      // std::ostream
+#include <pthread.h>
+#include "butil/macros.h"
+#include "bvar/reducer.h"               // VoidOp
+#include "bvar/detail/combiner.h"       // AgentCombiner
+#include "bvar/detail/sampler.h"        // ReducerSampler
+
+namespace bvar {
+namespace detail {
+
+// Values below 2^HISTOGRAM_SUB_BUCKET_BITS are counted exactly, others are
+// counted in 2^HISTOGRAM_SUB_BUCKET_BITS linear buckets of each power of
+// two, thus a bucket is narrower than 1/16 of its values.
+static const size_t HISTOGRAM_SUB_BUCKET_BITS = 4;
+static const size_t HISTOGRAM_SUB_BUCKET_COUNT = 1 << HISTOGRAM_SUB_BUCKET_BITS;
+// Values are capped at UINT32_MAX like Percentile.
+static const size_t HISTOGRAM_BUCKET_COUNT =
+    HISTOGRAM_SUB_BUCKET_COUNT * (33 - HISTOGRAM_SUB_BUCKET_BITS);
+
+// Index of the bucket counting `x'.
+inline size_t histogram_bucket_index(uint32_t x) {
+    if (x < HISTOGRAM_SUB_BUCKET_COUNT) {
+        return x;
+    }
+    const size_t e = 31 - __builtin_clz(x);  // >= HISTOGRAM_SUB_BUCKET_BITS
+    const size_t shift = e - HISTOGRAM_SUB_BUCKET_BITS;
+    return HISTOGRAM_SUB_BUCKET_COUNT * (shift + 1) +
+        ((x >> shift) & (HISTOGRAM_SUB_BUCKET_COUNT - 1));
+}
+
+// Smallest value counted by bucket `index'.
+inline uint32_t histogram_bucket_lower_bound(size_t index) {
+    if (index < HISTOGRAM_SUB_BUCKET_COUNT) {
+        return index;
+    }
+    const size_t shift = index / HISTOGRAM_SUB_BUCKET_COUNT - 1;
+    const uint64_t sub = HISTOGRAM_SUB_BUCKET_COUNT +
+        index % HISTOGRAM_SUB_BUCKET_COUNT;
+    return (uint32_t)(sub << shift);
+}
+
+// Largest value counted by bucket `index'.
+inline uint32_t histogram_bucket_upper_bound(size_t index) {
+    if (index + 1 >= HISTOGRAM_BUCKET_COUNT) {
+        return std::numeric_limits<uint32_t>::max();
+    }
+    return histogram_bucket_lower_bound(index + 1) - 1;
+}
+
+// Counts of values in log-linear buckets. Buckets are same everywhere,
+// thus histograms are merged exactly, even if they're from different
+// processes.
+template <typename Count>
+class HistogramBuckets {
+public:
+    HistogramBuckets() : _count(0), _sum(0) {
+        std::fill(_counts, _counts + HISTOGRAM_BUCKET_COUNT, Count(0));
+    }
+
+    void add(int64_t x) {
+        const uint32_t v = (x > (int64_t)std::numeric_limits<uint32_t>::max() ?
+                            std::numeric_limits<uint32_t>::max() : (uint32_t)x);
+        ++_counts[histogram_bucket_index(v)];
+        ++_count;
+        _sum += v;
+    }
+
+    template <typename Count2>
+    void merge(const HistogramBuckets<Count2>& rhs) {
+        if (rhs._count == 0) {
+            return;
+        }
+        for (size_t i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i) {
+            _counts[i] += rhs._counts[i];
+        }
+        _count += rhs._count;
+        _sum += rhs._sum;
+    }
+
+    // Get the `ratio'-ile value, which is the middle of the bucket, thus
+    // the relative error is less than 1/32.
+    uint32_t get_number(double ratio) const {
+        uint64_t n = (uint64_t)ceil(ratio * _count);
+        if (n > _count) {
+            n = _count;
+        } else if (n == 0) {
+            return 0;
+        }
+        for (size_t i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i) {
+            if (n <= _counts[i]) {
+                const uint32_t lower = histogram_bucket_lower_bound(i);
+                return lower + (histogram_bucket_upper_bound(i) - lower) / 2;
+            }
+            n -= _counts[i];
+        }
+        return std::numeric_limits<uint32_t>::max();
+    }
+
+    // Number of values in bucket `index'.
+    Count count_at(size_t index) const { return _counts[index]; }
+
+    // Number and sum of all values.
+    uint64_t count() const { return _count; }
+    uint64_t sum() const { return _sum; }
+
+    // Print non-empty buckets as a json object:
+    //   {"count":N,"sum":S,"buckets":[[upper_bound,count],...]}
+    // where upper_bound is the largest value counted by the bucket.
+    void describe(std::ostream& os) const {
+        os << "{\"count\":" << _count << ",\"sum\":" << _sum
+           << ",\"buckets\":[";
+        bool first = true;
+        for (size_t i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i) {
+            if (_counts[i] == 0) {
+                continue;
+            }
+            if (!first) {
+                os << ',';
+            }
+            first = false;
+            os << '[' << histogram_bucket_upper_bound(i) << ','
+               << (uint64_t)_counts[i] << ']';
+        }
+        os << "]}";
+    }
+
+private:
+template <typename Count2> friend class HistogramBuckets;
+
+    uint64_t _count;
+    uint64_t _sum;
+    Count _counts[HISTOGRAM_BUCKET_COUNT];
+};
+
+template <typename Count>
+std::ostream& operator<<(std::ostream& os, const HistogramBuckets<Count>& h) {
+    h.describe(os);
+    return os;
+}
+
+// Thread-local counters are reset by the sampler every second, 32-bit is
+// enough and halves the memory.
+typedef HistogramBuckets<uint64_t> GlobalHistogramBuckets;
+typedef HistogramBuckets<uint32_t> ThreadLocalHistogramBuckets;
+
+// A specialized reducer counting latencies in log-linear buckets, an
+// alternative to Percentile for LatencyRecorder.
+// NOTE: DON'T use it directly, use LatencyRecorder instead.
+class Histogram {
+public:
+    struct AddHistogramBuckets {
+        template <typename C1, typename C2>
+        void operator()(HistogramBuckets<C1>& b1,
+                        const HistogramBuckets<C2>& b2) const {
+            b1.merge(b2);
+        }
+    };
+
+    typedef GlobalHistogramBuckets                          value_type;
+    typedef ReducerSampler<Histogram,
+                           GlobalHistogramBuckets,
+                           AddHistogramBuckets, VoidOp>     sampler_type;
+    typedef AgentCombiner <GlobalHistogramBuckets,
+                           ThreadLocalHistogramBuckets,
+                           AddHistogramBuckets>             combiner_type;
+    typedef combiner_type::Agent                            agent_type;
+    Histogram();
+    ~Histogram();
+
+    AddHistogramBuckets op() const { return AddHistogramBuckets(); }
+    VoidOp inv_op() const { return VoidOp(); }
+
+    // The sampler for windows over histogram.
+    sampler_type* get_sampler() {
+        if (NULL == _sampler) {
+            _sampler = new sampler_type(this);
+            _sampler->schedule();
+        }
+        return _sampler;
+    }
+
+    // Called by the sampler every second.
+    value_type reset();
+
+    // Values added since last reset().
+    value_type get_value() const;
+
+    // Values ever added, whose buckets are monotonic counters as prometheus
+    // histograms require.
+    value_type get_cumulative_value() const;
+
+    Histogram& operator<<(int64_t latency);
+
+    bool valid() const { return _combiner != NULL && _combiner->valid(); }
+
+    // This name is useful for warning negative latencies in operator<<
+    void set_debug_name(const butil::StringPiece& name) {
+        _debug_name.assign(name.data(), name.size());
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(Histogram);
+
+    combiner_type*          _combiner;
+    sampler_type*           _sampler;
+    // Values reset by the sampler, protected by _total_mutex which also
+    // makes reset() atomic to get_cumulative_value().
+    mutable pthread_mutex_t _total_mutex;
+    GlobalHistogramBuckets  _total;
+    std::string _debug_name;
+};
+
+}  // namespace detail
+}  // namespace bvar
+
+#endif  // BVAR_DETAIL_HISTOGRAM_H
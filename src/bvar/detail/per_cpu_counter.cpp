@@ -0,0 +1,49 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <unistd.h>                     // sysconf
+#include "butil/logging.h"
+#include "bvar/detail/per_cpu_counter.h"
+
+namespace bvar {
+namespace detail {
+
+static size_t s_per_cpu_slot_count = 0;
+static pthread_once_t s_per_cpu_once = PTHREAD_ONCE_INIT;
+
+static void init_per_cpu_slot_count() {
+    if (current_cpu() < 0) {
+        LOG(WARNING) << "Fail to get cpu of current thread, per-cpu counters"
+            " fall back to thread-local agents";
+        return;
+    }
+    const long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+    if (ncpu <= 0) {
+        PLOG(WARNING) << "Fail to get number of cpus";
+        return;
+    }
+    s_per_cpu_slot_count = ncpu;
+}
+
+size_t per_cpu_slot_count() {
+    pthread_once(&s_per_cpu_once, init_per_cpu_slot_count);
+    return s_per_cpu_slot_count;
+}
+
+}  // namespace detail
+}  // namespace bvar
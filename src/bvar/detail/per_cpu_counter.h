@@ -0,0 +1,126 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_DETAIL_PER_CPU_COUNTER_H
+#define  BVAR_DETAIL_PER_CPU_COUNTER_H
+
+#include <stdlib.h>                     // posix_memalign
+#include <new>                          // placement new
+#include "butil/atomicops.h"            // butil::atomic
+#include "butil/build_config.h"         // OS_LINUX
+#include "butil/compiler_specific.h"    // BAIDU_CACHELINE_SIZE
+#include "butil/macros.h"
+#include "butil/type_traits.h"          // butil::is_integral
+#if defined(OS_LINUX)
+#include <sched.h>                      // sched_getcpu
+#endif
+
+namespace bvar {
+namespace detail {
+
+// Number of slots of per-cpu counters, which is the number of configured
+// cpus, or 0 if cpu of the calling thread can't be got cheaply on this
+// platform.
+size_t per_cpu_slot_count();
+
+// Cpu of the calling thread, -1 on error. glibc >= 2.35 reads it from the
+// rseq area registered for each thread, older versions use vDSO.
+inline int current_cpu() {
+#if defined(OS_LINUX)
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+// Integral counter whose value is spread over cache-line aligned slots of
+// cpus. Memory is O(ncpu) no matter how many threads modify it. A thread may
+// be migrated between getting the cpu and modifying the slot, thus slots
+// are still modified atomically, which is uncontended most of the time.
+template <typename T>
+class PerCpuCounter {
+    BAIDU_CASSERT(butil::is_integral<T>::value, T_must_be_integral);
+public:
+    PerCpuCounter() : _nslot(per_cpu_slot_count()), _slots(NULL) {
+        if (_nslot == 0) {
+            return;
+        }
+        void* mem = NULL;
+        if (posix_memalign(&mem, BAIDU_CACHELINE_SIZE,
+                           sizeof(Slot) * _nslot) != 0) {
+            _nslot = 0;
+            return;
+        }
+        _slots = static_cast<Slot*>(mem);
+        for (size_t i = 0; i < _nslot; ++i) {
+            new (&_slots[i]) Slot;
+        }
+    }
+
+    ~PerCpuCounter() {
+        free(_slots);
+        _slots = NULL;
+    }
+
+    // False if per-cpu counting is unavailable.
+    bool valid() const { return _slots != NULL; }
+
+    // Memory of slots in bytes.
+    size_t memory_size() const { return sizeof(Slot) * _nslot; }
+
+    void add(T value) {
+        size_t cpu = (size_t)current_cpu();
+        if (BAIDU_UNLIKELY(cpu >= _nslot)) {
+            // Including -1.
+            cpu %= _nslot;
+        }
+        _slots[cpu].value.fetch_add(value, butil::memory_order_relaxed);
+    }
+
+    T get_value() const {
+        T sum = 0;
+        for (size_t i = 0; i < _nslot; ++i) {
+            sum += _slots[i].value.load(butil::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    // Set all slots to zero and return the sum before.
+    T reset() {
+        T sum = 0;
+        for (size_t i = 0; i < _nslot; ++i) {
+            sum += _slots[i].value.exchange(0, butil::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PerCpuCounter);
+
+    struct BAIDU_CACHELINE_ALIGNMENT Slot {
+        Slot() : value(0) {}
+        butil::atomic<T> value;
+    };
+
+    size_t _nslot;
+    Slot* _slots;
+};
+
+}  // namespace detail
+}  // namespace bvar
+
+#endif  // BVAR_DETAIL_PER_CPU_COUNTER_H
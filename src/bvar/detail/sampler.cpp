@@ -17,14 +17,33 @@
 
 // Date: Tue Jul 28 18:14:40 CST 2015
 
+#include <algorithm>
+#include <gflags/gflags.h>
 #include "butil/time.h"
-#include "butil/memory/singleton_on_pthread_once.h"
+#include "butil/atomicops.h"
 #include "bvar/reducer.h"
+#include "bvar/recorder.h"
 #include "bvar/detail/sampler.h"
 #include "bvar/passive_status.h"
 #include "bvar/window.h"
 
 namespace bvar {
+
+static const int MAX_SAMPLER_THREAD_NUM = 32;
+
+DEFINE_int32(bvar_sampler_thread_num, 1,
+             "Number of threads calling take_sample() of windowed bvars, "
+             "samplers are spread over the threads evenly, including the ones "
+             "created before this flag is set. Increase this value when "
+             "bvar_sampler_collector_tick_us is close to one second");
+
+static bool validate_sampler_thread_num(const char*, int32_t v) {
+    return v >= 1 && v <= MAX_SAMPLER_THREAD_NUM;
+}
+const bool ALLOW_UNUSED dummy_bvar_sampler_thread_num =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_bvar_sampler_thread_num,
+                                       validate_sampler_thread_num);
+
 namespace detail {
 
 const int WARN_NOSLEEP_THRESHOLD = 2;
@@ -58,12 +77,21 @@ static bool registered_atfork = false;
 // list of Samplers. Waking through the list and call take_sample().
 // If a Sampler needs to be deleted, we just mark it as unused and the
 // deletion is taken place in the thread as well.
+// There're -bvar_sampler_thread_num collectors at most, each of which owns
+// a thread and a disjoint part of the samplers, so that one thread is not
+// the bottleneck of processes with hundreds of thousands of windowed bvars.
+// Samplers created before -bvar_sampler_thread_num is set (e.g. global
+// windows created during static initialization, before flags are parsed)
+// all go to the first collector, which moves them to other collectors once
+// it sees the flag grow.
 class SamplerCollector : public bvar::Reducer<Sampler*, CombineSampler> {
 public:
-    SamplerCollector()
-        : _created(false)
+    explicit SamplerCollector(int index)
+        : _index(index)
+        , _created(false)
         , _stop(false)
-        , _cumulated_time_us(0) {
+        , _cumulated_time_us(0)
+        , _nsampled(0) {
         create_sampling_thread();
     }
     ~SamplerCollector() {
@@ -76,15 +104,14 @@ public:
 
 private:
     // Support for fork:
-    // * The singleton can be null before forking, the child callback will not
-    //   be registered.
-    // * If the singleton is not null before forking, the child callback will
-    //   be registered and the sampling thread will be re-created.
+    // * No collector may be created before forking, the child callback will
+    //   not be registered.
+    // * If any collector is created before forking, the child callback will
+    //   be registered and sampling threads of all collectors will be
+    //   re-created.
     // * A forked program can be forked again.
 
-    static void child_callback_atfork() {
-        butil::get_leaky_singleton<SamplerCollector>()->after_forked_as_child();
-    }
+    static void child_callback_atfork();
 
     void create_sampling_thread() {
         const int rc = pthread_create(&_tid, NULL, sampling_thread, this);
@@ -106,25 +133,118 @@ private:
 
     void run();
 
+    // Move samplers in `root' to other collectors so that each of the
+    // `nthread' collectors gets a similar share.
+    void rebalance(butil::LinkNode<Sampler>* root, int nthread);
+
     static void* sampling_thread(void* arg) {
         static_cast<SamplerCollector*>(arg)->run();
         return NULL;
     }
 
-    static double get_cumulated_time(void* arg) {
-        return static_cast<SamplerCollector*>(arg)->_cumulated_time_us / 1000.0 / 1000.0;
-    }
+    static double get_cumulated_time(void*);
+    static int64_t get_sampler_count(void*);
+    static void create_vars();
 
 private:
+    int _index;
     bool _created;
     bool _stop;
     int64_t _cumulated_time_us;
+    // Number of samplers visited in last round.
+    int64_t _nsampled;
     pthread_t _tid;
 };
 
+// Collectors are created on demand and never destroyed.
+static butil::atomic<SamplerCollector*> s_collectors[MAX_SAMPLER_THREAD_NUM];
+static pthread_mutex_t s_collectors_mutex = PTHREAD_MUTEX_INITIALIZER;
+static butil::atomic<uint32_t> s_next_collector(0);
+
+static int sampler_thread_num() {
+    return std::min(std::max(FLAGS_bvar_sampler_thread_num, 1),
+                    MAX_SAMPLER_THREAD_NUM);
+}
+
+static SamplerCollector* get_or_create_collector_at(int index) {
+    SamplerCollector* c = s_collectors[index].load(butil::memory_order_acquire);
+    if (c != NULL) {
+        return c;
+    }
+    BAIDU_SCOPED_LOCK(s_collectors_mutex);
+    c = s_collectors[index].load(butil::memory_order_relaxed);
+    if (c == NULL) {
+        c = new SamplerCollector(index);
+        s_collectors[index].store(c, butil::memory_order_release);
+    }
+    return c;
+}
+
+// Pick a collector for a newly scheduled sampler in round-robin.
+static SamplerCollector* get_or_create_collector() {
+    const uint32_t nthread = sampler_thread_num();
+    const uint32_t index = (nthread == 1 ? 0 :
+        s_next_collector.fetch_add(1, butil::memory_order_relaxed) % nthread);
+    return get_or_create_collector_at(index);
+}
+
+void SamplerCollector::child_callback_atfork() {
+    for (int i = 0; i < MAX_SAMPLER_THREAD_NUM; ++i) {
+        SamplerCollector* c = s_collectors[i].load(butil::memory_order_relaxed);
+        if (c != NULL) {
+            c->after_forked_as_child();
+        }
+    }
+}
+
+double SamplerCollector::get_cumulated_time(void*) {
+    int64_t cumulated_time_us = 0;
+    for (int i = 0; i < MAX_SAMPLER_THREAD_NUM; ++i) {
+        SamplerCollector* c = s_collectors[i].load(butil::memory_order_relaxed);
+        if (c != NULL) {
+            cumulated_time_us += c->_cumulated_time_us;
+        }
+    }
+    return cumulated_time_us / 1000.0 / 1000.0;
+}
+
+int64_t SamplerCollector::get_sampler_count(void*) {
+    int64_t nsampled = 0;
+    for (int i = 0; i < MAX_SAMPLER_THREAD_NUM; ++i) {
+        SamplerCollector* c = s_collectors[i].load(butil::memory_order_relaxed);
+        if (c != NULL) {
+            nsampled += c->_nsampled;
+        }
+    }
+    return nsampled;
+}
+
 #ifndef UNIT_TEST
 static PassiveStatus<double>* s_cumulated_time_bvar = NULL;
 static bvar::PerSecond<bvar::PassiveStatus<double> >* s_sampling_thread_usage_bvar = NULL;
+static PassiveStatus<int64_t>* s_sampler_count_bvar = NULL;
+// Time spent by one thread on one round of sampling.
+static IntRecorder* s_tick_us = NULL;
+static Window<IntRecorder>* s_tick_us_bvar = NULL;
+static Maxer<int64_t>* s_max_tick_us = NULL;
+static Window<Maxer<int64_t> >* s_max_tick_us_bvar = NULL;
+static pthread_once_t s_create_vars_once = PTHREAD_ONCE_INIT;
+
+void SamplerCollector::create_vars() {
+    s_cumulated_time_bvar =
+        new PassiveStatus<double>(get_cumulated_time, NULL);
+    s_sampling_thread_usage_bvar =
+        new bvar::PerSecond<bvar::PassiveStatus<double> >(
+            "bvar_sampler_collector_usage", s_cumulated_time_bvar, 10);
+    s_sampler_count_bvar = new PassiveStatus<int64_t>(
+        "bvar_sampler_count", get_sampler_count, NULL);
+    s_tick_us = new IntRecorder;
+    s_tick_us_bvar = new Window<IntRecorder>(
+        "bvar_sampler_collector_tick_us", s_tick_us, 10);
+    s_max_tick_us = new Maxer<int64_t>;
+    s_max_tick_us_bvar = new Window<Maxer<int64_t> >(
+        "bvar_sampler_collector_max_tick_us", s_max_tick_us, 10);
+}
 #endif
 
 void SamplerCollector::run() {
@@ -134,25 +254,28 @@ void SamplerCollector::run() {
     //   may be adandoned at any time after forking.
     // * They can't created inside the constructor of SamplerCollector as well,
     //   which results in deadlock.
-    if (s_cumulated_time_bvar == NULL) {
-        s_cumulated_time_bvar =
-            new PassiveStatus<double>(get_cumulated_time, this);
-    }
-    if (s_sampling_thread_usage_bvar == NULL) {
-        s_sampling_thread_usage_bvar =
-            new bvar::PerSecond<bvar::PassiveStatus<double> >(
-                    "bvar_sampler_collector_usage", s_cumulated_time_bvar, 10);
-    }
+    // * They're shared by all collectors.
+    pthread_once(&s_create_vars_once, create_vars);
 #endif
 
     butil::LinkNode<Sampler> root;
     int consecutive_nosleep = 0;
+    int last_nthread = sampler_thread_num();
     while (!_stop) {
         int64_t abstime = butil::gettimeofday_us();
         Sampler* s = this->reset();
         if (s) {
             s->InsertBeforeAsList(&root);
         }
+        if (_index == 0) {
+            // Samplers scheduled before -bvar_sampler_thread_num was raised
+            // are all here.
+            const int nthread = sampler_thread_num();
+            if (nthread > last_nthread) {
+                rebalance(&root, nthread);
+            }
+            last_nthread = nthread;
+        }
         int nremoved = 0;
         int nsampled = 0;
         for (butil::LinkNode<Sampler>* p = root.next(); p != &root;) {
@@ -172,9 +295,14 @@ void SamplerCollector::run() {
             }
             p = saved_next;
         }
+        _nsampled = nsampled;
         bool slept = false;
         int64_t now = butil::gettimeofday_us();
         _cumulated_time_us += now - abstime;
+#ifndef UNIT_TEST
+        *s_tick_us << (now - abstime);
+        *s_max_tick_us << (now - abstime);
+#endif
         abstime += 1000000L;
         while (abstime > now) {
             ::usleep(abstime - now);
@@ -193,12 +321,28 @@ void SamplerCollector::run() {
     }
 }
 
+void SamplerCollector::rebalance(butil::LinkNode<Sampler>* root, int nthread) {
+    // Samplers are only touched by the collector owning them (besides
+    // destroy() which just marks them under _mutex), handing them over
+    // with operator<< as in Sampler::schedule() is safe.
+    int i = 0;
+    for (butil::LinkNode<Sampler>* p = root->next(); p != root; ++i) {
+        butil::LinkNode<Sampler>* saved_next = p->next();
+        const int index = i % nthread;
+        if (index != _index) {
+            p->RemoveFromList();
+            *get_or_create_collector_at(index) << p->value();
+        }
+        p = saved_next;
+    }
+}
+
 Sampler::Sampler() : _used(true) {}
 
 Sampler::~Sampler() {}
 
 void Sampler::schedule() {
-    *butil::get_leaky_singleton<SamplerCollector>() << this;
+    *get_or_create_collector() << this;
 }
 
 void Sampler::destroy() {
@@ -124,13 +124,9 @@ private:
 
     struct Data {
     public:
-        Data() {
-            // is_pod does not work for gcc 3.4
-            if (butil::is_integral<T>::value ||
-                butil::is_floating_point<T>::value) {
-                memset(_array, 0, sizeof(_array));
-            }
-        }
+        // Value-initialization zeroes integers and floating points and
+        // calls default constructors of classes.
+        Data() : _array() {}
         
         T& second(int index) { return _array[index]; }
         const T& second(int index) const { return _array[index]; }
@@ -39,11 +39,22 @@ const bool ALLOW_UNUSED dummy_bvar_latency_p2 = ::GFLAGS_NS::RegisterFlagValidat
 const bool ALLOW_UNUSED dummy_bvar_latency_p3 = ::GFLAGS_NS::RegisterFlagValidator(
     &FLAGS_bvar_latency_p3, valid_percentile);
 
+DEFINE_bool(bvar_latency_histogram, false,
+            "LatencyRecorder created afterwards count latencies in log-linear "
+            "buckets instead of sampling them, whose percentiles are within "
+            "3% of the exact values and stable at long tails, and expose "
+            "<prefix>_latency_histogram which is output as a histogram in "
+            "prometheus and can be merged across processes exactly");
+static bool pass_bool(const char*, bool) { return true; }
+const bool ALLOW_UNUSED dummy_bvar_latency_histogram =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_bvar_latency_histogram,
+                                       pass_bool);
+
 namespace detail {
 
 typedef PercentileSamples<1022> CombinedPercentileSamples;
 
-CDF::CDF(PercentileWindow* w) : _w(w) {}
+CDF::CDF(const LatencyRecorderBase* r) : _r(r) {}
 
 CDF::~CDF() {
     hide();
@@ -55,29 +66,33 @@ void CDF::describe(std::ostream& os, bool) const {
 
 int CDF::describe_series(
     std::ostream& os, const SeriesOptions& options) const {
-    if (_w == NULL) {
+    if (_r == NULL) {
         return 1;
     }
     if (options.test_only) {
         return 0;
     }
-    std::unique_ptr<CombinedPercentileSamples> cb(new CombinedPercentileSamples);
-    std::vector<GlobalPercentileSamples> buckets;
-    _w->get_samples(&buckets);
-    for (size_t i = 0; i < buckets.size(); ++i) {
-        cb->combine_of(buckets.begin(), buckets.end());
-    }
+    double ratios[20];
+    int64_t latencies[20];
     std::pair<int, int> values[20];
     size_t n = 0;
     for (int i = 1; i < 10; ++i) {
-        values[n++] = std::make_pair(i*10, cb->get_number(i * 0.1));
+        values[n].first = i * 10;
+        ratios[n++] = i * 0.1;
     }
     for (int i = 91; i < 100; ++i) {
-        values[n++] = std::make_pair(i, cb->get_number(i * 0.01));
+        values[n].first = i;
+        ratios[n++] = i * 0.01;
     }
-    values[n++] = std::make_pair(100, cb->get_number(0.999));
-    values[n++] = std::make_pair(101, cb->get_number(0.9999));
+    values[n].first = 100;
+    ratios[n++] = 0.999;
+    values[n].first = 101;
+    ratios[n++] = 0.9999;
     CHECK_EQ(n, arraysize(values));
+    _r->get_latency_percentiles(ratios, n, latencies);
+    for (size_t i = 0; i < n; ++i) {
+        values[i].second = latencies[i];
+    }
     os << "{\"label\":\"cdf\",\"data\":[";
     for (size_t i = 0; i < n; ++i) {
         if (i) {
@@ -89,6 +104,25 @@ int CDF::describe_series(
     return 0;
 }
 
+HistogramVar::HistogramVar(const Histogram* h) : _h(h) {}
+
+HistogramVar::~HistogramVar() {
+    hide();
+}
+
+void HistogramVar::describe(std::ostream& os, bool) const {
+    os << _h->get_cumulative_value();
+}
+
+LatencyPercentile::LatencyPercentile(time_t window_size)
+    : window(&percentile, window_size) {
+}
+
+LatencyHistogram::LatencyHistogram(time_t window_size)
+    : window(&histogram, window_size)
+    , var(&histogram) {
+}
+
 static int64_t get_window_recorder_qps(void* arg) {
     detail::Sample<Stat> s;
     static_cast<RecorderWindow*>(arg)->get_span(1, &s);
@@ -132,41 +166,72 @@ static int64_t get_p3(void* arg) {
 }
 
 static Vector<int64_t, 4> get_latencies(void *arg) {
-    std::unique_ptr<CombinedPercentileSamples> cb(
-        combine((PercentileWindow*)arg));
     // NOTE: We don't show 99.99% since it's often significantly larger than
     // other values and make other curves on the plotted graph small and
     // hard to read.
+    const double ratios[4] = {
+        FLAGS_bvar_latency_p1 / 100.0, FLAGS_bvar_latency_p2 / 100.0,
+        FLAGS_bvar_latency_p3 / 100.0, 0.999
+    };
     Vector<int64_t, 4> result;
-    result[0] = cb->get_number(FLAGS_bvar_latency_p1 / 100.0);
-    result[1] = cb->get_number(FLAGS_bvar_latency_p2 / 100.0);
-    result[2] = cb->get_number(FLAGS_bvar_latency_p3 / 100.0);
-    result[3] = cb->get_number(0.999);
+    static_cast<LatencyRecorderBase*>(arg)->get_latency_percentiles(
+        ratios, arraysize(ratios), &result[0]);
     return result;
 }
 
 LatencyRecorderBase::LatencyRecorderBase(time_t window_size)
     : _max_latency(0)
+    , _latency_percentile(FLAGS_bvar_latency_histogram ?
+                          NULL : new LatencyPercentile(window_size))
+    , _latency_histogram(_latency_percentile ?
+                         NULL : new LatencyHistogram(window_size))
     , _latency_window(&_latency, window_size)
     , _max_latency_window(&_max_latency, window_size)
     , _count(get_recorder_count, &_latency)
     , _qps(get_window_recorder_qps, &_latency_window)
-    , _latency_percentile_window(&_latency_percentile, window_size)
     , _latency_p1(get_p1, this)
     , _latency_p2(get_p2, this)
     , _latency_p3(get_p3, this)
     , _latency_999(get_percetile<999, 1000>, this)
     , _latency_9999(get_percetile<9999, 10000>, this)
-    , _latency_cdf(&_latency_percentile_window)
-    , _latency_percentiles(get_latencies, &_latency_percentile_window)
-{}
+    , _latency_cdf(this)
+    , _latency_percentiles(get_latencies, this) {
+}
+
+void LatencyRecorderBase::get_latency_percentiles(
+    const double* ratios, size_t n, int64_t* latencies) const {
+    if (_latency_histogram) {
+        const GlobalHistogramBuckets buckets =
+            _latency_histogram->window.get_value();
+        for (size_t i = 0; i < n; ++i) {
+            latencies[i] = buckets.get_number(ratios[i]);
+        }
+        return;
+    }
+    std::unique_ptr<CombinedPercentileSamples> cb(
+        combine(&_latency_percentile->window));
+    for (size_t i = 0; i < n; ++i) {
+        latencies[i] = cb->get_number(ratios[i]);
+    }
+}
 
 }  // namespace detail
 
 Vector<int64_t, 4> LatencyRecorder::latency_percentiles() const {
     // const_cast here is just to adapt parameter type and safe.
-    return detail::get_latencies(
-        const_cast<detail::PercentileWindow*>(&_latency_percentile_window));
+    return detail::get_latencies(const_cast<LatencyRecorder*>(this));
+}
+
+const std::string& LatencyRecorder::latency_histogram_name() const {
+    static const std::string s_empty;
+    return _latency_histogram ? _latency_histogram->var.name() : s_empty;
+}
+
+detail::GlobalHistogramBuckets LatencyRecorder::latency_histogram() const {
+    if (!_latency_histogram) {
+        return detail::GlobalHistogramBuckets();
+    }
+    return _latency_histogram->histogram.get_cumulative_value();
 }
 
 int64_t LatencyRecorder::qps(time_t window_size) const {
@@ -205,7 +270,11 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
 
     // set debug names for printing helpful error log.
     _latency.set_debug_name(prefix);
-    _latency_percentile.set_debug_name(prefix);
+    if (_latency_histogram) {
+        _latency_histogram->histogram.set_debug_name(prefix);
+    } else {
+        _latency_percentile->percentile.set_debug_name(prefix);
+    }
 
     if (_latency_window.expose_as(prefix, "latency") != 0) {
         return -1;
@@ -244,6 +313,10 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
     if (_latency_percentiles.expose_as(prefix, "latency_percentiles", DISPLAY_ON_HTML) != 0) {
         return -1;
     }
+    if (_latency_histogram &&
+        _latency_histogram->var.expose_as(prefix, "latency_histogram") != 0) {
+        return -1;
+    }
     snprintf(namebuf, sizeof(namebuf), "%d%%,%d%%,%d%%,99.9%%",
              (int)FLAGS_bvar_latency_p1, (int)FLAGS_bvar_latency_p2,
              (int)FLAGS_bvar_latency_p3);
@@ -252,9 +325,9 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
 }
 
 int64_t LatencyRecorder::latency_percentile(double ratio) const {
-    std::unique_ptr<detail::CombinedPercentileSamples> cb(
-        combine((detail::PercentileWindow*)&_latency_percentile_window));
-    return cb->get_number(ratio);
+    int64_t latency = 0;
+    get_latency_percentiles(&ratio, 1, &latency);
+    return latency;
 }
 
 void LatencyRecorder::hide() {
@@ -269,12 +342,19 @@ void LatencyRecorder::hide() {
     _latency_9999.hide();
     _latency_cdf.hide();
     _latency_percentiles.hide();
+    if (_latency_histogram) {
+        _latency_histogram->var.hide();
+    }
 }
 
 LatencyRecorder& LatencyRecorder::operator<<(int64_t latency) {
     _latency << latency;
     _max_latency << latency;
-    _latency_percentile << latency;
+    if (_latency_histogram) {
+        _latency_histogram->histogram << latency;
+    } else {
+        _latency_percentile->percentile << latency;
+    }
     return *this;
 }
 
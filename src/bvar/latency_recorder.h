@@ -20,29 +20,62 @@
 #ifndef  BVAR_LATENCY_RECORDER_H
 #define  BVAR_LATENCY_RECORDER_H
 
+#include <memory>                               // std::unique_ptr
 #include "bvar/recorder.h"
 #include "bvar/reducer.h"
 #include "bvar/passive_status.h"
 #include "bvar/detail/percentile.h"
+#include "bvar/detail/histogram.h"
 
 namespace bvar {
 namespace detail {
 
 class Percentile;
+class LatencyRecorderBase;
 typedef Window<IntRecorder, SERIES_IN_SECOND> RecorderWindow;
 typedef Window<Maxer<int64_t>, SERIES_IN_SECOND> MaxWindow;
 typedef Window<Percentile, SERIES_IN_SECOND> PercentileWindow;
+typedef Window<Histogram, SERIES_IN_SECOND> HistogramWindow;
 
 // NOTE: Always use int64_t in the interfaces no matter what the impl. is.
 
 class CDF : public Variable {
 public:
-    explicit CDF(PercentileWindow* w);
+    explicit CDF(const LatencyRecorderBase* r);
     ~CDF();
     void describe(std::ostream& os, bool quote_string) const override;
     int describe_series(std::ostream& os, const SeriesOptions& options) const override;
 private:
-    PercentileWindow* _w; 
+    const LatencyRecorderBase* _r;
+};
+
+// Buckets of all latencies ever recorded, see HistogramBuckets::describe().
+class HistogramVar : public Variable {
+public:
+    explicit HistogramVar(const Histogram* h);
+    ~HistogramVar();
+    void describe(std::ostream& os, bool quote_string) const override;
+private:
+    const Histogram* _h;
+};
+
+// Sampled latencies of LatencyRecorder created when -bvar_latency_histogram
+// is off.
+struct LatencyPercentile {
+    explicit LatencyPercentile(time_t window_size);
+
+    Percentile percentile;
+    PercentileWindow window;
+};
+
+// Replaces LatencyPercentile in LatencyRecorder created when
+// -bvar_latency_histogram is on.
+struct LatencyHistogram {
+    explicit LatencyHistogram(time_t window_size);
+
+    Histogram histogram;
+    HistogramWindow window;
+    HistogramVar var;
 };
 
 // For mimic constructor inheritance.
@@ -50,16 +83,24 @@ class LatencyRecorderBase {
 public:
     explicit LatencyRecorderBase(time_t window_size);
     time_t window_size() const { return _latency_window.window_size(); }
+
+    // Put latencies at `ratios'(e.g. 0.99 means 99%-ile) in recent
+    // window_size-to-ctor seconds into `latencies'.
+    void get_latency_percentiles(const double* ratios, size_t n,
+                                 int64_t* latencies) const;
 protected:
     IntRecorder _latency;
     Maxer<int64_t> _max_latency;
-    Percentile _latency_percentile;
+    // Exactly one of them is non-NULL depending on -bvar_latency_histogram
+    // at construction. Declared before the PassiveStatus below which read
+    // them in the sampler thread until they're destroyed.
+    std::unique_ptr<LatencyPercentile> _latency_percentile;
+    std::unique_ptr<LatencyHistogram> _latency_histogram;
 
     RecorderWindow _latency_window;
     MaxWindow _max_latency_window;
     PassiveStatus<int64_t> _count;
     PassiveStatus<int64_t> _qps;
-    PercentileWindow _latency_percentile_window;
     PassiveStatus<int64_t> _latency_p1;
     PassiveStatus<int64_t> _latency_p2;
     PassiveStatus<int64_t> _latency_p3;
@@ -111,6 +152,7 @@ public:
     //                                    // foo_bar_read_max_latency
     //                                    // foo_bar_read_count
     //                                    // foo_bar_read_qps
+    // and foo_bar_read_latency_histogram with -bvar_latency_histogram.
     int expose(const butil::StringPiece& prefix) {
         return expose(butil::StringPiece(), prefix);
     }
@@ -155,6 +197,11 @@ public:
     { return _max_latency_window.name(); }
     const std::string& count_name() const { return _count.name(); }
     const std::string& qps_name() const { return _qps.name(); }
+    const std::string& latency_histogram_name() const;
+
+    // Buckets of all recorded latencies, empty without
+    // -bvar_latency_histogram at construction.
+    detail::GlobalHistogramBuckets latency_histogram() const;
 };
 
 std::ostream& operator<<(std::ostream& os, const LatencyRecorder&);
@@ -0,0 +1,110 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_MULTI_DIMENSION_H
+#define  BVAR_MULTI_DIMENSION_H
+
+#include <pthread.h>
+#include <string>                                // std::string
+#include <vector>                                // std::vector
+#include "butil/containers/flat_map.h"            // butil::FlatMap
+#include "butil/containers/doubly_buffered_data.h" // butil::DoublyBufferedData
+#include "bvar/mvariable.h"
+
+namespace bvar {
+
+// A labeled metric family: one child of type T for each combination of
+// label values. Children are created lazily by get_stats() and are not
+// exposed as Variable, thus they don't take names or series buffers.
+// T must be default-constructible, e.g. Adder, Maxer, Miner, IntRecorder,
+// LatencyRecorder.
+//
+// Example:
+//   bvar::MultiDimension<bvar::LatencyRecorder> g_latency(
+//       "rpc_server_latency", {"method", "status"});
+//   ...
+//   bvar::LatencyRecorder* rec = g_latency.get_stats({"Echo", "OK"});
+//   if (rec) {
+//       *rec << latency_us;
+//   }
+//
+// In /brpc_metrics, a family of LatencyRecorder is a summary:
+//   rpc_server_latency{method="Echo",status="OK",quantile="0.99"} 12
+//   rpc_server_latency_sum{method="Echo",status="OK"} 1000
+//   rpc_server_latency_count{method="Echo",status="OK"} 100
+//   rpc_server_latency_qps{method="Echo",status="OK"} 10
+// and a family of other types is a gauge:
+//   rpc_server_error{method="Echo",status="EREQUEST"} 3
+template <typename T>
+class MultiDimension : public MVariable {
+public:
+    typedef std::vector<std::string> key_type;
+    typedef T value_type;
+
+    explicit MultiDimension(const key_type& labels);
+    MultiDimension(const butil::StringPiece& name, const key_type& labels);
+    MultiDimension(const butil::StringPiece& prefix,
+                   const butil::StringPiece& name, const key_type& labels);
+    ~MultiDimension();
+
+    // Get the child of `label_values' which are in the same order of the
+    // labels, create it if absent. Looking up an existing child is
+    // lock-free generally.
+    // Returns NULL when number of values does not match number of labels,
+    // or the family already has -bvar_max_multi_dimension_stats_count
+    // children, which avoids exhausting memory by labels of unbounded
+    // cardinality(e.g. user ids).
+    T* get_stats(const key_type& label_values);
+
+    // True if the child of `label_values' exists.
+    bool has_stats(const key_type& label_values);
+
+    // Delete the child of `label_values' or all children. Pointers returned
+    // by get_stats() for the deleted children are invalidated.
+    void delete_stats(const key_type& label_values);
+    void delete_stats();
+
+    // Put label values of all children into `label_values'.
+    void list_stats(std::vector<key_type>* label_values);
+
+    // Implement MVariable
+    size_t count_stats() override;
+    int dump(Dumper* dumper, const DumpOptions* options) override;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MultiDimension);
+
+    struct KeyHash {
+        size_t operator()(const key_type& key) const;
+    };
+    typedef butil::FlatMap<key_type, T*, KeyHash> MetricMap;
+
+    static size_t init_metric_map(MetricMap& m);
+    static size_t insert_stats(MetricMap& m, const key_type& key, T* const& v);
+    static size_t erase_stats(MetricMap& m, const key_type& key);
+    static size_t clear_stats(MetricMap& m);
+
+    butil::DoublyBufferedData<MetricMap> _metric_map;
+    // Serialize creations and deletions of children.
+    pthread_mutex_t _mutex;
+};
+
+}  // namespace bvar
+
+#include "bvar/multi_dimension_inl.h"
+
+#endif  // BVAR_MULTI_DIMENSION_H
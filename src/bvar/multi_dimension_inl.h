@@ -0,0 +1,387 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_MULTI_DIMENSION_INL_H
+#define  BVAR_MULTI_DIMENSION_INL_H
+
+#include <inttypes.h>                            // PRId64
+#include <algorithm>                             // std::sort
+#include <sstream>                               // std::ostringstream
+#include <gflags/gflags_declare.h>
+#include "butil/logging.h"
+#include "butil/scoped_lock.h"                    // BAIDU_SCOPED_LOCK
+#include "butil/string_printf.h"                  // butil::string_printf
+#include "butil/third_party/murmurhash3/murmurhash3.h"
+#include "bvar/variable.h"                        // Dumper, DumpOptions
+#include "bvar/latency_recorder.h"
+
+namespace bvar {
+
+DECLARE_int32(bvar_max_multi_dimension_stats_count);
+DECLARE_int32(bvar_latency_p1);
+DECLARE_int32(bvar_latency_p2);
+DECLARE_int32(bvar_latency_p3);
+
+namespace detail {
+
+// Append `label1="value1",label2="value2"' to `out', values are escaped
+// as required by prometheus.
+inline void append_label_pairs(std::string* out,
+                               const std::vector<std::string>& labels,
+                               const std::vector<std::string>& values) {
+    for (size_t i = 0; i < labels.size() && i < values.size(); ++i) {
+        if (i != 0) {
+            out->push_back(',');
+        }
+        out->append(labels[i]);
+        out->append("=\"");
+        const std::string& v = values[i];
+        for (size_t j = 0; j < v.size(); ++j) {
+            switch (v[j]) {
+            case '\\': out->append("\\\\"); break;
+            case '"':  out->append("\\\""); break;
+            case '\n': out->append("\\n"); break;
+            default:   out->push_back(v[j]); break;
+            }
+        }
+        out->push_back('"');
+    }
+}
+
+// family{label_pairs,extra}
+inline std::string labeled_name(const std::string& family,
+                                const std::string& label_pairs,
+                                const butil::StringPiece& extra) {
+    std::string name;
+    name.reserve(family.size() + label_pairs.size() + extra.size() + 3);
+    name.append(family);
+    if (label_pairs.empty() && extra.empty()) {
+        return name;
+    }
+    name.push_back('{');
+    name.append(label_pairs);
+    if (!label_pairs.empty() && !extra.empty()) {
+        name.push_back(',');
+    }
+    name.append(extra.data(), extra.size());
+    name.push_back('}');
+    return name;
+}
+
+// Dump children of a family, specialized for types other than gauges.
+template <typename T>
+struct MVarDumper {
+    typedef std::vector<std::pair<std::string/*label pairs*/, T*> > Children;
+
+    static int dump(Dumper* dumper, const DumpOptions* options,
+                    const std::string& family, const Children& children) {
+        if (!dumper->dump_comment(family, "gauge")) {
+            return -1;
+        }
+        std::ostringstream os;
+        for (size_t i = 0; i < children.size(); ++i) {
+            os.str(std::string());
+            children[i].second->describe(os, options->quote_string);
+            if (!dumper->dump_mvar(
+                    labeled_name(family, children[i].first, butil::StringPiece()),
+                    os.str())) {
+                return -1;
+            }
+        }
+        return children.size();
+    }
+};
+
+template <>
+struct MVarDumper<LatencyRecorder> {
+    typedef std::vector<std::pair<std::string, LatencyRecorder*> > Children;
+
+    static int dump(Dumper* dumper, const DumpOptions*,
+                    const std::string& family, const Children& children) {
+        const double ratios[] = {
+            FLAGS_bvar_latency_p1 / 100.0, FLAGS_bvar_latency_p2 / 100.0,
+            FLAGS_bvar_latency_p3 / 100.0, 0.999, 0.9999
+        };
+        int count = 0;
+        if (!dumper->dump_comment(family, "summary")) {
+            return -1;
+        }
+        for (size_t i = 0; i < children.size(); ++i) {
+            const std::string& pairs = children[i].first;
+            const LatencyRecorder* rec = children[i].second;
+            for (size_t j = 0; j < arraysize(ratios); ++j) {
+                const std::string quantile =
+                    butil::string_printf("quantile=\"%g\"", ratios[j]);
+                if (!dumper->dump_mvar(
+                        labeled_name(family, pairs, quantile),
+                        butil::string_printf("%" PRId64,
+                            rec->latency_percentile(ratios[j])))) {
+                    return -1;
+                }
+            }
+            const int64_t n = rec->count();
+            // There is no sum of latency in LatencyRecorder, use
+            // average * count as approximation like the flat bvars.
+            if (!dumper->dump_mvar(labeled_name(family, pairs, "quantile=\"1\""),
+                                   butil::string_printf("%" PRId64,
+                                                        rec->max_latency())) ||
+                !dumper->dump_mvar(labeled_name(family + "_sum", pairs,
+                                                butil::StringPiece()),
+                                   butil::string_printf("%" PRId64,
+                                                        rec->latency() * n)) ||
+                !dumper->dump_mvar(labeled_name(family + "_count", pairs,
+                                                butil::StringPiece()),
+                                   butil::string_printf("%" PRId64, n))) {
+                return -1;
+            }
+            count += arraysize(ratios) + 3;
+        }
+        const std::string qps_family = family + "_qps";
+        if (!dumper->dump_comment(qps_family, "gauge")) {
+            return -1;
+        }
+        for (size_t i = 0; i < children.size(); ++i) {
+            if (!dumper->dump_mvar(
+                    labeled_name(qps_family, children[i].first,
+                                 butil::StringPiece()),
+                    butil::string_printf("%" PRId64,
+                                         children[i].second->qps()))) {
+                return -1;
+            }
+            ++count;
+        }
+        return count;
+    }
+};
+
+}  // namespace detail
+
+template <typename T>
+size_t MultiDimension<T>::KeyHash::operator()(const key_type& key) const {
+    uint32_t h = 0;
+    for (size_t i = 0; i < key.size(); ++i) {
+        butil::MurmurHash3_x86_32(key[i].data(), (int)key[i].size(), h, &h);
+    }
+    return h;
+}
+
+template <typename T>
+size_t MultiDimension<T>::init_metric_map(MetricMap& m) {
+    CHECK_EQ(0, m.init(64, 80));
+    return 1;
+}
+
+template <typename T>
+size_t MultiDimension<T>::insert_stats(MetricMap& m, const key_type& key,
+                                       T* const& v) {
+    m[key] = v;
+    return 1;
+}
+
+template <typename T>
+size_t MultiDimension<T>::erase_stats(MetricMap& m, const key_type& key) {
+    return m.erase(key);
+}
+
+template <typename T>
+size_t MultiDimension<T>::clear_stats(MetricMap& m) {
+    m.clear();
+    return 1;
+}
+
+template <typename T>
+MultiDimension<T>::MultiDimension(const key_type& labels)
+    : MVariable(labels) {
+    pthread_mutex_init(&_mutex, NULL);
+    _metric_map.Modify(init_metric_map);
+}
+
+template <typename T>
+MultiDimension<T>::MultiDimension(const butil::StringPiece& name,
+                                  const key_type& labels)
+    : MVariable(labels) {
+    pthread_mutex_init(&_mutex, NULL);
+    _metric_map.Modify(init_metric_map);
+    this->expose(name);
+}
+
+template <typename T>
+MultiDimension<T>::MultiDimension(const butil::StringPiece& prefix,
+                                  const butil::StringPiece& name,
+                                  const key_type& labels)
+    : MVariable(labels) {
+    pthread_mutex_init(&_mutex, NULL);
+    _metric_map.Modify(init_metric_map);
+    this->expose_as(prefix, name);
+}
+
+template <typename T>
+MultiDimension<T>::~MultiDimension() {
+    hide();
+    delete_stats();
+    pthread_mutex_destroy(&_mutex);
+}
+
+template <typename T>
+T* MultiDimension<T>::get_stats(const key_type& label_values) {
+    if (label_values.size() != count_labels()) {
+        LOG_EVERY_SECOND(ERROR) << "Number of label values of `" << name()
+                                << "' should be " << count_labels()
+                                << " rather than " << label_values.size();
+        return NULL;
+    }
+    {
+        typename butil::DoublyBufferedData<MetricMap>::ScopedPtr ptr;
+        if (_metric_map.Read(&ptr) != 0) {
+            return NULL;
+        }
+        T** p = ptr->seek(label_values);
+        if (p != NULL) {
+            return *p;
+        }
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    {
+        // Check again since another thread may have created the child.
+        typename butil::DoublyBufferedData<MetricMap>::ScopedPtr ptr;
+        if (_metric_map.Read(&ptr) != 0) {
+            return NULL;
+        }
+        T** p = ptr->seek(label_values);
+        if (p != NULL) {
+            return *p;
+        }
+        if (ptr->size() >= (size_t)FLAGS_bvar_max_multi_dimension_stats_count) {
+            LOG_EVERY_SECOND(ERROR)
+                << "Too many children of `" << name() << "', the limit is "
+                << FLAGS_bvar_max_multi_dimension_stats_count;
+            return NULL;
+        }
+    }
+    T* stats = new (std::nothrow) T;
+    if (stats == NULL) {
+        return NULL;
+    }
+    _metric_map.Modify(insert_stats, label_values, stats);
+    return stats;
+}
+
+template <typename T>
+bool MultiDimension<T>::has_stats(const key_type& label_values) {
+    typename butil::DoublyBufferedData<MetricMap>::ScopedPtr ptr;
+    if (_metric_map.Read(&ptr) != 0) {
+        return false;
+    }
+    return ptr->seek(label_values) != NULL;
+}
+
+template <typename T>
+void MultiDimension<T>::delete_stats(const key_type& label_values) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    T* stats = NULL;
+    {
+        typename butil::DoublyBufferedData<MetricMap>::ScopedPtr ptr;
+        if (_metric_map.Read(&ptr) != 0) {
+            return;
+        }
+        T** p = ptr->seek(label_values);
+        if (p == NULL) {
+            return;
+        }
+        stats = *p;
+    }
+    // Readers are not using the child after Modify() returns.
+    _metric_map.Modify(erase_stats, label_values);
+    delete stats;
+}
+
+template <typename T>
+void MultiDimension<T>::delete_stats() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    std::vector<T*> stats;
+    {
+        typename butil::DoublyBufferedData<MetricMap>::ScopedPtr ptr;
+        if (_metric_map.Read(&ptr) != 0) {
+            return;
+        }
+        stats.reserve(ptr->size());
+        for (typename MetricMap::const_iterator it = ptr->begin();
+             it != ptr->end(); ++it) {
+            stats.push_back(it->second);
+        }
+    }
+    _metric_map.Modify(clear_stats);
+    for (size_t i = 0; i < stats.size(); ++i) {
+        delete stats[i];
+    }
+}
+
+template <typename T>
+void MultiDimension<T>::list_stats(std::vector<key_type>* label_values) {
+    if (label_values == NULL) {
+        return;
+    }
+    label_values->clear();
+    typename butil::DoublyBufferedData<MetricMap>::ScopedPtr ptr;
+    if (_metric_map.Read(&ptr) != 0) {
+        return;
+    }
+    label_values->reserve(ptr->size());
+    for (typename MetricMap::const_iterator it = ptr->begin();
+         it != ptr->end(); ++it) {
+        label_values->push_back(it->first);
+    }
+}
+
+template <typename T>
+size_t MultiDimension<T>::count_stats() {
+    typename butil::DoublyBufferedData<MetricMap>::ScopedPtr ptr;
+    if (_metric_map.Read(&ptr) != 0) {
+        return 0;
+    }
+    return ptr->size();
+}
+
+template <typename T>
+int MultiDimension<T>::dump(Dumper* dumper, const DumpOptions* options) {
+    // Children are not deleted before the dumping is done.
+    BAIDU_SCOPED_LOCK(_mutex);
+    typename detail::MVarDumper<T>::Children children;
+    {
+        typename butil::DoublyBufferedData<MetricMap>::ScopedPtr ptr;
+        if (_metric_map.Read(&ptr) != 0) {
+            return 0;
+        }
+        children.reserve(ptr->size());
+        for (typename MetricMap::const_iterator it = ptr->begin();
+             it != ptr->end(); ++it) {
+            std::string pairs;
+            detail::append_label_pairs(&pairs, labels(), it->first);
+            children.push_back(std::make_pair(pairs, it->second));
+        }
+    }
+    if (children.empty()) {
+        return 0;
+    }
+    // Sort by labels to make the output stable.
+    std::sort(children.begin(), children.end());
+    return detail::MVarDumper<T>::dump(dumper, options, name(), children);
+}
+
+}  // namespace bvar
+
+#endif  // BVAR_MULTI_DIMENSION_INL_H
@@ -0,0 +1,245 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <algorithm>                            // std::sort
+#include <sstream>                              // std::ostringstream
+#include <gflags/gflags.h>
+#include "butil/containers/flat_map.h"           // butil::FlatMap
+#include "butil/scoped_lock.h"                   // BAIDU_SCOPE_LOCK
+#include "butil/logging.h"
+#include "bvar/variable.h"
+#include "bvar/mvariable.h"
+#include "bvar/detail/wildcard_matcher.h"
+
+namespace bvar {
+
+DEFINE_int32(bvar_max_multi_dimension_stats_count, 1024,
+             "Max number of children of a labeled metric family "
+             "(bvar::MultiDimension), get_stats() of a new combination of "
+             "label values returns NULL when the limit is reached");
+static bool validate_bvar_max_multi_dimension_stats_count(const char*,
+                                                          int32_t v) {
+    return v > 0;
+}
+const bool ALLOW_UNUSED dummy_bvar_max_multi_dimension_stats_count =
+    ::GFLAGS_NS::RegisterFlagValidator(
+        &FLAGS_bvar_max_multi_dimension_stats_count,
+        validate_bvar_max_multi_dimension_stats_count);
+
+typedef butil::FlatMap<std::string, MVariable*> MVarMap;
+
+struct MVarMapWithLock : public MVarMap {
+    pthread_mutex_t mutex;
+
+    MVarMapWithLock() {
+        CHECK_EQ(0, init(256, 80));
+        pthread_mutex_init(&mutex, NULL);
+    }
+};
+
+// Initialized on need because families may be created before main().
+static pthread_once_t s_mvar_map_once = PTHREAD_ONCE_INIT;
+static MVarMapWithLock* s_mvar_map = NULL;
+
+static void init_mvar_map() {
+    s_mvar_map = new MVarMapWithLock;
+}
+
+inline MVarMapWithLock& get_mvar_map() {
+    pthread_once(&s_mvar_map_once, init_mvar_map);
+    return *s_mvar_map;
+}
+
+// [a-zA-Z_][a-zA-Z0-9_]*, as required by prometheus.
+static bool is_valid_label_name(const std::string& label) {
+    if (label.empty() || isdigit(label[0])) {
+        return false;
+    }
+    for (size_t i = 0; i < label.size(); ++i) {
+        if (!isalnum(label[i]) && label[i] != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+MVariable::MVariable(const std::vector<std::string>& labels)
+    : _labels(labels) {
+}
+
+MVariable::~MVariable() {
+    CHECK(!hide()) << "Subclass of MVariable MUST call hide() manually in"
+        " their dtors to avoid dumping a family that is just destructing";
+}
+
+void MVariable::describe(std::ostream& os) {
+    os << "{\"labels\":[";
+    for (size_t i = 0; i < _labels.size(); ++i) {
+        if (i != 0) {
+            os << ',';
+        }
+        os << '"' << _labels[i] << '"';
+    }
+    os << "],\"stats_count\":" << count_stats() << '}';
+}
+
+std::string MVariable::get_description() {
+    std::ostringstream os;
+    describe(os);
+    return os.str();
+}
+
+int MVariable::expose_impl(const butil::StringPiece& prefix,
+                           const butil::StringPiece& name) {
+    if (name.empty()) {
+        LOG(ERROR) << "Parameter[name] is empty";
+        return -1;
+    }
+    if (_labels.empty()) {
+        LOG(ERROR) << "Labels of `" << name << "' are empty";
+        return -1;
+    }
+    for (size_t i = 0; i < _labels.size(); ++i) {
+        // `quantile' is reserved for summaries.
+        if (!is_valid_label_name(_labels[i]) || _labels[i] == "quantile" ||
+            std::count(_labels.begin(), _labels.end(), _labels[i]) != 1) {
+            LOG(ERROR) << "Invalid label=`" << _labels[i] << "' of `"
+                       << name << '\'';
+            return -1;
+        }
+    }
+    // remove previous pointer from the map if needed.
+    hide();
+
+    _name.clear();
+    _name.reserve((prefix.size() + name.size()) * 5 / 4);
+    if (!prefix.empty()) {
+        to_underscored_name(&_name, prefix);
+        if (!_name.empty() && butil::back_char(_name) != '_') {
+            _name.push_back('_');
+        }
+    }
+    to_underscored_name(&_name, name);
+
+    MVarMapWithLock& m = get_mvar_map();
+    {
+        BAIDU_SCOPED_LOCK(m.mutex);
+        MVariable** entry = m.seek(_name);
+        if (entry == NULL) {
+            m[_name] = this;
+            return 0;
+        }
+    }
+    LOG(ERROR) << "Already exposed labeled bvar `" << _name << '\'';
+    _name.clear();
+    return -1;
+}
+
+bool MVariable::hide() {
+    if (_name.empty()) {
+        return false;
+    }
+    MVarMapWithLock& m = get_mvar_map();
+    BAIDU_SCOPED_LOCK(m.mutex);
+    MVariable** entry = m.seek(_name);
+    if (entry) {
+        CHECK_EQ(1UL, m.erase(_name));
+    } else {
+        CHECK(false) << "`" << _name << "' must exist";
+    }
+    _name.clear();
+    return true;
+}
+
+void MVariable::list_exposed(std::vector<std::string>* names) {
+    if (names == NULL) {
+        return;
+    }
+    names->clear();
+    MVarMapWithLock& m = get_mvar_map();
+    BAIDU_SCOPED_LOCK(m.mutex);
+    names->reserve(m.size());
+    for (MVarMap::const_iterator it = m.begin(); it != m.end(); ++it) {
+        names->push_back(it->first);
+    }
+}
+
+size_t MVariable::count_exposed() {
+    MVarMapWithLock& m = get_mvar_map();
+    BAIDU_SCOPED_LOCK(m.mutex);
+    return m.size();
+}
+
+int MVariable::describe_exposed(const std::string& name, std::ostream& os) {
+    MVarMapWithLock& m = get_mvar_map();
+    BAIDU_SCOPED_LOCK(m.mutex);
+    MVariable** p = m.seek(name);
+    if (p == NULL) {
+        return -1;
+    }
+    (*p)->describe(os);
+    return 0;
+}
+
+std::string MVariable::describe_exposed(const std::string& name) {
+    std::ostringstream oss;
+    if (describe_exposed(name, oss) == 0) {
+        return oss.str();
+    }
+    return std::string();
+}
+
+int MVariable::dump_exposed(Dumper* dumper, const DumpOptions* poptions) {
+    if (NULL == dumper) {
+        LOG(ERROR) << "Parameter[dumper] is NULL";
+        return -1;
+    }
+    DumpOptions opt;
+    if (poptions) {
+        opt = *poptions;
+    }
+    detail::WildcardMatcher black_matcher(opt.black_wildcards,
+                                          opt.question_mark, false);
+    detail::WildcardMatcher white_matcher(opt.white_wildcards,
+                                          opt.question_mark, true);
+    std::vector<std::string> names;
+    list_exposed(&names);
+    std::sort(names.begin(), names.end());
+    MVarMapWithLock& m = get_mvar_map();
+    int count = 0;
+    for (size_t i = 0; i < names.size(); ++i) {
+        const std::string& name = names[i];
+        if (!white_matcher.match(name) || black_matcher.match(name)) {
+            continue;
+        }
+        // Hold the lock so that the family is not destructed during dumping.
+        BAIDU_SCOPED_LOCK(m.mutex);
+        MVariable** p = m.seek(name);
+        if (p == NULL) {
+            continue;
+        }
+        const int n = (*p)->dump(dumper, &opt);
+        if (n < 0) {
+            return -1;
+        }
+        count += n;
+    }
+    return count;
+}
+
+}  // namespace bvar
@@ -0,0 +1,114 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_MVARIABLE_H
+#define  BVAR_MVARIABLE_H
+
+#include <ostream>                      // std::ostream
+#include <string>                       // std::string
+#include <vector>                       // std::vector
+#include "butil/macros.h"                // DISALLOW_COPY_AND_ASSIGN
+#include "butil/strings/string_piece.h"  // butil::StringPiece
+
+namespace bvar {
+
+class Dumper;
+struct DumpOptions;
+
+// Base class of labeled metric families(see multi_dimension.h).
+// A family has a name and a fixed list of label names, and holds one
+// child bvar for each combination of label values. Families are exposed
+// in a namespace separated from Variable and dumped by
+// MVariable::dump_exposed(), e.g. into prometheus with labels rather
+// than exposing every child as a separately named bvar.
+class MVariable {
+public:
+    explicit MVariable(const std::vector<std::string>& labels);
+    virtual ~MVariable();
+
+    // Number of children in this family.
+    virtual size_t count_stats() = 0;
+
+    // Send values of all children to `dumper'.
+    // Returns number of dumped values, -1 when the dumper failed.
+    virtual int dump(Dumper* dumper, const DumpOptions* options) = 0;
+
+    // Print label names and number of children into `os'.
+    virtual void describe(std::ostream& os);
+
+    // string form of describe().
+    std::string get_description();
+
+    // Expose this family globally so that it's counted in *_exposed
+    // functions. Label names must be valid prometheus label names.
+    // Returns 0 on success, -1 otherwise.
+    int expose(const butil::StringPiece& name) {
+        return expose_impl(butil::StringPiece(), name);
+    }
+
+    // Expose this family with a prefix, see Variable::expose_as().
+    // Returns 0 on success, -1 otherwise.
+    int expose_as(const butil::StringPiece& prefix,
+                  const butil::StringPiece& name) {
+        return expose_impl(prefix, name);
+    }
+
+    // Hide this family so that it's not counted in *_exposed functions.
+    // Returns false if this family is already hidden.
+    // CAUTION!! Subclasses must call hide() manually in their dtors.
+    bool hide();
+
+    // Get exposed name. If this family is not exposed, the name is empty.
+    const std::string& name() const { return _name; }
+
+    const std::vector<std::string>& labels() const { return _labels; }
+    size_t count_labels() const { return _labels.size(); }
+
+    // ====================================================================
+
+    // Put names of all exposed families into `names'.
+    static void list_exposed(std::vector<std::string>* names);
+
+    // Get number of exposed families.
+    static size_t count_exposed();
+
+    // Find an exposed family by `name' and describe it into `os'.
+    // Returns 0 on found, -1 otherwise.
+    static int describe_exposed(const std::string& name, std::ostream& os);
+    // String form. Returns empty string when not found.
+    static std::string describe_exposed(const std::string& name);
+
+    // Find all exposed families whose names are matching `white_wildcards'
+    // but `black_wildcards' of `options' and send them to `dumper'.
+    // Use default options when `options' is NULL.
+    // Return number of dumped values, -1 on error.
+    static int dump_exposed(Dumper* dumper, const DumpOptions* options);
+
+protected:
+    virtual int expose_impl(const butil::StringPiece& prefix,
+                            const butil::StringPiece& name);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MVariable);
+
+    std::string _name;
+    const std::vector<std::string> _labels;
+};
+
+}  // namespace bvar
+
+#endif  // BVAR_MVARIABLE_H
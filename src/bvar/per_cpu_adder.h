@@ -0,0 +1,130 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_PER_CPU_ADDER_H
+#define  BVAR_PER_CPU_ADDER_H
+
+#include "bvar/reducer.h"                       // Adder
+#include "bvar/detail/per_cpu_counter.h"        // detail::PerCpuCounter
+
+namespace bvar {
+
+// Same as Adder<T> for integral T, but values are added into per-cpu slots
+// rather than thread-local agents. Memory of the variable is O(ncpu) instead
+// of O(nthread) and get_value() does not lock, which suits processes with
+// hundreds of threads and many counters. Each add is an uncontended atomic
+// fetch_add, a bit slower than Adder on a few threads. Falls back to Adder
+// if the cpu of current thread can't be got cheaply.
+// Works with Window<> and PerSecond<> like Adder.
+// Example:
+//   bvar::PerCpuAdder<int64_t> nrequest("server_request_count");
+//   bvar::PerSecond<bvar::PerCpuAdder<int64_t> > qps(
+//       "server_request_qps", &nrequest);
+//   nrequest << 1;
+template <typename T>
+class PerCpuAdder : public Variable {
+public:
+    typedef T value_type;
+    typedef detail::ReducerSampler<PerCpuAdder, T, detail::AddTo<T>,
+                                   detail::MinusFrom<T> > sampler_type;
+
+    PerCpuAdder() : _fallback(NULL), _sampler(NULL) { init(); }
+    explicit PerCpuAdder(const butil::StringPiece& name)
+        : _fallback(NULL), _sampler(NULL) {
+        init();
+        this->expose(name);
+    }
+    PerCpuAdder(const butil::StringPiece& prefix,
+                const butil::StringPiece& name)
+        : _fallback(NULL), _sampler(NULL) {
+        init();
+        this->expose_as(prefix, name);
+    }
+
+    ~PerCpuAdder() {
+        // Calling hide() manually is a MUST required by Variable.
+        hide();
+        if (_sampler) {
+            _sampler->destroy();
+            _sampler = NULL;
+        }
+        delete _fallback;
+        _fallback = NULL;
+    }
+
+    PerCpuAdder& operator<<(T value) {
+        if (BAIDU_LIKELY(_fallback == NULL)) {
+            _counter.add(value);
+        } else {
+            *_fallback << value;
+        }
+        return *this;
+    }
+
+    // Get the sum of all slots.
+    T get_value() const {
+        return _fallback == NULL ? _counter.get_value()
+                                 : _fallback->get_value();
+    }
+
+    // Reset the value to 0 and return the value before reset.
+    T reset() {
+        return _fallback == NULL ? _counter.reset() : _fallback->reset();
+    }
+
+    void describe(std::ostream& os, bool /*quote_string*/) const override {
+        os << get_value();
+    }
+
+#ifdef BAIDU_INTERNAL
+    void get_value(boost::any* value) const override { *value = get_value(); }
+#endif
+
+    // True if values are added into per-cpu slots.
+    bool is_per_cpu() const { return _fallback == NULL; }
+
+    // Memory of per-cpu slots in bytes, 0 if falling back to Adder.
+    size_t memory_size() const { return _counter.memory_size(); }
+
+    detail::AddTo<T> op() const { return detail::AddTo<T>(); }
+    detail::MinusFrom<T> inv_op() const { return detail::MinusFrom<T>(); }
+
+    sampler_type* get_sampler() {
+        if (NULL == _sampler) {
+            _sampler = new sampler_type(this);
+            _sampler->schedule();
+        }
+        return _sampler;
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PerCpuAdder);
+
+    void init() {
+        if (!_counter.valid()) {
+            _fallback = new Adder<T>;
+        }
+    }
+
+    detail::PerCpuCounter<T> _counter;
+    Adder<T>* _fallback;
+    sampler_type* _sampler;
+};
+
+}  // namespace bvar
+
+#endif  // BVAR_PER_CPU_ADDER_H
@@ -31,6 +31,9 @@
 #include "butil/file_util.h"                     // butil::FilePath
 #include "bvar/gflag.h"
 #include "bvar/variable.h"
+#include "bvar/mvariable.h"
+#include "bvar/binary_dump.h"
+#include "bvar/detail/wildcard_matcher.h"
 
 namespace bvar {
 
@@ -364,94 +367,6 @@ void CharArrayStreamBuf::reset() {
 }
 
 
-// Written by Jack Handy
-// <A href="mailto:jakkhandy@hotmail.com">jakkhandy@hotmail.com</A>
-inline bool wildcmp(const char* wild, const char* str, char question_mark) {
-    const char* cp = NULL;
-    const char* mp = NULL;
-
-    while (*str && *wild != '*') {
-        if (*wild != *str && *wild != question_mark) {
-            return false;
-        }
-        ++wild;
-        ++str;
-    }
-
-    while (*str) {
-        if (*wild == '*') {
-            if (!*++wild) {
-                return true;
-            }
-            mp = wild;
-            cp = str+1;
-        } else if (*wild == *str || *wild == question_mark) {
-            ++wild;
-            ++str;
-        } else {
-            wild = mp;
-            str = cp++;
-        }
-    }
-
-    while (*wild == '*') {
-        ++wild;
-    }
-    return !*wild;
-}
-
-class WildcardMatcher {
-public:
-    WildcardMatcher(const std::string& wildcards,
-                    char question_mark,
-                    bool on_both_empty)
-        : _question_mark(question_mark)
-        , _on_both_empty(on_both_empty) {
-        if (wildcards.empty()) {
-            return;
-        }
-        std::string name;
-        const char wc_pattern[3] = { '*', question_mark, '\0' };
-        for (butil::StringMultiSplitter sp(wildcards.c_str(), ",;");
-             sp != NULL; ++sp) {
-            name.assign(sp.field(), sp.length());
-            if (name.find_first_of(wc_pattern) != std::string::npos) {
-                if (_wcs.empty()) {
-                    _wcs.reserve(8);
-                }
-                _wcs.push_back(name);
-            } else {
-                _exact.insert(name);
-            }
-        }
-    }
-    
-    bool match(const std::string& name) const {
-        if (!_exact.empty()) {
-            if (_exact.find(name) != _exact.end()) {
-                return true;
-            }
-        } else if (_wcs.empty()) {
-            return _on_both_empty;
-        }
-        for (size_t i = 0; i < _wcs.size(); ++i) {
-            if (wildcmp(_wcs[i].c_str(), name.c_str(), _question_mark)) {
-                return true;
-            }
-        }
-        return false;
-    }
-
-    const std::vector<std::string>& wildcards() const { return _wcs; }
-    const std::set<std::string>& exact_names() const { return _exact; }
-
-private:
-    char _question_mark;
-    bool _on_both_empty;
-    std::vector<std::string> _wcs;
-    std::set<std::string> _exact;
-};
-
 DumpOptions::DumpOptions()
     : quote_string(true)
     , question_mark('?')
@@ -470,10 +385,10 @@ int Variable::dump_exposed(Dumper* dumper, const DumpOptions* poptions) {
     CharArrayStreamBuf streambuf;
     std::ostream os(&streambuf);
     int count = 0;
-    WildcardMatcher black_matcher(opt.black_wildcards,
+    detail::WildcardMatcher black_matcher(opt.black_wildcards,
                                   opt.question_mark,
                                   false);
-    WildcardMatcher white_matcher(opt.white_wildcards,
+    detail::WildcardMatcher white_matcher(opt.white_wildcards,
                                   opt.question_mark,
                                   true);
 
@@ -561,22 +476,27 @@ std::string read_command_name() {
     return s;
 }
 
+// Normalize -bvar_dump_prefix into `prefix' which is prepended to names.
+static void normalize_dump_prefix(std::string* prefix, butil::StringPiece s) {
+    prefix->clear();
+    // remove trailing spaces.
+    const char* p = s.data() + s.size();
+    for (; p != s.data() && isspace(p[-1]); --p) {}
+    s.remove_suffix(s.data() + s.size() - p);
+    // normalize it.
+    if (!s.empty()) {
+        to_underscored_name(prefix, s);
+        if (butil::back_char(*prefix) != '_') {
+            prefix->push_back('_');
+        }
+    }
+}
+
 class FileDumper : public Dumper {
 public:
     FileDumper(const std::string& filename, butil::StringPiece s/*prefix*/)
         : _filename(filename), _fp(NULL) {
-        // setting prefix.
-        // remove trailing spaces.
-        const char* p = s.data() + s.size();
-        for (; p != s.data() && isspace(p[-1]); --p) {}
-        s.remove_suffix(s.data() + s.size() - p);
-        // normalize it.
-        if (!s.empty()) {
-            to_underscored_name(&_prefix, s);
-            if (butil::back_char(_prefix) != '_') {
-                _prefix.push_back('_');
-            }
-        }
+        normalize_dump_prefix(&_prefix, s);
     }
 
     ~FileDumper() {
@@ -634,12 +554,13 @@ public:
             std::string value = sp.value().as_string();
             FileDumper *f = new FileDumper(
                     path.AddExtension(key).AddExtension("data").value(), s);
-            WildcardMatcher *m = new WildcardMatcher(value, '?', true);
+            detail::WildcardMatcher *m =
+                new detail::WildcardMatcher(value, '?', true);
             dumpers.push_back(std::make_pair(f, m));
         }
         dumpers.push_back(std::make_pair(
                     new FileDumper(path.AddExtension("data").value(), s), 
-                    (WildcardMatcher *)NULL));
+                    (detail::WildcardMatcher *)NULL));
     }
     ~FileDumperGroup() {
         for (size_t i = 0; i < dumpers.size(); ++i) {
@@ -659,7 +580,7 @@ public:
         return dumpers.back().first->dump(name, desc);
     }
 private:
-    std::vector<std::pair<FileDumper *, WildcardMatcher*> > dumpers;
+    std::vector<std::pair<FileDumper *, detail::WildcardMatcher*> > dumpers;
 };
 
 static pthread_once_t dumping_thread_once = PTHREAD_ONCE_INIT;
@@ -683,6 +604,99 @@ DEFINE_string(bvar_dump_tabs, "latency=*_latency*"
                               "; system=*process_*,*malloc_*,*kernel_*",
               "Dump bvar into different tabs according to the filters (seperated by semicolon), "
               "format: *(tab_name=wildcards;)");
+DEFINE_bool(bvar_dump_binary, false,
+            "Dump bvar into bvar_dump_file with extension .bin in the binary "
+            "format of bvar/binary_dump.h instead of text files of tabs, "
+            "read it with tools/bvar_dump_reader");
+DEFINE_int32(bvar_dump_binary_keyframe_interval, 60,
+             "Rewrite the binary dump file from all values every so many "
+             "dumps, other dumps only append changed values");
+
+// Appends frames of BinaryDumpEncoder to one file, which is rewritten from
+// a keyframe when the file, the prefix or the filters are changed, or every
+// -bvar_dump_binary_keyframe_interval dumps.
+class BinaryFileDumper : public Dumper {
+public:
+    BinaryFileDumper() : _fp(NULL), _ndump(0) {}
+    ~BinaryFileDumper() { close(); }
+
+    // Dump all exposed variables as a frame.
+    int dump_exposed(const std::string& filename, const std::string& prefix,
+                     const DumpOptions& options);
+
+    bool dump(const std::string& name, const butil::StringPiece& desc) override {
+        return _encoder.dump(_prefix + name, desc);
+    }
+    bool dump_comment(const std::string& name, const std::string& type) override {
+        return _encoder.dump_comment(_prefix + name, type);
+    }
+    bool dump_mvar(const std::string& name, const butil::StringPiece& desc) override {
+        return _encoder.dump_mvar(_prefix + name, desc);
+    }
+
+private:
+    void close() {
+        if (_fp) {
+            fclose(_fp);
+            _fp = NULL;
+        }
+    }
+
+    std::string _filename;
+    std::string _prefix;
+    DumpOptions _options;
+    FILE* _fp;
+    int _ndump;
+    BinaryDumpEncoder _encoder;
+};
+
+int BinaryFileDumper::dump_exposed(const std::string& filename,
+                                   const std::string& prefix,
+                                   const DumpOptions& options) {
+    std::string normalized_prefix;
+    normalize_dump_prefix(&normalized_prefix, prefix);
+    const bool keyframe = (_fp == NULL || filename != _filename ||
+                           normalized_prefix != _prefix ||
+                           options.white_wildcards != _options.white_wildcards ||
+                           options.black_wildcards != _options.black_wildcards ||
+                           _ndump >= FLAGS_bvar_dump_binary_keyframe_interval);
+    if (keyframe) {
+        close();
+        _filename = filename;
+        _prefix = normalized_prefix;
+        _options = options;
+        _ndump = 0;
+        butil::File::Error error;
+        butil::FilePath dir = butil::FilePath(_filename).DirName();
+        if (!butil::CreateDirectoryAndGetError(dir, &error)) {
+            LOG(ERROR) << "Fail to create directory=`" << dir.value()
+                       << "', " << error;
+            return -1;
+        }
+        _fp = fopen(_filename.c_str(), "w");
+        if (NULL == _fp) {
+            PLOG(ERROR) << "Fail to open " << _filename;
+            return -1;
+        }
+    }
+    _encoder.begin_frame(keyframe);
+    if (Variable::dump_exposed(this, &options) < 0 ||
+        MVariable::dump_exposed(this, &options) < 0) {
+        // The encoder has values not written, restart from a keyframe.
+        close();
+        return -1;
+    }
+    butil::IOBuf frame;
+    const int nvalue = _encoder.end_frame(&frame);
+    const std::string data = frame.to_string();
+    if (fwrite(data.data(), data.size(), 1, _fp) != 1 || fflush(_fp) != 0) {
+        PLOG(ERROR) << "Fail to write into " << _filename;
+        close();
+        return -1;
+    }
+    ++_ndump;
+    return nvalue;
+}
 
 #if !defined(BVAR_NOT_LINK_DEFAULT_VARIABLES)
 // Expose bvar-releated gflags so that they're collected by noah.
@@ -696,6 +710,7 @@ static void* dumping_thread(void*) {
     // destructed when program exits and caused coredumps.
     const std::string command_name = read_command_name();
     std::string last_filename;
+    BinaryFileDumper binary_dumper;
     while (1) {
         // We can't access string flags directly because it's thread-unsafe.
         std::string filename;
@@ -735,6 +750,13 @@ static void* dumping_thread(void*) {
             if (pos != std::string::npos) {
                 filename.replace(pos, 5/*<app>*/, command_name);
             }
+            if (FLAGS_bvar_dump_binary) {
+                butil::FilePath path(filename);
+                if (path.FinalExtension() == ".data") {
+                    path = path.RemoveFinalExtension();
+                }
+                filename = path.AddExtension("bin").value();
+            }
             if (last_filename != filename) {
                 last_filename = filename;
                 LOG(INFO) << "Write all bvar to " << filename << " every "
@@ -744,10 +766,18 @@ static void* dumping_thread(void*) {
             if (pos2 != std::string::npos) {
                 prefix.replace(pos2, 5/*<app>*/, command_name);
             }            
-            FileDumperGroup dumper(tabs, filename, prefix);
-            int nline = Variable::dump_exposed(&dumper, &options);
-            if (nline < 0) {
-                LOG(ERROR) << "Fail to dump vars into " << filename;
+            if (FLAGS_bvar_dump_binary) {
+                if (binary_dumper.dump_exposed(filename, prefix, options) < 0) {
+                    LOG(ERROR) << "Fail to dump vars into " << filename;
+                }
+            } else {
+                FileDumperGroup dumper(tabs, filename, prefix);
+                int nline = Variable::dump_exposed(&dumper, &options);
+                if (nline < 0) {
+                    LOG(ERROR) << "Fail to dump vars into " << filename;
+                } else if (MVariable::dump_exposed(&dumper, &options) < 0) {
+                    LOG(ERROR) << "Fail to dump labeled vars into " << filename;
+                }
             }
         }
 
@@ -815,6 +845,20 @@ static bool validate_bvar_log_dumpped(const char *, bool) { return true; }
 const bool ALLOW_UNUSED dummy_bvar_log_dumpped = ::GFLAGS_NS::RegisterFlagValidator(
         &FLAGS_bvar_log_dumpped, validate_bvar_log_dumpped);
 
+static bool wakeup_dumping_thread_bool(const char*, bool) {
+    pthread_cond_signal(&dump_cond);
+    return true;
+}
+const bool ALLOW_UNUSED dummy_bvar_dump_binary = ::GFLAGS_NS::RegisterFlagValidator(
+    &FLAGS_bvar_dump_binary, wakeup_dumping_thread_bool);
+
+static bool validate_bvar_dump_binary_keyframe_interval(const char*, int32_t v) {
+    return v >= 1;
+}
+const bool ALLOW_UNUSED dummy_bvar_dump_binary_keyframe_interval =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_bvar_dump_binary_keyframe_interval,
+                                       validate_bvar_dump_binary_keyframe_interval);
+
 static bool wakeup_dumping_thread(const char*, const std::string&) {
     // We're modifying a flag, wake up dumping_thread to generate
     // a new file soon.
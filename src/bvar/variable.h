@@ -53,6 +53,21 @@ public:
     virtual ~Dumper() { }
     virtual bool dump(const std::string& name,
                       const butil::StringPiece& description) = 0;
+
+    // Called by MVariable::dump_exposed() before values of the labeled
+    // metric family `name' whose type is `type' (gauge, counter, summary),
+    // used by dumpers needing metadata of families, e.g. prometheus.
+    virtual bool dump_comment(const std::string& /*name*/,
+                              const std::string& /*type*/) {
+        return true;
+    }
+
+    // Dump a value of a labeled metric family, `name' is in the form of
+    // family{label1="value1",label2="value2"}.
+    virtual bool dump_mvar(const std::string& name,
+                           const butil::StringPiece& description) {
+        return dump(name, description);
+    }
 };
 
 // Options for Variable::dump_exposed().
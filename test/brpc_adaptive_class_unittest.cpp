@@ -20,9 +20,11 @@
 // Date: 2019/04/16 23:41:04
 
 #include <gtest/gtest.h>
+#include <gflags/gflags.h>
 #include "brpc/adaptive_max_concurrency.h"
 #include "brpc/adaptive_protocol_type.h"
 #include "brpc/adaptive_connection_type.h"
+#include "brpc/details/adaptive_compression.h"
 
 const std::string kAutoCL = "aUto";
 const std::string kHttp = "hTTp";
@@ -73,3 +75,58 @@ TEST(AdaptiveConnectionTypeTest, ShouldConvertCorrectly) {
     EXPECT_NE(act, brpc::ConnectionType::CONNECTION_TYPE_SINGLE);
 }
 
+
+namespace brpc {
+DECLARE_bool(adaptive_response_compression);
+DECLARE_double(adaptive_compress_max_cpu_usage);
+DECLARE_int32(adaptive_compress_probe_interval);
+}
+
+TEST(AdaptiveCompressionTest, ShouldSkipPoorCompression) {
+    brpc::FLAGS_adaptive_response_compression = true;
+    // Not affected by cpu usage of the test.
+    brpc::FLAGS_adaptive_compress_max_cpu_usage = 100;
+    butil::EndPoint remote;
+    butil::EndPoint local;
+    ASSERT_EQ(0, butil::str2endpoint("10.1.1.1:8000", &remote));
+    ASSERT_EQ(0, butil::str2endpoint("10.1.1.2:8000", &local));
+    brpc::AdaptiveCompression ac;
+
+    EXPECT_EQ(brpc::COMPRESS_TYPE_NONE,
+              ac.Decide(brpc::COMPRESS_TYPE_NONE, 4096, remote, local));
+    // Too small
+    EXPECT_EQ(brpc::COMPRESS_TYPE_NONE,
+              ac.Decide(brpc::COMPRESS_TYPE_GZIP, 10, remote, local));
+    // Same host
+    EXPECT_EQ(brpc::COMPRESS_TYPE_NONE,
+              ac.Decide(brpc::COMPRESS_TYPE_GZIP, 4096, remote, remote));
+    EXPECT_EQ(brpc::COMPRESS_TYPE_GZIP,
+              ac.Decide(brpc::COMPRESS_TYPE_GZIP, 4096, remote, local));
+
+    // Incompressible payloads are skipped except the probes.
+    ac.OnCompressed(4096, 4100);
+    EXPECT_GT(ac.ratio(), 1.0);
+    int ncompressed = 0;
+    for (int i = 0; i < brpc::FLAGS_adaptive_compress_probe_interval * 2; ++i) {
+        if (ac.Decide(brpc::COMPRESS_TYPE_GZIP, 4096, remote, local)
+            != brpc::COMPRESS_TYPE_NONE) {
+            ++ncompressed;
+        }
+    }
+    EXPECT_EQ(2, ncompressed);
+
+    // Compressible again after probes find a good ratio.
+    for (int i = 0; i < 32; ++i) {
+        ac.OnCompressed(4096, 1024);
+    }
+    EXPECT_LT(ac.ratio(), 0.5);
+    EXPECT_EQ(brpc::COMPRESS_TYPE_GZIP,
+              ac.Decide(brpc::COMPRESS_TYPE_GZIP, 4096, remote, local));
+
+    // Busy cpu
+    brpc::FLAGS_adaptive_compress_max_cpu_usage = -1;
+    EXPECT_EQ(brpc::COMPRESS_TYPE_NONE,
+              ac.Decide(brpc::COMPRESS_TYPE_GZIP, 4096, remote, local));
+    brpc::FLAGS_adaptive_compress_max_cpu_usage = 0.8;
+    brpc::FLAGS_adaptive_response_compression = false;
+}
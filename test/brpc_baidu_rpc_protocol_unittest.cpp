@@ -0,0 +1,337 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/fd_guard.h"
+#include "butil/time.h"
+#include "butil/logging.h"
+#include "butil/synchronization/lock.h"
+#include "brpc/channel.h"
+#include "brpc/server.h"
+#include "brpc/controller.h"
+#include "brpc/policy/baidu_rpc_meta.pb.h"
+#include "echo.pb.h"
+
+namespace brpc {
+DECLARE_int32(idle_timeout_second);
+DECLARE_int32(health_check_interval);
+namespace policy {
+DECLARE_bool(baidu_std_compact_meta);
+}
+}
+
+int main(int argc, char* argv[]) {
+    brpc::FLAGS_idle_timeout_second = 0;
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+class EchoServiceImpl : public ::test::EchoService {
+public:
+    void Echo(google::protobuf::RpcController* cntl_base,
+              const ::test::EchoRequest* req,
+              ::test::EchoResponse* res,
+              google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        if (req->server_fail()) {
+            cntl->SetFailed(req->server_fail(), "fail as requested");
+            return;
+        }
+        res->set_message(req->message());
+        res->add_code_list(cntl->log_id());
+        cntl->response_attachment() = cntl->request_attachment();
+    }
+
+    void BytesEcho1(google::protobuf::RpcController*,
+                    const ::test::BytesRequest* req,
+                    ::test::BytesResponse* res,
+                    google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        res->set_databytes(req->databytes());
+    }
+};
+
+// Forward connections to the server and record bytes sent by clients.
+class Relay {
+public:
+    Relay() : _listened_fd(-1), _conn_fd(-1), _stop(false), _tid(0) {}
+    ~Relay() { Stop(); }
+
+    int Start(const butil::EndPoint& server) {
+        _server = server;
+        butil::EndPoint point;
+        butil::str2endpoint("127.0.0.1:0", &point);
+        _listened_fd = butil::tcp_listen(point);
+        if (_listened_fd < 0 ||
+            butil::get_local_side(_listened_fd, &_address) != 0) {
+            return -1;
+        }
+        return pthread_create(&_tid, NULL, RunThis, this);
+    }
+
+    void Stop() {
+        if (_tid) {
+            _stop = true;
+            shutdown(_listened_fd, SHUT_RDWR);
+            CloseConnection();
+            pthread_join(_tid, NULL);
+            _tid = 0;
+        }
+        if (_listened_fd >= 0) {
+            close(_listened_fd);
+            _listened_fd = -1;
+        }
+    }
+
+    // Close the connection being relayed, clients connect again.
+    void CloseConnection() {
+        const int fd = _conn_fd.load();
+        if (fd >= 0) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+
+    const butil::EndPoint& address() const { return _address; }
+
+    // baidu_std metas sent by clients.
+    std::vector<std::string> request_metas() {
+        BAIDU_SCOPED_LOCK(_mutex);
+        std::vector<std::string> metas;
+        for (size_t pos = 0; pos + 12 <= _sent.size(); ) {
+            uint32_t body_size = 0;
+            uint32_t meta_size = 0;
+            memcpy(&body_size, _sent.data() + pos + 4, 4);
+            memcpy(&meta_size, _sent.data() + pos + 8, 4);
+            metas.push_back(_sent.substr(pos + 12, ntohl(meta_size)));
+            pos += 12 + ntohl(body_size);
+        }
+        return metas;
+    }
+
+private:
+    static void* RunThis(void* arg) {
+        static_cast<Relay*>(arg)->Run();
+        return NULL;
+    }
+
+    void Run() {
+        while (!_stop) {
+            butil::fd_guard client_fd(accept(_listened_fd, NULL, NULL));
+            if (client_fd < 0) {
+                continue;
+            }
+            butil::fd_guard server_fd(butil::tcp_connect(_server, NULL));
+            if (server_fd < 0) {
+                continue;
+            }
+            _conn_fd.store(client_fd);
+            struct pollfd fds[2] = { { client_fd, POLLIN, 0 },
+                                     { server_fd, POLLIN, 0 } };
+            char buf[4096];
+            while (poll(fds, 2, -1) > 0) {
+                const ssize_t nr = read(fds[0].revents ? fds[0].fd : fds[1].fd,
+                                        buf, sizeof(buf));
+                if (nr <= 0) {
+                    break;
+                }
+                if (fds[0].revents) {
+                    {
+                        BAIDU_SCOPED_LOCK(_mutex);
+                        _sent.append(buf, nr);
+                    }
+                    ASSERT_EQ(nr, write(server_fd, buf, nr));
+                } else {
+                    ASSERT_EQ(nr, write(client_fd, buf, nr));
+                }
+            }
+            _conn_fd.store(-1);
+        }
+    }
+
+    butil::EndPoint _server;
+    butil::EndPoint _address;
+    int _listened_fd;
+    butil::atomic<int> _conn_fd;
+    volatile bool _stop;
+    pthread_t _tid;
+    butil::Mutex _mutex;
+    std::string _sent;
+};
+
+bool IsCompactMeta(const std::string& meta) {
+    return !meta.empty() && meta[0] == 0;
+}
+
+class BaiduRpcProtocolTest : public ::testing::Test {
+protected:
+    void SetUp() {
+        ASSERT_EQ(0, _server.AddService(&_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+        ASSERT_EQ(0, _server.Start("127.0.0.1", brpc::PortRange(8100, 8900), NULL));
+    }
+
+    void TearDown() {
+        brpc::policy::FLAGS_baidu_std_compact_meta = false;
+        _server.Stop(0);
+        _server.Join();
+    }
+
+    void InitChannel(brpc::Channel* channel) {
+        InitChannel(channel, _server.listen_address());
+    }
+
+    void InitChannel(brpc::Channel* channel, const butil::EndPoint& ep) {
+        brpc::ChannelOptions options;
+        options.connection_type = brpc::CONNECTION_TYPE_SINGLE;
+        ASSERT_EQ(0, channel->Init(ep, &options));
+    }
+
+    EchoServiceImpl _svc;
+    brpc::Server _server;
+};
+
+TEST_F(BaiduRpcProtocolTest, compact_meta) {
+    brpc::policy::FLAGS_baidu_std_compact_meta = true;
+    brpc::Channel channel;
+    InitChannel(&channel);
+    ::test::EchoService_Stub stub(&channel);
+    // The first call of a method interns it, later calls use compact meta.
+    for (int i = 0; i < 5; ++i) {
+        ::test::EchoRequest req;
+        ::test::EchoResponse res;
+        brpc::Controller cntl;
+        req.set_message("hello");
+        cntl.set_log_id(i + 100);
+        cntl.request_attachment().append("attachment");
+        if (i % 2) {
+            cntl.set_request_compress_type(brpc::COMPRESS_TYPE_GZIP);
+        }
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ("hello", res.message());
+        ASSERT_EQ(1, res.code_list_size());
+        ASSERT_EQ(i + 100, res.code_list(0));
+        ASSERT_EQ("attachment", cntl.response_attachment().to_string());
+    }
+    for (int i = 0; i < 3; ++i) {
+        ::test::BytesRequest req;
+        ::test::BytesResponse res;
+        brpc::Controller cntl;
+        req.set_databytes("bytes");
+        stub.BytesEcho1(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ("bytes", res.databytes());
+    }
+    // Errors are carried by compact responses as well.
+    ::test::EchoRequest req;
+    ::test::EchoResponse res;
+    brpc::Controller cntl;
+    req.set_message("hello");
+    req.set_server_fail(brpc::EINTERNAL);
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_TRUE(cntl.Failed());
+    ASSERT_EQ(brpc::EINTERNAL, cntl.ErrorCode());
+    ASSERT_NE(std::string::npos, cntl.ErrorText().find("fail as requested"));
+
+    // Protobuf meta still works on the same connection.
+    brpc::policy::FLAGS_baidu_std_compact_meta = false;
+    brpc::Controller cntl2;
+    req.clear_server_fail();
+    stub.Echo(&cntl2, &req, &res, NULL);
+    ASSERT_FALSE(cntl2.Failed()) << cntl2.ErrorText();
+    ASSERT_EQ("hello", res.message());
+}
+
+TEST_F(BaiduRpcProtocolTest, compact_meta_on_wire) {
+    GFLAGS_NS::FlagSaver saver;
+    brpc::FLAGS_health_check_interval = 1;
+    brpc::policy::FLAGS_baidu_std_compact_meta = true;
+    Relay relay;
+    ASSERT_EQ(0, relay.Start(_server.listen_address()));
+    brpc::Channel channel;
+    InitChannel(&channel, relay.address());
+    ::test::EchoService_Stub stub(&channel);
+    ::test::EchoRequest req;
+    req.set_message("hello");
+    for (int i = 0; i < 3; ++i) {
+        ::test::EchoResponse res;
+        brpc::Controller cntl;
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ("hello", res.message());
+    }
+    // Methods not found are never interned, thus always sent in protobuf
+    // meta although the responses are compact.
+    ::test::DownloadService_Stub bad_stub(&channel);
+    for (int i = 0; i < 2; ++i) {
+        ::test::HttpRequest bad_req;
+        ::test::HttpResponse bad_res;
+        brpc::Controller cntl;
+        bad_stub.Download(&cntl, &bad_req, &bad_res, NULL);
+        ASSERT_EQ(brpc::ENOSERVICE, cntl.ErrorCode()) << cntl.ErrorText();
+    }
+    std::vector<std::string> metas = relay.request_metas();
+    ASSERT_EQ(5u, metas.size());
+    // Interned by the first request, in which the id is asked for.
+    brpc::policy::RpcMeta meta;
+    ASSERT_FALSE(IsCompactMeta(metas[0]));
+    ASSERT_TRUE(meta.ParseFromString(metas[0]));
+    ASSERT_TRUE(meta.request().has_compact_method_id());
+    const int id = meta.request().compact_method_id();
+    ASSERT_TRUE(IsCompactMeta(metas[1]));
+    ASSERT_TRUE(IsCompactMeta(metas[2]));
+    for (size_t i = 3; i < 5; ++i) {
+        ASSERT_FALSE(IsCompactMeta(metas[i]));
+        ASSERT_TRUE(meta.ParseFromString(metas[i]));
+        ASSERT_NE(id, meta.request().compact_method_id());
+    }
+
+    // The connection is negotiated again after reconnection with the same
+    // id, rather than sending ids not interned by the new connection.
+    relay.CloseConnection();
+    bool reconnected = false;
+    for (int i = 0; i < 50 && !reconnected; ++i) {
+        ::test::EchoResponse res;
+        brpc::Controller cntl;
+        stub.Echo(&cntl, &req, &res, NULL);
+        if (cntl.Failed()) {
+            bthread_usleep(100000);
+            continue;
+        }
+        ASSERT_EQ("hello", res.message());
+        reconnected = true;
+    }
+    ASSERT_TRUE(reconnected);
+    ::test::EchoResponse res;
+    brpc::Controller cntl;
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    metas = relay.request_metas();
+    ASSERT_EQ(7u, metas.size());
+    ASSERT_FALSE(IsCompactMeta(metas[5]));
+    ASSERT_TRUE(meta.ParseFromString(metas[5]));
+    ASSERT_EQ(id, meta.request().compact_method_id());
+    ASSERT_TRUE(IsCompactMeta(metas[6]));
+}
+
+} // namespace
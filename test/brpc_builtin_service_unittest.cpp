@@ -21,6 +21,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>                          // mkdir
 #include <fstream>
 #include <gtest/gtest.h>
 #include <gflags/gflags.h>
@@ -46,6 +47,7 @@
 #include "brpc/builtin/vars_service.h"         // VarsService
 #include "brpc/builtin/rpcz_service.h"         // RpczService
 #include "brpc/builtin/dir_service.h"          // DirService
+#include "brpc/builtin/static_file_service.h"  // StaticFileService
 #include "brpc/builtin/pprof_service.h"        // PProfService
 #include "brpc/builtin/bthreads_service.h"     // BthreadsService
 #include "brpc/builtin/ids_service.h"          // IdsService
@@ -61,6 +63,7 @@ namespace brpc {
 DECLARE_bool(enable_rpcz);
 DECLARE_bool(rpcz_hex_log_id);
 DECLARE_int32(idle_timeout_second);
+DECLARE_string(static_file_dir);
 } // namespace rpc
 
 int main(int argc, char* argv[]) {
@@ -729,6 +732,68 @@ TEST_F(BuiltinServiceTest, dir) {
     }
 }
     
+TEST_F(BuiltinServiceTest, static_files) {
+    GFLAGS_NS::FlagSaver saver;
+    char dir[] = "/tmp/brpc_static_file_ut_XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    brpc::FLAGS_static_file_dir = dir;
+    const std::string sub_dir = std::string(dir) + "/sub";
+    ASSERT_EQ(0, mkdir(sub_dir.c_str(), 0700));
+    const char* files[] = { "index.html", "sub/a.txt", "..hidden" };
+    for (size_t i = 0; i < ARRAY_SIZE(files); ++i) {
+        std::ofstream out((std::string(dir) + "/" + files[i]).c_str());
+        out << "content of " << files[i];
+    }
+
+    brpc::StaticFileService service;
+    brpc::StaticFileRequest req;
+    brpc::StaticFileResponse res;
+    const char* content_types[] = {
+        "text/html", "text/plain", "application/octet-stream" };
+    for (size_t i = 0; i < ARRAY_SIZE(files); ++i) {
+        ClosureChecker done;
+        brpc::Controller cntl;
+        SetUpController(&cntl, false);
+        cntl.http_request()._unresolved_path = files[i];
+        service.default_method(&cntl, &req, &res, &done);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(std::string("content of ") + files[i],
+                  cntl.response_attachment().to_string());
+        ASSERT_EQ(content_types[i], cntl.http_response().content_type());
+    }
+    // Paths going out of the directory.
+    const char* unsafe_paths[] = {
+        "", "..", "../etc/passwd", "sub/../../etc/passwd", "sub/.." };
+    for (size_t i = 0; i < ARRAY_SIZE(unsafe_paths); ++i) {
+        ClosureChecker done;
+        brpc::Controller cntl;
+        SetUpController(&cntl, false);
+        cntl.http_request()._unresolved_path = unsafe_paths[i];
+        service.default_method(&cntl, &req, &res, &done);
+        ASSERT_EQ(EPERM, cntl.ErrorCode()) << unsafe_paths[i];
+        ASSERT_TRUE(cntl.response_attachment().empty());
+    }
+    // Files not existing and directories.
+    const char* missing_paths[] = { "not_exist.html", "sub", "sub/b.txt" };
+    for (size_t i = 0; i < ARRAY_SIZE(missing_paths); ++i) {
+        ClosureChecker done;
+        brpc::Controller cntl;
+        SetUpController(&cntl, false);
+        cntl.http_request()._unresolved_path = missing_paths[i];
+        service.default_method(&cntl, &req, &res, &done);
+        ASSERT_EQ(ENOENT, cntl.ErrorCode()) << missing_paths[i];
+        ASSERT_EQ(brpc::HTTP_STATUS_NOT_FOUND,
+                  cntl.http_response().status_code());
+        CheckErrorText(cntl, "Cannot open");
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(files); ++i) {
+        unlink((std::string(dir) + "/" + files[i]).c_str());
+    }
+    rmdir(sub_dir.c_str());
+    rmdir(dir);
+}
+
 TEST_F(BuiltinServiceTest, ids) {
     brpc::IdsService service;
     brpc::IdsRequest req;
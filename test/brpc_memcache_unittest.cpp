@@ -16,10 +16,16 @@
 // under the License.
 
 #include <iostream>
+#include <map>
 #include "butil/time.h"
 #include "butil/logging.h"
+#include "butil/string_printf.h"
+#include "butil/synchronization/lock.h"
+#include <bthread/bthread.h>
 #include <brpc/memcache.h>
+#include <brpc/memcache_coalescing_channel.h>
 #include <brpc/channel.h>
+#include <brpc/server.h>
 #include <gtest/gtest.h>
 
 namespace brpc {
@@ -222,4 +228,292 @@ TEST_F(MemcacheTest, version) {
     ASSERT_TRUE(response.PopVersion(&version)) << response.LastError();
     std::cout << "version=" << version << std::endl;
 }
+
+// A memcached in memory without expiration.
+class MemoryMemcacheService : public brpc::MemcacheService {
+public:
+    MemoryMemcacheService() : nget(0), _last_cas(0) {}
+
+    Status Get(const butil::StringPiece& key, butil::IOBuf* value,
+               uint32_t* flags, uint64_t* cas_value) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        ++nget;
+        std::map<std::string, Item>::const_iterator it = _items.find(key.as_string());
+        if (it == _items.end()) {
+            return brpc::MemcacheResponse::STATUS_KEY_ENOENT;
+        }
+        value->append(it->second.value);
+        *flags = it->second.flags;
+        *cas_value = it->second.cas;
+        return brpc::MemcacheResponse::STATUS_SUCCESS;
+    }
+
+    Status Store(StoreOperation op, const butil::StringPiece& key,
+                 const butil::IOBuf& value, uint32_t flags, uint32_t /*exptime*/,
+                 uint64_t cas_value, uint64_t* new_cas_value) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        std::map<std::string, Item>::iterator it = _items.find(key.as_string());
+        const bool exists = (it != _items.end());
+        if ((op == STORE_ADD && exists) ||
+            (op != STORE_SET && op != STORE_ADD && !exists)) {
+            return brpc::MemcacheResponse::STATUS_NOT_STORED;
+        }
+        if (cas_value != 0 && (!exists || it->second.cas != cas_value)) {
+            return brpc::MemcacheResponse::STATUS_KEY_EEXISTS;
+        }
+        Item& item = _items[key.as_string()];
+        if (op == STORE_APPEND) {
+            item.value.append(value.to_string());
+        } else if (op == STORE_PREPEND) {
+            item.value.insert(0, value.to_string());
+        } else {
+            item.value = value.to_string();
+            item.flags = flags;
+        }
+        item.cas = ++_last_cas;
+        *new_cas_value = item.cas;
+        return brpc::MemcacheResponse::STATUS_SUCCESS;
+    }
+
+    Status Delete(const butil::StringPiece& key, uint64_t /*cas_value*/) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_items.erase(key.as_string()) == 0) {
+            return brpc::MemcacheResponse::STATUS_KEY_ENOENT;
+        }
+        return brpc::MemcacheResponse::STATUS_SUCCESS;
+    }
+
+    Status Counter(bool increment, const butil::StringPiece& key,
+                   uint64_t delta, uint64_t initial_value, uint32_t /*exptime*/,
+                   uint64_t* new_value, uint64_t* new_cas_value) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        std::map<std::string, Item>::iterator it = _items.find(key.as_string());
+        uint64_t n = initial_value;
+        if (it != _items.end()) {
+            n = strtoull(it->second.value.c_str(), NULL, 10);
+            n = (increment ? n + delta : (n > delta ? n - delta : 0));
+        }
+        Item& item = _items[key.as_string()];
+        item.value = butil::string_printf("%" PRIu64, n);
+        item.cas = ++_last_cas;
+        *new_value = n;
+        *new_cas_value = item.cas;
+        return brpc::MemcacheResponse::STATUS_SUCCESS;
+    }
+
+    Status Version(std::string* version) {
+        *version = "memory-1.0";
+        return brpc::MemcacheResponse::STATUS_SUCCESS;
+    }
+
+    int nget;
+
+private:
+    struct Item {
+        Item() : flags(0), cas(0) {}
+        std::string value;
+        uint32_t flags;
+        uint64_t cas;
+    };
+    butil::Mutex _mutex;
+    uint64_t _last_cas;
+    std::map<std::string, Item> _items;
+};
+
+class MemcacheServerTest : public testing::Test {
+protected:
+    void SetUp() {
+        _service = new MemoryMemcacheService;
+        brpc::ServerOptions options;
+        options.memcache_service = _service;
+        ASSERT_EQ(0, _server.Start("127.0.0.1", brpc::PortRange(8600, 8900), &options));
+        brpc::ChannelOptions chan_options;
+        chan_options.protocol = brpc::PROTOCOL_MEMCACHE;
+        ASSERT_EQ(0, _channel.Init(_server.listen_address(), &chan_options));
+    }
+
+    brpc::Server _server;
+    MemoryMemcacheService* _service;
+    brpc::Channel _channel;
+};
+
+TEST_F(MemcacheServerTest, sanity) {
+    brpc::MemcacheRequest request;
+    brpc::MemcacheResponse response;
+    brpc::Controller cntl;
+    request.Get("hello");
+    request.Set("hello", "world", 0xdeadbeef, 10, 0);
+    request.Add("hello", "again", 0, 10, 0);
+    request.Append("hello", "!", 0, 10, 0);
+    request.Get("hello");
+    request.Increment("counter", 2, 10, 0);
+    request.Increment("counter", 2, 10, 0);
+    request.Delete("hello");
+    request.Delete("hello");
+    request.Touch("counter", 10);
+    request.Version();
+    _channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+
+    std::string value;
+    uint32_t flags = 0;
+    uint64_t cas_value = 0;
+    ASSERT_FALSE(response.PopGet(&value, &flags, &cas_value));
+    ASSERT_EQ("The key does not exist", response.LastError());
+    ASSERT_TRUE(response.PopSet(&cas_value)) << response.LastError();
+    ASSERT_FALSE(response.PopAdd(NULL));
+    ASSERT_TRUE(response.PopAppend(NULL)) << response.LastError();
+    ASSERT_TRUE(response.PopGet(&value, &flags, &cas_value)) << response.LastError();
+    ASSERT_EQ("world!", value);
+    ASSERT_EQ(0xdeadbeef, flags);
+    uint64_t new_value = 0;
+    ASSERT_TRUE(response.PopIncrement(&new_value, NULL)) << response.LastError();
+    ASSERT_EQ(10u, new_value);
+    ASSERT_TRUE(response.PopIncrement(&new_value, NULL)) << response.LastError();
+    ASSERT_EQ(12u, new_value);
+    ASSERT_TRUE(response.PopDelete()) << response.LastError();
+    ASSERT_FALSE(response.PopDelete());
+    // Not implemented by MemoryMemcacheService.
+    ASSERT_FALSE(response.PopTouch());
+    ASSERT_EQ("Unknown command", response.LastError());
+    std::string version;
+    ASSERT_TRUE(response.PopVersion(&version)) << response.LastError();
+    ASSERT_EQ("memory-1.0", version);
+}
+
+struct SetAndGetArgs {
+    brpc::Channel* channel;
+    int index;
+    int nfailed;
+};
+
+static void* RunSetAndGet(void* void_args) {
+    SetAndGetArgs* args = static_cast<SetAndGetArgs*>(void_args);
+    for (int i = 0; i < 100; ++i) {
+        const std::string key = butil::string_printf("key%d_%d", args->index, i);
+        brpc::MemcacheRequest request;
+        brpc::MemcacheResponse response;
+        brpc::Controller cntl;
+        request.Set(key, key, 0, 0, 0);
+        request.Get(key);
+        args->channel->CallMethod(NULL, &cntl, &request, &response, NULL);
+        std::string value;
+        uint32_t flags = 0;
+        if (cntl.Failed() || !response.PopSet(NULL) ||
+            !response.PopGet(&value, &flags, NULL) || value != key) {
+            ++args->nfailed;
+        }
+    }
+    return NULL;
+}
+
+TEST_F(MemcacheServerTest, concurrent_requests_in_order) {
+    // Requests from many bthreads are pipelined over the single connection
+    // and probably cut into different messages by the server, responses
+    // must still be in order.
+    const int N = 16;
+    SetAndGetArgs args[N];
+    bthread_t th[N];
+    for (int i = 0; i < N; ++i) {
+        args[i].channel = &_channel;
+        args[i].index = i;
+        args[i].nfailed = 0;
+        ASSERT_EQ(0, bthread_start_background(&th[i], NULL, RunSetAndGet, &args[i]));
+    }
+    for (int i = 0; i < N; ++i) {
+        bthread_join(th[i], NULL);
+    }
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, args[i].nfailed) << "index=" << i;
+    }
+}
+
+class CountingChannel : public brpc::ChannelBase {
+public:
+    explicit CountingChannel(brpc::ChannelBase* sub) : ncall(0), _sub(sub) {}
+    void CallMethod(const google::protobuf::MethodDescriptor* method,
+                    google::protobuf::RpcController* controller,
+                    const google::protobuf::Message* request,
+                    google::protobuf::Message* response,
+                    google::protobuf::Closure* done) {
+        ncall.fetch_add(1);
+        _sub->CallMethod(method, controller, request, response, done);
+    }
+    int CheckHealth() { return _sub->CheckHealth(); }
+
+    butil::atomic<int> ncall;
+private:
+    brpc::ChannelBase* _sub;
+};
+
+struct GetArgs {
+    brpc::ChannelBase* channel;
+    std::string key;
+    bool failed;
+    bool found;
+    std::string value;
+};
+
+static void* RunGet(void* void_args) {
+    GetArgs* args = static_cast<GetArgs*>(void_args);
+    brpc::MemcacheRequest request;
+    brpc::MemcacheResponse response;
+    brpc::Controller cntl;
+    request.Get(args->key);
+    args->channel->CallMethod(NULL, &cntl, &request, &response, NULL);
+    args->failed = cntl.Failed();
+    uint32_t flags = 0;
+    args->found = response.PopGet(&args->value, &flags, NULL);
+    return NULL;
+}
+
+TEST_F(MemcacheServerTest, coalesce_gets) {
+    CountingChannel counting(&_channel);
+    brpc::MemcacheCoalescingChannel channel;
+    brpc::MemcacheCoalescingChannelOptions options;
+    options.window_us = 200000;
+    ASSERT_EQ(0, channel.Init(&counting, brpc::DOESNT_OWN_CHANNEL, &options));
+
+    // Non-GET requests are not coalesced.
+    for (int i = 0; i < 3; ++i) {
+        brpc::MemcacheRequest request;
+        brpc::MemcacheResponse response;
+        brpc::Controller cntl;
+        request.Set(butil::string_printf("key%d", i), butil::string_printf("value%d", i),
+                    0, 0, 0);
+        channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_TRUE(response.PopSet(NULL)) << response.LastError();
+    }
+    ASSERT_EQ(3, counting.ncall.load());
+
+    const char* const keys[] = { "key0", "key1", "key2", "key0", "nokey", "key2" };
+    const size_t N = arraysize(keys);
+    GetArgs args[N];
+    bthread_t th[N];
+    for (size_t i = 0; i < N; ++i) {
+        args[i].channel = &channel;
+        args[i].key = keys[i];
+        args[i].failed = true;
+        args[i].found = false;
+        ASSERT_EQ(0, bthread_start_background(&th[i], NULL, RunGet, &args[i]));
+    }
+    for (size_t i = 0; i < N; ++i) {
+        bthread_join(th[i], NULL);
+    }
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_FALSE(args[i].failed) << args[i].key;
+        if (args[i].key == "nokey") {
+            ASSERT_FALSE(args[i].found);
+        } else {
+            ASSERT_TRUE(args[i].found) << args[i].key;
+            ASSERT_EQ("value" + args[i].key.substr(3), args[i].value);
+        }
+    }
+    // GETs are sent in much less RPCs, and duplicated keys are fetched once
+    // in a batch.
+    ASSERT_LT(counting.ncall.load(), 3 + (int)N);
+    ASSERT_LT(_service->nget, (int)N);
+}
+
 } //namespace
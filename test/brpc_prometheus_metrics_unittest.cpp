@@ -17,13 +17,20 @@
 
 // brpc - A framework to host and access services throughout Baidu.
 
+#include <gflags/gflags.h>
 #include <gtest/gtest.h>
 #include "brpc/server.h"
 #include "brpc/channel.h"
 #include "brpc/controller.h"
 #include "butil/strings/string_piece.h"
+#include "bvar/multi_dimension.h"
+#include "brpc/builtin/prometheus_metrics_service.h"
 #include "echo.pb.h"
 
+namespace bvar {
+DECLARE_bool(bvar_latency_histogram);
+}
+
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -142,3 +149,49 @@ TEST(PrometheusMetrics, sanity) {
     ASSERT_EQ(0, server.Stop(0));
     ASSERT_EQ(0, server.Join());
 }
+
+TEST(PrometheusMetrics, labeled_bvars) {
+    bvar::MultiDimension<bvar::Adder<int> > errors(
+        "labeled_error", {"method", "code"});
+    *errors.get_stats({"Echo", "1003"}) << 2;
+    bvar::MultiDimension<bvar::LatencyRecorder> latency(
+        "labeled_latency", {"method"});
+    *latency.get_stats({"Echo"}) << 10;
+
+    butil::IOBuf buf;
+    ASSERT_EQ(0, brpc::DumpPrometheusMetricsToIOBuf(&buf));
+    const std::string res = buf.to_string();
+    ASSERT_NE(std::string::npos, res.find(
+        "# TYPE labeled_error gauge\n"
+        "labeled_error{method=\"Echo\",code=\"1003\"} 2\n"));
+    ASSERT_NE(std::string::npos, res.find(
+        "# TYPE labeled_latency summary\n"
+        "labeled_latency{method=\"Echo\",quantile="));
+    ASSERT_NE(std::string::npos, res.find(
+        "labeled_latency_count{method=\"Echo\"} 1\n"));
+    ASSERT_NE(std::string::npos, res.find(
+        "# TYPE labeled_latency_qps gauge\n"));
+}
+
+TEST(PrometheusMetrics, latency_histogram) {
+    bvar::FLAGS_bvar_latency_histogram = true;
+    bvar::LatencyRecorder rec("histogram_rpc");
+    bvar::FLAGS_bvar_latency_histogram = false;
+    rec << 1;
+    rec << 1;
+    rec << 100;
+
+    butil::IOBuf buf;
+    ASSERT_EQ(0, brpc::DumpPrometheusMetricsToIOBuf(&buf));
+    const std::string res = buf.to_string();
+    ASSERT_NE(std::string::npos, res.find(
+        "# TYPE histogram_rpc_latency_histogram histogram\n"
+        "histogram_rpc_latency_histogram_bucket{le=\"1\"} 2\n"
+        "histogram_rpc_latency_histogram_bucket{le=\"103\"} 3\n"
+        "histogram_rpc_latency_histogram_bucket{le=\"+Inf\"} 3\n"
+        "histogram_rpc_latency_histogram_sum 102\n"
+        "histogram_rpc_latency_histogram_count 3\n")) << res;
+    // The summary is still there.
+    ASSERT_NE(std::string::npos, res.find(
+        "# TYPE histogram_rpc_latency summary\n"));
+}
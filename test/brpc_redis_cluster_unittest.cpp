@@ -0,0 +1,275 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <unordered_map>
+#include <butil/logging.h>
+#include <butil/string_printf.h>
+#include <butil/synchronization/lock.h>
+#include <brpc/redis.h>
+#include <brpc/redis_cluster.h>
+#include <brpc/server.h>
+#include <gtest/gtest.h>
+
+namespace brpc {
+DECLARE_int32(idle_timeout_second);
+}
+
+int main(int argc, char* argv[]) {
+    brpc::FLAGS_idle_timeout_second = 0;
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+// A stand-in redis cluster of two nodes built on RedisService. Slots less
+// than `split' are owned by node 0, others by node 1. Keys of
+// `migrating_slot' are being migrated from node 0 to node 1.
+struct FakeCluster {
+    FakeCluster() : split(brpc::REDIS_CLUSTER_SLOT_COUNT / 2), migrating_slot(-1) {
+        ncommand[0] = ncommand[1] = 0;
+        asking[0] = asking[1] = false;
+    }
+    int owner(int slot) const { return slot < split ? 0 : 1; }
+
+    brpc::Server servers[2];
+    int ports[2];
+    int split;
+    int migrating_slot;
+    int ncommand[2];
+    bool asking[2];
+    // Nodes are accessed in parallel.
+    butil::Mutex kv_mutex;
+    std::unordered_map<std::string, std::string> kv;
+};
+
+class FakeNodeHandler : public brpc::RedisCommandHandler {
+public:
+    FakeNodeHandler(FakeCluster* cluster, int self)
+        : _c(cluster), _self(self) {}
+
+    brpc::RedisCommandHandlerResult Run(const std::vector<butil::StringPiece>& args,
+                                        brpc::RedisReply* output,
+                                        bool /*flush_batched*/) {
+        const bool asking = _c->asking[_self];
+        _c->asking[_self] = false;
+        if (args[0] == "cluster") {
+            output->SetArray(2);
+            for (int i = 0; i < 2; ++i) {
+                brpc::RedisReply& range = (*output)[i];
+                range.SetArray(3);
+                range[0].SetInteger(i == 0 ? 0 : _c->split);
+                range[1].SetInteger(i == 0 ? _c->split - 1
+                                    : brpc::REDIS_CLUSTER_SLOT_COUNT - 1);
+                range[2].SetArray(2);
+                // Empty host means the node being asked.
+                range[2][0].SetString(i == _self ? "" : "127.0.0.1");
+                range[2][1].SetInteger(_c->ports[i]);
+            }
+            return brpc::REDIS_CMD_HANDLED;
+        }
+        if (args[0] == "asking") {
+            _c->asking[_self] = true;
+            output->SetStatus("OK");
+            return brpc::REDIS_CMD_HANDLED;
+        }
+        if (args.size() < 2) {
+            output->SetError("ERR wrong number of arguments");
+            return brpc::REDIS_CMD_HANDLED;
+        }
+        const int slot = brpc::RedisClusterKeySlot(args[1]);
+        if (slot == _c->migrating_slot && _self == 0) {
+            output->FormatError("ASK %d 127.0.0.1:%d", slot, _c->ports[1]);
+            return brpc::REDIS_CMD_HANDLED;
+        }
+        if (_c->owner(slot) != _self &&
+            !(slot == _c->migrating_slot && asking)) {
+            output->FormatError("MOVED %d 127.0.0.1:%d", slot,
+                                _c->ports[_c->owner(slot)]);
+            return brpc::REDIS_CMD_HANDLED;
+        }
+        ++_c->ncommand[_self];
+        BAIDU_SCOPED_LOCK(_c->kv_mutex);
+        if (args[0] == "set" && args.size() >= 3) {
+            _c->kv[args[1].as_string()] = args[2].as_string();
+            output->SetStatus("OK");
+        } else if (args[0] == "get") {
+            std::unordered_map<std::string, std::string>::const_iterator
+                it = _c->kv.find(args[1].as_string());
+            if (it != _c->kv.end()) {
+                output->SetString(it->second);
+            } else {
+                output->SetNullString();
+            }
+        } else {
+            output->SetError("ERR unknown command");
+        }
+        return brpc::REDIS_CMD_HANDLED;
+    }
+
+private:
+    FakeCluster* _c;
+    int _self;
+};
+
+class RedisClusterTest : public testing::Test {
+protected:
+    void SetUp() {
+        for (int i = 0; i < 2; ++i) {
+            brpc::RedisService* rs = new brpc::RedisService;
+            FakeNodeHandler* h = new FakeNodeHandler(&_cluster, i);
+            rs->AddCommandHandler("cluster", h);
+            rs->AddCommandHandler("asking", h);
+            rs->AddCommandHandler("set", h);
+            rs->AddCommandHandler("get", h);
+            brpc::ServerOptions options;
+            options.redis_service = rs;
+            ASSERT_EQ(0, _cluster.servers[i].Start(
+                          "127.0.0.1", brpc::PortRange(8100, 8900), &options));
+            _cluster.ports[i] = _cluster.servers[i].listen_address().port;
+        }
+    }
+
+    // Find a key whose slot is owned by `node'.
+    std::string KeyOnNode(int node, const char* prefix) {
+        for (int i = 0; ; ++i) {
+            std::string key = butil::string_printf("%s%d", prefix, i);
+            if (_cluster.owner(brpc::RedisClusterKeySlot(key)) == node) {
+                return key;
+            }
+        }
+    }
+
+    FakeCluster _cluster;
+};
+
+TEST_F(RedisClusterTest, key_slot) {
+    ASSERT_EQ(12739, brpc::RedisClusterKeySlot("123456789"));
+    ASSERT_EQ(12182, brpc::RedisClusterKeySlot("foo"));
+    ASSERT_EQ(5061, brpc::RedisClusterKeySlot("bar"));
+    ASSERT_EQ(brpc::RedisClusterKeySlot("user1000"),
+              brpc::RedisClusterKeySlot("{user1000}.following"));
+    ASSERT_EQ(brpc::RedisClusterKeySlot("user1000"),
+              brpc::RedisClusterKeySlot("{user1000}.followers"));
+    // Empty hash tag is not a hash tag.
+    ASSERT_NE(brpc::RedisClusterKeySlot("{}foo"),
+              brpc::RedisClusterKeySlot("foo"));
+}
+
+TEST_F(RedisClusterTest, split_pipeline) {
+    brpc::RedisClusterChannel channel;
+    const std::string seeds = butil::string_printf("127.0.0.1:%d", _cluster.ports[0]);
+    ASSERT_EQ(0, channel.Init(seeds.c_str(), NULL));
+
+    const std::string k0 = KeyOnNode(0, "key");
+    const std::string k1 = KeyOnNode(1, "key");
+    brpc::RedisRequest request;
+    ASSERT_TRUE(request.AddCommand("set %s v0", k0.c_str()));
+    ASSERT_TRUE(request.AddCommand("set %s v1", k1.c_str()));
+    ASSERT_TRUE(request.AddCommand("get %s", k1.c_str()));
+    ASSERT_TRUE(request.AddCommand("get %s", k0.c_str()));
+    ASSERT_TRUE(request.AddCommand("get nosuchkey"));
+    brpc::RedisResponse response;
+    brpc::Controller cntl;
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(5, response.reply_size());
+    ASSERT_STREQ("OK", response.reply(0).c_str());
+    ASSERT_STREQ("OK", response.reply(1).c_str());
+    ASSERT_STREQ("v1", response.reply(2).c_str());
+    ASSERT_STREQ("v0", response.reply(3).c_str());
+    ASSERT_TRUE(response.reply(4).is_nil());
+    // No redirections since slots were fetched.
+    const int nosuchkey_owner = _cluster.owner(brpc::RedisClusterKeySlot("nosuchkey"));
+    ASSERT_EQ(2 + (nosuchkey_owner == 0), _cluster.ncommand[0]);
+    ASSERT_EQ(2 + (nosuchkey_owner == 1), _cluster.ncommand[1]);
+}
+
+TEST_F(RedisClusterTest, moved_and_ask) {
+    brpc::RedisClusterChannel channel;
+    const std::string seeds = butil::string_printf(
+        "127.0.0.1:%d,127.0.0.1:%d", _cluster.ports[0], _cluster.ports[1]);
+    ASSERT_EQ(0, channel.Init(seeds.c_str(), NULL));
+
+    // Reshard: the slot of `k' moves from node 0 to node 1.
+    const std::string k = KeyOnNode(0, "moved");
+    _cluster.kv[k] = "moved_value";
+    _cluster.split = brpc::RedisClusterKeySlot(k);
+    {
+        brpc::RedisRequest request;
+        ASSERT_TRUE(request.AddCommand("get %s", k.c_str()));
+        brpc::RedisResponse response;
+        brpc::Controller cntl;
+        channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(1, response.reply_size());
+        ASSERT_STREQ("moved_value", response.reply(0).c_str());
+        ASSERT_EQ(0, _cluster.ncommand[0]);
+        ASSERT_EQ(1, _cluster.ncommand[1]);
+    }
+    {
+        // The slot map is updated by MOVED, node 1 is accessed directly.
+        brpc::RedisRequest request;
+        ASSERT_TRUE(request.AddCommand("get %s", k.c_str()));
+        brpc::RedisResponse response;
+        brpc::Controller cntl;
+        channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_STREQ("moved_value", response.reply(0).c_str());
+        ASSERT_EQ(2, _cluster.ncommand[1]);
+    }
+
+    // The slot of `k2' is being migrated from node 0 to node 1.
+    const std::string k2 = KeyOnNode(0, "ask");
+    _cluster.migrating_slot = brpc::RedisClusterKeySlot(k2);
+    {
+        brpc::RedisRequest request;
+        ASSERT_TRUE(request.AddCommand("set %s migrated", k2.c_str()));
+        ASSERT_TRUE(request.AddCommand("get %s", k.c_str()));
+        brpc::RedisResponse response;
+        brpc::Controller cntl;
+        channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(2, response.reply_size());
+        ASSERT_STREQ("OK", response.reply(0).c_str());
+        ASSERT_STREQ("moved_value", response.reply(1).c_str());
+        ASSERT_EQ("migrated", _cluster.kv[k2]);
+        ASSERT_EQ(4, _cluster.ncommand[1]);
+    }
+
+    // Redirections are not followed infinitely.
+    _cluster.migrating_slot = -1;
+    brpc::RedisClusterChannelOptions options;
+    options.max_redirect = 0;
+    brpc::RedisClusterChannel channel2;
+    ASSERT_EQ(0, channel2.Init(seeds.c_str(), &options));
+    const std::string k3 = KeyOnNode(1, "key");
+    _cluster.split = brpc::REDIS_CLUSTER_SLOT_COUNT;
+    {
+        brpc::RedisRequest request;
+        ASSERT_TRUE(request.AddCommand("get %s", k3.c_str()));
+        brpc::RedisResponse response;
+        brpc::Controller cntl;
+        channel2.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_TRUE(response.reply(0).is_error());
+        ASSERT_TRUE(butil::StringPiece(
+            response.reply(0).error_message()).starts_with("MOVED "));
+    }
+}
+
+} // namespace
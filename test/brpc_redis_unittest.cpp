@@ -25,10 +25,12 @@
 #include <brpc/policy/redis_authenticator.h>
 #include <brpc/server.h>
 #include <brpc/redis_command.h>
+#include <bthread/bthread.h>
 #include <gtest/gtest.h>
 
 namespace brpc {
 DECLARE_int32(idle_timeout_second);
+DECLARE_int32(redis_reply_iobuf_min_size);
 }
 
 int main(int argc, char* argv[]) {
@@ -635,6 +637,74 @@ TEST_F(RedisTest, command_parser) {
     }
 }
 
+static void DeleteCharArray(void* data) {
+    delete [] static_cast<char*>(data);
+}
+
+TEST_F(RedisTest, redis_reply_iobuf_string) {
+    butil::Arena arena;
+    const std::string value(100 * 1024, 'v');
+    butil::IOBuf value_buf;
+    value_buf.append(value);
+    {
+        brpc::RedisReply r(&arena);
+        r.SetString(value_buf);
+        ASSERT_TRUE(r.is_string());
+        ASSERT_EQ(value.size(), r.size());
+        butil::IOBufAppender appender;
+        ASSERT_TRUE(r.SerializeTo(&appender));
+        butil::IOBuf buf;
+        appender.move_to(buf);
+        ASSERT_EQ("$102400\r\n" + value + "\r\n", buf.to_string());
+        // Serialized by reference.
+        ASSERT_EQ(value_buf.backing_block(0).data(), buf.backing_block(1).data());
+        ASSERT_EQ(value, r.data().as_string());
+        ASSERT_STREQ(value.c_str(), r.c_str());
+
+        r.SetString(butil::IOBuf());
+        ASSERT_TRUE(r.is_string());
+        ASSERT_EQ(0u, r.size());
+        ASSERT_STREQ("", r.c_str());
+    }
+    {
+        brpc::RedisReply r(&arena);
+        char* data = new char[64];
+        memset(data, 'u', 64);
+        r.SetUserString(data, 64, DeleteCharArray);
+        butil::IOBufAppender appender;
+        ASSERT_TRUE(r.SerializeTo(&appender));
+        butil::IOBuf buf;
+        appender.move_to(buf);
+        ASSERT_EQ("$64\r\n" + std::string(64, 'u') + "\r\n", buf.to_string());
+    }
+    brpc::FLAGS_redis_reply_iobuf_min_size = 1024;
+    {
+        butil::IOBuf buf;
+        buf.append("$102400\r\n");
+        buf.append(value_buf);
+        buf.append("\r\n$4\r\nabcd\r\n");
+        brpc::RedisReply r(&arena);
+        ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+        brpc::RedisReply r2(&arena);
+        ASSERT_EQ(brpc::PARSE_OK, r2.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(buf.empty());
+        ASSERT_STREQ("abcd", r2.c_str());
+
+        // The parsed string references the input.
+        butil::IOBuf out;
+        r.AppendDataTo(&out);
+        ASSERT_EQ(value.size(), out.size());
+        ASSERT_EQ(value_buf.backing_block(0).data(), out.backing_block(0).data());
+
+        butil::Arena arena2;
+        brpc::RedisReply r3(&arena2);
+        r3.CopyFromDifferentArena(r);
+        ASSERT_EQ(value, r3.data().as_string());
+        ASSERT_EQ(value, r.data().as_string());
+    }
+    brpc::FLAGS_redis_reply_iobuf_min_size = 0;
+}
+
 TEST_F(RedisTest, redis_reply_codec) {
     butil::Arena arena;
     // status
@@ -1238,4 +1308,79 @@ TEST_F(RedisTest, server_handle_pipeline) {
     ASSERT_STREQ(response.reply(7).c_str(), "world");
 }
 
+// "sleep <ms> <text>": replies <text> after <ms> milliseconds in another bthread.
+class SleepCommandHandler : public brpc::RedisAsyncCommandHandler {
+public:
+    struct Call {
+        int64_t sleep_ms;
+        brpc::RedisReply* output;
+        std::string text;
+        google::protobuf::Closure* done;
+    };
+
+    static void* RunCall(void* arg) {
+        Call* call = static_cast<Call*>(arg);
+        bthread_usleep(call->sleep_ms * 1000L);
+        call->output->SetString(call->text);
+        call->done->Run();
+        delete call;
+        return NULL;
+    }
+
+    void RunAsync(const std::vector<butil::StringPiece>& args,
+                  brpc::RedisReply* output,
+                  google::protobuf::Closure* done) {
+        if (args.size() < 3) {
+            output->SetError("ERR wrong number of arguments for 'sleep' command");
+            done->Run();
+            return;
+        }
+        Call* call = new Call;
+        call->sleep_ms = strtoll(args[1].as_string().c_str(), NULL, 10);
+        call->output = output;
+        call->text = args[2].as_string();
+        call->done = done;
+        bthread_t th;
+        ASSERT_EQ(0, bthread_start_background(&th, NULL, RunCall, call));
+    }
+};
+
+TEST_F(RedisTest, server_async_handler_keeps_order) {
+    brpc::Server server;
+    brpc::ServerOptions server_options;
+    RedisServiceImpl* rsimpl = new RedisServiceImpl;
+    rsimpl->AddCommandHandler("get", new GetCommandHandler(rsimpl));
+    rsimpl->AddCommandHandler("set", new SetCommandHandler(rsimpl));
+    rsimpl->AddCommandHandler("sleep", new SleepCommandHandler);
+    server_options.redis_service = rsimpl;
+    brpc::PortRange pr(8081, 8900);
+    ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_REDIS;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", server.listen_address().port, &options));
+
+    brpc::RedisRequest request;
+    brpc::RedisResponse response;
+    brpc::Controller cntl;
+    ASSERT_TRUE(request.AddCommand("set async_key v1"));
+    ASSERT_TRUE(request.AddCommand("sleep 200 first"));
+    ASSERT_TRUE(request.AddCommand("get async_key"));
+    ASSERT_TRUE(request.AddCommand("sleep 100 second"));
+    ASSERT_TRUE(request.AddCommand("sleep 0 third"));
+    ASSERT_TRUE(request.AddCommand("set async_key v2"));
+    ASSERT_TRUE(request.AddCommand("get async_key"));
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(7, response.reply_size());
+    ASSERT_STREQ("OK", response.reply(0).c_str());
+    ASSERT_STREQ("first", response.reply(1).c_str());
+    ASSERT_STREQ("v1", response.reply(2).c_str());
+    ASSERT_STREQ("second", response.reply(3).c_str());
+    ASSERT_STREQ("third", response.reply(4).c_str());
+    ASSERT_STREQ("OK", response.reply(5).c_str());
+    ASSERT_STREQ("v2", response.reply(6).c_str());
+}
+
 } //namespace
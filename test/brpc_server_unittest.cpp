@@ -28,7 +28,11 @@
 #include "butil/macros.h"
 #include "butil/fd_guard.h"
 #include "butil/files/scoped_file.h"
+#include "butil/string_printf.h"
+#include "bvar/variable.h"
 #include "brpc/socket.h"
+#include "brpc/acceptor.h"
+#include "brpc/event_dispatcher.h"
 #include "brpc/builtin/version_service.h"
 #include "brpc/builtin/health_service.h"
 #include "brpc/builtin/list_service.h"
@@ -64,6 +68,9 @@ int main(int argc, char* argv[]) {
 namespace brpc {
 DECLARE_bool(enable_threads_service);
 DECLARE_bool(enable_dir_service);
+DECLARE_int32(socket_busy_poll_us);
+DECLARE_bool(read_size_by_fionread);
+DECLARE_int32(input_message_batch_size);
 }
 
 namespace {
@@ -1171,6 +1178,306 @@ TEST_F(ServerTest, serving_requests) {
     ASSERT_EQ(0, server.Join());
 }
 
+TEST_F(ServerTest, sort_protocols_by_frequency) {
+    EchoServiceImpl echo_svc;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&echo_svc,
+                                   brpc::SERVER_DOESNT_OWN_SERVICE));
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8613", &ep));
+    ASSERT_EQ(0, server.Start(ep, NULL));
+
+    // Every call creates a new connection whose protocol is detected.
+    brpc::ChannelOptions copt;
+    copt.protocol = "hulu_pbrpc";
+    copt.connection_type = "short";
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init(ep, &copt));
+    test::EchoService_Stub stub(&chan);
+    // Enough to re-sort the protocols twice. Run tools/rpc_io_benchmark
+    // with -tests=short to measure the rate of short connections.
+    const int N = 300;
+    for (int i = 0; i < N; ++i) {
+        test::BytesRequest req;
+        test::BytesResponse res;
+        brpc::Controller cntl;
+        req.set_databytes(EXP_REQUEST);
+        stub.BytesEcho1(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    }
+
+    // hulu_pbrpc is tried first now rather than after baidu_std.
+    const int hulu = server._am->FindProtocolIndex(brpc::PROTOCOL_HULU_PBRPC);
+    ASSERT_GE(hulu, 0);
+    // Connections whose first read is incomplete are not counted.
+    ASSERT_LE(server._am->SelectedCountOfProtocol(hulu), N);
+    ASSERT_GT(server._am->SelectedCountOfProtocol(hulu), N / 2);
+    ASSERT_EQ(hulu, server._am->_trial_order[0].load());
+    // Operators see the counts in /vars.
+    const std::string selected = bvar::Variable::describe_exposed(
+        "rpc_server_8613_protocol_selected_count");
+    ASSERT_EQ(0u, selected.find("hulu_pbrpc:")) << selected;
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+struct ShortConnectionArgs {
+    butil::EndPoint ep;
+    int ncall;
+};
+
+static void* CallWithShortConnections(void* void_args) {
+    ShortConnectionArgs* args = (ShortConnectionArgs*)void_args;
+    brpc::ChannelOptions copt;
+    copt.connection_type = "short";
+    brpc::Channel chan;
+    EXPECT_EQ(0, chan.Init(args->ep, &copt));
+    test::EchoService_Stub stub(&chan);
+    for (int i = 0; i < args->ncall; ++i) {
+        test::EchoRequest req;
+        test::EchoResponse res;
+        brpc::Controller cntl;
+        req.set_message(EXP_REQUEST);
+        stub.Echo(&cntl, &req, &res, NULL);
+        EXPECT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    }
+    return NULL;
+}
+
+TEST_F(ServerTest, listen_per_dispatcher) {
+    // Run with --event_dispatcher_num=N(>1) to listen with N sockets.
+    const int ndispatcher = brpc::GetGlobalEventDispatcherCount();
+    for (int per_dispatcher = 0; per_dispatcher < 2; ++per_dispatcher) {
+        EchoServiceImpl echo_svc;
+        brpc::Server server;
+        ASSERT_EQ(0, server.AddService(&echo_svc,
+                                       brpc::SERVER_DOESNT_OWN_SERVICE));
+        brpc::ServerOptions opt;
+        opt.listen_per_dispatcher = per_dispatcher;
+        ASSERT_EQ(0, server.Start("127.0.0.1", brpc::PortRange(8613, 8713),
+                                  &opt));
+        ASSERT_EQ(per_dispatcher ? (size_t)ndispatcher : 1UL,
+                  server._am->listener_count());
+
+        // Connections accepted by any of the listeners are served. Run
+        // tools/rpc_io_benchmark with -tests=short -listen_per_dispatcher
+        // to measure the rate of short connections.
+        ShortConnectionArgs args = { server.listen_address(), 20 };
+        const int NTHREAD = 8;
+        pthread_t th[NTHREAD];
+        for (int i = 0; i < NTHREAD; ++i) {
+            ASSERT_EQ(0, pthread_create(&th[i], NULL,
+                                        CallWithShortConnections, &args));
+        }
+        for (int i = 0; i < NTHREAD; ++i) {
+            pthread_join(th[i], NULL);
+        }
+        ASSERT_EQ(NTHREAD * args.ncall, echo_svc.count.load());
+        ASSERT_EQ(0, server.Stop(0));
+        ASSERT_EQ(0, server.Join());
+        ASSERT_EQ(-1, server._am->listened_fd());
+    }
+}
+
+TEST_F(ServerTest, unix_socket) {
+    const char* const UNIX_ADDR = "unix:/tmp/brpc_server_unittest.sock";
+    EchoServiceImpl echo_svc;
+    brpc::Server unix_server;
+    ASSERT_EQ(0, unix_server.AddService(&echo_svc,
+                                        brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, unix_server.Start(UNIX_ADDR, NULL));
+    ASSERT_TRUE(butil::is_unix_endpoint(unix_server.listen_address()));
+    ASSERT_EQ(UNIX_ADDR, std::string(
+        butil::endpoint2str(unix_server.listen_address()).c_str()));
+    brpc::Server tcp_server;
+    ASSERT_EQ(0, tcp_server.AddService(&echo_svc,
+                                       brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, tcp_server.Start("127.0.0.1", brpc::PortRange(8613, 8713),
+                                  NULL));
+
+    for (int use_unix = 0; use_unix < 2; ++use_unix) {
+        brpc::Channel chan;
+        if (use_unix) {
+            ASSERT_EQ(0, chan.Init(UNIX_ADDR, NULL));
+        } else {
+            ASSERT_EQ(0, chan.Init(tcp_server.listen_address(), NULL));
+        }
+        test::EchoService_Stub stub(&chan);
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res.message());
+        ASSERT_EQ(use_unix, butil::is_unix_endpoint(cntl.remote_side()));
+    }
+
+    // The file is removed after stopping.
+    ASSERT_EQ(0, unix_server.Stop(0));
+    ASSERT_EQ(0, unix_server.Join());
+    ASSERT_NE(0, access(UNIX_ADDR + 5, F_OK));
+    ASSERT_EQ(0, tcp_server.Stop(0));
+    ASSERT_EQ(0, tcp_server.Join());
+}
+
+int64_t ExposedCount(const char* name) {
+    // Empty when the variable is not created yet.
+    const std::string value = bvar::Variable::describe_exposed(name);
+    return strtoll(value.c_str(), NULL, 10);
+}
+
+// Write `nreq' http requests to Echo at once into `fd', with `padding'
+// spaces in each body, and read all responses. Unlike channels, the fd is
+// not read by InputMessenger, thus only the server moves the counters of
+// reading.
+void HttpEchoByFd(int fd, int nreq, size_t padding) {
+    const std::string body =
+        "{\"message\":\"" + EXP_REQUEST + "\"" + std::string(padding, ' ') + "}";
+    std::string reqs;
+    for (int i = 0; i < nreq; ++i) {
+        butil::string_appendf(&reqs, "POST /EchoService/Echo HTTP/1.1\r\n"
+                              "Content-Type: application/json\r\n"
+                              "Content-Length: %d\r\n\r\n", (int)body.size());
+        reqs.append(body);
+    }
+    for (size_t nw = 0; nw < reqs.size(); ) {
+        const ssize_t n = write(fd, reqs.data() + nw, reqs.size() - nw);
+        ASSERT_GT(n, 0) << berror();
+        nw += n;
+    }
+    const std::string exp_res = "\"" + EXP_RESPONSE + "\"";
+    std::string res;
+    int nres = 0;
+    while (nres < nreq) {
+        char buf[4096];
+        const ssize_t n = read(fd, buf, sizeof(buf));
+        ASSERT_GT(n, 0) << berror();
+        res.append(buf, n);
+        for (size_t pos = res.find(exp_res); pos != std::string::npos;
+             pos = res.find(exp_res)) {
+            ++nres;
+            res.erase(0, pos + exp_res.size());
+        }
+    }
+}
+
+TEST_F(ServerTest, busy_poll_and_fionread) {
+    // Restore the flags even if an assertion fails. Run
+    // tools/rpc_io_benchmark -tests=latency with these flags to compare
+    // the latencies.
+    GFLAGS_NS::FlagSaver saver;
+    EchoServiceImpl echo_svc;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start("127.0.0.1", brpc::PortRange(8613, 8713), NULL));
+
+    struct Mode {
+        int busy_poll_us;
+        bool fionread;
+    } modes[] = { { 0, false }, { 0, true }, { 100000, false }, { 100000, true } };
+    for (size_t m = 0; m < ARRAY_SIZE(modes); ++m) {
+        brpc::FLAGS_socket_busy_poll_us = modes[m].busy_poll_us;
+        brpc::FLAGS_read_size_by_fionread = modes[m].fionread;
+        const int64_t nbusy_poll = ExposedCount("rpc_socket_busy_poll_count");
+        const int64_t nfionread = ExposedCount("rpc_socket_fionread_count");
+        butil::fd_guard fd(butil::tcp_connect(server.listen_address(), NULL));
+        ASSERT_GE(fd, 0);
+        // Sequential requests of different sizes, which are read in one or
+        // more rounds. The server finds the next request by polling if
+        // busy-polling is on, since it comes much sooner than 100ms.
+        for (int i = 0; i < 20; ++i) {
+            HttpEchoByFd(fd, 1, i * 4096);
+        }
+        if (modes[m].busy_poll_us) {
+            ASSERT_LT(nbusy_poll, ExposedCount("rpc_socket_busy_poll_count"));
+        } else {
+            ASSERT_EQ(nbusy_poll, ExposedCount("rpc_socket_busy_poll_count"));
+        }
+        if (modes[m].fionread) {
+            ASSERT_LT(nfionread, ExposedCount("rpc_socket_fionread_count"));
+        } else {
+            ASSERT_EQ(nfionread, ExposedCount("rpc_socket_fionread_count"));
+        }
+    }
+    ASSERT_EQ(20 * (int64_t)ARRAY_SIZE(modes), echo_svc.count.load());
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+struct PipelineArg {
+    brpc::Channel* chan;
+    int n;
+    int nfailed;
+};
+
+static void* SendPipelinedRequests(void* void_arg) {
+    PipelineArg* arg = static_cast<PipelineArg*>(void_arg);
+    test::EchoService_Stub stub(arg->chan);
+    for (int i = 0; i < arg->n; ++i) {
+        brpc::Controller cntl;
+        test::BytesRequest req;
+        test::BytesResponse res;
+        req.set_databytes(EXP_REQUEST);
+        stub.BytesEcho1(&cntl, &req, &res, NULL);
+        if (cntl.Failed()) {
+            ++arg->nfailed;
+        }
+    }
+    return NULL;
+}
+
+TEST_F(ServerTest, input_message_batch) {
+    // Restore the flag even if an assertion fails. Run
+    // tools/rpc_io_benchmark -tests=pipeline with -input_message_batch_size
+    // to measure the throughput.
+    GFLAGS_NS::FlagSaver saver;
+    EchoServiceImpl echo_svc;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start("127.0.0.1", brpc::PortRange(8613, 8713), NULL));
+
+    const int batch_sizes[] = { 1, 4, 16 };
+    for (size_t b = 0; b < ARRAY_SIZE(batch_sizes); ++b) {
+        brpc::FLAGS_input_message_batch_size = batch_sizes[b];
+        // All requests are pipelined in one connection.
+        brpc::ChannelOptions options;
+        options.connection_type = brpc::CONNECTION_TYPE_SINGLE;
+        options.connection_group =
+            butil::string_printf("pipeline_%d", batch_sizes[b]);
+        brpc::Channel chan;
+        ASSERT_EQ(0, chan.Init(server.listen_address(), &options));
+        const int NTHREAD = 16;
+        PipelineArg args[NTHREAD];
+        bthread_t th[NTHREAD];
+        for (int i = 0; i < NTHREAD; ++i) {
+            args[i].chan = &chan;
+            args[i].n = 50;
+            args[i].nfailed = 0;
+            ASSERT_EQ(0, bthread_start_background(
+                          &th[i], NULL, SendPipelinedRequests, &args[i]));
+        }
+        for (int i = 0; i < NTHREAD; ++i) {
+            bthread_join(th[i], NULL);
+            ASSERT_EQ(0, args[i].nfailed);
+        }
+
+        // Requests written at once are read in one round, the ones before
+        // the last are processed in batches if batching is on.
+        const int64_t nbatch = ExposedCount("rpc_input_message_batch_count");
+        butil::fd_guard fd(butil::tcp_connect(server.listen_address(), NULL));
+        ASSERT_GE(fd, 0);
+        HttpEchoByFd(fd, 8, 0);
+        if (batch_sizes[b] > 1) {
+            ASSERT_LT(nbatch, ExposedCount("rpc_input_message_batch_count"));
+        } else {
+            ASSERT_EQ(nbatch, ExposedCount("rpc_input_message_batch_count"));
+        }
+    }
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
 TEST_F(ServerTest, create_pid_file) {
     {
         brpc::Server server;
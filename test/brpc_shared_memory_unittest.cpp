@@ -0,0 +1,252 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <fcntl.h>                              // O_CREAT
+#include <sys/mman.h>                           // shm_open
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/fd_guard.h"
+#include "butil/string_printf.h"
+#include "butil/time.h"
+#include "butil/logging.h"
+#include "brpc/channel.h"
+#include "brpc/server.h"
+#include "brpc/controller.h"
+#include "brpc/acceptor.h"
+#include "brpc/shared_memory_transport.h"
+#include "echo.pb.h"
+
+namespace brpc {
+DECLARE_int32(idle_timeout_second);
+DECLARE_int32(shared_memory_ring_size);
+}
+
+int main(int argc, char* argv[]) {
+    brpc::FLAGS_idle_timeout_second = 0;
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+class EchoServiceImpl : public ::test::EchoService {
+public:
+    void Echo(google::protobuf::RpcController* cntl_base,
+              const ::test::EchoRequest* req,
+              ::test::EchoResponse* res,
+              google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        res->set_message(req->message());
+        cntl->response_attachment().swap(cntl->request_attachment());
+    }
+};
+
+class SharedMemoryTest : public ::testing::Test {
+protected:
+    void StartServer(bool use_shared_memory) {
+        ASSERT_EQ(0, _server.AddService(&_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+        brpc::ServerOptions options;
+        options.use_shared_memory = use_shared_memory;
+        ASSERT_EQ(0, _server.Start("127.0.0.1", brpc::PortRange(8100, 8900),
+                                   &options));
+    }
+
+    void TearDown() {
+        _server.Stop(0);
+        _server.Join();
+    }
+
+    void InitChannel(brpc::Channel* channel, bool use_shared_memory) {
+        brpc::ChannelOptions options;
+        options.use_shared_memory = use_shared_memory;
+        options.timeout_ms = 5000;
+        ASSERT_EQ(0, channel->Init(_server.listen_address(), &options));
+    }
+
+    void Echo(brpc::Channel* channel, const butil::IOBuf& attachment) {
+        ::test::EchoService_Stub stub(channel);
+        ::test::EchoRequest req;
+        ::test::EchoResponse res;
+        brpc::Controller cntl;
+        req.set_message("hello");
+        cntl.request_attachment() = attachment;
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ("hello", res.message());
+        ASSERT_TRUE(attachment.equals(cntl.response_attachment().to_string()));
+    }
+
+    static bool UsingSharedMemory(const brpc::Channel& channel) {
+        brpc::SocketUniquePtr s;
+        if (brpc::Socket::Address(channel._server_id, &s) != 0) {
+            return false;
+        }
+        brpc::SharedMemoryConnection* conn =
+            dynamic_cast<brpc::SharedMemoryConnection*>(s->_conn);
+        return conn != NULL && conn->enabled();
+    }
+
+    // Send a handshake as SharedMemoryConnect does, returns error_code of
+    // the reply.
+    int Handshake(const std::string& name, uint32_t ring_size) {
+        butil::fd_guard fd(butil::tcp_connect(_server.listen_address(), NULL));
+        EXPECT_GE(fd, 0);
+        char hello[64] = "BRPC_SHM";
+        memcpy(hello + 8, &ring_size, sizeof(ring_size));
+        snprintf(hello + 16, 48, "%s", name.c_str());
+        EXPECT_EQ((ssize_t)sizeof(hello), write(fd, hello, sizeof(hello)));
+        char ack[16];
+        size_t nack = 0;
+        while (nack < sizeof(ack)) {
+            const ssize_t nr = read(fd, ack + nack, sizeof(ack) - nack);
+            if (nr <= 0) {
+                ADD_FAILURE() << "Fail to read the reply: " << berror();
+                return -1;
+            }
+            nack += nr;
+        }
+        EXPECT_EQ(0, memcmp(ack, "BRPC_SHM", 8));
+        int32_t error_code = 0;
+        memcpy(&error_code, ack + 8, sizeof(error_code));
+        return error_code;
+    }
+
+    EchoServiceImpl _svc;
+    brpc::Server _server;
+};
+
+TEST_F(SharedMemoryTest, echo) {
+    StartServer(true);
+    brpc::Channel channel;
+    InitChannel(&channel, true);
+    butil::IOBuf attachment;
+    for (int i = 0; i < 10; ++i) {
+        Echo(&channel, attachment);
+        attachment.append("attachment");
+    }
+    ASSERT_TRUE(UsingSharedMemory(channel));
+
+    // Messages larger than the rings are written in multiple rounds.
+    std::string large(brpc::FLAGS_shared_memory_ring_size * 3 + 17, 'x');
+    for (size_t i = 0; i < large.size(); i += 4096) {
+        large[i] = 'a' + i % 26;
+    }
+    attachment.clear();
+    attachment.append(large);
+    Echo(&channel, attachment);
+
+    // Plain clients are served as before.
+    brpc::Channel tcp_channel;
+    InitChannel(&tcp_channel, false);
+    Echo(&tcp_channel, attachment);
+    ASSERT_FALSE(UsingSharedMemory(tcp_channel));
+}
+
+TEST_F(SharedMemoryTest, fallback_to_tcp) {
+    StartServer(false);
+    brpc::Channel channel;
+    InitChannel(&channel, true);
+    butil::IOBuf attachment;
+    attachment.append("attachment");
+    Echo(&channel, attachment);
+    ASSERT_FALSE(UsingSharedMemory(channel));
+    ASSERT_EQ(ENOTSUP, Handshake("/brpc_shm_ut", 4096));
+
+    // Accepted sockets are plain ones, which keep optimizations of reading
+    // and writing fds directly.
+    std::vector<brpc::SocketId> conns;
+    _server._am->ListConnections(&conns);
+    ASSERT_FALSE(conns.empty());
+    for (size_t i = 0; i < conns.size(); ++i) {
+        brpc::SocketUniquePtr s;
+        if (brpc::Socket::Address(conns[i], &s) == 0) {
+            ASSERT_TRUE(s->_conn == NULL);
+        }
+    }
+}
+
+TEST_F(SharedMemoryTest, reject_invalid_segments) {
+    StartServer(true);
+    const uint32_t ring_size = 4096;
+    // Not created by brpc.
+    const std::string other_name =
+        butil::string_printf("/brpc_ut_shm_%d", (int)getpid());
+    const std::string name =
+        butil::string_printf("/brpc_shm_ut_%d", (int)getpid());
+    for (int i = 0; i < 2; ++i) {
+        const std::string& n = (i == 0 ? other_name : name);
+        butil::fd_guard fd(shm_open(n.c_str(), O_CREAT | O_RDWR, 0600));
+        ASSERT_GE(fd, 0) << berror();
+        // Enough for the rings if the size were not checked exactly.
+        ASSERT_EQ(0, ftruncate(fd, 4 * ring_size));
+    }
+    ASSERT_EQ(EINVAL, Handshake(other_name, ring_size));
+    ASSERT_EQ(EINVAL, Handshake("/brpc_shm_ut/../" + other_name.substr(1),
+                                ring_size));
+    // The size does not match ring_size.
+    ASSERT_EQ(EINVAL, Handshake(name, ring_size));
+    ASSERT_EQ(EINVAL, Handshake(name, ring_size * 2));
+    ASSERT_EQ(EINVAL, Handshake(name, ring_size + 1));
+    ASSERT_EQ(ENOENT, Handshake(name + "_nonexist", ring_size));
+    shm_unlink(other_name.c_str());
+    shm_unlink(name.c_str());
+
+    // Clients work as usual.
+    brpc::Channel channel;
+    InitChannel(&channel, true);
+    Echo(&channel, butil::IOBuf());
+    ASSERT_TRUE(UsingSharedMemory(channel));
+}
+
+TEST_F(SharedMemoryTest, performance) {
+    StartServer(true);
+    const size_t sizes[] = { 16, 4096, 1024 * 1024 };
+    for (size_t i = 0; i < ARRAY_SIZE(sizes); ++i) {
+        const int N = (sizes[i] >= 1024 * 1024 ? 200 : 10000);
+        butil::IOBuf attachment;
+        attachment.append(std::string(sizes[i], 'a'));
+        for (int shm = 0; shm < 2; ++shm) {
+            brpc::Channel channel;
+            InitChannel(&channel, shm);
+            ::test::EchoService_Stub stub(&channel);
+            ::test::EchoRequest req;
+            req.set_message("hello");
+            butil::Timer tm;
+            for (int j = -10; j < N; ++j) {
+                if (j == 0) {
+                    tm.start();
+                }
+                ::test::EchoResponse res;
+                brpc::Controller cntl;
+                cntl.request_attachment() = attachment;
+                stub.Echo(&cntl, &req, &res, NULL);
+                ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+            }
+            tm.stop();
+            ASSERT_EQ((bool)shm, UsingSharedMemory(channel));
+            LOG(INFO) << (shm ? "shared_memory" : "tcp") << " size="
+                      << sizes[i] << " latency=" << tm.u_elapsed() / N
+                      << "us throughput="
+                      << sizes[i] * 2 * N / std::max(tm.u_elapsed(), (int64_t)1)
+                      << "MB/s";
+        }
+    }
+}
+
+} // namespace
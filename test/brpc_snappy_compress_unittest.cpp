@@ -28,18 +28,26 @@
 #include "snappy_message.pb.h"
 #include "brpc/policy/snappy_compress.h"
 #include "brpc/policy/gzip_compress.h"
+#ifdef BRPC_WITH_LZ4
+#include "brpc/policy/lz4_compress.h"
+#endif
+#ifdef BRPC_WITH_ZSTD
+#include <zdict.h>
+#include "brpc/policy/zstd_compress.h"
+#endif
 
 typedef bool (*Compress)(const google::protobuf::Message&, butil::IOBuf*);
 typedef bool (*Decompress)(const butil::IOBuf&, google::protobuf::Message*);
 
+template <typename Message>
 inline void CompressMessage(const char* method_name,
-                            int num, snappy_message::SnappyMessageProto& msg, 
+                            int num, Message& msg, 
                             int len, Compress compress, Decompress decompress) {
     butil::Timer timer;
     size_t compression_length = 0;
     int64_t total_compress_time = 0;
     int64_t total_decompress_time = 0;
-    snappy_message::SnappyMessageProto new_msg;
+    Message new_msg;
     for (int index = 0; index < num; index++) {
         butil::IOBuf buf;
         timer.start();
@@ -194,6 +202,16 @@ TEST_F(test_compress_method, throughput_compare) {
         CompressMessage("Zlib", k, old_msg, len, 
                          brpc::policy::ZlibCompress, 
                          brpc::policy::ZlibDecompress);
+#ifdef BRPC_WITH_LZ4
+        CompressMessage("LZ4", k, old_msg, len,
+                         brpc::policy::LZ4Compress,
+                         brpc::policy::LZ4Decompress);
+#endif
+#ifdef BRPC_WITH_ZSTD
+        CompressMessage("Zstd", k, old_msg, len,
+                         brpc::policy::ZstdCompress,
+                         brpc::policy::ZstdDecompress);
+#endif
         printf("\n");
         delete [] text;
     }
@@ -228,6 +246,16 @@ TEST_F(test_compress_method, throughput_compare_complete_random) {
         CompressMessage("Zlib", k, old_msg, len, 
                          brpc::policy::ZlibCompress, 
                          brpc::policy::ZlibDecompress);
+#ifdef BRPC_WITH_LZ4
+        CompressMessage("LZ4", k, old_msg, len,
+                         brpc::policy::LZ4Compress,
+                         brpc::policy::LZ4Decompress);
+#endif
+#ifdef BRPC_WITH_ZSTD
+        CompressMessage("Zstd", k, old_msg, len,
+                         brpc::policy::ZstdCompress,
+                         brpc::policy::ZstdDecompress);
+#endif
         printf("\n");
         delete [] text;
     }
@@ -253,3 +281,213 @@ TEST_F(test_compress_method, mass_snappy_iobuf) {
     ASSERT_TRUE(strcmp(check_str.c_str(), text) == 0);
     delete [] text;
 }
+
+#if defined(BRPC_WITH_LZ4) || defined(BRPC_WITH_ZSTD)
+static std::string MakeMultiBlockText(size_t len) {
+    std::string text;
+    text.reserve(len);
+    while (text.size() < len) {
+        text.append("{\"user_id\":");
+        text.append(std::to_string(text.size() * 7919 % 100003));
+        text.append(",\"region\":\"cn-north\",\"tags\":[\"a\",\"b\"]}");
+    }
+    text.resize(len);
+    return text;
+}
+#endif
+
+// A message looking like the requests of typical online services.
+template <typename Message>
+static void FillRepresentativeMessage(int seq, size_t len, Message* msg) {
+    char buf[64];
+    std::string text;
+    while (text.size() < len) {
+        snprintf(buf, sizeof(buf), "{\"id\":%d,\"name\":\"user_%d\",",
+                 seq, (seq * 31 + (int)text.size()) % 977);
+        text.append(buf);
+        text.append("\"status\":\"active\",\"region\":\"cn-north-1\"}");
+    }
+    text.resize(len);
+    msg->set_text(text);
+    for (int i = 0; i < 8; ++i) {
+        msg->add_numbers(seq * 8 + i);
+    }
+}
+
+#ifdef BRPC_WITH_LZ4
+TEST_F(test_compress_method, lz4) {
+    snappy_message::SnappyMessageProto old_msg;
+    old_msg.set_text("Hello World!");
+    old_msg.add_numbers(2);
+    old_msg.add_numbers(7);
+    butil::IOBuf buf;
+    ASSERT_TRUE(brpc::policy::LZ4Compress(old_msg, &buf));
+    snappy_message::SnappyMessageProto new_msg;
+    ASSERT_TRUE(brpc::policy::LZ4Decompress(buf, &new_msg));
+    ASSERT_EQ("Hello World!", new_msg.text());
+    ASSERT_EQ(2, new_msg.numbers_size());
+
+    // Truncated frames must be rejected.
+    butil::IOBuf truncated;
+    buf.append_to(&truncated, buf.size() - 1);
+    ASSERT_FALSE(brpc::policy::LZ4Decompress(truncated, &new_msg));
+}
+
+TEST_F(test_compress_method, lz4_multiple_blocks) {
+    // Make `in' consist of many small blocks.
+    const std::string text = MakeMultiBlockText(300 * 1024);
+    butil::IOBuf in;
+    for (size_t i = 0; i < text.size(); i += 1000) {
+        in.append(text.data() + i, std::min((size_t)1000, text.size() - i));
+    }
+    butil::IOBuf out;
+    butil::IOBuf check;
+    ASSERT_TRUE(brpc::policy::LZ4Compress(in, &out));
+    ASSERT_LT(out.size(), in.size());
+    ASSERT_TRUE(brpc::policy::LZ4Decompress(out, &check));
+    ASSERT_EQ(text, check.to_string());
+}
+
+TEST_F(test_compress_method, lz4_dictionary) {
+    snappy_message::DictionaryMessageProto sample;
+    FillRepresentativeMessage(0, 256, &sample);
+    ASSERT_EQ(0, brpc::policy::RegisterLZ4Dictionary(
+                  sample.GetDescriptor()->full_name(),
+                  sample.SerializeAsString()));
+    ASSERT_EQ(-1, brpc::policy::RegisterLZ4Dictionary(
+                  sample.GetDescriptor()->full_name(), "other"));
+    snappy_message::DictionaryMessageProto old_msg;
+    FillRepresentativeMessage(1, 256, &old_msg);
+    butil::IOBuf with_dict;
+    ASSERT_TRUE(brpc::policy::LZ4Compress(old_msg, &with_dict));
+    // The IOBuf version never uses dictionaries.
+    butil::IOBuf serialized;
+    serialized.append(old_msg.SerializeAsString());
+    butil::IOBuf without_dict;
+    ASSERT_TRUE(brpc::policy::LZ4Compress(serialized, &without_dict));
+    ASSERT_LT(with_dict.size(), without_dict.size());
+    snappy_message::DictionaryMessageProto new_msg;
+    ASSERT_TRUE(brpc::policy::LZ4Decompress(with_dict, &new_msg));
+    ASSERT_EQ(old_msg.text(), new_msg.text());
+}
+#endif  // BRPC_WITH_LZ4
+
+#ifdef BRPC_WITH_ZSTD
+TEST_F(test_compress_method, zstd) {
+    snappy_message::SnappyMessageProto old_msg;
+    old_msg.set_text("Hello World!");
+    old_msg.add_numbers(2);
+    old_msg.add_numbers(7);
+    butil::IOBuf buf;
+    ASSERT_TRUE(brpc::policy::ZstdCompress(old_msg, &buf));
+    snappy_message::SnappyMessageProto new_msg;
+    ASSERT_TRUE(brpc::policy::ZstdDecompress(buf, &new_msg));
+    ASSERT_EQ("Hello World!", new_msg.text());
+    ASSERT_EQ(2, new_msg.numbers_size());
+
+    butil::IOBuf truncated;
+    buf.append_to(&truncated, buf.size() - 1);
+    ASSERT_FALSE(brpc::policy::ZstdDecompress(truncated, &new_msg));
+}
+
+TEST_F(test_compress_method, zstd_multiple_blocks) {
+    const std::string text = MakeMultiBlockText(300 * 1024);
+    butil::IOBuf in;
+    for (size_t i = 0; i < text.size(); i += 1000) {
+        in.append(text.data() + i, std::min((size_t)1000, text.size() - i));
+    }
+    butil::IOBuf out;
+    butil::IOBuf check;
+    ASSERT_TRUE(brpc::policy::ZstdCompress(in, &out));
+    ASSERT_LT(out.size(), in.size());
+    ASSERT_TRUE(brpc::policy::ZstdDecompress(out, &check));
+    ASSERT_EQ(text, check.to_string());
+}
+
+static std::string TrainZstdDictionary() {
+    std::string samples;
+    std::vector<size_t> sample_sizes;
+    for (int i = 0; i < 2000; ++i) {
+        snappy_message::DictionaryMessageProto msg;
+        FillRepresentativeMessage(i, 200 + i % 300, &msg);
+        const std::string s = msg.SerializeAsString();
+        samples.append(s);
+        sample_sizes.push_back(s.size());
+    }
+    std::string dict(16 * 1024, '\0');
+    const size_t rc = ZDICT_trainFromBuffer(
+        &dict[0], dict.size(), samples.data(), &sample_sizes[0],
+        sample_sizes.size());
+    if (ZDICT_isError(rc)) {
+        return std::string();
+    }
+    dict.resize(rc);
+    return dict;
+}
+
+TEST_F(test_compress_method, zstd_dictionary) {
+    const std::string dict = TrainZstdDictionary();
+    ASSERT_FALSE(dict.empty());
+    const std::string& type_name =
+        snappy_message::DictionaryMessageProto::descriptor()->full_name();
+    ASSERT_EQ(0, brpc::policy::RegisterZstdDictionary(type_name, dict));
+    ASSERT_EQ(-1, brpc::policy::RegisterZstdDictionary(type_name, dict));
+    snappy_message::DictionaryMessageProto old_msg;
+    FillRepresentativeMessage(54321, 256, &old_msg);
+    butil::IOBuf with_dict;
+    ASSERT_TRUE(brpc::policy::ZstdCompress(old_msg, &with_dict));
+    butil::IOBuf serialized;
+    serialized.append(old_msg.SerializeAsString());
+    butil::IOBuf without_dict;
+    ASSERT_TRUE(brpc::policy::ZstdCompress(serialized, &without_dict));
+    ASSERT_LT(with_dict.size(), without_dict.size());
+    snappy_message::DictionaryMessageProto new_msg;
+    ASSERT_TRUE(brpc::policy::ZstdDecompress(with_dict, &new_msg));
+    ASSERT_EQ(old_msg.text(), new_msg.text());
+
+    // Compare with the Zstd rows of throughput_compare_representative_messages
+    // which are measured without dictionary.
+    const int len_subs[] = {128, 512, 2048, 8192};
+    for (size_t num = 0; num < ARRAY_SIZE(len_subs); ++num) {
+        const int len = len_subs[num];
+        snappy_message::DictionaryMessageProto msg;
+        FillRepresentativeMessage(12345, len, &msg);
+        const int k = std::min(32*1024*1024/len, 5000);
+        CompressMessage("Zstd+dict", k, msg, len,
+                         brpc::policy::ZstdCompress,
+                         brpc::policy::ZstdDecompress);
+    }
+}
+#endif  // BRPC_WITH_ZSTD
+
+// Compare ratio and throughput on small messages where per-call overhead
+// matters most. SnappyMessageProto has no dictionary registered.
+TEST_F(test_compress_method, throughput_compare_representative_messages) {
+    int len_subs[] = {128, 512, 2048, 8192};
+    printf("%20s%20s%20s%20s%30s%30s%30s\n", "Compress method", "Compress size(B)", 
+           "Compress time(us)", "Decompress time(us)", "Compress throughput(MB/s)", 
+           "Decompress throughput(MB/s)", "Compress ratio");
+    for (size_t num = 0; num < ARRAY_SIZE(len_subs); ++num) {
+        const int len = len_subs[num];
+        snappy_message::SnappyMessageProto old_msg;
+        FillRepresentativeMessage(12345, len, &old_msg);
+        const int k = std::min(32*1024*1024/len, 5000);
+        CompressMessage("Snappy", k, old_msg, len,
+                         brpc::policy::SnappyCompress,
+                         brpc::policy::SnappyDecompress);
+        CompressMessage("Gzip", k, old_msg, len,
+                         brpc::policy::GzipCompress,
+                         brpc::policy::GzipDecompress);
+#ifdef BRPC_WITH_LZ4
+        CompressMessage("LZ4", k, old_msg, len,
+                         brpc::policy::LZ4Compress,
+                         brpc::policy::LZ4Decompress);
+#endif
+#ifdef BRPC_WITH_ZSTD
+        CompressMessage("Zstd", k, old_msg, len,
+                         brpc::policy::ZstdCompress,
+                         brpc::policy::ZstdDecompress);
+#endif
+        printf("\n");
+    }
+}
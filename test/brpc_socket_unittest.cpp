@@ -28,6 +28,7 @@
 #include "butil/time.h"
 #include "butil/macros.h"
 #include "butil/fd_utility.h"
+#include "butil/string_printf.h"
 #include "bthread/unstable.h"
 #include "bthread/task_control.h"
 #include "brpc/socket.h"
@@ -53,6 +54,10 @@ extern TaskControl* g_task_control;
 
 namespace brpc {
 DECLARE_int32(health_check_interval);
+DECLARE_int64(socket_max_unwritten_bytes);
+DECLARE_int64(socket_unwritten_bytes_low_watermark);
+DECLARE_bool(server_pause_read_when_overcrowded);
+extern SocketVarsCollector* g_vars;
 }
 
 void EchoProcessHuluRequest(brpc::InputMessageBase* msg_base);
@@ -287,6 +292,281 @@ TEST_F(SocketTest, single_threaded_write) {
     close(fds[0]);
 }
 
+TEST_F(SocketTest, coalesced_write) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    brpc::SocketId id = 8888;
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    options.user = new CheckRecycle;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    {
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+        global_sock = s.get();
+        brpc::Socket::WriteOptions wopt;
+        wopt.coalesce_window_us = 100000;
+        const bvar::Stat batch0 = brpc::g_vars->write_batch_size.get_value();
+        std::string expected;
+        for (int i = 0; i < 3; ++i) {
+            butil::IOBuf src;
+            src.append(butil::string_printf("hello world! %d", i));
+            expected.append(src.to_string());
+            ASSERT_EQ(0, s->Write(&src, &wopt));
+        }
+        std::string received;
+        while (received.size() < expected.size()) {
+            char dest[256];
+            const ssize_t nr = read(fds[0], dest, sizeof(dest));
+            ASSERT_GT(nr, 0);
+            received.append(dest, nr);
+        }
+        ASSERT_EQ(expected, received);
+        // All requests are written in one batch after the window.
+        const bvar::Stat batch1 = brpc::g_vars->write_batch_size.get_value();
+        ASSERT_EQ(1, batch1.num - batch0.num);
+        ASSERT_EQ(3, batch1.sum - batch0.sum);
+        ASSERT_EQ(0, s->SetFailed());
+    }
+    ASSERT_EQ((brpc::Socket*)NULL, global_sock);
+    close(fds[0]);
+}
+
+struct DrainArg {
+    int fd;
+    size_t nbytes;
+};
+
+void* DrainSocket(void* void_arg) {
+    DrainArg* arg = static_cast<DrainArg*>(void_arg);
+    char buf[16384];
+    size_t nread = 0;
+    while (nread < arg->nbytes) {
+        const ssize_t nr = read(arg->fd, buf, sizeof(buf));
+        if (nr <= 0) {
+            break;
+        }
+        nread += nr;
+    }
+    return NULL;
+}
+
+struct WritableArg {
+    butil::atomic<int> ncalled;
+    int error_code;
+};
+
+void OnWritable(int error_code, void* void_arg) {
+    WritableArg* arg = static_cast<WritableArg*>(void_arg);
+    arg->error_code = error_code;
+    arg->ncalled.fetch_add(1, butil::memory_order_release);
+}
+
+TEST_F(SocketTest, wait_writable) {
+    GFLAGS_NS::FlagSaver saver;
+    brpc::FLAGS_socket_max_unwritten_bytes = 1024 * 1024;
+    brpc::FLAGS_socket_unwritten_bytes_low_watermark = 64 * 1024;
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    brpc::SocketId id = 8888;
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    options.user = new CheckRecycle;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    {
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+        global_sock = s.get();
+        ASSERT_EQ(0, s->WaitWritable(NULL));
+
+        // The peer does not read, most of the data is left unwritten.
+        const size_t N = 4 * 1024 * 1024;
+        butil::IOBuf src;
+        src.resize(N);
+        ASSERT_EQ(0, s->Write(&src));
+        ASSERT_TRUE(s->is_overcrowded());
+        butil::IOBuf src2;
+        src2.append("hello");
+        ASSERT_EQ(-1, s->Write(&src2));
+        ASSERT_EQ(brpc::EOVERCROWDED, errno);
+
+        timespec abstime = butil::milliseconds_from_now(50);
+        ASSERT_EQ(-1, s->WaitWritable(&abstime));
+        ASSERT_EQ(ETIMEDOUT, errno);
+        WritableArg warg;
+        warg.ncalled = 0;
+        warg.error_code = -1;
+        ASSERT_EQ(0, s->NotifyOnWritable(OnWritable, &warg));
+
+        // Read until unwritten bytes are between the watermarks. The socket
+        // is still overcrowded, otherwise producers would resume as soon as
+        // the peer reads a little.
+        size_t nread = 0;
+        while (s->_unwritten_bytes.load() > 768 * 1024) {
+            char buf[16384];
+            const ssize_t nr = read(fds[0], buf, sizeof(buf));
+            ASSERT_GT(nr, 0);
+            nread += nr;
+        }
+        ASSERT_TRUE(s->is_overcrowded());
+        abstime = butil::milliseconds_from_now(50);
+        ASSERT_EQ(-1, s->WaitWritable(&abstime));
+        ASSERT_EQ(ETIMEDOUT, errno);
+        // Data refilling the socket buffer does not drain that much.
+        ASSERT_LT(brpc::FLAGS_socket_unwritten_bytes_low_watermark,
+                  s->_unwritten_bytes.load());
+        ASSERT_EQ(-1, s->Write(&src2));
+        ASSERT_EQ(brpc::EOVERCROWDED, errno);
+        ASSERT_EQ(0, warg.ncalled.load());
+
+        DrainArg darg = { fds[0], N - nread };
+        pthread_t th;
+        ASSERT_EQ(0, pthread_create(&th, NULL, DrainSocket, &darg));
+        ASSERT_EQ(0, s->WaitWritable(NULL));
+        ASSERT_FALSE(s->is_overcrowded());
+        pthread_join(th, NULL);
+        for (int i = 0; i < 100 && warg.ncalled.load() == 0; ++i) {
+            bthread_usleep(10000);
+        }
+        ASSERT_EQ(1, warg.ncalled.load());
+        ASSERT_EQ(0, warg.error_code);
+
+        // Waiters are woken up by SetFailed.
+        src.resize(N);
+        ASSERT_EQ(0, s->Write(&src));
+        ASSERT_TRUE(s->is_overcrowded());
+        warg.ncalled = 0;
+        warg.error_code = 0;
+        ASSERT_EQ(0, s->NotifyOnWritable(OnWritable, &warg));
+        ASSERT_EQ(0, s->SetFailed());
+        ASSERT_EQ(-1, s->WaitWritable(NULL));
+        ASSERT_EQ(brpc::EFAILEDSOCKET, errno);
+        for (int i = 0; i < 100 && warg.ncalled.load() == 0; ++i) {
+            bthread_usleep(10000);
+        }
+        ASSERT_EQ(1, warg.ncalled.load());
+        ASSERT_EQ(brpc::EFAILEDSOCKET, warg.error_code);
+    }
+    ASSERT_EQ((brpc::Socket*)NULL, global_sock);
+    close(fds[0]);
+}
+
+butil::atomic<int> g_nechoed(0);
+
+// Echo like EchoProcessHuluRequest, but responses are never rejected, so
+// that they pile up when the client does not read.
+void EchoIgnoringOvercrowded(brpc::InputMessageBase* msg_base) {
+    brpc::DestroyingPtr<brpc::policy::MostCommonMessage> msg(
+        static_cast<brpc::policy::MostCommonMessage*>(msg_base));
+    butil::IOBuf buf;
+    buf.append(msg->meta);
+    buf.append(msg->payload);
+    brpc::Socket::WriteOptions wopt;
+    wopt.ignore_eovercrowded = true;
+    ASSERT_EQ(0, msg->socket()->Write(&buf, &wopt));
+    g_nechoed.fetch_add(1, butil::memory_order_relaxed);
+}
+
+struct HuluWriterArg {
+    int fd;
+    std::string data;
+};
+
+void* WriteHuluRequests(void* void_arg) {
+    HuluWriterArg* arg = static_cast<HuluWriterArg*>(void_arg);
+    for (size_t nw = 0; nw < arg->data.size(); ) {
+        const ssize_t n = write(arg->fd, arg->data.data() + nw,
+                                arg->data.size() - nw);
+        if (n <= 0) {
+            break;
+        }
+        nw += n;
+    }
+    return NULL;
+}
+
+TEST_F(SocketTest, server_pause_read_when_overcrowded) {
+    GFLAGS_NS::FlagSaver saver;
+    brpc::FLAGS_server_pause_read_when_overcrowded = true;
+    brpc::FLAGS_socket_max_unwritten_bytes = 256 * 1024;
+    brpc::FLAGS_socket_unwritten_bytes_low_watermark = 64 * 1024;
+    g_nechoed = 0;
+    // FIXME(gejun): Messenger has to be new otherwise quitting may crash.
+    brpc::Acceptor* messenger = new brpc::Acceptor;
+    const brpc::InputMessageHandler pairs[] = {
+        { brpc::policy::ParseHuluMessage,
+          EchoIgnoringOvercrowded, NULL, NULL, "dummy_hulu" }
+    };
+    // Buffers of unix domain sockets are small and not auto-tuned.
+    const std::string path = butil::string_printf(
+        "/tmp/brpc_socket_unittest_%d.sock", (int)getpid());
+    butil::EndPoint point;
+    ASSERT_EQ(0, butil::str2endpoint(("unix:" + path).c_str(), &point));
+    int listening_fd = tcp_listen(point);
+    ASSERT_TRUE(listening_fd > 0);
+    butil::make_non_blocking(listening_fd);
+    ASSERT_EQ(0, messenger->AddHandler(pairs[0]));
+    ASSERT_EQ(0, messenger->StartAccept(listening_fd, -1, NULL));
+
+    const int N = 256;
+    const std::string payload(16 * 1024, 'x');
+    HuluWriterArg warg;
+    for (int i = 0; i < N; ++i) {
+        const char meta[4] = { 'M', 'e', 't', 'a' };
+        // HULU uses host byte order directly...
+        const uint32_t sizes[2] = { (uint32_t)(sizeof(meta) + payload.size()),
+                                    (uint32_t)sizeof(meta) };
+        warg.data.append("HULU", 4);
+        warg.data.append((const char*)sizes, sizeof(sizes));
+        warg.data.append(meta, sizeof(meta));
+        warg.data.append(payload);
+    }
+    const size_t response_size = N * (4 + payload.size());
+    warg.fd = butil::tcp_connect(point, NULL);
+    ASSERT_LE(0, warg.fd);
+    pthread_t th;
+    ASSERT_EQ(0, pthread_create(&th, NULL, WriteHuluRequests, &warg));
+
+    // The client does not read, responses pile up on the server side.
+    brpc::SocketUniquePtr s;
+    for (int i = 0; i < 500 && s.get() == NULL; ++i) {
+        std::vector<brpc::SocketId> conns;
+        messenger->ListConnections(&conns);
+        if (conns.empty() || brpc::Socket::Address(conns[0], &s) != 0) {
+            bthread_usleep(10000);
+        }
+    }
+    ASSERT_TRUE(s.get() != NULL);
+    for (int i = 0; i < 500 && !s->is_overcrowded(); ++i) {
+        bthread_usleep(10000);
+    }
+    ASSERT_TRUE(s->is_overcrowded());
+    // Requests are not read any more.
+    bthread_usleep(100000);
+    const int nechoed = g_nechoed.load();
+    ASSERT_LT(nechoed, N);
+    bthread_usleep(100000);
+    ASSERT_EQ(nechoed, g_nechoed.load());
+    ASSERT_TRUE(s->is_overcrowded());
+
+    // Reading resumes after the client reads responses.
+    size_t nread = 0;
+    while (nread < response_size) {
+        char buf[16384];
+        const ssize_t nr = read(warg.fd, buf, sizeof(buf));
+        ASSERT_GT(nr, 0);
+        nread += nr;
+    }
+    pthread_join(th, NULL);
+    ASSERT_EQ(N, g_nechoed.load());
+    ASSERT_EQ(response_size, nread);
+
+    close(warg.fd);
+    s.reset();
+    messenger->StopAccept(0);
+    unlink(path.c_str());
+}
+
 void EchoProcessHuluRequest(brpc::InputMessageBase* msg_base) {
     brpc::DestroyingPtr<brpc::policy::MostCommonMessage> msg(
         static_cast<brpc::policy::MostCommonMessage*>(msg_base));
@@ -32,9 +32,14 @@
 #include "brpc/channel.h"
 #include "brpc/socket_map.h"
 #include "brpc/controller.h"
+#include "brpc/acceptor.h"
+#include "brpc/details/ssl_helper.h"
 #include "echo.pb.h"
 
 namespace brpc {
+DECLARE_bool(ssl_ktls);
+DECLARE_int32(ssl_max_concurrent_handshakes);
+extern SocketVarsCollector* g_vars;
 void ExtractHostnames(X509* x, std::vector<std::string>* hostnames);
 } // namespace brpc
 
@@ -175,6 +180,136 @@ TEST_F(SSLTest, sanity) {
     ASSERT_EQ(0, server.Join());
 }
 
+TEST_F(SSLTest, ktls) {
+    GFLAGS_NS::FlagSaver saver;
+    const int port = 8613;
+    brpc::Server server;
+    brpc::ServerOptions options;
+    brpc::CertInfo cert;
+    cert.certificate = "cert1.crt";
+    cert.private_key = "cert1.key";
+    options.mutable_ssl_options()->default_cert = cert;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(
+        &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(port, &options));
+
+    // Connections fall back to userspace encryption if kTLS is not
+    // supported, the results are same.
+    for (int ktls = 0; ktls < 2; ++ktls) {
+        brpc::FLAGS_ssl_ktls = ktls;
+        brpc::Channel channel;
+        brpc::ChannelOptions coptions;
+        coptions.mutable_ssl_options()->sni_name = "localhost";
+        ASSERT_EQ(0, channel.Init("127.0.0.1", port, &coptions));
+        test::EchoService_Stub stub(&channel);
+        // Attachments written in one or more records.
+        for (int i = 0; i < 20; ++i) {
+            brpc::Controller cntl;
+            test::EchoRequest req;
+            test::EchoResponse res;
+            req.set_message(EXP_REQUEST);
+            cntl.request_attachment().resize(i * 8192, 'k');
+            stub.Echo(&cntl, &req, &res, NULL);
+            ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+            ASSERT_EQ(EXP_RESPONSE, res.message());
+        }
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(channel._server_id, &s));
+        ASSERT_TRUE(s->is_ssl());
+        // The accepted socket of this connection.
+        brpc::SocketUniquePtr server_s;
+        std::vector<brpc::SocketId> conns;
+        server._am->ListConnections(&conns);
+        for (size_t i = 0; i < conns.size(); ++i) {
+            brpc::SocketUniquePtr ptr;
+            if (brpc::Socket::Address(conns[i], &ptr) == 0 &&
+                ptr->remote_side() == s->local_side()) {
+                server_s.reset(ptr.release());
+            }
+        }
+        ASSERT_TRUE(server_s != NULL);
+        ASSERT_TRUE(server_s->is_ssl());
+        if (!ktls) {
+            ASSERT_EQ(0, s->_ssl_ktls);
+            ASSERT_EQ(0, server_s->_ssl_ktls);
+        } else if (s->_ssl_ktls == 0) {
+            LOG(WARNING) << "kTLS is not supported by the kernel or OpenSSL,"
+                " skip checking the offloading";
+        } else {
+            // Both ends run on the same kernel and OpenSSL.
+            ASSERT_TRUE(s->_ssl_ktls & brpc::KTLS_SEND);
+            ASSERT_EQ(s->_ssl_ktls, server_s->_ssl_ktls);
+            // Otherwise records are written by SocketConnection rather
+            // than the kernel.
+            ASSERT_TRUE(server_s->_conn == NULL);
+        }
+    }
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+TEST_F(SSLTest, session_resumption) {
+    // Restore the flag even if an assertion fails. Run
+    // tools/rpc_io_benchmark -tests=short -ssl to measure the rate of
+    // handshakes.
+    GFLAGS_NS::FlagSaver saver;
+    const int port = 8613;
+    brpc::Server server;
+    brpc::ServerOptions options;
+    brpc::CertInfo cert;
+    cert.certificate = "cert1.crt";
+    cert.private_key = "cert1.key";
+    options.mutable_ssl_options()->default_cert = cert;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(
+        &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(port, &options));
+
+    // Every RPC over short connections does a handshake.
+    const int N = 20;
+    const int max_concurrent_handshakes[] = { 0, 2 };
+    for (size_t i = 0; i < ARRAY_SIZE(max_concurrent_handshakes); ++i) {
+        brpc::FLAGS_ssl_max_concurrent_handshakes = max_concurrent_handshakes[i];
+        for (int reuse = 0; reuse < 2; ++reuse) {
+            brpc::Channel channel;
+            brpc::ChannelOptions coptions;
+            coptions.connection_type = brpc::CONNECTION_TYPE_SHORT;
+            coptions.mutable_ssl_options()->sni_name = "localhost";
+            coptions.mutable_ssl_options()->reuse_session = reuse;
+            ASSERT_EQ(0, channel.Init("127.0.0.1", port, &coptions));
+            test::EchoService_Stub stub(&channel);
+            const int64_t handshake_before =
+                brpc::g_vars->nssl_handshake.get_value();
+            const int64_t reused_before =
+                brpc::g_vars->nssl_session_reused.get_value();
+            for (int j = 0; j < N; ++j) {
+                brpc::Controller cntl;
+                test::EchoRequest req;
+                test::EchoResponse res;
+                req.set_message(EXP_REQUEST);
+                stub.Echo(&cntl, &req, &res, NULL);
+                ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+                ASSERT_EQ(EXP_RESPONSE, res.message());
+            }
+            // Both sides of each connection count the handshake.
+            const int64_t nhandshake =
+                brpc::g_vars->nssl_handshake.get_value() - handshake_before;
+            const int64_t nreused =
+                brpc::g_vars->nssl_session_reused.get_value() - reused_before;
+            ASSERT_GE(nhandshake, 2 * N);
+            if (reuse) {
+                // The first handshake can't be resumed.
+                ASSERT_GT(nreused, N);
+            } else {
+                ASSERT_EQ(0, nreused);
+            }
+        }
+    }
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
 void CheckCert(const char* cname, const char* cert) {
     const int port = 8613;
     brpc::Channel channel;
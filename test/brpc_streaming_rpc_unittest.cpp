@@ -187,6 +187,76 @@ TEST_F(StreamingRpcTest, received_in_order) {
     ASSERT_EQ(N, handler._expected_next_value);
 }
 
+struct StreamWriterArg {
+    brpc::StreamId stream;
+    int value;
+    butil::atomic<bool> done;
+};
+
+static void* WriteIntToStream(void* void_arg) {
+    StreamWriterArg* arg = static_cast<StreamWriterArg*>(void_arg);
+    int network = htonl(arg->value);
+    butil::IOBuf out;
+    out.append(&network, sizeof(network));
+    EXPECT_EQ(0, brpc::StreamWrite(arg->stream, out));
+    arg->done = true;
+    return NULL;
+}
+
+TEST_F(StreamingRpcTest, wait_for_overcrowded_host_socket) {
+    OrderedInputHandler handler;
+    brpc::StreamOptions opt;
+    opt.handler = &handler;
+    brpc::Server server;
+    MyServiceWithStream service(opt);
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(9007, NULL));
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1:9007", NULL));
+    brpc::Controller cntl;
+    brpc::StreamId request_stream;
+    brpc::StreamOptions request_stream_options;
+    request_stream_options.max_buf_size = 0;
+    ASSERT_EQ(0, StreamCreate(&request_stream, cntl, &request_stream_options));
+    brpc::ScopedStream stream_guard(request_stream);
+    test::EchoService_Stub stub(&channel);
+    stub.Echo(&cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText() << " request_stream=" << request_stream;
+
+    brpc::SocketUniquePtr ptr;
+    ASSERT_EQ(0, brpc::Socket::Address(request_stream, &ptr));
+    brpc::Socket* host_socket = ((brpc::Stream*)ptr->conn())->_host_socket;
+    ASSERT_TRUE(host_socket);
+    // The data is kept by the stream until the host socket is writable
+    // again rather than failing with EOVERCROWDED.
+    host_socket->_overcrowded = true;
+    StreamWriterArg warg;
+    warg.stream = request_stream;
+    warg.value = 0;
+    warg.done = false;
+    pthread_t th;
+    ASSERT_EQ(0, pthread_create(&th, NULL, WriteIntToStream, &warg));
+    usleep(100000);
+    ASSERT_FALSE(warg.done);
+    ASSERT_EQ(0, handler._expected_next_value);
+    // Wake up the writer like the unwritten bytes dropping below the low
+    // watermark.
+    host_socket->CancelUnwrittenBytes(0);
+    pthread_join(th, NULL);
+    ASSERT_TRUE(warg.done);
+    while (handler._expected_next_value != 1) {
+        usleep(100);
+    }
+    ptr.reset();
+    ASSERT_EQ(0, brpc::StreamClose(request_stream));
+    server.Stop(0);
+    server.Join();
+    while (!handler.stopped()) {
+        usleep(100);
+    }
+    ASSERT_FALSE(handler.failed());
+}
+
 void on_writable(brpc::StreamId, void* arg, int error_code) {
     std::pair<bool, int>* p = (std::pair<bool, int>*)arg;
     p->first = true;
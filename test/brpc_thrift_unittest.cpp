@@ -0,0 +1,237 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifdef ENABLE_THRIFT_FRAMED_PROTOCOL
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <thrift/Thrift.h>
+#include <thrift/protocol/TProtocol.h>
+#include <thrift/transport/TTransportException.h>
+#include "butil/iobuf.h"
+#include "butil/macros.h"
+#include "brpc/errno.pb.h"
+#include "brpc/controller.h"
+#include "brpc/thrift_message.h"
+#include "brpc/thrift_service.h"
+
+namespace {
+
+using ::apache::thrift::protocol::TProtocol;
+using ::apache::thrift::protocol::TType;
+
+// What the thrift compiler generates for
+//   struct EchoMessage { 1: string message, 2: i32 number }
+class EchoMessage : public brpc::ThriftMessageBase {
+public:
+    EchoMessage() : number(0) {}
+
+    uint32_t Read(TProtocol* iprot) override {
+        uint32_t xfer = 0;
+        std::string fname;
+        TType ftype;
+        int16_t fid;
+        xfer += iprot->readStructBegin(fname);
+        while (true) {
+            xfer += iprot->readFieldBegin(fname, ftype, fid);
+            if (ftype == ::apache::thrift::protocol::T_STOP) {
+                break;
+            }
+            if (fid == 1 && ftype == ::apache::thrift::protocol::T_STRING) {
+                xfer += iprot->readString(message);
+            } else if (fid == 2 && ftype == ::apache::thrift::protocol::T_I32) {
+                xfer += iprot->readI32(number);
+            } else {
+                xfer += iprot->skip(ftype);
+            }
+            xfer += iprot->readFieldEnd();
+        }
+        xfer += iprot->readStructEnd();
+        return xfer;
+    }
+
+    uint32_t Write(TProtocol* oprot) const override {
+        uint32_t xfer = 0;
+        xfer += oprot->writeStructBegin("EchoMessage");
+        xfer += oprot->writeFieldBegin("message", ::apache::thrift::protocol::T_STRING, 1);
+        xfer += oprot->writeString(message);
+        xfer += oprot->writeFieldEnd();
+        xfer += oprot->writeFieldBegin("number", ::apache::thrift::protocol::T_I32, 2);
+        xfer += oprot->writeI32(number);
+        xfer += oprot->writeFieldEnd();
+        xfer += oprot->writeFieldStop();
+        xfer += oprot->writeStructEnd();
+        return xfer;
+    }
+
+    std::string message;
+    int32_t number;
+};
+
+void AppendI16(std::string* out, int16_t v) {
+    out->push_back((char)((v >> 8) & 0xFF));
+    out->push_back((char)(v & 0xFF));
+}
+
+void AppendI32(std::string* out, int32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out->push_back((char)((v >> shift) & 0xFF));
+    }
+}
+
+// Body of a framed message in TBinaryProtocol: a struct whose field
+// `fid' is an EchoMessage.
+std::string MakeBody(int16_t fid, const std::string& message, int32_t number) {
+    std::string body;
+    body.push_back((char)::apache::thrift::protocol::T_STRUCT);
+    AppendI16(&body, fid);
+    body.push_back((char)::apache::thrift::protocol::T_STRING);
+    AppendI16(&body, 1);
+    AppendI32(&body, message.size());
+    body.append(message);
+    body.push_back((char)::apache::thrift::protocol::T_I32);
+    AppendI16(&body, 2);
+    AppendI32(&body, number);
+    body.push_back((char)::apache::thrift::protocol::T_STOP);
+    body.push_back((char)::apache::thrift::protocol::T_STOP);
+    return body;
+}
+
+// Put every `fragment' bytes of `data' into a separate block.
+butil::IOBuf Fragment(const std::string& data, size_t fragment) {
+    butil::IOBuf buf;
+    for (size_t i = 0; i < data.size(); i += fragment) {
+        const size_t n = std::min(fragment, data.size() - i);
+        void* p = malloc(n);
+        memcpy(p, data.data() + i, n);
+        buf.append_user_data(p, n, free);
+    }
+    return buf;
+}
+
+TEST(ThriftTest, read_struct_from_fragmented_iobuf) {
+    const std::string message(1000, 'm');
+    const std::string body = MakeBody(brpc::THRIFT_REQUEST_FID, message, 42);
+    const size_t fragments[] = { body.size(), 1, 3, 7, 512 };
+    for (size_t i = 0; i < arraysize(fragments); ++i) {
+        const butil::IOBuf buf = Fragment(body, fragments[i]);
+        ASSERT_EQ((body.size() + fragments[i] - 1) / fragments[i],
+                  buf.backing_block_num());
+        EchoMessage msg;
+        ASSERT_TRUE(brpc::policy::ReadThriftStruct(
+                        buf, &msg, brpc::THRIFT_REQUEST_FID)) << fragments[i];
+        ASSERT_EQ(message, msg.message) << fragments[i];
+        ASSERT_EQ(42, msg.number) << fragments[i];
+        // The struct is skipped if the field id does not match.
+        EchoMessage msg2;
+        ASSERT_FALSE(brpc::policy::ReadThriftStruct(
+                         buf, &msg2, brpc::THRIFT_RESPONSE_FID));
+        ASSERT_TRUE(msg2.message.empty());
+    }
+    // Truncated in the middle of the string.
+    const butil::IOBuf truncated = Fragment(body.substr(0, body.size() / 2), 7);
+    EchoMessage msg;
+    ASSERT_THROW(brpc::policy::ReadThriftStruct(
+                     truncated, &msg, brpc::THRIFT_REQUEST_FID),
+                 ::apache::thrift::transport::TTransportException);
+}
+
+class CountingClosure : public google::protobuf::Closure {
+public:
+    CountingClosure() : nrun(0) {}
+    void Run() override { ++nrun; }
+    int nrun;
+};
+
+class NamedService : public brpc::ThriftService {
+public:
+    NamedService() : ncalled(0) {}
+    void ProcessThriftFramedRequest(brpc::Controller* cntl,
+                                    brpc::ThriftFramedMessage*,
+                                    brpc::ThriftFramedMessage*,
+                                    google::protobuf::Closure* done) override {
+        ++ncalled;
+        method_name = cntl->thrift_method_name();
+        done->Run();
+    }
+    int ncalled;
+    std::string method_name;
+};
+
+TEST(ThriftTest, multiplexed_service) {
+    brpc::ThriftMultiplexedService mux;
+    NamedService* echo = new NamedService;
+    NamedService* other = new NamedService;
+    ASSERT_EQ(0, mux.AddService("EchoService", echo));
+    ASSERT_EQ(0, mux.AddService("OtherService", other));
+    // Services failed to be added are not owned by mux.
+    NamedService dup;
+    ASSERT_EQ(-1, mux.AddService("EchoService", &dup));
+    ASSERT_EQ(-1, mux.AddService("Bad:Name", &dup));
+    ASSERT_EQ(-1, mux.AddService("", &dup));
+
+    // Dispatched by the service name, which is removed from the method name.
+    brpc::ThriftFramedMessage req;
+    brpc::ThriftFramedMessage res;
+    {
+        brpc::Controller cntl;
+        cntl._thrift_method_name = "EchoService:Echo";
+        CountingClosure done;
+        mux.ProcessThriftFramedRequest(&cntl, &req, &res, &done);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(1, done.nrun);
+        ASSERT_EQ(1, echo->ncalled);
+        ASSERT_EQ("Echo", echo->method_name);
+        ASSERT_EQ(0, other->ncalled);
+    }
+    {
+        brpc::Controller cntl;
+        cntl._thrift_method_name = "OtherService:Echo:Again";
+        CountingClosure done;
+        mux.ProcessThriftFramedRequest(&cntl, &req, &res, &done);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(1, done.nrun);
+        ASSERT_EQ(1, other->ncalled);
+        ASSERT_EQ("Echo:Again", other->method_name);
+    }
+    // Unknown service.
+    {
+        brpc::Controller cntl;
+        cntl._thrift_method_name = "NoSuchService:Echo";
+        CountingClosure done;
+        mux.ProcessThriftFramedRequest(&cntl, &req, &res, &done);
+        ASSERT_EQ(brpc::ENOSERVICE, cntl.ErrorCode());
+        ASSERT_EQ(1, done.nrun);
+    }
+    // Not multiplexed.
+    {
+        brpc::Controller cntl;
+        cntl._thrift_method_name = "Echo";
+        CountingClosure done;
+        mux.ProcessThriftFramedRequest(&cntl, &req, &res, &done);
+        ASSERT_EQ(brpc::ENOMETHOD, cntl.ErrorCode());
+        ASSERT_EQ(1, done.nrun);
+    }
+    ASSERT_EQ(1, echo->ncalled);
+    ASSERT_EQ(1, other->ncalled);
+}
+
+} // namespace
+
+#endif // ENABLE_THRIFT_FRAMED_PROTOCOL
@@ -0,0 +1,277 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/atomicops.h"
+#include "butil/fd_guard.h"
+#include "butil/logging.h"
+#include "bvar/variable.h"
+#include "brpc/channel.h"
+#include "brpc/server.h"
+#include "brpc/controller.h"
+#include "brpc/udp_channel.h"
+#include "echo.pb.h"
+
+namespace brpc {
+DECLARE_bool(udp_gso);
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+class CountingEchoServiceImpl : public ::test::EchoService {
+public:
+    CountingEchoServiceImpl() : count(0), bytes(0) {}
+
+    void Echo(google::protobuf::RpcController* cntl_base,
+              const ::test::EchoRequest* req,
+              ::test::EchoResponse* res,
+              google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        ASSERT_EQ("hello", req->message());
+        bytes.fetch_add(cntl->request_attachment().size(),
+                        butil::memory_order_relaxed);
+        count.fetch_add(1, butil::memory_order_relaxed);
+        res->set_message(req->message());
+    }
+
+    butil::atomic<int64_t> count;
+    butil::atomic<int64_t> bytes;
+};
+
+int64_t DroppedDatagrams() {
+    // Empty when the variable is not created yet.
+    const std::string value =
+        bvar::Variable::describe_exposed("rpc_udp_dropped_datagram_count");
+    return strtoll(value.c_str(), NULL, 10);
+}
+
+class UdpTest : public ::testing::Test {
+protected:
+    void SetUp() {
+        ASSERT_EQ(0, _server.AddService(&_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+        brpc::ServerOptions options;
+        options.enable_udp = true;
+        ASSERT_EQ(0, _server.Start("127.0.0.1", brpc::PortRange(8100, 8900),
+                                   &options));
+    }
+
+    void TearDown() {
+        _server.Stop(0);
+        _server.Join();
+    }
+
+    // Wait until the server gets `n' requests.
+    bool WaitCount(int64_t n) {
+        for (int i = 0; i < 500; ++i) {
+            if (_svc.count.load(butil::memory_order_relaxed) >= n) {
+                return true;
+            }
+            usleep(10000);
+        }
+        return false;
+    }
+
+    static void Send(brpc::UdpChannel* channel, const butil::IOBuf& attachment,
+                     brpc::Controller* cntl) {
+        ::test::EchoService_Stub stub(channel);
+        ::test::EchoRequest req;
+        ::test::EchoResponse res;
+        req.set_message("hello");
+        cntl->request_attachment() = attachment;
+        stub.Echo(cntl, &req, &res, NULL);
+        ASSERT_FALSE(res.has_message());
+    }
+
+    CountingEchoServiceImpl _svc;
+    brpc::Server _server;
+};
+
+TEST_F(UdpTest, one_way) {
+    brpc::UdpChannel channel;
+    ASSERT_EQ(0, channel.Init(_server.listen_address()));
+    butil::IOBuf attachment;
+    const int N = 100;
+    int64_t expected_bytes = 0;
+    for (int i = 0; i < N; ++i) {
+        brpc::Controller cntl;
+        Send(&channel, attachment, &cntl);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        expected_bytes += attachment.size();
+        attachment.append("attachment");
+    }
+    ASSERT_TRUE(WaitCount(N));
+    ASSERT_EQ(expected_bytes, _svc.bytes.load());
+
+    // Requests not fitting in a datagram are rejected.
+    attachment.clear();
+    attachment.resize(70000);
+    brpc::Controller cntl;
+    Send(&channel, attachment, &cntl);
+    ASSERT_EQ(brpc::EREQUEST, cntl.ErrorCode());
+
+    // TCP clients are served as before.
+    brpc::Channel tcp_channel;
+    ASSERT_EQ(0, tcp_channel.Init(_server.listen_address(), NULL));
+    ::test::EchoService_Stub stub(&tcp_channel);
+    ::test::EchoRequest req;
+    ::test::EchoResponse res;
+    req.set_message("hello");
+    brpc::Controller tcp_cntl;
+    stub.Echo(&tcp_cntl, &req, &res, NULL);
+    ASSERT_FALSE(tcp_cntl.Failed()) << tcp_cntl.ErrorText();
+    ASSERT_EQ("hello", res.message());
+}
+
+TEST_F(UdpTest, drop_invalid_datagrams) {
+    const int64_t dropped = DroppedDatagrams();
+    butil::fd_guard fd(socket(AF_INET, SOCK_DGRAM, 0));
+    ASSERT_GE(fd, 0);
+    struct sockaddr_storage addr;
+    socklen_t addr_len = 0;
+    ASSERT_GE(butil::endpoint2sockaddr(_server.listen_address(),
+                                       &addr, &addr_len), 0);
+    // Not baidu_std, and a truncated baidu_std message.
+    const char garbage[] = "GET / HTTP/1.1\r\n\r\n";
+    const char truncated[] = "PRPC\0\0\0\x20\0\0\0\x10";
+    ASSERT_GT(sendto(fd, garbage, sizeof(garbage) - 1, 0,
+                     (struct sockaddr*)&addr, addr_len), 0);
+    ASSERT_GT(sendto(fd, truncated, sizeof(truncated) - 1, 0,
+                     (struct sockaddr*)&addr, addr_len), 0);
+    // A complete baidu_std message with malformed meta, which must not
+    // fail the socket shared by all senders.
+    const char bad_meta[] = "PRPC\0\0\0\x04\0\0\0\x04\xff\xff\xff\xff";
+    ASSERT_GT(sendto(fd, bad_meta, sizeof(bad_meta) - 1, 0,
+                     (struct sockaddr*)&addr, addr_len), 0);
+
+    // The server keeps receiving valid requests.
+    brpc::UdpChannel channel;
+    ASSERT_EQ(0, channel.Init(_server.listen_address()));
+    brpc::Controller cntl;
+    Send(&channel, butil::IOBuf(), &cntl);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_TRUE(WaitCount(1));
+    // The malformed meta is found in another bthread.
+    for (int i = 0; i < 100 && DroppedDatagrams() < dropped + 3; ++i) {
+        usleep(10000);
+    }
+    ASSERT_EQ(dropped + 3, DroppedDatagrams());
+    brpc::Controller cntl2;
+    Send(&channel, butil::IOBuf(), &cntl2);
+    ASSERT_FALSE(cntl2.Failed()) << cntl2.ErrorText();
+    ASSERT_TRUE(WaitCount(2));
+}
+
+TEST_F(UdpTest, skip_busy_udp_port) {
+    // Occupy the udp port only.
+    butil::fd_guard fd(socket(AF_INET, SOCK_DGRAM, 0));
+    ASSERT_GE(fd, 0);
+    butil::EndPoint point;
+    ASSERT_EQ(0, butil::str2endpoint("127.0.0.1:0", &point));
+    struct sockaddr_storage addr;
+    socklen_t addr_len = 0;
+    ASSERT_GE(butil::endpoint2sockaddr(point, &addr, &addr_len), 0);
+    ASSERT_EQ(0, bind(fd, (struct sockaddr*)&addr, addr_len));
+    ASSERT_EQ(0, butil::get_local_side(fd, &point));
+
+    CountingEchoServiceImpl svc;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions options;
+    options.enable_udp = true;
+    ASSERT_EQ(0, server.Start("127.0.0.1",
+                              brpc::PortRange(point.port, point.port + 100),
+                              &options));
+    ASSERT_GT(server.listen_address().port, point.port);
+    brpc::UdpChannel channel;
+    ASSERT_EQ(0, channel.Init(server.listen_address()));
+    brpc::Controller cntl;
+    Send(&channel, butil::IOBuf(), &cntl);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    for (int i = 0; i < 500 && svc.count.load() == 0; ++i) {
+        usleep(10000);
+    }
+    ASSERT_EQ(1, svc.count.load());
+    server.Stop(0);
+    server.Join();
+
+    // Fail if all ports are busy.
+    brpc::Server server2;
+    ASSERT_EQ(0, server2.AddService(&svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(-1, server2.Start("127.0.0.1",
+                                brpc::PortRange(point.port, point.port),
+                                &options));
+}
+
+struct SenderArg {
+    brpc::UdpChannel* channel;
+    int n;
+    int nfailed;
+};
+
+void* SendRequests(void* void_arg) {
+    SenderArg* arg = static_cast<SenderArg*>(void_arg);
+    ::test::EchoService_Stub stub(arg->channel);
+    ::test::EchoRequest req;
+    req.set_message("hello");
+    ::test::EchoResponse res;
+    for (int i = 0; i < arg->n; ++i) {
+        brpc::Controller cntl;
+        stub.Echo(&cntl, &req, &res, NULL);
+        if (cntl.Failed()) {
+            ++arg->nfailed;
+        }
+    }
+    return NULL;
+}
+
+TEST_F(UdpTest, concurrent_senders) {
+    GFLAGS_NS::FlagSaver saver;
+    const int NTHREAD = 4;
+    const int N = 200;
+    for (int gso = 0; gso < 2; ++gso) {
+        brpc::FLAGS_udp_gso = gso;
+        brpc::UdpChannel channel;
+        ASSERT_EQ(0, channel.Init(_server.listen_address()));
+        const int64_t count0 = _svc.count.load();
+        SenderArg args[NTHREAD];
+        pthread_t th[NTHREAD];
+        for (int i = 0; i < NTHREAD; ++i) {
+            args[i].channel = &channel;
+            args[i].n = N;
+            args[i].nfailed = 0;
+            ASSERT_EQ(0, pthread_create(&th[i], NULL, SendRequests, &args[i]));
+        }
+        for (int i = 0; i < NTHREAD; ++i) {
+            pthread_join(th[i], NULL);
+            ASSERT_EQ(0, args[i].nfailed);
+        }
+        // Datagrams may be lost even on loopback, don't wait for all.
+        WaitCount(count0 + (int64_t)NTHREAD * N);
+        ASSERT_GT(_svc.count.load(), count0);
+    }
+}
+
+} // namespace
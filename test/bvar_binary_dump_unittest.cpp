@@ -0,0 +1,234 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <string>
+#include <vector>
+#include "butil/logging.h"
+#include "butil/string_printf.h"
+#include "bvar/bvar.h"
+#include "bvar/binary_dump.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+// Record calls in order.
+class StringDumper : public bvar::Dumper {
+public:
+    bool dump(const std::string& name,
+              const butil::StringPiece& desc) override {
+        out.append(name).append(" : ").append(desc.data(), desc.size())
+            .push_back('\n');
+        return true;
+    }
+    bool dump_comment(const std::string& name,
+                      const std::string& type) override {
+        out.append("# ").append(name).append(" ").append(type).push_back('\n');
+        return true;
+    }
+    bool dump_mvar(const std::string& name,
+                   const butil::StringPiece& desc) override {
+        out.append("  ");
+        return dump(name, desc);
+    }
+
+    std::string out;
+};
+
+TEST(BinaryDumpTest, encode_and_decode) {
+    bvar::BinaryDumpEncoder encoder;
+    bvar::BinaryDumpDecoder decoder;
+    butil::IOBuf buf;
+
+    encoder.begin_frame(false);  // The first frame is always a keyframe.
+    encoder.dump("b", "hello");
+    encoder.dump("a", "-10");
+    encoder.dump_comment("rpc_error", "gauge");
+    encoder.dump_mvar("rpc_error{method=\"Echo\"}", "3");
+    encoder.dump_mvar("rpc_error{method=\"Add\"}", "007");
+    ASSERT_EQ(5, encoder.end_frame(&buf));
+    ASSERT_EQ(1, decoder.decode(&buf));
+    ASSERT_TRUE(buf.empty());
+    StringDumper d1;
+    ASSERT_EQ(4, decoder.dump(&d1));
+    ASSERT_EQ("a : -10\n"
+              "b : hello\n"
+              "# rpc_error gauge\n"
+              "  rpc_error{method=\"Add\"} : 007\n"
+              "  rpc_error{method=\"Echo\"} : 3\n", d1.out);
+
+    // Only changed values are encoded.
+    encoder.begin_frame(false);
+    encoder.dump("a", "90");
+    encoder.dump("b", "hello");
+    encoder.dump("c", "1.5");
+    encoder.dump_comment("rpc_error", "gauge");
+    encoder.dump_mvar("rpc_error{method=\"Echo\"}", "3");
+    ASSERT_EQ(2, encoder.end_frame(&buf));
+    ASSERT_EQ(1, decoder.decode(&buf));
+    StringDumper d2;
+    ASSERT_EQ(4, decoder.dump(&d2));
+    ASSERT_EQ("a : 90\n"
+              "b : hello\n"
+              "c : 1.5\n"
+              "# rpc_error gauge\n"
+              "  rpc_error{method=\"Echo\"} : 3\n", d2.out);
+
+    // A new decoder starts from the next keyframe.
+    bvar::BinaryDumpDecoder decoder2;
+    encoder.begin_frame(false);
+    encoder.dump("a", "91");
+    encoder.end_frame(&buf);
+    ASSERT_EQ(1, decoder2.decode(&buf));
+    StringDumper d3;
+    ASSERT_EQ(0, decoder2.dump(&d3));
+    encoder.begin_frame(true);
+    encoder.dump("a", "92");
+    encoder.end_frame(&buf);
+    ASSERT_EQ(1, decoder2.decode(&buf));
+    ASSERT_EQ(1, decoder2.dump(&d3));
+    ASSERT_EQ("a : 92\n", d3.out);
+}
+
+TEST(BinaryDumpTest, partial_and_malformed_frames) {
+    bvar::BinaryDumpEncoder encoder;
+    butil::IOBuf frames;
+    for (int i = 0; i < 3; ++i) {
+        encoder.begin_frame(false);
+        encoder.dump("x", butil::string_printf("%d", i));
+        encoder.dump("y", std::string(200, 'a' + i));
+        encoder.end_frame(&frames);
+    }
+    // Feed byte by byte.
+    bvar::BinaryDumpDecoder decoder;
+    butil::IOBuf buf;
+    int nframe = 0;
+    const std::string data = frames.to_string();
+    for (size_t i = 0; i < data.size(); ++i) {
+        buf.push_back(data[i]);
+        const int rc = decoder.decode(&buf);
+        ASSERT_LE(0, rc);
+        nframe += rc;
+    }
+    ASSERT_EQ(3, nframe);
+    ASSERT_TRUE(buf.empty());
+    StringDumper d;
+    decoder.dump(&d);
+    ASSERT_EQ("x : 2\ny : " + std::string(200, 'c') + "\n", d.out);
+
+    butil::IOBuf bad;
+    bad.append("BVD2\x01\x00");
+    ASSERT_EQ(-1, decoder.decode(&bad));
+}
+
+TEST(BinaryDumpTest, exposed_variables) {
+    bvar::Adder<int> a("binary_dump_adder");
+    bvar::Status<std::string> s("binary_dump_status", "hello");
+    bvar::MultiDimension<bvar::Adder<int> > errors(
+        "binary_dump_error", {"method"});
+    *errors.get_stats({"Echo"}) << 2;
+    a << 5;
+    bvar::DumpOptions options;
+    options.white_wildcards = "binary_dump_*";
+
+    bvar::BinaryDumpEncoder encoder;
+    butil::IOBuf buf;
+    encoder.begin_frame(true);
+    ASSERT_EQ(2, bvar::Variable::dump_exposed(&encoder, &options));
+    ASSERT_EQ(1, bvar::MVariable::dump_exposed(&encoder, &options));
+    encoder.end_frame(&buf);
+
+    bvar::BinaryDumpDecoder decoder;
+    ASSERT_EQ(1, decoder.decode(&buf));
+    StringDumper d;
+    ASSERT_EQ(3, decoder.dump(&d));
+    ASSERT_EQ("binary_dump_adder : 5\n"
+              "binary_dump_status : \"hello\"\n"
+              "# binary_dump_error gauge\n"
+              "  binary_dump_error{method=\"Echo\"} : 2\n", d.out);
+}
+
+static size_t varint_size(uint64_t v) {
+    size_t n = 1;
+    for (; v >= 0x80; v >>= 7) {
+        ++n;
+    }
+    return n;
+}
+
+// Ends the frame of `encoder' and decodes it with `decoder'. Returns size of
+// the frame excluding time_us which varies.
+static size_t frame_size(bvar::BinaryDumpEncoder* encoder,
+                         bvar::BinaryDumpDecoder* decoder, int nvalue) {
+    butil::IOBuf frame;
+    EXPECT_EQ(nvalue, encoder->end_frame(&frame));
+    const size_t size = frame.size();
+    EXPECT_EQ(1, decoder->decode(&frame));
+    return size - varint_size(decoder->time_us());
+}
+
+TEST(BinaryDumpTest, frame_sizes) {
+    const int N = 100;
+    bvar::BinaryDumpEncoder encoder;
+    bvar::BinaryDumpDecoder decoder;
+    // Names are sent once in the keyframe: kind, size and 3 bytes of the
+    // name. Values are integers: id, type and 2 bytes of 1000+i zigzagged.
+    encoder.begin_frame(true);
+    for (int i = 0; i < N; ++i) {
+        encoder.dump(butil::string_printf("v%02d", i),
+                     butil::string_printf("%d", 1000 + i));
+    }
+    // magic + body_size + flags + nname + names + nvalue + values + nremoved
+    ASSERT_EQ(4u + 2 + 1 + 1 + N * 5 + 1 + N * 4 + 1,
+              frame_size(&encoder, &decoder, N));
+
+    // Only changed values are sent, the delta 7 takes 1 byte.
+    encoder.begin_frame(false);
+    for (int i = 0; i < N; ++i) {
+        encoder.dump(butil::string_printf("v%02d", i),
+                     butil::string_printf("%d", 1000 + i + (i % 10 ? 0 : 7)));
+    }
+    ASSERT_EQ(4u + 1 + 1 + 1 + 1 + (N / 10) * 3 + 1,
+              frame_size(&encoder, &decoder, N / 10));
+
+    // Nothing but the header when nothing changes.
+    encoder.begin_frame(false);
+    for (int i = 0; i < N; ++i) {
+        encoder.dump(butil::string_printf("v%02d", i),
+                     butil::string_printf("%d", 1000 + i + (i % 10 ? 0 : 7)));
+    }
+    ASSERT_EQ(4u + 1 + 1 + 1 + 1 + 1, frame_size(&encoder, &decoder, 0));
+
+    // v00 is removed and a string is added: the new name, id + type +
+    // size + "hello", and the removed id.
+    encoder.begin_frame(false);
+    for (int i = 1; i < N; ++i) {
+        encoder.dump(butil::string_printf("v%02d", i),
+                     butil::string_printf("%d", 1000 + i + (i % 10 ? 0 : 7)));
+    }
+    encoder.dump("w", "hello");
+    ASSERT_EQ(4u + 1 + 1 + 1 + 3 + 1 + 8 + 1 + 1,
+              frame_size(&encoder, &decoder, 1));
+
+    StringDumper d;
+    ASSERT_EQ(N, decoder.dump(&d));
+    ASSERT_EQ(0u, d.out.find("v01 : 1001\n"));
+    ASSERT_NE(std::string::npos, d.out.find("v10 : 1017\n"));
+    ASSERT_EQ(std::string::npos, d.out.find("v00"));
+    ASSERT_NE(std::string::npos, d.out.find("w : hello\n"));
+}
+
+} // namespace
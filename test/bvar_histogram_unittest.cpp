@@ -0,0 +1,131 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <algorithm>
+#include <vector>
+#include "butil/time.h"
+#include "butil/fast_rand.h"
+#include "butil/logging.h"
+#include "bvar/detail/histogram.h"
+#include "bvar/latency_recorder.h"
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+namespace bvar {
+DECLARE_bool(bvar_latency_histogram);
+}
+
+namespace {
+
+using bvar::detail::histogram_bucket_index;
+using bvar::detail::histogram_bucket_lower_bound;
+using bvar::detail::histogram_bucket_upper_bound;
+
+TEST(HistogramTest, buckets) {
+    ASSERT_EQ(0u, histogram_bucket_lower_bound(0));
+    for (size_t i = 0; i + 1 < bvar::detail::HISTOGRAM_BUCKET_COUNT; ++i) {
+        ASSERT_LE(histogram_bucket_lower_bound(i),
+                  histogram_bucket_upper_bound(i));
+        ASSERT_EQ(histogram_bucket_upper_bound(i) + 1,
+                  histogram_bucket_lower_bound(i + 1)) << i;
+        ASSERT_EQ(i, histogram_bucket_index(histogram_bucket_lower_bound(i)));
+        ASSERT_EQ(i, histogram_bucket_index(histogram_bucket_upper_bound(i)));
+    }
+    ASSERT_EQ(bvar::detail::HISTOGRAM_BUCKET_COUNT - 1,
+              histogram_bucket_index(0xFFFFFFFFu));
+    for (int i = 0; i < 100000; ++i) {
+        const uint32_t x = butil::fast_rand();
+        const size_t index = histogram_bucket_index(x);
+        ASSERT_LE(histogram_bucket_lower_bound(index), x);
+        ASSERT_GE(histogram_bucket_upper_bound(index), x);
+    }
+}
+
+TEST(HistogramTest, get_number) {
+    bvar::detail::GlobalHistogramBuckets b;
+    std::vector<int64_t> values;
+    for (int i = 0; i < 100000; ++i) {
+        // Long-tailed values.
+        const int64_t v = butil::fast_rand_less_than(1000) *
+            (butil::fast_rand_less_than(100) == 0 ? 100 : 1);
+        values.push_back(v);
+        b.add(v);
+    }
+    std::sort(values.begin(), values.end());
+    ASSERT_EQ(values.size(), b.count());
+    const double ratios[] = { 0.1, 0.5, 0.8, 0.9, 0.99, 0.999, 0.9999 };
+    for (size_t i = 0; i < arraysize(ratios); ++i) {
+        const int64_t exact = values[(size_t)ceil(ratios[i] * values.size()) - 1];
+        const int64_t approx = b.get_number(ratios[i]);
+        ASSERT_LE(std::abs(approx - exact), exact / 32 + 1)
+            << "ratio=" << ratios[i];
+    }
+}
+
+TEST(HistogramTest, merge) {
+    bvar::detail::GlobalHistogramBuckets b1;
+    bvar::detail::ThreadLocalHistogramBuckets b2;
+    bvar::detail::GlobalHistogramBuckets all;
+    for (int i = 1; i <= 1000; ++i) {
+        b1.add(i);
+        b2.add(i * 1000);
+        all.add(i);
+        all.add(i * 1000);
+    }
+    b1.merge(b2);
+    ASSERT_EQ(all.count(), b1.count());
+    ASSERT_EQ(all.sum(), b1.sum());
+    for (size_t i = 0; i < bvar::detail::HISTOGRAM_BUCKET_COUNT; ++i) {
+        ASSERT_EQ(all.count_at(i), b1.count_at(i));
+    }
+}
+
+TEST(HistogramTest, cumulative) {
+    bvar::detail::Histogram h;
+    for (int i = 0; i < 100; ++i) {
+        h << i;
+    }
+    ASSERT_EQ(100u, h.reset().count());
+    ASSERT_EQ(0u, h.get_value().count());
+    h << 1;
+    ASSERT_EQ(101u, h.get_cumulative_value().count());
+    ASSERT_EQ(4951u, h.get_cumulative_value().sum());
+}
+
+TEST(HistogramTest, latency_recorder) {
+    bvar::FLAGS_bvar_latency_histogram = true;
+    bvar::LatencyRecorder rec("histogram_test");
+    bvar::FLAGS_bvar_latency_histogram = false;
+    ASSERT_EQ("histogram_test_latency_histogram", rec.latency_histogram_name());
+    for (int i = 1; i <= 10000; ++i) {
+        rec << i;
+    }
+    // Wait for the window to be sampled.
+    usleep(1100000);
+    ASSERT_EQ(10000u, rec.latency_histogram().count());
+    const int64_t p99 = rec.latency_percentile(0.99);
+    ASSERT_LE(std::abs(p99 - 9900), 9900 / 32 + 1) << p99;
+    const std::string desc =
+        bvar::Variable::describe_exposed("histogram_test_latency_histogram");
+    // Only non-empty buckets are printed.
+    ASSERT_EQ(0u, desc.find("{\"count\":10000,\"sum\":50005000,\"buckets\":[[1,1],"));
+
+    bvar::LatencyRecorder rec2("histogram_test2");
+    ASSERT_TRUE(rec2.latency_histogram_name().empty());
+}
+
+} // namespace
@@ -0,0 +1,189 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "butil/time.h"
+#include "bvar/bvar.h"
+#include "bvar/multi_dimension.h"
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+namespace bvar {
+DECLARE_int32(bvar_max_multi_dimension_stats_count);
+}
+
+namespace {
+
+class MapDumper : public bvar::Dumper {
+public:
+    bool dump(const std::string& name,
+              const butil::StringPiece& desc) override {
+        values[name] = desc.as_string();
+        return true;
+    }
+    bool dump_comment(const std::string& name,
+                      const std::string& type) override {
+        types[name] = type;
+        return true;
+    }
+
+    std::map<std::string, std::string> values;
+    std::map<std::string, std::string> types;
+};
+
+class MultiDimensionTest : public testing::Test {
+protected:
+    void TearDown() {
+        ASSERT_EQ(0UL, bvar::MVariable::count_exposed());
+    }
+};
+
+TEST_F(MultiDimensionTest, get_and_delete_stats) {
+    bvar::MultiDimension<bvar::Adder<int> > family(
+        "request_count", {"method", "status"});
+    ASSERT_EQ("request_count", family.name());
+    ASSERT_EQ(2UL, family.count_labels());
+    ASSERT_EQ(1UL, bvar::MVariable::count_exposed());
+
+    bvar::Adder<int>* a = family.get_stats({"Echo", "OK"});
+    ASSERT_TRUE(a != NULL);
+    ASSERT_EQ(a, family.get_stats({"Echo", "OK"}));
+    *a << 2;
+    *family.get_stats({"Echo", "EREQUEST"}) << 3;
+    ASSERT_EQ(2UL, family.count_stats());
+    ASSERT_TRUE(family.has_stats({"Echo", "OK"}));
+    ASSERT_FALSE(family.has_stats({"Echo", "ETIMEDOUT"}));
+    // Number of label values must match.
+    ASSERT_TRUE(family.get_stats({"Echo"}) == NULL);
+    // Children are not exposed as Variable.
+    ASSERT_EQ(0UL, bvar::Variable::count_exposed());
+
+    std::vector<std::vector<std::string> > stats;
+    family.list_stats(&stats);
+    ASSERT_EQ(2UL, stats.size());
+
+    family.delete_stats({"Echo", "OK"});
+    ASSERT_FALSE(family.has_stats({"Echo", "OK"}));
+    ASSERT_EQ(1UL, family.count_stats());
+    family.delete_stats();
+    ASSERT_EQ(0UL, family.count_stats());
+}
+
+TEST_F(MultiDimensionTest, invalid_labels) {
+    bvar::MultiDimension<bvar::Adder<int> > f1("bad1", {"1st"});
+    ASSERT_TRUE(f1.name().empty());
+    bvar::MultiDimension<bvar::Adder<int> > f2("bad2", {"a", "a"});
+    ASSERT_TRUE(f2.name().empty());
+    bvar::MultiDimension<bvar::Adder<int> > f3("bad3", {"quantile"});
+    ASSERT_TRUE(f3.name().empty());
+    bvar::MultiDimension<bvar::Adder<int> > f4("good", {"a"});
+    ASSERT_EQ("good", f4.name());
+    // Same name is rejected.
+    bvar::MultiDimension<bvar::Adder<int> > f5("good", {"b"});
+    ASSERT_TRUE(f5.name().empty());
+}
+
+TEST_F(MultiDimensionTest, max_stats_count) {
+    const int saved = bvar::FLAGS_bvar_max_multi_dimension_stats_count;
+    bvar::FLAGS_bvar_max_multi_dimension_stats_count = 10;
+    bvar::MultiDimension<bvar::Maxer<int> > family("user_max", {"user"});
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(family.get_stats({std::to_string(i)}) != NULL);
+    }
+    ASSERT_TRUE(family.get_stats({"10"}) == NULL);
+    // Existing children are still returned.
+    ASSERT_TRUE(family.get_stats({"0"}) != NULL);
+    ASSERT_EQ(10UL, family.count_stats());
+    bvar::FLAGS_bvar_max_multi_dimension_stats_count = saved;
+}
+
+TEST_F(MultiDimensionTest, dump) {
+    bvar::MultiDimension<bvar::Adder<int> > errors("rpc_error", {"method"});
+    *errors.get_stats({"Echo"}) << 1;
+    *errors.get_stats({"say \"hi\"\n"}) << 2;
+    bvar::MultiDimension<bvar::LatencyRecorder> latency(
+        "rpc", "latency", {"method", "peer"});
+    bvar::LatencyRecorder* rec = latency.get_stats({"Echo", "127.0.0.1"});
+    ASSERT_TRUE(rec != NULL);
+    for (int i = 1; i <= 100; ++i) {
+        *rec << i;
+    }
+
+    MapDumper dumper;
+    ASSERT_EQ(2 + 9, bvar::MVariable::dump_exposed(&dumper, NULL));
+    ASSERT_EQ("gauge", dumper.types["rpc_error"]);
+    ASSERT_EQ("summary", dumper.types["rpc_latency"]);
+    ASSERT_EQ("gauge", dumper.types["rpc_latency_qps"]);
+    ASSERT_EQ("1", dumper.values["rpc_error{method=\"Echo\"}"]);
+    // Label values are escaped.
+    ASSERT_EQ("2", dumper.values["rpc_error{method=\"say \\\"hi\\\"\\n\"}"]);
+    ASSERT_EQ("100", dumper.values[
+        "rpc_latency_count{method=\"Echo\",peer=\"127.0.0.1\"}"]);
+    ASSERT_EQ(1UL, dumper.values.count(
+        "rpc_latency{method=\"Echo\",peer=\"127.0.0.1\",quantile=\"0.99\"}"));
+    ASSERT_EQ(1UL, dumper.values.count(
+        "rpc_latency_qps{method=\"Echo\",peer=\"127.0.0.1\"}"));
+
+    bvar::DumpOptions options;
+    options.white_wildcards = "rpc_err*";
+    MapDumper dumper2;
+    ASSERT_EQ(2, bvar::MVariable::dump_exposed(&dumper2, &options));
+}
+
+struct LookupArg {
+    bvar::MultiDimension<bvar::Adder<int> >* family;
+    int n;
+};
+
+void* lookup_stats(void* void_arg) {
+    LookupArg* arg = static_cast<LookupArg*>(void_arg);
+    for (int i = 0; i < arg->n; ++i) {
+        *arg->family->get_stats({"Echo", std::to_string(i % 16)}) << 1;
+    }
+    return NULL;
+}
+
+TEST_F(MultiDimensionTest, concurrent_lookup) {
+    bvar::MultiDimension<bvar::Adder<int> > family(
+        "concurrent_count", {"method", "shard"});
+    const int NTHREAD = 8;
+    const int N = 100000;
+    LookupArg arg = { &family, N };
+    pthread_t th[NTHREAD];
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < NTHREAD; ++i) {
+        ASSERT_EQ(0, pthread_create(&th[i], NULL, lookup_stats, &arg));
+    }
+    for (int i = 0; i < NTHREAD; ++i) {
+        pthread_join(th[i], NULL);
+    }
+    tm.stop();
+    LOG(INFO) << "get_stats+add takes " << tm.n_elapsed() / (NTHREAD * N)
+              << "ns";
+    ASSERT_EQ(16UL, family.count_stats());
+    int sum = 0;
+    for (int i = 0; i < 16; ++i) {
+        sum += family.get_stats({"Echo", std::to_string(i)})->get_value();
+    }
+    ASSERT_EQ(NTHREAD * N, sum);
+}
+
+} // namespace
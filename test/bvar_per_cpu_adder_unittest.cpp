@@ -0,0 +1,52 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "butil/time.h"
+#include "butil/logging.h"
+#include "bvar/bvar.h"
+#include "bvar/per_cpu_adder.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+TEST(PerCpuAdderTest, sanity) {
+    bvar::PerCpuAdder<int64_t> adder("per_cpu_adder_sanity");
+#if defined(OS_LINUX)
+    ASSERT_TRUE(adder.is_per_cpu());
+    ASSERT_EQ(bvar::detail::per_cpu_slot_count() * BAIDU_CACHELINE_SIZE,
+              adder.memory_size());
+#endif
+    adder << 1 << 2 << -4;
+    ASSERT_EQ(-1, adder.get_value());
+    ASSERT_EQ("-1", bvar::Variable::describe_exposed("per_cpu_adder_sanity"));
+    ASSERT_EQ(-1, adder.reset());
+    ASSERT_EQ(0, adder.get_value());
+}
+
+TEST(PerCpuAdderTest, window) {
+    bvar::PerCpuAdder<int64_t> adder;
+    bvar::Window<bvar::PerCpuAdder<int64_t> > window(&adder, 10);
+    bvar::PerSecond<bvar::PerCpuAdder<int64_t> > per_second(&adder, 10);
+    adder << 10;
+    usleep(1100000);
+    adder << 5;
+    usleep(1100000);
+    ASSERT_EQ(15, window.get_value());
+    ASSERT_LT(0, per_second.get_value(10));
+}
+
+} // namespace
@@ -16,11 +16,19 @@
 // under the License.
 
 #include <limits>                           //std::numeric_limits
+#include <set>
+#include <vector>
 #include "bvar/detail/sampler.h"
+#include "bvar/reducer.h"
 #include "butil/time.h"
 #include "butil/logging.h"
+#include <gflags/gflags.h>
 #include <gtest/gtest.h>
 
+namespace bvar {
+DECLARE_int32(bvar_sampler_thread_num);
+}
+
 namespace {
 
 TEST(SamplerTest, linked_list) {
@@ -136,4 +144,77 @@ TEST(SamplerTest, multi_threaded) {
     }
 #endif
 }
+
+// Reads an Adder like samplers of windows and records where and when it's
+// called.
+class TimedSampler : public bvar::detail::Sampler {
+public:
+    explicit TimedSampler(bvar::Adder<int>* adder)
+        : _adder(adder), _tid(0), _last_us(0) {}
+    void take_sample() override {
+        _adder->get_value();
+        _tid = pthread_self();
+        _last_us = butil::gettimeofday_us();
+    }
+    bvar::Adder<int>* _adder;
+    pthread_t _tid;
+    int64_t _last_us;
+};
+
+// Schedules `n' TimedSamplers reading `adder'.
+static void schedule_samplers(bvar::Adder<int>* adder, int n,
+                              std::vector<TimedSampler*>* out) {
+    for (int i = 0; i < n; ++i) {
+        out->push_back(new TimedSampler(adder));
+        out->back()->schedule();
+    }
+}
+
+// Returns number of distinct threads which called take_sample() of
+// `samplers' last time.
+static size_t count_sampling_threads(const std::vector<TimedSampler*>& samplers) {
+    std::set<pthread_t> tids;
+    for (size_t i = 0; i < samplers.size(); ++i) {
+        samplers[i]->_mutex.lock();
+        const pthread_t tid = samplers[i]->_tid;
+        const int64_t last_us = samplers[i]->_last_us;
+        samplers[i]->_mutex.unlock();
+        EXPECT_NE(0, last_us);
+        tids.insert(tid);
+    }
+    return tids.size();
+}
+
+// Cost of sampling with different -bvar_sampler_thread_num is measured by
+// tools/bvar_sampler_benchmark.
+TEST(SamplerTest, sharded_collectors) {
+    GFLAGS_NS::FlagSaver saver;
+    bvar::Adder<int> adder;
+    adder << 1;
+    // Like windows created before flags are parsed, these samplers all go
+    // to the first collector.
+    bvar::FLAGS_bvar_sampler_thread_num = 1;
+    std::vector<TimedSampler*> early_samplers;
+    schedule_samplers(&adder, 100, &early_samplers);
+    usleep(1100000);
+    ASSERT_EQ(1u, count_sampling_threads(early_samplers));
+
+    const int nthread = 4;
+    bvar::FLAGS_bvar_sampler_thread_num = nthread;
+    std::vector<TimedSampler*> samplers;
+    schedule_samplers(&adder, 100, &samplers);
+    // A round for the first collector to notice the flag and hand samplers
+    // over, another round for other collectors to sample them.
+    usleep(2100000);
+    ASSERT_EQ((size_t)nthread, count_sampling_threads(samplers));
+    ASSERT_EQ((size_t)nthread, count_sampling_threads(early_samplers));
+
+    for (size_t i = 0; i < early_samplers.size(); ++i) {
+        early_samplers[i]->destroy();
+    }
+    // No more take_sample() after destroy(), `adder' can be gone.
+    for (size_t i = 0; i < samplers.size(); ++i) {
+        samplers[i]->destroy();
+    }
+}
 } // namespace
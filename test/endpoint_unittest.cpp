@@ -15,11 +15,17 @@
 // specific language governing permissions and limitations
 // under the License.
 
+#include <fcntl.h>                             // open
+#include <sys/stat.h>                          // lstat
+#include <sys/socket.h>                        // bind
+#include <sys/un.h>                            // sockaddr_un
+#include <stddef.h>                            // offsetof
 #include <gtest/gtest.h>
 #include "butil/errno.h"
 #include "butil/endpoint.h"
 #include "butil/logging.h"
 #include "butil/containers/flat_map.h"
+#include "butil/fd_guard.h"
 
 namespace {
 
@@ -148,4 +154,132 @@ TEST(EndPointTest, flat_map) {
     ASSERT_LT(info.longest_length, 32ul) << "detect hash collision and it's too large.";
 }
 
+TEST(EndPointTest, unix_socket) {
+    butil::EndPoint p1;
+    ASSERT_EQ(0, butil::str2endpoint("unix:/tmp/brpc_ut.sock", &p1));
+    ASSERT_TRUE(butil::is_unix_endpoint(p1));
+    ASSERT_STREQ("/tmp/brpc_ut.sock", butil::endpoint2unix_path(p1));
+    ASSERT_STREQ("unix:/tmp/brpc_ut.sock", butil::endpoint2str(p1).c_str());
+    std::ostringstream oss;
+    oss << p1;
+    ASSERT_EQ("unix:/tmp/brpc_ut.sock", oss.str());
+
+    // Same paths are same EndPoints.
+    butil::EndPoint p2;
+    ASSERT_EQ(0, butil::hostname2endpoint("unix:/tmp/brpc_ut.sock", &p2));
+    ASSERT_EQ(p1, p2);
+    ASSERT_EQ(0, butil::unix_path2endpoint("@brpc_ut", &p2));
+    ASSERT_NE(p1, p2);
+    ASSERT_STREQ("@brpc_ut", butil::endpoint2unix_path(p2));
+    butil::hash_map<butil::EndPoint, int> m;
+    ++m[p1];
+    ++m[p2];
+    ASSERT_EQ(2u, m.size());
+
+    ASSERT_EQ(-1, butil::str2endpoint("unix:", &p2));
+    ASSERT_EQ(-1, butil::unix_path2endpoint(std::string(200, 'a').c_str(), &p2));
+    ASSERT_TRUE(butil::endpoint2unix_path(butil::EndPoint()) == NULL);
+    ASSERT_FALSE(butil::is_unix_endpoint(butil::EndPoint(butil::IP_ANY, 80)));
+
+#if defined(OS_LINUX)
+    const char* paths[] = { "unix:/tmp/brpc_endpoint_ut.sock", "unix:@brpc_endpoint_ut" };
+#else
+    const char* paths[] = { "unix:/tmp/brpc_endpoint_ut.sock" };
+#endif
+    for (size_t i = 0; i < ARRAY_SIZE(paths); ++i) {
+        butil::EndPoint point;
+        ASSERT_EQ(0, butil::str2endpoint(paths[i], &point));
+        butil::fd_guard listened_fd(butil::tcp_listen(point));
+        ASSERT_GE(listened_fd, 0) << paths[i] << ": " << berror();
+        // Unix domain sockets can't share a path with SO_REUSEPORT.
+        ASSERT_LT(butil::tcp_listen(point, true), 0);
+        butil::fd_guard fd(butil::tcp_connect(point, NULL));
+        ASSERT_GE(fd, 0) << berror();
+        butil::EndPoint local;
+        ASSERT_EQ(0, butil::get_local_side(listened_fd, &local));
+        ASSERT_EQ(point, local);
+        butil::EndPoint remote;
+        ASSERT_EQ(0, butil::get_remote_side(fd, &remote));
+        ASSERT_EQ(point, remote);
+        ASSERT_EQ(0, butil::get_local_side(fd, &local));
+        ASSERT_TRUE(butil::is_unix_endpoint(local));
+        ASSERT_STREQ("", butil::endpoint2unix_path(local));
+
+        // Paths bound by clients are not interned.
+        const std::string client_path =
+            std::string(paths[i] + 5) + ".client";
+        struct sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        ASSERT_EQ(AF_UNIX, butil::endpoint2sockaddr(point, &addr, &addr_len));
+        butil::fd_guard client_fd(socket(AF_UNIX, SOCK_STREAM, 0));
+        ASSERT_GE(client_fd, 0);
+        struct sockaddr_un client_addr;
+        memset(&client_addr, 0, sizeof(client_addr));
+        client_addr.sun_family = AF_UNIX;
+        snprintf(client_addr.sun_path, sizeof(client_addr.sun_path), "%s",
+                 client_path.c_str());
+        socklen_t client_addr_len = sizeof(client_addr);
+        if (client_path[0] == '@') {
+            client_addr.sun_path[0] = '\0';
+            client_addr_len =
+                offsetof(sockaddr_un, sun_path) + client_path.size();
+        } else {
+            unlink(client_path.c_str());
+        }
+        ASSERT_EQ(0, bind(client_fd, (struct sockaddr*)&client_addr,
+                          client_addr_len)) << berror();
+        ASSERT_EQ(0, connect(client_fd, (struct sockaddr*)&addr, addr_len));
+        // The connection of `fd' comes first.
+        butil::fd_guard unnamed_fd(accept(listened_fd, NULL, NULL));
+        ASSERT_GE(unnamed_fd, 0);
+        butil::fd_guard accepted_fd(accept(listened_fd, NULL, NULL));
+        ASSERT_GE(accepted_fd, 0);
+        ASSERT_EQ(0, butil::get_remote_side(accepted_fd, &remote));
+        ASSERT_TRUE(butil::is_unix_endpoint(remote));
+        ASSERT_STREQ("", butil::endpoint2unix_path(remote));
+        // Unless the path is given by users.
+        butil::EndPoint client_point;
+        ASSERT_EQ(0, butil::unix_path2endpoint(client_path.c_str(),
+                                               &client_point));
+        ASSERT_EQ(0, butil::get_remote_side(accepted_fd, &remote));
+        ASSERT_EQ(client_point, remote);
+        if (client_path[0] != '@') {
+            unlink(client_path.c_str());
+        }
+        if (paths[i][5] != '@') {
+            unlink(paths[i] + 5);
+        }
+    }
+}
+
+TEST(EndPointTest, listen_unix_socket_in_use) {
+    const char* path = "/tmp/brpc_endpoint_ut_in_use.sock";
+    unlink(path);
+    butil::EndPoint point;
+    ASSERT_EQ(0, butil::unix_path2endpoint(path, &point));
+
+    // Regular files are never removed.
+    butil::fd_guard file_fd(open(path, O_CREAT | O_WRONLY, 0600));
+    ASSERT_GE(file_fd, 0);
+    ASSERT_LT(butil::tcp_listen(point), 0);
+    ASSERT_EQ(EADDRINUSE, errno);
+    struct stat st;
+    ASSERT_EQ(0, lstat(path, &st));
+    ASSERT_TRUE(S_ISREG(st.st_mode));
+    ASSERT_EQ(0, unlink(path));
+
+    // Nor sockets of live servers.
+    int listened_fd = butil::tcp_listen(point);
+    ASSERT_GE(listened_fd, 0) << berror();
+    ASSERT_LT(butil::tcp_listen(point), 0);
+    ASSERT_EQ(EADDRINUSE, errno);
+
+    // The socket left by a closed server is replaced.
+    ASSERT_EQ(0, close(listened_fd));
+    ASSERT_EQ(0, lstat(path, &st));
+    butil::fd_guard fd(butil::tcp_listen(point));
+    ASSERT_GE(fd, 0) << berror();
+    unlink(path);
+}
+
 } // end of namespace
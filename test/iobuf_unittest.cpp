@@ -1476,6 +1476,21 @@ TEST_F(IOBufTest, appender) {
     ASSERT_EQ(str, buf3);
 }
 
+TEST_F(IOBufTest, appender_append_iobuf) {
+    butil::IOBuf large;
+    large.append(std::string(20000, 'x'));
+    butil::IOBufAppender appender;
+    ASSERT_EQ(0, appender.append("head", 4));
+    ASSERT_EQ(0, appender.append(large));
+    ASSERT_EQ(0, appender.push_back('-'));
+    ASSERT_EQ(0, appender.append("tail", 4));
+    butil::IOBuf buf;
+    appender.move_to(buf);
+    ASSERT_EQ("head" + std::string(20000, 'x') + "-tail", buf);
+    // Blocks of `large' are referenced rather than copied.
+    ASSERT_EQ(large.backing_block(0).data(), buf.backing_block(1).data());
+}
+
 TEST_F(IOBufTest, appender_perf) {
     const size_t N1 = 100000;
     butil::Timer tm1;
@@ -1657,6 +1672,107 @@ TEST_F(IOBufTest, append_user_data_and_share) {
     ASSERT_EQ(data, my_free_params);
 }
 
+TEST_F(IOBufTest, append_file) {
+    std::string content;
+    for (int i = 0; i < 100000; ++i) {
+        content.push_back('a' + i % 26);
+    }
+    butil::TempFile file;
+    ASSERT_EQ(0, file.save_bin(content.data(), content.size()));
+    butil::fd_guard fd(open(file.fname(), O_RDONLY));
+    ASSERT_GE(fd, 0);
+
+    butil::IOBuf b0;
+    ASSERT_EQ(0, b0.append_file(fd, 0, 0));
+    ASSERT_TRUE(b0.empty());
+    ASSERT_EQ(-1, b0.append_file(fd, 10, content.size()));
+    ASSERT_TRUE(b0.empty());
+    // Not aligned with pages.
+    ASSERT_EQ(0, b0.append_file(fd, 4097, content.size() - 4097));
+    ASSERT_EQ(content.substr(4097), b0.to_string());
+
+    // Cut memory and file data into a socket.
+    butil::IOBuf head;
+    head.append("head");
+    butil::IOBuf body;
+    ASSERT_EQ(0, body.append_file(fd, 0, content.size()));
+    butil::IOBuf tail;
+    tail.append("tail");
+    std::string expected = "head" + content + "tail";
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    butil::IOBuf* pieces[] = { &head, &body, &tail };
+    size_t nw = 0;
+    butil::IOPortal received;
+    while (nw < expected.size()) {
+        const ssize_t rc = butil::IOBuf::cut_multiple_into_file_descriptor(
+            fds[0], pieces, ARRAY_SIZE(pieces));
+        ASSERT_GT(rc, 0) << berror();
+        nw += rc;
+        while (received.size() < nw) {
+            ASSERT_GT(received.append_from_file_descriptor(fds[1], 65536), 0);
+        }
+    }
+    ASSERT_TRUE(head.empty() && body.empty() && tail.empty());
+    ASSERT_EQ(expected, received.to_string());
+    close(fds[0]);
+    close(fds[1]);
+
+    // Shared file data are kept after the fd is closed.
+    butil::IOBuf b1;
+    ASSERT_EQ(0, b1.append_file(fd, 0, content.size()));
+    fd.reset(-1);
+    butil::IOBuf b2;
+    b1.cutn(&b2, 100);
+    ASSERT_EQ(content.substr(0, 100), b2.to_string());
+    ASSERT_EQ(content.substr(100), b1.to_string());
+}
+
+static void* drain_fd(void* arg) {
+    const int fd = (int)(intptr_t)arg;
+    char buf[65536];
+    while (read(fd, buf, sizeof(buf)) > 0) {}
+    return NULL;
+}
+
+TEST_F(IOBufTest, append_file_perf) {
+    const size_t FILE_SIZE = 64 * 1024 * 1024;
+    std::string content(FILE_SIZE, 'f');
+    butil::TempFile file;
+    ASSERT_EQ(0, file.save_bin(content.data(), content.size()));
+    butil::fd_guard fd(open(file.fname(), O_RDONLY));
+    ASSERT_GE(fd, 0);
+    const int N = 5;
+    for (int use_file = 0; use_file < 2; ++use_file) {
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        pthread_t th;
+        ASSERT_EQ(0, pthread_create(&th, NULL, drain_fd, (void*)(intptr_t)fds[1]));
+        butil::Timer tm;
+        tm.start();
+        for (int i = 0; i < N; ++i) {
+            butil::IOPortal buf;
+            if (use_file) {
+                ASSERT_EQ(0, buf.append_file(fd, 0, FILE_SIZE));
+            } else {
+                while (buf.size() < FILE_SIZE) {
+                    ASSERT_GT(buf.pappend_from_file_descriptor(
+                                  fd, buf.size(), FILE_SIZE - buf.size()), 0);
+                }
+            }
+            while (!buf.empty()) {
+                ASSERT_GT(buf.cut_into_file_descriptor(fds[0]), 0);
+            }
+        }
+        tm.stop();
+        close(fds[0]);
+        pthread_join(th, NULL);
+        close(fds[1]);
+        LOG(INFO) << (use_file ? "append_file" : "read") << " throughput="
+                  << FILE_SIZE * N / tm.u_elapsed() << "MB/s";
+    }
+}
+
 TEST_F(IOBufTest, share_tls_block) {
     butil::iobuf::remove_tls_block_chain();
     butil::IOBuf::Block* b = butil::iobuf::acquire_tls_block();
@@ -0,0 +1,226 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Measure costs of bvar which are too slow or too noisy for unittests:
+// sampling of windowed bvars by background threads, adding to Adder or
+// PerCpuAdder from many threads and recording into LatencyRecorder with
+// percentiles sampled or counted in histograms. Flags of bvar, e.g.
+// -bvar_sampler_thread_num, can be set in the command line to compare
+// their effects.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <vector>
+#include <gflags/gflags.h>
+#include <butil/logging.h>
+#include <butil/strings/string_split.h>
+#include <butil/time.h>
+#include <bvar/bvar.h>
+#include <bvar/per_cpu_adder.h>
+#include <bvar/variable.h>
+
+DEFINE_string(tests, "sampler,per_cpu_adder,latency_recorder",
+              "Comma-separated tests, available values: sampler(cost of "
+              "sampling windowed bvars), per_cpu_adder(cost of adding to "
+              "Adder and PerCpuAdder), latency_recorder(cost of "
+              "LatencyRecorder::operator<< with and without "
+              "-bvar_latency_histogram)");
+DEFINE_int32(samplers, 100000, "Number of windowed bvars of the sampler test");
+DEFINE_int32(seconds, 3, "Seconds to wait for samplers to be visited");
+DEFINE_string(adder_threads, "1,8,500", "Comma-separated numbers of threads "
+              "adding in the per_cpu_adder test");
+DEFINE_int32(adds, 200000, "Number of adds of each thread in the "
+             "per_cpu_adder test");
+DEFINE_int32(recorder_threads, 8, "Number of threads recording in the "
+             "latency_recorder test");
+DEFINE_int32(records, 1000000, "Number of latencies recorded by each thread "
+             "in the latency_recorder test");
+
+namespace bvar {
+DECLARE_int32(bvar_sampler_thread_num);
+DECLARE_bool(bvar_latency_histogram);
+}
+
+namespace {
+
+int64_t ExposedCount(const char* name) {
+    const std::string value = bvar::Variable::describe_exposed(name);
+    return strtoll(value.c_str(), NULL, 10);
+}
+
+void TestSampler() {
+    std::vector<bvar::Adder<int>*> adders;
+    std::vector<bvar::Window<bvar::Adder<int> >*> windows;
+    adders.reserve(FLAGS_samplers);
+    windows.reserve(FLAGS_samplers);
+    for (int i = 0; i < FLAGS_samplers; ++i) {
+        adders.push_back(new bvar::Adder<int>);
+        *adders.back() << 1;
+        windows.push_back(new bvar::Window<bvar::Adder<int> >(adders.back(), 10));
+    }
+    sleep(FLAGS_seconds);
+    LOG(INFO) << "Sampling " << ExposedCount("bvar_sampler_count")
+              << " samplers with " << bvar::FLAGS_bvar_sampler_thread_num
+              << " threads takes "
+              << ExposedCount("bvar_sampler_collector_tick_us")
+              << "us per second (max="
+              << ExposedCount("bvar_sampler_collector_max_tick_us")
+              << "us), collector usage="
+              << bvar::Variable::describe_exposed("bvar_sampler_collector_usage");
+    for (int i = 0; i < FLAGS_samplers; ++i) {
+        delete windows[i];
+        delete adders[i];
+    }
+}
+
+template <typename Adder>
+struct AddArgs {
+    Adder* adder;
+    int n;
+};
+
+template <typename Adder>
+void* AddValues(void* void_args) {
+    AddArgs<Adder>* args = static_cast<AddArgs<Adder>*>(void_args);
+    for (int i = 0; i < args->n; ++i) {
+        *args->adder << 1;
+    }
+    return NULL;
+}
+
+// Returns average ns of each add, or -1 on error.
+template <typename Adder>
+int64_t AddInThreads(Adder* adder, int nthread, int n) {
+    AddArgs<Adder> args = { adder, n };
+    std::vector<pthread_t> th(nthread);
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < nthread; ++i) {
+        const int rc = pthread_create(&th[i], NULL, AddValues<Adder>, &args);
+        if (rc != 0) {
+            LOG(ERROR) << "Fail to create pthread, " << berror(rc);
+            nthread = i;
+            break;
+        }
+    }
+    for (int i = 0; i < nthread; ++i) {
+        pthread_join(th[i], NULL);
+    }
+    tm.stop();
+    if ((int64_t)adder->get_value() != (int64_t)nthread * n) {
+        LOG(ERROR) << "Added " << adder->get_value() << ", expected "
+                   << (int64_t)nthread * n;
+        return -1;
+    }
+    return tm.n_elapsed() / n;
+}
+
+void TestPerCpuAdder() {
+    std::vector<std::string> nthreads;
+    butil::SplitString(FLAGS_adder_threads, ',', &nthreads);
+    for (size_t i = 0; i < nthreads.size(); ++i) {
+        const int nthread = atoi(nthreads[i].c_str());
+        if (nthread <= 0) {
+            LOG(ERROR) << "Invalid number of threads=" << nthreads[i];
+            continue;
+        }
+        bvar::Adder<int64_t> adder;
+        bvar::PerCpuAdder<int64_t> per_cpu_adder;
+        const int64_t adder_ns = AddInThreads(&adder, nthread, FLAGS_adds);
+        const int64_t per_cpu_ns =
+            AddInThreads(&per_cpu_adder, nthread, FLAGS_adds);
+        LOG(INFO) << nthread << " threads: Adder takes " << adder_ns
+                  << "ns per add, PerCpuAdder takes " << per_cpu_ns
+                  << "ns per add with " << per_cpu_adder.memory_size()
+                  << " bytes";
+    }
+}
+
+struct RecordArgs {
+    bvar::LatencyRecorder* rec;
+    int n;
+};
+
+void* RecordLatencies(void* void_args) {
+    RecordArgs* args = static_cast<RecordArgs*>(void_args);
+    for (int i = 0; i < args->n; ++i) {
+        *args->rec << (i & 1023) * 10;
+    }
+    return NULL;
+}
+
+void TestLatencyRecorder() {
+    const bool saved_histogram = bvar::FLAGS_bvar_latency_histogram;
+    for (int histogram = 0; histogram < 2; ++histogram) {
+        // Only affects LatencyRecorder created afterwards.
+        bvar::FLAGS_bvar_latency_histogram = histogram;
+        bvar::LatencyRecorder rec;
+        bvar::FLAGS_bvar_latency_histogram = saved_histogram;
+        RecordArgs args = { &rec, FLAGS_records };
+        std::vector<pthread_t> th(FLAGS_recorder_threads);
+        int nthread = 0;
+        butil::Timer tm;
+        tm.start();
+        for (; nthread < FLAGS_recorder_threads; ++nthread) {
+            const int rc = pthread_create(&th[nthread], NULL,
+                                          RecordLatencies, &args);
+            if (rc != 0) {
+                LOG(ERROR) << "Fail to create pthread, " << berror(rc);
+                break;
+            }
+        }
+        for (int i = 0; i < nthread; ++i) {
+            pthread_join(th[i], NULL);
+        }
+        tm.stop();
+        LOG(INFO) << (histogram ? "Histogram" : "Percentile")
+                  << " LatencyRecorder::operator<< takes "
+                  << tm.n_elapsed() / FLAGS_records << "ns with " << nthread
+                  << " threads, count=" << rec.count();
+    }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    std::vector<std::string> tests;
+    if (FLAGS_samplers < 0 || FLAGS_seconds <= 0 || FLAGS_adds <= 0 ||
+        FLAGS_recorder_threads <= 0 || FLAGS_records <= 0) {
+        LOG(ERROR) << "-samplers must not be negative, -seconds, -adds, "
+            "-recorder_threads and -records must be positive";
+        return -1;
+    }
+    butil::SplitString(FLAGS_tests, ',', &tests);
+    for (size_t i = 0; i < tests.size(); ++i) {
+        if (tests[i] != "sampler" && tests[i] != "per_cpu_adder" &&
+            tests[i] != "latency_recorder") {
+            LOG(ERROR) << "Unknown test=" << tests[i];
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < tests.size(); ++i) {
+        if (tests[i] == "sampler") {
+            TestSampler();
+        } else if (tests[i] == "per_cpu_adder") {
+            TestPerCpuAdder();
+        } else if (tests[i] == "latency_recorder") {
+            TestLatencyRecorder();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Convert binary bvar dumps, written with -bvar_dump_binary or streamed
+// from /vars?binary, back to text or prometheus format. Examples:
+//   ./bvar_dump_reader monitor/bvar.echo_server.bin
+//   curl -sN 'http://127.0.0.1:8000/vars?binary' | ./bvar_dump_reader -follow
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <memory>
+#include <gflags/gflags.h>
+#include <butil/logging.h>
+#include <butil/iobuf.h>
+#include <butil/fd_guard.h>
+#include <butil/time.h>
+#include <bvar/binary_dump.h>
+#include <brpc/builtin/prometheus_metrics_service.h>
+
+DEFINE_string(format, "text", "Output format: text or prometheus");
+DEFINE_bool(follow, false, "Print values after every frame rather than "
+            "after all input is read, for streamed input");
+
+// Print "name : value" like files written by -bvar_dump.
+class TextDumper : public bvar::Dumper {
+public:
+    explicit TextDumper(butil::IOBufBuilder* os) : _os(os) {}
+    bool dump(const std::string& name,
+              const butil::StringPiece& desc) override {
+        *_os << name << " : " << desc << '\n';
+        return true;
+    }
+private:
+    butil::IOBufBuilder* _os;
+};
+
+static int print_values(const bvar::BinaryDumpDecoder& decoder) {
+    butil::IOBufBuilder os;
+    std::unique_ptr<bvar::Dumper> dumper;
+    if (FLAGS_format == "prometheus") {
+        dumper.reset(brpc::NewPrometheusMetricsDumper(&os));
+    } else {
+        dumper.reset(new TextDumper(&os));
+    }
+    if (FLAGS_follow) {
+        char buf[64];
+        time_t t = decoder.time_us() / 1000000L;
+        struct tm tm;
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S",
+                 localtime_r(&t, &tm));
+        os << "# " << buf << '\n';
+    }
+    if (decoder.dump(dumper.get()) < 0) {
+        LOG(ERROR) << "Fail to dump values";
+        return -1;
+    }
+    butil::IOBuf out;
+    os.move_to(out);
+    while (!out.empty()) {
+        if (out.cut_into_file_descriptor(STDOUT_FILENO) < 0) {
+            PLOG(ERROR) << "Fail to write to stdout";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NS::SetUsageMessage("Usage: ./bvar_dump_reader [file]\n"
+                               "Read stdin if the file is absent");
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    if (FLAGS_format != "text" && FLAGS_format != "prometheus") {
+        LOG(ERROR) << "Unknown format=" << FLAGS_format;
+        return -1;
+    }
+    butil::fd_guard fd(argc >= 2 ? open(argv[1], O_RDONLY) : dup(STDIN_FILENO));
+    if (fd < 0) {
+        PLOG(ERROR) << "Fail to open " << (argc >= 2 ? argv[1] : "stdin");
+        return -1;
+    }
+    bvar::BinaryDumpDecoder decoder;
+    butil::IOPortal buf;
+    int nframe = 0;
+    while (true) {
+        const ssize_t nr = buf.append_from_file_descriptor(fd, 1024 * 1024);
+        if (nr < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            PLOG(ERROR) << "Fail to read input";
+            return -1;
+        }
+        if (nr == 0) {
+            break;
+        }
+        const int rc = decoder.decode(&buf);
+        if (rc < 0) {
+            return -1;
+        }
+        nframe += rc;
+        if (FLAGS_follow && rc > 0 && print_values(decoder) != 0) {
+            return -1;
+        }
+    }
+    if (!buf.empty()) {
+        LOG(WARNING) << "Ignored incomplete frame of " << buf.size()
+                     << " bytes at the end";
+    }
+    if (nframe == 0) {
+        LOG(ERROR) << "No frame in the input";
+        return -1;
+    }
+    if (!FLAGS_follow) {
+        return print_values(decoder);
+    }
+    return 0;
+}
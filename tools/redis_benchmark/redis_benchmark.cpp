@@ -0,0 +1,298 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Measure pipelined throughput of a redis server, like redis-benchmark.
+// Optionally starts an in-process brpc redis server whose handlers are
+// synchronous or asynchronous, to compare the two kinds of handlers.
+
+#include <gflags/gflags.h>
+#include <unordered_map>
+#include <butil/logging.h>
+#include <butil/string_printf.h>
+#include <butil/strings/string_split.h>
+#include <butil/time.h>
+#include <butil/fast_rand.h>
+#include <bthread/bthread.h>
+#include <bvar/bvar.h>
+#include <brpc/channel.h>
+#include <brpc/server.h>
+#include <brpc/redis.h>
+
+DEFINE_string(server, "", "Address of the redis server. If empty, an "
+              "in-process brpc redis server is started and tested");
+DEFINE_int32(clients, 50, "Number of parallel connections");
+DEFINE_int32(pipeline, 1, "Number of commands pipelined in one request");
+DEFINE_int64(requests, 100000, "Total number of commands of each test");
+DEFINE_string(tests, "set,get", "Comma-separated commands to test, "
+              "available values: set, get, incr, ping");
+DEFINE_int32(data_size, 3, "Data size of SET value in bytes");
+DEFINE_int32(keyspace, 10000, "Use random keys in [0, keyspace)");
+DEFINE_int32(timeout_ms, 1000, "RPC timeout in milliseconds");
+DEFINE_bool(async_handler, true, "Use asynchronous command handlers in the "
+            "in-process server");
+DEFINE_int32(handler_delay_us, 0, "Commands of the in-process server take "
+             "so many microseconds to finish, simulating calls to backends");
+
+namespace {
+
+butil::Mutex s_mutex;
+std::unordered_map<std::string, std::string> s_kv;
+
+void DoCommand(const std::vector<butil::StringPiece>& args,
+               brpc::RedisReply* output) {
+    if (args[0] == "ping") {
+        output->SetStatus("PONG");
+    } else if (args[0] == "set" && args.size() >= 3) {
+        BAIDU_SCOPED_LOCK(s_mutex);
+        s_kv[args[1].as_string()] = args[2].as_string();
+        output->SetStatus("OK");
+    } else if (args[0] == "get" && args.size() >= 2) {
+        BAIDU_SCOPED_LOCK(s_mutex);
+        auto it = s_kv.find(args[1].as_string());
+        if (it != s_kv.end()) {
+            output->SetString(it->second);
+        } else {
+            output->SetNullString();
+        }
+    } else if (args[0] == "incr" && args.size() >= 2) {
+        BAIDU_SCOPED_LOCK(s_mutex);
+        std::string& v = s_kv[args[1].as_string()];
+        const int64_t n = strtoll(v.c_str(), NULL, 10) + 1;
+        v = butil::string_printf("%" PRId64, n);
+        output->SetInteger(n);
+    } else {
+        output->SetError("ERR wrong number of arguments");
+    }
+}
+
+class SyncHandler : public brpc::RedisCommandHandler {
+public:
+    brpc::RedisCommandHandlerResult Run(const std::vector<butil::StringPiece>& args,
+                                        brpc::RedisReply* output,
+                                        bool /*flush_batched*/) override {
+        if (FLAGS_handler_delay_us > 0) {
+            bthread_usleep(FLAGS_handler_delay_us);
+        }
+        DoCommand(args, output);
+        return brpc::REDIS_CMD_HANDLED;
+    }
+};
+
+class AsyncHandler : public brpc::RedisAsyncCommandHandler {
+public:
+    struct Call {
+        const std::vector<butil::StringPiece>* args;
+        brpc::RedisReply* output;
+        google::protobuf::Closure* done;
+    };
+
+    static void* RunCall(void* arg) {
+        Call* call = static_cast<Call*>(arg);
+        bthread_usleep(FLAGS_handler_delay_us);
+        DoCommand(*call->args, call->output);
+        call->done->Run();
+        delete call;
+        return NULL;
+    }
+
+    void RunAsync(const std::vector<butil::StringPiece>& args,
+                  brpc::RedisReply* output,
+                  google::protobuf::Closure* done) override {
+        if (FLAGS_handler_delay_us <= 0) {
+            DoCommand(args, output);
+            done->Run();
+            return;
+        }
+        Call* call = new Call;
+        call->args = &args;
+        call->output = output;
+        call->done = done;
+        bthread_t th;
+        if (bthread_start_background(&th, NULL, RunCall, call) != 0) {
+            LOG(ERROR) << "Fail to start bthread";
+            RunCall(call);
+        }
+    }
+};
+
+struct TestStats {
+    TestStats() : ncommand(0), nerror(0) {}
+    bvar::LatencyRecorder latency;
+    butil::atomic<int64_t> ncommand;
+    butil::atomic<int64_t> nerror;
+};
+
+struct SenderArgs {
+    brpc::Channel* channel;
+    std::string command;
+    std::string value;
+    TestStats* stats;
+};
+
+void* Sender(void* void_args) {
+    SenderArgs* args = static_cast<SenderArgs*>(void_args);
+    TestStats* stats = args->stats;
+    while (!brpc::IsAskedToQuit()) {
+        const int64_t nsent = stats->ncommand.fetch_add(
+            FLAGS_pipeline, butil::memory_order_relaxed);
+        if (nsent >= FLAGS_requests) {
+            break;
+        }
+        brpc::RedisRequest request;
+        for (int i = 0; i < FLAGS_pipeline; ++i) {
+            const int key = (int)butil::fast_rand_less_than(FLAGS_keyspace);
+            bool ok = false;
+            if (args->command == "set") {
+                ok = request.AddCommand("SET key:%012d %s", key,
+                                        args->value.c_str());
+            } else if (args->command == "get") {
+                ok = request.AddCommand("GET key:%012d", key);
+            } else if (args->command == "incr") {
+                ok = request.AddCommand("INCR counter:%012d", key);
+            } else {
+                ok = request.AddCommand("PING");
+            }
+            CHECK(ok) << "Fail to add command";
+        }
+        brpc::RedisResponse response;
+        brpc::Controller cntl;
+        args->channel->CallMethod(NULL, &cntl, &request, &response, NULL);
+        if (cntl.Failed()) {
+            stats->nerror.fetch_add(FLAGS_pipeline, butil::memory_order_relaxed);
+            LOG_EVERY_SECOND(WARNING) << "Fail to access redis, " << cntl.ErrorText();
+            continue;
+        }
+        for (int i = 0; i < response.reply_size(); ++i) {
+            if (response.reply(i).is_error()) {
+                stats->nerror.fetch_add(1, butil::memory_order_relaxed);
+            }
+        }
+        stats->latency << cntl.latency_us();
+    }
+    return NULL;
+}
+
+void RunTest(brpc::Channel* channel, const std::string& command) {
+    TestStats stats;
+    std::vector<SenderArgs> args(FLAGS_clients);
+    std::vector<bthread_t> tids(FLAGS_clients);
+    const std::string value(FLAGS_data_size, 'x');
+    butil::Timer timer;
+    timer.start();
+    for (int i = 0; i < FLAGS_clients; ++i) {
+        args[i].channel = channel;
+        args[i].command = command;
+        args[i].value = value;
+        args[i].stats = &stats;
+        if (bthread_start_background(&tids[i], NULL, Sender, &args[i]) != 0) {
+            LOG(ERROR) << "Fail to create bthread";
+            // Run in this thread, still joinable below.
+            tids[i] = INVALID_BTHREAD;
+            Sender(&args[i]);
+        }
+    }
+    for (int i = 0; i < FLAGS_clients; ++i) {
+        if (tids[i] != INVALID_BTHREAD) {
+            bthread_join(tids[i], NULL);
+        }
+    }
+    timer.stop();
+    const int64_t ncommand = std::min(
+        stats.ncommand.load(butil::memory_order_relaxed), FLAGS_requests);
+    const double seconds = timer.u_elapsed() / 1000000.0;
+    std::string upper = command;
+    for (size_t i = 0; i < upper.size(); ++i) {
+        upper[i] = toupper(upper[i]);
+    }
+    printf("====== %s ======\n"
+           "  %" PRId64 " requests completed in %.2f seconds\n"
+           "  %d parallel clients, %d commands per pipeline, %d bytes payload\n"
+           "  %" PRId64 " errors\n"
+           "  latency of pipelines(us): avg=%" PRId64 " p50=%" PRId64
+           " p99=%" PRId64 " p999=%" PRId64 " max=%" PRId64 "\n"
+           "  %.2f requests per second\n\n",
+           upper.c_str(), ncommand, seconds, FLAGS_clients, FLAGS_pipeline,
+           FLAGS_data_size, stats.nerror.load(butil::memory_order_relaxed),
+           stats.latency.latency(), stats.latency.latency_percentile(0.5),
+           stats.latency.latency_percentile(0.99),
+           stats.latency.latency_percentile(0.999),
+           stats.latency.max_latency(),
+           seconds > 0 ? ncommand / seconds : 0);
+    fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    if (FLAGS_clients <= 0 || FLAGS_pipeline <= 0 || FLAGS_keyspace <= 0) {
+        LOG(ERROR) << "-clients, -pipeline and -keyspace must be positive";
+        return -1;
+    }
+
+    brpc::Server server;
+    std::string server_addr = FLAGS_server;
+    if (server_addr.empty()) {
+        brpc::RedisService* rs = new brpc::RedisService;
+        brpc::RedisCommandHandler* handler = NULL;
+        if (FLAGS_async_handler) {
+            handler = new AsyncHandler;
+        } else {
+            handler = new SyncHandler;
+        }
+        rs->AddCommandHandler("ping", handler);
+        rs->AddCommandHandler("set", handler);
+        rs->AddCommandHandler("get", handler);
+        rs->AddCommandHandler("incr", handler);
+        brpc::ServerOptions server_options;
+        server_options.redis_service = rs;
+        if (server.Start("127.0.0.1", brpc::PortRange(6380, 6480),
+                         &server_options) != 0) {
+            LOG(ERROR) << "Fail to start in-process redis server";
+            return -1;
+        }
+        server_addr = butil::endpoint2str(server.listen_address()).c_str();
+        LOG(INFO) << "Started in-process redis server at " << server_addr
+                  << " with " << (FLAGS_async_handler ? "asynchronous" : "synchronous")
+                  << " handlers";
+    }
+
+    // Every sender waits for its response synchronously, thus occupies one
+    // pooled connection.
+    brpc::Channel channel;
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_REDIS;
+    options.connection_type = brpc::CONNECTION_TYPE_POOLED;
+    options.timeout_ms = FLAGS_timeout_ms;
+    options.max_retry = 0;
+    if (channel.Init(server_addr.c_str(), &options) != 0) {
+        LOG(ERROR) << "Fail to initialize channel";
+        return -1;
+    }
+
+    std::vector<std::string> tests;
+    butil::SplitString(FLAGS_tests, ',', &tests);
+    for (size_t i = 0; i < tests.size() && !brpc::IsAskedToQuit(); ++i) {
+        const std::string& t = tests[i];
+        if (t != "set" && t != "get" && t != "incr" && t != "ping") {
+            LOG(ERROR) << "Unknown test=" << t;
+            continue;
+        }
+        RunTest(&channel, t);
+    }
+    return 0;
+}
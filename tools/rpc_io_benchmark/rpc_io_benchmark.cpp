@@ -0,0 +1,304 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Measure how fast a server reads and dispatches messages: short connections
+// (accepting and protocol detection), latency of sequential calls,
+// throughput of requests pipelined in a single connection, and throughput of
+// one-way requests over UDP. Optionally starts an in-process server listening
+// on loopback tcp or an unix domain socket.
+// I/O related flags of brpc, e.g. -socket_busy_poll_us,
+// -read_size_by_fionread, -input_message_batch_size and -ssl_ktls, can be
+// set in the command line to compare their effects, e.g. the latency test
+// with -baidu_std_compact_meta measures the saving of compact meta of
+// baidu_std. With -ssl, the short test measures the rate of SSL handshakes.
+
+#include <gflags/gflags.h>
+#include <butil/logging.h>
+#include <butil/strings/string_split.h>
+#include <butil/time.h>
+#include <bthread/bthread.h>
+#include <bvar/bvar.h>
+#include <bvar/variable.h>
+#include <brpc/channel.h>
+#include <brpc/server.h>
+#include <brpc/udp_channel.h>
+#include <brpc/trackme.pb.h>
+
+DEFINE_string(server, "", "Address of the server, e.g. 127.0.0.1:8002 or "
+              "unix:/tmp/echo.sock. If empty, an in-process server is "
+              "started and tested");
+DEFINE_string(unix_socket, "", "The in-process server listens on this unix "
+              "domain socket instead of a loopback tcp port");
+DEFINE_bool(listen_per_dispatcher, false, "Set ServerOptions.listen_per_dispatcher "
+            "of the in-process server");
+DEFINE_string(protocol, "baidu_std", "Protocol of the client");
+DEFINE_int32(clients, 8, "Number of parallel clients of short and pipeline tests");
+DEFINE_int64(requests, 100000, "Total number of requests of each test");
+DEFINE_string(tests, "short,latency,pipeline", "Comma-separated tests, "
+              "available values: short(a new connection per request), "
+              "latency(sequential requests), pipeline(parallel requests "
+              "in one connection), udp(parallel one-way requests over UDP, "
+              "the server must enable udp)");
+DEFINE_int32(data_size, 16, "Size of the echoed data in bytes");
+DEFINE_int32(timeout_ms, 1000, "RPC timeout in milliseconds");
+DEFINE_bool(ssl, false, "Connect with SSL, the in-process server uses "
+            "-certificate and -private_key");
+DEFINE_string(certificate, "", "Certificate file of the in-process server");
+DEFINE_string(private_key, "", "Private key file of the in-process server");
+DEFINE_bool(reuse_ssl_session, true, "Resume SSL sessions of previous "
+            "connections to the server");
+
+namespace {
+
+// TrackMeService is built into brpc, which is used as an echo service here
+// to not depend on protos of examples. server_addr of the request is sent
+// back in error_text of the response.
+class EchoServiceImpl : public brpc::TrackMeService {
+public:
+    EchoServiceImpl() : nrequest(0) {}
+
+    void TrackMe(google::protobuf::RpcController*,
+                 const brpc::TrackMeRequest* request,
+                 brpc::TrackMeResponse* response,
+                 google::protobuf::Closure* done) override {
+        brpc::ClosureGuard done_guard(done);
+        nrequest.fetch_add(1, butil::memory_order_relaxed);
+        response->set_severity(brpc::TrackMeOK);
+        response->set_error_text(request->server_addr());
+    }
+
+    butil::atomic<int64_t> nrequest;
+};
+
+// The in-process server, NULL if -server is set.
+EchoServiceImpl* g_echo_service = NULL;
+
+struct TestStats {
+    TestStats() : nrequest(0), nerror(0) {}
+    bvar::LatencyRecorder latency;
+    butil::atomic<int64_t> nrequest;
+    butil::atomic<int64_t> nerror;
+};
+
+// Value of a counter exposed by brpc, 0 if it's not created yet.
+int64_t ExposedCount(const char* name) {
+    const std::string value = bvar::Variable::describe_exposed(name);
+    return strtoll(value.c_str(), NULL, 10);
+}
+
+struct SenderArgs {
+    google::protobuf::RpcChannel* channel;
+    // Responses of one-way requests are never filled.
+    bool one_way;
+    std::string data;
+    TestStats* stats;
+};
+
+void* Sender(void* void_args) {
+    SenderArgs* args = static_cast<SenderArgs*>(void_args);
+    TestStats* stats = args->stats;
+    brpc::TrackMeService_Stub stub(args->channel);
+    while (!brpc::IsAskedToQuit()) {
+        if (stats->nrequest.fetch_add(1, butil::memory_order_relaxed)
+            >= FLAGS_requests) {
+            break;
+        }
+        brpc::TrackMeRequest request;
+        brpc::TrackMeResponse response;
+        brpc::Controller cntl;
+        request.set_server_addr(args->data);
+        stub.TrackMe(&cntl, &request, &response, NULL);
+        if (cntl.Failed() ||
+            (!args->one_way && response.error_text() != args->data)) {
+            stats->nerror.fetch_add(1, butil::memory_order_relaxed);
+            LOG_EVERY_SECOND(WARNING) << "Fail to call server, " << cntl.ErrorText();
+            continue;
+        }
+        stats->latency << cntl.latency_us();
+    }
+    return NULL;
+}
+
+void RunTest(const std::string& server_addr, const std::string& test) {
+    brpc::ChannelOptions options;
+    options.protocol = FLAGS_protocol;
+    options.timeout_ms = FLAGS_timeout_ms;
+    options.max_retry = 0;
+    int nclient = FLAGS_clients;
+    const bool one_way = (test == "udp");
+    if (test == "short") {
+        options.connection_type = brpc::CONNECTION_TYPE_SHORT;
+    } else if (test == "latency") {
+        nclient = 1;
+    } else {
+        options.connection_type = brpc::CONNECTION_TYPE_SINGLE;
+        // Don't share the connection with other tests.
+        options.connection_group = "pipeline";
+    }
+    if (FLAGS_ssl) {
+        options.mutable_ssl_options()->reuse_session = FLAGS_reuse_ssl_session;
+    }
+    brpc::Channel tcp_channel;
+    brpc::UdpChannel udp_channel;
+    google::protobuf::RpcChannel* channel = &tcp_channel;
+    if (one_way) {
+        channel = &udp_channel;
+        if (udp_channel.Init(server_addr.c_str()) != 0) {
+            LOG(ERROR) << "Fail to initialize udp channel";
+            return;
+        }
+    } else if (tcp_channel.Init(server_addr.c_str(), &options) != 0) {
+        LOG(ERROR) << "Fail to initialize channel";
+        return;
+    }
+    TestStats stats;
+    std::vector<SenderArgs> args(nclient);
+    std::vector<bthread_t> tids(nclient);
+    const std::string data(FLAGS_data_size, 'x');
+    const int64_t nhandshake0 = ExposedCount("rpc_ssl_handshake_count");
+    const int64_t nreused0 = ExposedCount("rpc_ssl_session_reused_count");
+    const int64_t nreceived0 = (g_echo_service ?
+        g_echo_service->nrequest.load(butil::memory_order_relaxed) : 0);
+    const int64_t ndropped0 = ExposedCount("rpc_udp_dropped_datagram_count");
+    butil::Timer timer;
+    timer.start();
+    for (int i = 0; i < nclient; ++i) {
+        args[i].channel = channel;
+        args[i].one_way = one_way;
+        args[i].data = data;
+        args[i].stats = &stats;
+        if (bthread_start_background(&tids[i], NULL, Sender, &args[i]) != 0) {
+            LOG(ERROR) << "Fail to create bthread";
+            tids[i] = INVALID_BTHREAD;
+            Sender(&args[i]);
+        }
+    }
+    for (int i = 0; i < nclient; ++i) {
+        if (tids[i] != INVALID_BTHREAD) {
+            bthread_join(tids[i], NULL);
+        }
+    }
+    timer.stop();
+    const int64_t nrequest = std::min(
+        stats.nrequest.load(butil::memory_order_relaxed), FLAGS_requests);
+    const double seconds = timer.u_elapsed() / 1000000.0;
+    printf("====== %s ======\n"
+           "  %" PRId64 " requests completed in %.2f seconds\n"
+           "  %d parallel clients, %d bytes payload, protocol=%s\n"
+           "  %" PRId64 " errors\n"
+           "  latency(us): avg=%" PRId64 " p50=%" PRId64 " p99=%" PRId64
+           " p999=%" PRId64 " max=%" PRId64 "\n"
+           "  %.2f requests per second\n\n",
+           test.c_str(), nrequest, seconds, nclient, FLAGS_data_size,
+           FLAGS_protocol.c_str(), stats.nerror.load(butil::memory_order_relaxed),
+           stats.latency.latency(), stats.latency.latency_percentile(0.5),
+           stats.latency.latency_percentile(0.99),
+           stats.latency.latency_percentile(0.999),
+           stats.latency.max_latency(),
+           seconds > 0 ? nrequest / seconds : 0);
+    if (one_way && g_echo_service) {
+        // Datagrams may be lost, don't wait for all of them.
+        int64_t nreceived = 0;
+        for (int i = 0; i < 100; ++i) {
+            nreceived = g_echo_service->nrequest.load(butil::memory_order_relaxed)
+                - nreceived0;
+            if (nreceived >= nrequest - stats.nerror.load()) {
+                break;
+            }
+            bthread_usleep(10000);
+        }
+        printf("  %" PRId64 " requests received by the server, %" PRId64
+               " dropped datagrams\n\n", nreceived,
+               ExposedCount("rpc_udp_dropped_datagram_count") - ndropped0);
+    }
+    if (FLAGS_ssl) {
+        // Counted at both sides if the server is in-process.
+        const int64_t nhandshake =
+            ExposedCount("rpc_ssl_handshake_count") - nhandshake0;
+        printf("  %" PRId64 " ssl handshakes(%" PRId64 " resumed), %.2f per"
+               " second\n\n", nhandshake,
+               ExposedCount("rpc_ssl_session_reused_count") - nreused0,
+               seconds > 0 ? nhandshake / seconds : 0);
+    }
+    fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    if (FLAGS_clients <= 0 || FLAGS_data_size < 0) {
+        LOG(ERROR) << "-clients must be positive and -data_size must not be negative";
+        return -1;
+    }
+
+    std::vector<std::string> tests;
+    butil::SplitString(FLAGS_tests, ',', &tests);
+    bool use_udp = false;
+    for (size_t i = 0; i < tests.size(); ++i) {
+        const std::string& t = tests[i];
+        if (t != "short" && t != "latency" && t != "pipeline" && t != "udp") {
+            LOG(ERROR) << "Unknown test=" << t;
+            return -1;
+        }
+        use_udp = use_udp || (t == "udp");
+    }
+
+    EchoServiceImpl echo_service;
+    brpc::Server server;
+    std::string server_addr = FLAGS_server;
+    if (server_addr.empty()) {
+        if (server.AddService(&echo_service,
+                              brpc::SERVER_DOESNT_OWN_SERVICE) != 0) {
+            LOG(ERROR) << "Fail to add service";
+            return -1;
+        }
+        brpc::ServerOptions server_options;
+        server_options.listen_per_dispatcher = FLAGS_listen_per_dispatcher;
+        server_options.enable_udp = use_udp;
+        if (FLAGS_ssl) {
+            if (FLAGS_certificate.empty() || FLAGS_private_key.empty()) {
+                LOG(ERROR) << "-ssl requires -certificate and -private_key";
+                return -1;
+            }
+            brpc::CertInfo& cert =
+                server_options.mutable_ssl_options()->default_cert;
+            cert.certificate = FLAGS_certificate;
+            cert.private_key = FLAGS_private_key;
+        }
+        int rc = 0;
+        if (!FLAGS_unix_socket.empty()) {
+            rc = server.Start(("unix:" + FLAGS_unix_socket).c_str(),
+                              &server_options);
+        } else {
+            rc = server.Start("127.0.0.1", brpc::PortRange(8765, 8865),
+                              &server_options);
+        }
+        if (rc != 0) {
+            LOG(ERROR) << "Fail to start in-process server";
+            return -1;
+        }
+        server_addr = butil::endpoint2str(server.listen_address()).c_str();
+        LOG(INFO) << "Started in-process server at " << server_addr;
+        g_echo_service = &echo_service;
+    }
+
+    for (size_t i = 0; i < tests.size() && !brpc::IsAskedToQuit(); ++i) {
+        RunTest(server_addr, tests[i]);
+    }
+    return 0;
+}